@@ -1,126 +1,989 @@
 #include "assembler.h"
+#include "table.h"
+#include "assembly_cache.h"
+#include "verifier.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
+// The assembler makes a single pass over the source. Labels and function
+// names live in hash tables; jumps to labels that are not defined yet are
+// queued on the label and patched as soon as the label appears. Function
+// references need no patching: the Function object is allocated on first
+// mention and filled in when its FUNCTION block is reached.
+//
+// The parallel mode first splits the source at FUNCTION boundaries, declares
+// every function, and then assembles the bodies on worker threads against the
+// now read-only symbol table.
+
+typedef enum {
+    OPERAND_NONE,
+    OPERAND_CONSTANT, // number literal, "string" literal or function name
+    OPERAND_LABEL,
+    OPERAND_COUNT,    // small unsigned integer, e.g. CALL argument count or a local slot
+} OperandKind;
+
+typedef struct {
+    const char* name;
+    OpCode opcode;
+    OperandKind operand;
+} Mnemonic;
+
+static const Mnemonic MNEMONICS[] = {
+    {"CONSTANT", OP_CONSTANT, OPERAND_CONSTANT},
+    {"ADD", OP_ADD, OPERAND_NONE},
+    {"HALT", OP_HALT, OPERAND_NONE},
+    {"JMP_IF_FALSE", OP_JMP_IF_FALSE, OPERAND_LABEL},
+    {"JMP", OP_JMP, OPERAND_LABEL},
+    {"CALL", OP_CALL, OPERAND_COUNT},
+    {"RETURN", OP_RETURN, OPERAND_NONE},
+    {"CHECKPOINT", OP_CHECKPOINT, OPERAND_NONE},
+    {"SUB", OP_SUB, OPERAND_NONE},
+    {"MUL", OP_MUL, OPERAND_NONE},
+    {"DIV", OP_DIV, OPERAND_NONE},
+    {"MOD", OP_MOD, OPERAND_NONE},
+    {"EQUAL", OP_EQUAL, OPERAND_NONE},
+    {"NOT_EQUAL", OP_NOT_EQUAL, OPERAND_NONE},
+    {"LESS", OP_LESS, OPERAND_NONE},
+    {"LESS_EQUAL", OP_LESS_EQUAL, OPERAND_NONE},
+    {"GREATER", OP_GREATER, OPERAND_NONE},
+    {"GREATER_EQUAL", OP_GREATER_EQUAL, OPERAND_NONE},
+    {"DUP", OP_DUP, OPERAND_NONE},
+    {"SWAP", OP_SWAP, OPERAND_NONE},
+    {"POP", OP_POP, OPERAND_NONE},
+    {"JMP_IF_EQUAL", OP_JMP_IF_EQUAL, OPERAND_LABEL},
+    {"JMP_IF_NOT_EQUAL", OP_JMP_IF_NOT_EQUAL, OPERAND_LABEL},
+    {"JMP_IF_LESS", OP_JMP_IF_LESS, OPERAND_LABEL},
+    {"JMP_IF_LESS_EQUAL", OP_JMP_IF_LESS_EQUAL, OPERAND_LABEL},
+    {"JMP_IF_GREATER", OP_JMP_IF_GREATER, OPERAND_LABEL},
+    {"JMP_IF_GREATER_EQUAL", OP_JMP_IF_GREATER_EQUAL, OPERAND_LABEL},
+    {"GET_LOCAL", OP_GET_LOCAL, OPERAND_COUNT},
+    {"SET_LOCAL", OP_SET_LOCAL, OPERAND_COUNT},
+    {"THROW", OP_THROW, OPERAND_NONE},
+    {"NEW_OBJECT", OP_NEW_OBJECT, OPERAND_NONE},
+    {"GET_PROPERTY", OP_GET_PROPERTY, OPERAND_NONE},
+    {"SET_PROPERTY", OP_SET_PROPERTY, OPERAND_NONE},
+    {"DELETE_PROPERTY", OP_DELETE_PROPERTY, OPERAND_NONE},
+    {"NEXT_PROPERTY", OP_NEXT_PROPERTY, OPERAND_NONE},
+    {"CONCAT", OP_CONCAT, OPERAND_NONE},
+    {"SLICE", OP_SLICE, OPERAND_NONE},
+    {"LENGTH", OP_LENGTH, OPERAND_NONE},
+    {"COMPARE", OP_COMPARE, OPERAND_NONE},
+    {"NEW_BUILDER", OP_NEW_BUILDER, OPERAND_NONE},
+    {"APPEND", OP_APPEND, OPERAND_NONE},
+    {"BUILD", OP_BUILD, OPERAND_NONE},
+    {"NEW_LIST", OP_NEW_LIST, OPERAND_NONE},
+    {"LIST_PUSH", OP_LIST_PUSH, OPERAND_NONE},
+    {"LIST_GET", OP_LIST_GET, OPERAND_NONE},
+    {"LIST_SET", OP_LIST_SET, OPERAND_NONE},
+};
+
+typedef struct {
+    const char* start;
+    size_t length;
+} Token;
+
+// A jump waiting for its label to be defined
 typedef struct {
-    char name[256];
     size_t address;
-} Label;
+    size_t line;
+} JumpPatch;
 
 typedef struct {
-    char label_name[256];
-    size_t instruction_address;
-    size_t line_number; // For error reporting
-} UnresolvedJump;
+    Token name; // points into the source being assembled
+    size_t address;
+    bool defined;
+    size_t first_use_line;
+    JumpPatch* patches;
+    size_t patch_count;
+    size_t patch_capacity;
+} LabelInfo;
 
-Chunk assemble_chunk_from_string(const char *src) {
-    Chunk chunk;
-    init_chunk(&chunk);
-    Label labels[256];
-    size_t label_count = 0;
-    UnresolvedJump unresolved[256];
-    size_t unresolved_count = 0;
-
-    char *src_copy = strdup(src);
-    char *line_saveptr;
-    char *line = strtok_r(src_copy, "\n", &line_saveptr);
-    size_t instruction_count = 0;
-    size_t line_num = 0;
-
-    // First pass: find labels
-    while (line != NULL) {
-        line_num++;
-        char *trimmed_line = line;
-        while (isspace(*trimmed_line)) trimmed_line++;
-
-        char *colon = strchr(trimmed_line, ':');
-        if (colon != NULL && *(colon + 1) == '\0') {
-            *colon = '\0'; // Null-terminate the label name
-            strcpy(labels[label_count].name, trimmed_line);
-            labels[label_count].address = instruction_count;
-            label_count++;
-        } else if (strlen(trimmed_line) > 0) {
-            instruction_count++;
+// A jump table entry naming a label; filled in once the scope is complete
+typedef struct {
+    size_t table;
+    size_t entry;
+    size_t label; // index into infos
+} SwitchCase;
+
+// A TRY block: open until its ENDTRY, then an entry in the chunk's handler
+// table whose target is filled in once the scope is complete
+typedef struct {
+    size_t start;
+    size_t label;   // index into infos
+    size_t line;
+    bool closed;
+    size_t handler; // index into the chunk's handlers, once closed
+} TryBlock;
+
+// Per-chunk assembly state: the chunk being written and its label scope
+typedef struct {
+    Chunk* chunk;
+    Table labels; // label name -> index into infos
+    LabelInfo* infos;
+    size_t info_count;
+    size_t info_capacity;
+    SwitchCase* cases;
+    size_t case_count;
+    size_t case_capacity;
+    TryBlock* tries;
+    size_t try_count;
+    size_t try_capacity;
+} ChunkScope;
+
+typedef struct {
+    Token name;
+    Function* function;
+    bool defined;
+    size_t first_use_line;
+} FunctionSymbol;
+
+// Function names shared by every chunk of a program
+typedef struct {
+    Program* program;
+    Table names; // function name -> index into symbols
+    FunctionSymbol* symbols;
+    size_t count;
+    size_t capacity;
+    bool frozen; // read-only while worker threads assemble function bodies
+} SymbolTable;
+
+typedef struct {
+    SymbolTable* symbols; // NULL when assembling a single chunk
+    ChunkScope main_scope;
+    ChunkScope function_scope;
+    ChunkScope* scope;    // where instructions currently go
+    size_t line;
+    bool had_error;
+    FILE* errors;         // opened on the first error when output is buffered
+    char* error_text;
+    size_t error_length;
+    bool record_refs;     // collect function references for the assembly cache
+    FunctionRef* refs;
+    size_t ref_count;
+    size_t ref_capacity;
+} Assembler;
+
+static void error_at(Assembler* as, size_t line, const char* message, Token token) {
+    if (!as->errors) as->errors = open_memstream(&as->error_text, &as->error_length);
+    if (token.length > 0) {
+        fprintf(as->errors, "AssemblerError: line %zu: %s '%.*s'\n", line, message, (int)token.length, token.start);
+    } else {
+        fprintf(as->errors, "AssemblerError: line %zu: %s\n", line, message);
+    }
+    as->had_error = true;
+}
+
+static void init_scope(ChunkScope* scope, Chunk* chunk) {
+    scope->chunk = chunk;
+    init_table(&scope->labels);
+    scope->infos = NULL;
+    scope->info_count = 0;
+    scope->info_capacity = 0;
+    scope->cases = NULL;
+    scope->case_count = 0;
+    scope->case_capacity = 0;
+    scope->tries = NULL;
+    scope->try_count = 0;
+    scope->try_capacity = 0;
+}
+
+// Resolves SWITCH cases and TRY handlers, reports labels that were jumped to
+// but never defined, then releases the scope
+static void finish_scope(Assembler* as, ChunkScope* scope) {
+    for (size_t i = 0; i < scope->case_count; i++) {
+        const SwitchCase* c = &scope->cases[i];
+        const LabelInfo* info = &scope->infos[c->label];
+        if (info->defined) scope->chunk->jump_tables.tables[c->table].targets[c->entry] = info->address;
+    }
+    free(scope->cases);
+    for (size_t i = 0; i < scope->try_count; i++) {
+        const TryBlock* block = &scope->tries[i];
+        const LabelInfo* info = &scope->infos[block->label];
+        if (!block->closed) {
+            error_at(as, block->line, "Missing ENDTRY for", info->name);
+        } else if (info->defined && block->handler != SIZE_MAX) {
+            scope->chunk->handlers.handlers[block->handler].target = info->address;
         }
-        line = strtok_r(NULL, "\n", &line_saveptr);
-    }
-    free(src_copy);
-
-    // Second pass: assemble
-    src_copy = strdup(src);
-    line = strtok_r(src_copy, "\n", &line_saveptr);
-    instruction_count = 0;
-    line_num = 0;
-    while (line != NULL) {
-        line_num++;
-        char *colon = strchr(line, ':');
-        if (colon != NULL && *(colon + 1) == '\0') {
-             line = strtok_r(NULL, "\n", &line_saveptr);
-             continue;
+    }
+    free(scope->tries);
+    for (size_t i = 0; i < scope->info_count; i++) {
+        LabelInfo* info = &scope->infos[i];
+        if (!info->defined) {
+            error_at(as, info->first_use_line, "Undefined label", info->name);
         }
+        free(info->patches);
+    }
+    free(scope->infos);
+    free_table(&scope->labels);
+    // Lets hand-built frames run the chunk in the checked interpreter without
+    // verifying it first; a range the stack cannot be unwound to is an error
+    if (scope->chunk->handlers.count > 0 && !as->had_error && compute_handler_depths(scope->chunk) != 0) {
+        as->had_error = true;
+    }
+    scope->chunk = NULL;
+}
 
-        char *opcode_saveptr;
-        char *opcode_str = strtok_r(line, " \t", &opcode_saveptr);
+static LabelInfo* lookup_label(ChunkScope* scope, Token name, size_t line) {
+    size_t index;
+    if (!table_get(&scope->labels, name.start, name.length, &index)) {
+        if (scope->info_count == scope->info_capacity) {
+            scope->info_capacity = scope->info_capacity < 8 ? 8 : scope->info_capacity * 2;
+            scope->infos = realloc(scope->infos, sizeof(LabelInfo) * scope->info_capacity);
+        }
+        index = scope->info_count++;
+        scope->infos[index] = (LabelInfo){.name = name, .first_use_line = line};
+        table_set(&scope->labels, name.start, name.length, index);
+    }
+    return &scope->infos[index];
+}
 
-        if (opcode_str) {
-             if (strcasecmp(opcode_str, "CONSTANT") == 0) {
-                char *operand_str = strtok_r(NULL, " \t", &opcode_saveptr);
-                if (operand_str) {
-                    long long num = atoll(operand_str);
-                    size_t const_idx = add_constant(&chunk, (Value){.type = VAL_NUMBER, .as.number = num});
-                    write_instruction(&chunk, make_instruction(OP_CONSTANT, const_idx));
-                }
-             } else if (strcasecmp(opcode_str, "ADD") == 0) {
-                write_instruction(&chunk, make_instruction(OP_ADD, 0));
-             } else if (strcasecmp(opcode_str, "HALT") == 0) {
-                write_instruction(&chunk, make_instruction(OP_HALT, 0));
-             } else if (strcasecmp(opcode_str, "JMP") == 0 || strcasecmp(opcode_str, "JMP_IF_FALSE") == 0) {
-                 char *label_name = strtok_r(NULL, " \t", &opcode_saveptr);
-                 strcpy(unresolved[unresolved_count].label_name, label_name);
-                 unresolved[unresolved_count].instruction_address = instruction_count;
-                 unresolved[unresolved_count].line_number = line_num;
-                 unresolved_count++;
-                 write_instruction(&chunk, make_instruction(strcasecmp(opcode_str, "JMP") == 0 ? OP_JMP : OP_JMP_IF_FALSE, 0)); // Placeholder operand
-             } else if (strcasecmp(opcode_str, "CALL") == 0) {
-                 char *operand_str = strtok_r(NULL, " \t", &opcode_saveptr);
-                 if (operand_str) {
-                     long long arg_count = atoll(operand_str);
-                     write_instruction(&chunk, make_instruction(OP_CALL, (uint64_t)arg_count));
-                 }
-             } else if (strcasecmp(opcode_str, "RETURN") == 0) {
-                 write_instruction(&chunk, make_instruction(OP_RETURN, 0));
-             }
+static void patch_jump(Assembler* as, const LabelInfo* label, JumpPatch jump) {
+    Chunk* chunk = as->scope->chunk;
+    const int64_t offset = (int64_t)label->address - ((int64_t)jump.address + 1);
+    // vm_run reads jump offsets as int16_t
+    if (offset != (int16_t)offset) {
+        error_at(as, jump.line, "Jump out of range to", label->name);
+        return;
+    }
+    uint8_t opcode = get_opcode(chunk->code.code[jump.address]);
+    chunk->code.code[jump.address] = make_instruction(opcode, (uint64_t)offset);
+}
+
+static void define_label(Assembler* as, Token name) {
+    ChunkScope* scope = as->scope;
+    LabelInfo* info = lookup_label(scope, name, as->line);
+    if (info->defined) {
+        error_at(as, as->line, "Duplicate label", name);
+        return;
+    }
+    info->defined = true;
+    info->address = scope->chunk->code.count;
+    for (size_t i = 0; i < info->patch_count; i++) {
+        patch_jump(as, info, info->patches[i]);
+    }
+    free(info->patches);
+    info->patches = NULL;
+    info->patch_count = info->patch_capacity = 0;
+}
+
+static void emit_jump(Assembler* as, OpCode opcode, Token label) {
+    ChunkScope* scope = as->scope;
+    LabelInfo* info = lookup_label(scope, label, as->line);
+    size_t address = scope->chunk->code.count;
+    write_instruction(scope->chunk, make_instruction(opcode, 0));
+    const JumpPatch jump = {address, as->line};
+    if (info->defined) {
+        patch_jump(as, info, jump);
+        return;
+    }
+    if (info->patch_count == info->patch_capacity) {
+        info->patch_capacity = info->patch_capacity < 4 ? 4 : info->patch_capacity * 2;
+        info->patches = realloc(info->patches, sizeof(JumpPatch) * info->patch_capacity);
+    }
+    info->patches[info->patch_count++] = jump;
+}
+
+static void init_symbol_table(SymbolTable* symbols, Program* program) {
+    symbols->program = program;
+    init_table(&symbols->names);
+    symbols->symbols = NULL;
+    symbols->count = 0;
+    symbols->capacity = 0;
+    symbols->frozen = false;
+}
+
+static void free_symbol_table(SymbolTable* symbols) {
+    free(symbols->symbols);
+    free_table(&symbols->names);
+}
+
+// Returns the symbol for a function name, declaring it on first mention.
+// Returns NULL for unknown names once the table is frozen.
+static FunctionSymbol* lookup_function(Assembler* as, Token name) {
+    SymbolTable* symbols = as->symbols;
+    size_t index;
+    if (!table_get(&symbols->names, name.start, name.length, &index)) {
+        if (symbols->frozen) return NULL;
+        if (symbols->count == symbols->capacity) {
+            symbols->capacity = symbols->capacity < 8 ? 8 : symbols->capacity * 2;
+            symbols->symbols = realloc(symbols->symbols, sizeof(FunctionSymbol) * symbols->capacity);
         }
-        instruction_count++;
-        line = strtok_r(NULL, "\n", &line_saveptr);
-    }
-    free(src_copy);
-    
-    // Resolve jumps
-    for (size_t i = 0; i < unresolved_count; i++) {
-        int found = 0;
-        for (size_t j = 0; j < label_count; j++) {
-            if (strcmp(unresolved[i].label_name, labels[j].name) == 0) {
-                int64_t offset = (int64_t)labels[j].address - ((int64_t)unresolved[i].instruction_address + 1);
-                uint8_t opcode = get_opcode(chunk.code.code[unresolved[i].instruction_address]);
-                chunk.code.code[unresolved[i].instruction_address] = make_instruction(opcode, (uint64_t)offset);
-                found = 1;
+        Chunk* chunk = malloc(sizeof(Chunk));
+        init_chunk(chunk);
+        Function* function = malloc(sizeof(Function));
+        function->chunk = chunk;
+        function->name = NULL;
+        function->local_count = 0;
+        index = symbols->count++;
+        symbols->symbols[index] = (FunctionSymbol){.name = name, .function = function, .first_use_line = as->line};
+        table_set(&symbols->names, name.start, name.length, index);
+    }
+    return &symbols->symbols[index];
+}
+
+static void add_function_to_program(Program* program, Token name, Function* function) {
+    if (program->function_count >= program->function_capacity) {
+        size_t old_capacity = program->function_capacity;
+        program->function_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        program->functions = realloc(program->functions,
+            sizeof(FunctionDef) * program->function_capacity);
+    }
+
+    FunctionDef* func_def = &program->functions[program->function_count++];
+    func_def->name = malloc(name.length + 1);
+    memcpy(func_def->name, name.start, name.length);
+    func_def->name[name.length] = '\0';
+    func_def->chunk = function->chunk;
+    func_def->function = function;
+    function->name = func_def->name;
+}
+
+// Skips a string literal starting at the quote at p. Returns the position
+// after its closing quote, or end if it has none.
+static const char* skip_string(const char* p, const char* end) {
+    for (p++; p < end && *p != '"'; p++) {
+        if (*p == '\\' && p + 1 < end) p++;
+    }
+    return p < end ? p + 1 : end;
+}
+
+// A token runs to the next space, except that spaces inside a string
+// literal belong to it
+static Token next_token(const char** cursor, const char* end) {
+    const char* p = *cursor;
+    while (p < end && isspace((unsigned char)*p)) p++;
+    const char* start = p;
+    while (p < end && !isspace((unsigned char)*p)) p = *p == '"' ? skip_string(p, end) : p + 1;
+    *cursor = p;
+    return (Token){start, (size_t)(p - start)};
+}
+
+// The '#' that starts the line's comment, outside any string literal, or end
+static const char* find_comment(const char* line, const char* end) {
+    const char* comment = memchr(line, '#', (size_t)(end - line));
+    // Most lines have no strings to skip
+    const char* quote = memchr(line, '"', (size_t)((comment ? comment : end) - line));
+    if (!quote) return comment ? comment : end;
+    for (const char* p = quote; p < end;) {
+        if (*p == '#') return p;
+        p = *p == '"' ? skip_string(p, end) : p + 1;
+    }
+    return end;
+}
+
+static bool token_equals(Token token, const char* word) {
+    return strlen(word) == token.length && strncasecmp(token.start, word, token.length) == 0;
+}
+
+static const Mnemonic* find_mnemonic(Token token) {
+    for (size_t i = 0; i < sizeof(MNEMONICS) / sizeof(MNEMONICS[0]); i++) {
+        if (token_equals(token, MNEMONICS[i].name)) return &MNEMONICS[i];
+    }
+    return NULL;
+}
+
+static bool parse_integer(Token token, long long* out) {
+    if (token.length == 0 || token.length > 32) return false;
+    char buffer[33];
+    memcpy(buffer, token.start, token.length);
+    buffer[token.length] = '\0';
+    char* end;
+    errno = 0;
+    *out = strtoll(buffer, &end, 10);
+    return *end == '\0' && errno != ERANGE;
+}
+
+// Reads numbers with a fraction or an exponent, and integers too large for
+// int64_t, as doubles
+static bool parse_double(Token token, double* out) {
+    if (token.length == 0 || token.length > 64) return false;
+    if (!isdigit((unsigned char)token.start[0]) && !strchr("+-.", token.start[0])) return false;
+    char buffer[65];
+    memcpy(buffer, token.start, token.length);
+    buffer[token.length] = '\0';
+    char* end;
+    *out = strtod(buffer, &end);
+    return end != buffer && *end == '\0' && isfinite(*out);
+}
+
+// Reads a "string" literal with the escapes \" \\ \n and \t into a new
+// buffer. Returns NULL if the token is not a well-formed literal.
+static char* parse_string(Token token) {
+    if (token.length < 2 || token.start[0] != '"' || token.start[token.length - 1] != '"') return NULL;
+    char* string = malloc(token.length);
+    size_t length = 0;
+    for (size_t i = 1; i < token.length - 1; i++) {
+        char c = token.start[i];
+        if (c == '\\') {
+            switch (++i < token.length - 1 ? token.start[i] : '\0') {
+                case '"': c = '"'; break;
+                case '\\': c = '\\'; break;
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                default: c = '\0'; break;
+            }
+        }
+        // An unknown escape, a quote before the end or a quote escaped away
+        if (c == '\0' || (c == '"' && token.start[i - 1] != '\\')) {
+            free(string);
+            return NULL;
+        }
+        string[length++] = c;
+    }
+    string[length] = '\0';
+    return string;
+}
+
+static bool is_identifier(Token token) {
+    if (token.length == 0) return false;
+    if (!isalpha((unsigned char)token.start[0]) && token.start[0] != '_') return false;
+    for (size_t i = 1; i < token.length; i++) {
+        if (!isalnum((unsigned char)token.start[i]) && token.start[i] != '_') return false;
+    }
+    return true;
+}
+
+static void assemble_instruction(Assembler* as, const Mnemonic* mnemonic, Token operand) {
+    Chunk* chunk = as->scope->chunk;
+    if (mnemonic->operand != OPERAND_NONE && operand.length == 0) {
+        error_at(as, as->line, "Missing operand for", (Token){mnemonic->name, strlen(mnemonic->name)});
+        return;
+    }
+    switch (mnemonic->operand) {
+        case OPERAND_NONE:
+            write_instruction(chunk, make_instruction(mnemonic->opcode, 0));
+            break;
+        case OPERAND_CONSTANT: {
+            long long num;
+            double fp_num;
+            Value value;
+            if (operand.length > 0 && operand.start[0] == '"') {
+                char* string = parse_string(operand);
+                if (!string) {
+                    error_at(as, as->line, "Invalid constant", operand);
+                    return;
+                }
+                // add_constant keeps its own copy
+                value = (Value){.type = VAL_STRING, .as.string = string};
+                const size_t const_idx = add_constant(chunk, value);
+                free(string);
+                write_instruction(chunk, make_instruction(OP_CONSTANT, const_idx));
                 break;
             }
+            if (parse_integer(operand, &num)) {
+                value = (Value){.type = VAL_NUMBER, .as.number = num};
+            } else if (parse_double(operand, &fp_num)) {
+                value = (Value){.type = VAL_DOUBLE, .as.fp_number = fp_num};
+            } else if (as->symbols && is_identifier(operand)) {
+                FunctionSymbol* symbol = lookup_function(as, operand);
+                if (!symbol) {
+                    error_at(as, as->line, "Undefined function", operand);
+                    return;
+                }
+                value = (Value){.type = VAL_FUNCTION, .as.function = symbol->function};
+            } else {
+                error_at(as, as->line, "Invalid constant", operand);
+                return;
+            }
+            size_t const_idx = add_constant(chunk, value);
+            if (as->record_refs && value.type == VAL_FUNCTION) {
+                if (as->ref_count == as->ref_capacity) {
+                    as->ref_capacity = as->ref_capacity < 8 ? 8 : as->ref_capacity * 2;
+                    as->refs = realloc(as->refs, sizeof(FunctionRef) * as->ref_capacity);
+                }
+                as->refs[as->ref_count++] = (FunctionRef){const_idx, operand.start, operand.length, as->line};
+            }
+            write_instruction(chunk, make_instruction(OP_CONSTANT, const_idx));
+            break;
+        }
+        case OPERAND_LABEL:
+            emit_jump(as, mnemonic->opcode, operand);
+            break;
+        case OPERAND_COUNT: {
+            long long count;
+            if (!parse_integer(operand, &count) || count < 0 || count > UINT8_MAX) {
+                error_at(as, as->line, "Invalid count", operand);
+                return;
+            }
+            write_instruction(chunk, make_instruction(mnemonic->opcode, (uint64_t)count));
+            break;
+        }
+    }
+}
+
+// Declares and registers a function defined at the current line, with the
+// optional local count from its header. Returns NULL on error.
+static FunctionSymbol* define_function(Assembler* as, Token name, Token locals) {
+    if (!is_identifier(name)) {
+        error_at(as, as->line, "Invalid function name", name);
+        return NULL;
+    }
+    long long local_count = 0;
+    if (locals.length > 0 && (!parse_integer(locals, &local_count) || local_count < 0 || local_count > UINT8_MAX)) {
+        error_at(as, as->line, "Invalid local count", locals);
+        return NULL;
+    }
+    FunctionSymbol* symbol = lookup_function(as, name);
+    if (symbol->defined) {
+        error_at(as, as->line, "Duplicate function", name);
+        return NULL;
+    }
+    symbol->defined = true;
+    symbol->function->local_count = (size_t)local_count;
+    add_function_to_program(as->symbols->program, name, symbol->function);
+    return symbol;
+}
+
+static void begin_function(Assembler* as, Token name, Token locals) {
+    if (!as->symbols) {
+        error_at(as, as->line, "FUNCTION is only allowed in programs:", name);
+        return;
+    }
+    if (as->scope == &as->function_scope) {
+        error_at(as, as->line, "Nested FUNCTION", name);
+        return;
+    }
+    FunctionSymbol* symbol = define_function(as, name, locals);
+    if (!symbol) return;
+    init_scope(&as->function_scope, symbol->function->chunk);
+    as->scope = &as->function_scope;
+}
+
+static void end_function(Assembler* as, Token keyword) {
+    if (as->scope != &as->function_scope) {
+        error_at(as, as->line, "Unexpected", keyword);
+        return;
+    }
+    finish_scope(as, &as->function_scope);
+    as->scope = &as->main_scope;
+}
+
+// Splits a line into its first three tokens plus the start of anything after
+// them, ignoring comments. Returns false on a blank line.
+static bool split_line(const char* line, const char* end, Token* first, Token* operand, Token* extra, Token* rest) {
+    end = find_comment(line, end);
+
+    const char* cursor = line;
+    *first = next_token(&cursor, end);
+    *operand = next_token(&cursor, end);
+    *extra = next_token(&cursor, end);
+    *rest = next_token(&cursor, end);
+    return first->length != 0;
+}
+
+// Only FUNCTION headers take a second operand, the function's local count
+static Token unexpected_token(Token first, Token extra, Token rest) {
+    return token_equals(first, "FUNCTION") ? rest : extra;
+}
+
+// SWITCH label0 label1 ...: one jump table entry per label
+static void emit_switch(Assembler* as, const char* cursor, const char* end) {
+    ChunkScope* scope = as->scope;
+    size_t count = 0;
+    for (const char* p = cursor; next_token(&p, end).length != 0;) count++;
+    if (count == 0) {
+        error_at(as, as->line, "Missing operand for", (Token){"SWITCH", 6});
+        return;
+    }
+    const size_t table = add_jump_table(scope->chunk, count);
+    for (size_t entry = 0; entry < count; entry++) {
+        const Token label = next_token(&cursor, end);
+        if (scope->case_count == scope->case_capacity) {
+            scope->case_capacity = scope->case_capacity < 8 ? 8 : scope->case_capacity * 2;
+            scope->cases = realloc(scope->cases, sizeof(SwitchCase) * scope->case_capacity);
+        }
+        const size_t info = (size_t)(lookup_label(scope, label, as->line) - scope->infos);
+        scope->cases[scope->case_count++] = (SwitchCase){table, entry, info};
+    }
+    write_instruction(scope->chunk, make_instruction(OP_SWITCH, table));
+}
+
+// TRY label: instructions up to the matching ENDTRY throw to label. Nothing
+// is emitted; the range goes into the chunk's handler table.
+static void begin_try(Assembler* as, Token label) {
+    ChunkScope* scope = as->scope;
+    if (label.length == 0) {
+        error_at(as, as->line, "Missing operand for", (Token){"TRY", 3});
+        return;
+    }
+    if (scope->try_count == scope->try_capacity) {
+        scope->try_capacity = scope->try_capacity < 4 ? 4 : scope->try_capacity * 2;
+        scope->tries = realloc(scope->tries, sizeof(TryBlock) * scope->try_capacity);
+    }
+    const size_t info = (size_t)(lookup_label(scope, label, as->line) - scope->infos);
+    scope->tries[scope->try_count++] = (TryBlock){scope->chunk->code.count, info, as->line, false, SIZE_MAX};
+}
+
+// Closes the innermost open TRY block
+static void end_try(Assembler* as, Token keyword) {
+    ChunkScope* scope = as->scope;
+    size_t i = scope->try_count;
+    while (i > 0 && scope->tries[i - 1].closed) i--;
+    if (i == 0) {
+        error_at(as, as->line, "Unexpected", keyword);
+        return;
+    }
+    TryBlock* block = &scope->tries[i - 1];
+    block->closed = true;
+    const size_t end = scope->chunk->code.count;
+    if (end == block->start) {
+        error_at(as, as->line, "Empty TRY block for", scope->infos[block->label].name);
+        return;
+    }
+    // Inner blocks close first, so their ranges come first in the table
+    block->handler = add_handler(scope->chunk, (Handler){block->start, end, 0, 0});
+}
+
+static void assemble_line(Assembler* as, const char* line, const char* end) {
+    Token first, operand, extra, rest;
+    if (!split_line(line, end, &first, &operand, &extra, &rest)) return;
+    if (token_equals(first, "SWITCH")) {
+        emit_switch(as, operand.start, find_comment(line, end));
+        return;
+    }
+    const Token unexpected = unexpected_token(first, extra, rest);
+    if (unexpected.length != 0) {
+        error_at(as, as->line, "Unexpected token", unexpected);
+        return;
+    }
+
+    if (first.length > 1 && first.start[first.length - 1] == ':' && operand.length == 0) {
+        define_label(as, (Token){first.start, first.length - 1});
+    } else if (token_equals(first, "FUNCTION")) {
+        begin_function(as, operand, extra);
+    } else if (token_equals(first, "ENDFUNCTION") && operand.length == 0) {
+        end_function(as, first);
+    } else if (token_equals(first, "TRY")) {
+        begin_try(as, operand);
+    } else if (token_equals(first, "ENDTRY") && operand.length == 0) {
+        end_try(as, first);
+    } else {
+        const Mnemonic* mnemonic = find_mnemonic(first);
+        if (!mnemonic) {
+            error_at(as, as->line, "Unknown instruction", first);
+            return;
         }
-        if (!found) { /* handle error */ }
+        if (mnemonic->operand == OPERAND_NONE && operand.length != 0) {
+            error_at(as, as->line, "Unexpected operand", operand);
+            return;
+        }
+        assemble_instruction(as, mnemonic, operand);
+    }
+}
+
+static void init_assembler(Assembler* as, SymbolTable* symbols, Chunk* main_chunk) {
+    as->symbols = symbols;
+    init_scope(&as->main_scope, main_chunk);
+    as->function_scope.chunk = NULL;
+    as->scope = &as->main_scope;
+    as->line = 0;
+    as->had_error = false;
+    as->errors = stderr;
+    as->error_text = NULL;
+    as->error_length = 0;
+    as->record_refs = false;
+    as->refs = NULL;
+    as->ref_count = 0;
+    as->ref_capacity = 0;
+}
+
+// Assembles the lines in [start, end); line numbers continue from as->line
+static void assemble_lines(Assembler* as, const char* start, const char* end) {
+    const char* line = start;
+    while (line < end) {
+        const char* line_end = memchr(line, '\n', end - line);
+        if (!line_end) line_end = end;
+        as->line++;
+        assemble_line(as, line, line_end);
+        line = line_end + 1;
     }
+}
+
+// Functions that were referenced but never defined still belong to the
+// program so that free_program releases them
+static void finish_symbols(Assembler* as) {
+    SymbolTable* symbols = as->symbols;
+    for (size_t i = 0; i < symbols->count; i++) {
+        FunctionSymbol* symbol = &symbols->symbols[i];
+        if (symbol->defined) continue;
+        error_at(as, symbol->first_use_line, "Undefined function", symbol->name);
+        add_function_to_program(symbols->program, symbol->name, symbol->function);
+    }
+}
+
+static void run_assembler(Assembler* as, const char* src) {
+    assemble_lines(as, src, src + strlen(src));
+    if (as->scope == &as->function_scope) {
+        error_at(as, as->line, "Missing ENDFUNCTION at end of input", (Token){"", 0});
+        finish_scope(as, &as->function_scope);
+    }
+    finish_scope(as, &as->main_scope);
+    if (as->symbols) finish_symbols(as);
+}
+
+static void init_program(Program* program) {
+    init_chunk(&program->main_chunk);
+    program->functions = NULL;
+    program->function_count = 0;
+    program->function_capacity = 0;
+    program->had_error = false;
+}
+
+Chunk assemble_chunk_from_string(const char *src) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    Assembler as;
+    init_assembler(&as, NULL, &chunk);
+    run_assembler(&as, src);
     return chunk;
 }
 
+Program assemble_program_from_string(const char *src) {
+    Program program;
+    init_program(&program);
+    SymbolTable symbols;
+    init_symbol_table(&symbols, &program);
+
+    Assembler as;
+    init_assembler(&as, &symbols, &program.main_chunk);
+    run_assembler(&as, src);
+    program.had_error = as.had_error;
+    free_symbol_table(&symbols);
+    return program;
+}
+
+// A FUNCTION body or a run of main code between function blocks
+typedef struct {
+    const char* start;
+    const char* end;
+    size_t line;           // line number just before the first line
+    Function* function;    // NULL for main code
+    bool had_error;
+    char* header_text;     // reported while splitting, at lines before the block
+    char* error_text;
+} SourceBlock;
+
+typedef struct {
+    SymbolTable* symbols;
+    SourceBlock* blocks;
+    size_t block_count;
+    atomic_size_t next_block;
+    const char* cache_dir; // NULL when caching is off
+    atomic_size_t cache_hits;
+    atomic_size_t cache_misses;
+} ParallelAssembly;
+
+// Fills a function chunk from the assembly cache, resolving its function
+// references against this program. Returns false on a miss.
+static bool load_cached_block(ParallelAssembly* job, Assembler* as, SourceBlock* block) {
+    Chunk* chunk = block->function->chunk;
+    FunctionRef* refs;
+    size_t ref_count;
+    char* storage;
+    if (!cache_load(job->cache_dir, block->start, block->end - block->start, chunk, &refs, &ref_count, &storage)) {
+        return false;
+    }
+    for (size_t i = 0; i < ref_count; i++) {
+        size_t index;
+        if (table_get(&job->symbols->names, refs[i].name, refs[i].length, &index)) {
+            chunk->constants.values[refs[i].constant].as.function = job->symbols->symbols[index].function;
+        } else {
+            error_at(as, block->line + refs[i].line, "Undefined function", (Token){refs[i].name, refs[i].length});
+        }
+    }
+    free(refs);
+    free(storage);
+    return true;
+}
+
+// The reports buffered since the last call, or NULL if there were none
+static char* take_errors(Assembler* as) {
+    if (!as->errors) return NULL;
+    fclose(as->errors);
+    char* text = as->error_text;
+    as->errors = NULL;
+    as->error_text = NULL;
+    return text;
+}
+
+static void assemble_function_block(ParallelAssembly* job, SourceBlock* block) {
+    Assembler as;
+    init_assembler(&as, job->symbols, NULL);
+    as.errors = NULL; // buffered so that reports come out in source order
+
+    if (job->cache_dir && load_cached_block(job, &as, block)) {
+        atomic_fetch_add(&job->cache_hits, 1);
+    } else {
+        init_scope(&as.function_scope, block->function->chunk);
+        as.scope = &as.function_scope;
+        as.line = block->line;
+        as.record_refs = job->cache_dir != NULL;
+        assemble_lines(&as, block->start, block->end);
+        finish_scope(&as, &as.function_scope);
+        if (job->cache_dir) {
+            atomic_fetch_add(&job->cache_misses, 1);
+            for (size_t i = 0; i < as.ref_count; i++) as.refs[i].line -= block->line;
+            // Bodies with errors are not cached so that they are reported every time
+            if (!as.had_error) {
+                cache_store(job->cache_dir, block->start, block->end - block->start,
+                            block->function->chunk, as.refs, as.ref_count);
+            }
+        }
+        free(as.refs);
+    }
+    block->had_error = as.had_error;
+    block->error_text = take_errors(&as);
+}
+
+static void* assembly_worker(void* arg) {
+    ParallelAssembly* job = arg;
+    for (;;) {
+        size_t index = atomic_fetch_add(&job->next_block, 1);
+        if (index >= job->block_count) break;
+        if (job->blocks[index].function) {
+            assemble_function_block(job, &job->blocks[index]);
+        }
+    }
+    return NULL;
+}
+
+// Errors found while splitting go with the next block so that every report
+// comes out in source order
+static void add_block(SourceBlock** blocks, size_t* count, size_t* capacity, SourceBlock block, Assembler* as) {
+    block.header_text = take_errors(as);
+    if (*count == *capacity) {
+        *capacity = *capacity < 8 ? 8 : *capacity * 2;
+        *blocks = realloc(*blocks, sizeof(SourceBlock) * *capacity);
+    }
+    (*blocks)[(*count)++] = block;
+}
+
+// Prints and frees text from take_errors
+static void print_errors(char* text) {
+    if (!text) return;
+    fputs(text, stderr);
+    free(text);
+}
+
+Program assemble_program_from_string_parallel(const char *src, int thread_count) {
+    return assemble_program_cached(src, NULL, thread_count, NULL);
+}
+
+Program assemble_program_cached(const char *src, const char *cache_dir, int thread_count, CacheStats *stats) {
+    Program program;
+    init_program(&program);
+    SymbolTable symbols;
+    init_symbol_table(&symbols, &program);
+    Assembler as;
+    init_assembler(&as, &symbols, &program.main_chunk);
+    as.errors = NULL;
+
+    // Split at function boundaries and declare every function in definition order
+    SourceBlock* blocks = NULL;
+    size_t block_count = 0, block_capacity = 0;
+    const char* src_end = src + strlen(src);
+    SourceBlock current = {.start = src, .line = 0};
+    bool in_function = false;
+    const char* line = src;
+    while (line < src_end) {
+        const char* line_end = memchr(line, '\n', src_end - line);
+        if (!line_end) line_end = src_end;
+        as.line++;
+        Token first, operand, extra, rest;
+        // Lines with stray tokens stay inside their block and are reported there
+        bool is_directive = split_line(line, line_end, &first, &operand, &extra, &rest) &&
+                            unexpected_token(first, extra, rest).length == 0;
+        // A nested FUNCTION stays in its body and a stray ENDFUNCTION in main
+        // code, where they are reported when the block is assembled
+        if (is_directive && token_equals(first, "FUNCTION")) {
+            if (!in_function) {
+                current.end = line;
+                add_block(&blocks, &block_count, &block_capacity, current, &as);
+                current = (SourceBlock){.start = line_end + 1, .line = as.line};
+                FunctionSymbol* symbol = define_function(&as, operand, extra);
+                current.function = symbol ? symbol->function : NULL;
+                in_function = true;
+            } else if (!current.function) {
+                error_at(&as, as.line, "Nested FUNCTION", operand);
+            }
+        } else if (is_directive && token_equals(first, "ENDFUNCTION") && operand.length == 0 && in_function) {
+            current.end = line;
+            // The body of a function whose definition failed is skipped
+            if (current.function) add_block(&blocks, &block_count, &block_capacity, current, &as);
+            current = (SourceBlock){.start = line_end + 1, .line = as.line};
+            in_function = false;
+        }
+        line = line_end + 1;
+    }
+    current.end = src_end;
+    if (!in_function || current.function) add_block(&blocks, &block_count, &block_capacity, current, &as);
+    if (in_function) error_at(&as, as.line, "Missing ENDFUNCTION at end of input", (Token){"", 0});
+    char* trailing_text = take_errors(&as);
+    symbols.frozen = true;
+
+    // Workers take function blocks; this thread assembles main, then helps out
+    if (thread_count <= 0) thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count < 1) thread_count = 1;
+    ParallelAssembly job = {.symbols = &symbols, .blocks = blocks, .block_count = block_count, .cache_dir = cache_dir};
+    atomic_init(&job.next_block, 0);
+    atomic_init(&job.cache_hits, 0);
+    atomic_init(&job.cache_misses, 0);
+    pthread_t* threads = malloc(sizeof(pthread_t) * thread_count);
+    int started = 0;
+    for (int i = 1; i < thread_count; i++) {
+        if (pthread_create(&threads[started], NULL, assembly_worker, &job) == 0) started++;
+    }
+    for (size_t i = 0; i < block_count; i++) {
+        if (blocks[i].function) continue;
+        as.line = blocks[i].line;
+        assemble_lines(&as, blocks[i].start, blocks[i].end);
+        blocks[i].error_text = take_errors(&as);
+    }
+    finish_scope(&as, &as.main_scope);
+    char* main_text = take_errors(&as);
+    assembly_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    if (stats) {
+        stats->hits = atomic_load(&job.cache_hits);
+        stats->misses = atomic_load(&job.cache_misses);
+    }
+
+    program.had_error = as.had_error;
+    for (size_t i = 0; i < block_count; i++) {
+        if (blocks[i].had_error) program.had_error = true;
+        print_errors(blocks[i].header_text);
+        print_errors(blocks[i].error_text);
+    }
+    // Like the serial assembler, a missing ENDFUNCTION comes before what
+    // finishing main code reports
+    print_errors(trailing_text);
+    print_errors(main_text);
+    free(blocks);
+    free_symbol_table(&symbols);
+    return program;
+}
+
 int assemble_chunk_from_file(const char* in_filename, const char* out_filename) {
     // For backward compatibility, use the new program assembler but only save main chunk
     return assemble_program_from_file(in_filename, out_filename);
 }
 
 int assemble_program_from_file(const char* in_filename, const char* out_filename) {
+    return assemble_program_from_file_parallel(in_filename, out_filename, 1);
+}
+
+int assemble_program_from_file_parallel(const char* in_filename, const char* out_filename, int thread_count) {
     FILE *f_in = fopen(in_filename, "r");
     if (!f_in) return -1;
 
@@ -134,189 +997,34 @@ int assemble_program_from_file(const char* in_filename, const char* out_filename
 
     string[fsize] = 0;
 
-    Program program = assemble_program_from_string(string);
+    Program program = thread_count == 1
+        ? assemble_program_from_string(string)
+        : assemble_program_from_string_parallel(string, thread_count);
     free(string);
+    if (program.had_error) {
+        free_program(&program);
+        return -2;
+    }
 
-    // For now, only save the main chunk (functions are lost)
-    // TODO: Implement proper program serialization format
+    // Function chunks are reachable from the main chunk's constants and are
+    // saved along with it
     int result = save_chunk(&program.main_chunk, out_filename);
     free_program(&program);
 
     return result;
 }
 
-static void assemble_main_with_functions(Program* program, const char* main_code) {
-    char *src_copy = strdup(main_code);
-    char *line_saveptr;
-    char *line = strtok_r(src_copy, "\n", &line_saveptr);
-    
-    while (line != NULL) {
-        char *trimmed_line = line;
-        while (isspace(*trimmed_line)) trimmed_line++;
-        
-        if (strlen(trimmed_line) == 0 || trimmed_line[0] == '#') {
-            line = strtok_r(NULL, "\n", &line_saveptr);
-            continue;
-        }
-        
-        char *opcode_saveptr;
-        char *opcode_str = strtok_r(trimmed_line, " \t", &opcode_saveptr);
-        
-        if (opcode_str) {
-            if (strcasecmp(opcode_str, "CONSTANT") == 0) {
-                char *operand_str = strtok_r(NULL, " \t", &opcode_saveptr);
-                if (operand_str) {
-                    // Check if operand is a function name
-                    int is_function = 0;
-                    size_t func_idx = 0;
-                    
-                    for (size_t i = 0; i < program->function_count; i++) {
-                        if (strcmp(operand_str, program->functions[i].name) == 0) {
-                            // Add function to constants if not already added
-                            Value func_value;
-                            func_value.type = VAL_FUNCTION;
-                            func_value.as.function = program->functions[i].function;
-                            func_idx = add_constant(&program->main_chunk, func_value);
-                            is_function = 1;
-                            break;
-                        }
-                    }
-                    
-                    if (!is_function) {
-                        // Regular number constant
-                        long long num = atoll(operand_str);
-                        func_idx = add_constant(&program->main_chunk, (Value){.type = VAL_NUMBER, .as.number = num});
-                    }
-                    
-                    write_instruction(&program->main_chunk, make_instruction(OP_CONSTANT, func_idx));
-                }
-            } else if (strcasecmp(opcode_str, "ADD") == 0) {
-                write_instruction(&program->main_chunk, make_instruction(OP_ADD, 0));
-            } else if (strcasecmp(opcode_str, "HALT") == 0) {
-                write_instruction(&program->main_chunk, make_instruction(OP_HALT, 0));
-            } else if (strcasecmp(opcode_str, "CALL") == 0) {
-                char *operand_str = strtok_r(NULL, " \t", &opcode_saveptr);
-                if (operand_str) {
-                    long long arg_count = atoll(operand_str);
-                    write_instruction(&program->main_chunk, make_instruction(OP_CALL, (uint64_t)arg_count));
-                }
-            } else if (strcasecmp(opcode_str, "RETURN") == 0) {
-                write_instruction(&program->main_chunk, make_instruction(OP_RETURN, 0));
-            }
-            // TODO: Add other opcodes as needed
-        }
-        
-        line = strtok_r(NULL, "\n", &line_saveptr);
-    }
-    
-    free(src_copy);
-}
-
-static void add_function_to_program(Program* program, const char* name, const char* func_src) {
-    if (program->function_count >= program->function_capacity) {
-        size_t old_capacity = program->function_capacity;
-        program->function_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
-        program->functions = realloc(program->functions, 
-            sizeof(FunctionDef) * program->function_capacity);
-    }
-    
-    FunctionDef* func_def = &program->functions[program->function_count];
-    strcpy(func_def->name, name);
-    
-    // Create chunk for function
-    func_def->chunk = malloc(sizeof(Chunk));
-    *func_def->chunk = assemble_chunk_from_string(func_src);
-    
-    // Create Function struct
-    func_def->function = malloc(sizeof(Function));
-    func_def->function->chunk = func_def->chunk;
-    
-    program->function_count++;
-}
-
-Program assemble_program_from_string(const char *src) {
-    Program program;
-    init_chunk(&program.main_chunk);
-    program.functions = NULL;
-    program.function_count = 0;
-    program.function_capacity = 0;
-    
-    char *src_copy = strdup(src);
-    char *main_code = malloc(strlen(src) + 1);
-    main_code[0] = '\0';
-    
-    char *line_saveptr;
-    char *line = strtok_r(src_copy, "\n", &line_saveptr);
-    
-    int in_function = 0;
-    char current_function_name[256];
-    char *function_code = NULL;
-    size_t function_code_size = 0;
-    size_t function_code_capacity = 0;
-    
-    while (line != NULL) {
-        char *trimmed_line = line;
-        while (isspace(*trimmed_line)) trimmed_line++;
-        
-        if (strncasecmp(trimmed_line, "FUNCTION ", 9) == 0) {
-            // Start of function definition
-            char *func_name = trimmed_line + 9;
-            while (isspace(*func_name)) func_name++;
-            strcpy(current_function_name, func_name);
-            
-            in_function = 1;
-            function_code_size = 0;
-        } else if (strcasecmp(trimmed_line, "ENDFUNCTION") == 0) {
-            // End of function definition
-            if (in_function && function_code) {
-                function_code[function_code_size] = '\0';
-                add_function_to_program(&program, current_function_name, function_code);
-            }
-            in_function = 0;
-        } else if (in_function) {
-            // Add line to function code
-            size_t line_len = strlen(line);
-            if (function_code_size + line_len + 2 > function_code_capacity) {
-                function_code_capacity = (function_code_size + line_len + 2) * 2;
-                function_code = realloc(function_code, function_code_capacity);
-            }
-            
-            if (function_code_size > 0) {
-                function_code[function_code_size++] = '\n';
-            }
-            strcpy(function_code + function_code_size, line);
-            function_code_size += line_len;
-        } else {
-            // Add line to main code
-            strcat(main_code, line);
-            strcat(main_code, "\n");
-        }
-        
-        line = strtok_r(NULL, "\n", &line_saveptr);
-    }
-    
-    // Process main code with custom assembler that knows about functions
-    if (strlen(main_code) > 0) {
-        assemble_main_with_functions(&program, main_code);
-    }
-    
-    free(src_copy);
-    free(main_code);
-    if (function_code) free(function_code);
-    
-    return program;
-}
-
 void free_program(Program* program) {
     free_chunk(&program->main_chunk);
-    
+
     for (size_t i = 0; i < program->function_count; i++) {
+        free(program->functions[i].name);
         free_chunk(program->functions[i].chunk);
         free(program->functions[i].chunk);
         free(program->functions[i].function);
     }
-    
+
     if (program->functions) {
         free(program->functions);
     }
-} 
\ No newline at end of file
+}
@@ -3,9 +3,10 @@
 
 #include "chunk.h"
 #include "value.h"
+#include "assembly_cache.h"
 
 typedef struct {
-    char name[256];
+    char* name;
     Chunk* chunk;
     Function* function;
 } FunctionDef;
@@ -15,12 +16,20 @@ typedef struct {
     FunctionDef* functions;
     size_t function_count;
     size_t function_capacity;
+    bool had_error;
 } Program;
 
 Chunk assemble_chunk_from_string(const char *src);
 Program assemble_program_from_string(const char *src);
+// Assembles FUNCTION bodies on thread_count threads (0 = one per CPU). The
+// result is identical to assemble_program_from_string.
+Program assemble_program_from_string_parallel(const char *src, int thread_count);
+// Like the parallel assembler, but FUNCTION bodies whose text is unchanged
+// are loaded from cache_dir instead of being assembled again. stats may be NULL.
+Program assemble_program_cached(const char *src, const char *cache_dir, int thread_count, CacheStats *stats);
 int assemble_chunk_from_file(const char* in_filename, const char* out_filename);
 int assemble_program_from_file(const char* in_filename, const char* out_filename);
+int assemble_program_from_file_parallel(const char* in_filename, const char* out_filename, int thread_count);
 void free_program(Program* program);
 
 #endif //KAPPAVM_ASSEMBLER_H 
\ No newline at end of file
@@ -0,0 +1,256 @@
+#include "assembly_cache.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define KAPPA_CACHE_MAGIC "KFC0"
+// Bump whenever the assembler output for a given body changes
+#define KAPPA_CACHE_VERSION 5
+
+static uint64_t hash_body(const char* body, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)body[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void entry_path(char* out, size_t size, const char* dir, const char* body, size_t length) {
+    snprintf(out, size, "%s/%016llx.kfc", dir, (unsigned long long)hash_body(body, length));
+}
+
+// mkdir -p
+static int ensure_dir(const char* dir) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s", dir) >= (int)sizeof(path)) return -1;
+    for (char* p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+const char* default_cache_dir(void) {
+    static char path[PATH_MAX];
+    const char* env = getenv("KAPPA_CACHE_DIR");
+    if (env && *env) return env;
+    env = getenv("XDG_CACHE_HOME");
+    if (env && *env) {
+        snprintf(path, sizeof(path), "%s/kappavm", env);
+        return path;
+    }
+    env = getenv("HOME");
+    if (env && *env) {
+        snprintf(path, sizeof(path), "%s/.cache/kappavm", env);
+        return path;
+    }
+    return ".kappa_cache";
+}
+
+int cache_store(const char* dir, const char* body, size_t length,
+                const Chunk* chunk, const FunctionRef* refs, size_t ref_count) {
+    if (ensure_dir(dir) != 0) return -1;
+    char path[PATH_MAX], tmp_path[PATH_MAX + 64];
+    entry_path(path, sizeof(path), dir, body, length);
+    // Write then rename so concurrent readers never see a partial entry
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%lu.tmp", path, (int)getpid(), (unsigned long)pthread_self());
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) return -1;
+
+    fwrite(KAPPA_CACHE_MAGIC, 1, 4, f);
+    uint32_t version = KAPPA_CACHE_VERSION;
+    fwrite(&version, sizeof(uint32_t), 1, f);
+    uint64_t body_length = length;
+    fwrite(&body_length, sizeof(uint64_t), 1, f);
+    fwrite(body, 1, length, f);
+
+    uint64_t counts[3] = {chunk->constants.count, chunk->code.count, ref_count};
+    fwrite(counts, sizeof(uint64_t), 3, f);
+    int res = 0;
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        uint8_t type = chunk->constants.values[i].type;
+        fwrite(&type, 1, 1, f);
+        if (type == VAL_NUMBER || type == VAL_DOUBLE) {
+            // Doubles are stored as their bits
+            int64_t num = chunk->constants.values[i].as.number;
+            fwrite(&num, sizeof(int64_t), 1, f);
+        } else if (type == VAL_STRING) {
+            const char* string = chunk->constants.values[i].as.string;
+            const uint64_t string_length = strlen(string);
+            fwrite(&string_length, sizeof(uint64_t), 1, f);
+            fwrite(string, 1, string_length, f);
+        } else if (type != VAL_FUNCTION) {
+            res = -2;
+        }
+    }
+    for (size_t i = 0; i < ref_count; i++) {
+        uint64_t header[3] = {refs[i].constant, refs[i].line, refs[i].length};
+        fwrite(header, sizeof(uint64_t), 3, f);
+        fwrite(refs[i].name, 1, refs[i].length, f);
+    }
+    fwrite(chunk->code.code, sizeof(Instruction), chunk->code.count, f);
+    uint64_t table_count = chunk->jump_tables.count;
+    fwrite(&table_count, sizeof(uint64_t), 1, f);
+    for (size_t i = 0; i < chunk->jump_tables.count; i++) {
+        const JumpTable* table = &chunk->jump_tables.tables[i];
+        uint64_t entry_count = table->count;
+        fwrite(&entry_count, sizeof(uint64_t), 1, f);
+        for (size_t e = 0; e < table->count; e++) {
+            uint64_t target = table->targets[e];
+            fwrite(&target, sizeof(uint64_t), 1, f);
+        }
+    }
+    uint64_t handler_count = chunk->handlers.count;
+    fwrite(&handler_count, sizeof(uint64_t), 1, f);
+    for (size_t i = 0; i < chunk->handlers.count; i++) {
+        const Handler* handler = &chunk->handlers.handlers[i];
+        const uint64_t fields[4] = {handler->start, handler->end, handler->target, (uint64_t)handler->depth};
+        fwrite(fields, sizeof(uint64_t), 4, f);
+    }
+
+    if (fclose(f) != 0) res = -1;
+    if (res == 0 && rename(tmp_path, path) != 0) res = -1;
+    if (res != 0) remove(tmp_path);
+    return res;
+}
+
+// Bounds-checked cursor over a loaded entry
+typedef struct {
+    const char* pos;
+    const char* end;
+} Cursor;
+
+static const void* take(Cursor* cursor, uint64_t count, size_t size) {
+    if (count > (uint64_t)(cursor->end - cursor->pos) / size) return NULL;
+    const void* ptr = cursor->pos;
+    cursor->pos += count * size;
+    return ptr;
+}
+
+static bool read_u64(Cursor* cursor, uint64_t* out) {
+    const void* ptr = take(cursor, 1, sizeof(uint64_t));
+    if (ptr) memcpy(out, ptr, sizeof(uint64_t));
+    return ptr != NULL;
+}
+
+static bool parse_entry(Cursor* cursor, const char* body, size_t length,
+                        Chunk* chunk, FunctionRef** refs, size_t* ref_count) {
+    const char* magic = take(cursor, 4, 1);
+    uint32_t version = 0;
+    const void* version_ptr = take(cursor, 1, sizeof(uint32_t));
+    if (!magic || !version_ptr || memcmp(magic, KAPPA_CACHE_MAGIC, 4) != 0) return false;
+    memcpy(&version, version_ptr, sizeof(uint32_t));
+    uint64_t body_length;
+    if (version != KAPPA_CACHE_VERSION || !read_u64(cursor, &body_length) || body_length != length) return false;
+    const char* cached_body = take(cursor, length, 1);
+    if (!cached_body || memcmp(cached_body, body, length) != 0) return false;
+
+    uint64_t const_count, code_count, count;
+    if (!read_u64(cursor, &const_count) || !read_u64(cursor, &code_count) || !read_u64(cursor, &count)) return false;
+    for (uint64_t i = 0; i < const_count; i++) {
+        const uint8_t* type = take(cursor, 1, 1);
+        if (!type) return false;
+        if (*type == VAL_NUMBER || *type == VAL_DOUBLE) {
+            uint64_t num;
+            if (!read_u64(cursor, &num)) return false;
+            add_constant(chunk, (Value){.type = (ValueType)*type, .as.number = (int64_t)num});
+        } else if (*type == VAL_STRING) {
+            uint64_t string_length;
+            if (!read_u64(cursor, &string_length)) return false;
+            const char* bytes = take(cursor, string_length, 1);
+            if (!bytes) return false;
+            char* string = malloc(string_length + 1);
+            memcpy(string, bytes, string_length);
+            string[string_length] = '\0';
+            add_constant(chunk, (Value){.type = VAL_STRING, .as.string = string});
+            free(string);
+        } else if (*type == VAL_FUNCTION) {
+            // Resolved by the assembler through refs
+            add_constant(chunk, (Value){.type = VAL_FUNCTION, .as.function = NULL});
+        } else {
+            return false;
+        }
+    }
+    *refs = malloc(sizeof(FunctionRef) * (count ? count : 1));
+    *ref_count = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t constant, line, name_length;
+        if (!read_u64(cursor, &constant) || !read_u64(cursor, &line) || !read_u64(cursor, &name_length)) return false;
+        const char* name = take(cursor, name_length, 1);
+        if (!name || constant >= const_count || chunk->constants.values[constant].type != VAL_FUNCTION) return false;
+        (*refs)[(*ref_count)++] = (FunctionRef){constant, name, name_length, line};
+    }
+    const Instruction* code = take(cursor, code_count, sizeof(Instruction));
+    if (!code) return false;
+    for (uint64_t i = 0; i < code_count; i++) {
+        Instruction inst;
+        memcpy(&inst, &code[i], sizeof(Instruction));
+        write_instruction(chunk, inst);
+    }
+    uint64_t table_count;
+    if (!read_u64(cursor, &table_count)) return false;
+    for (uint64_t i = 0; i < table_count; i++) {
+        uint64_t entry_count;
+        if (!read_u64(cursor, &entry_count) || entry_count > (uint64_t)(cursor->end - cursor->pos) / sizeof(uint64_t)) {
+            return false;
+        }
+        const size_t index = add_jump_table(chunk, entry_count);
+        JumpTable* table = &chunk->jump_tables.tables[index];
+        for (uint64_t e = 0; e < entry_count; e++) {
+            uint64_t target;
+            read_u64(cursor, &target);
+            table->targets[e] = target;
+        }
+    }
+    uint64_t handler_count;
+    if (!read_u64(cursor, &handler_count) ||
+        handler_count > (uint64_t)(cursor->end - cursor->pos) / (4 * sizeof(uint64_t))) {
+        return false;
+    }
+    for (uint64_t i = 0; i < handler_count; i++) {
+        uint64_t fields[4];
+        for (int f = 0; f < 4; f++) read_u64(cursor, &fields[f]);
+        add_handler(chunk, (Handler){fields[0], fields[1], fields[2], (int64_t)fields[3]});
+    }
+    return cursor->pos == cursor->end;
+}
+
+bool cache_load(const char* dir, const char* body, size_t length,
+                Chunk* chunk, FunctionRef** refs, size_t* ref_count, char** storage) {
+    char path[PATH_MAX];
+    entry_path(path, sizeof(path), dir, body, length);
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = size > 0 ? malloc(size) : NULL;
+    bool ok = data && fread(data, 1, size, f) == (size_t)size;
+    fclose(f);
+
+    *refs = NULL;
+    *ref_count = 0;
+    if (ok) {
+        Cursor cursor = {data, data + size};
+        ok = parse_entry(&cursor, body, length, chunk, refs, ref_count);
+    }
+    if (!ok) {
+        free_chunk(chunk);
+        free(*refs);
+        *refs = NULL;
+        *ref_count = 0;
+        free(data);
+        return false;
+    }
+    *storage = data;
+    return true;
+}
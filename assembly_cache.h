@@ -0,0 +1,33 @@
+#ifndef KAPPAVM_ASSEMBLY_CACHE_H
+#define KAPPAVM_ASSEMBLY_CACHE_H
+
+#include "common.h"
+#include "chunk.h"
+
+// On-disk cache of assembled FUNCTION bodies, addressed by a hash of the
+// body text. Entries also hold the full text, so a hash collision is a miss
+// rather than wrong code. References to other functions are stored by name
+// and resolved by the assembler against the current program.
+
+typedef struct {
+    size_t constant;  // index into the chunk's constant pool
+    const char* name;
+    size_t length;
+    size_t line;      // line within the body, for error reporting
+} FunctionRef;
+
+typedef struct {
+    size_t hits;
+    size_t misses;
+} CacheStats;
+
+// $KAPPA_CACHE_DIR, else $XDG_CACHE_HOME/kappavm, else ~/.cache/kappavm
+const char* default_cache_dir(void);
+// Fills chunk and refs on a hit. Names in refs point into *storage, which
+// the caller frees.
+bool cache_load(const char* dir, const char* body, size_t length,
+                Chunk* chunk, FunctionRef** refs, size_t* ref_count, char** storage);
+int cache_store(const char* dir, const char* body, size_t length,
+                const Chunk* chunk, const FunctionRef* refs, size_t ref_count);
+
+#endif //KAPPAVM_ASSEMBLY_CACHE_H
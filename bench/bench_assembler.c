@@ -0,0 +1,97 @@
+#include "../assembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures assembler throughput on generated programs of increasing size.
+// With a linear-time assembler the MB/s column should stay flat. The second
+// table assembles the largest program with the parallel assembler.
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+static void append(Buffer* buffer, const char* text) {
+    size_t length = strlen(text);
+    if (buffer->length + length + 1 > buffer->capacity) {
+        buffer->capacity = (buffer->length + length + 1) * 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->length, text, length + 1);
+    buffer->length += length;
+}
+
+// Emits functions until the source reaches target_bytes, then a main that calls all of them
+static char* generate_program(size_t target_bytes, size_t* function_count) {
+    Buffer buffer = {0};
+    char line[128];
+    size_t count = 0;
+    while (buffer.length < target_bytes) {
+        snprintf(line, sizeof(line), "FUNCTION fn_%zu\n", count);
+        append(&buffer, line);
+        for (int block = 0; block < 8; block++) {
+            snprintf(line, sizeof(line), "  CONSTANT %d\n  JMP_IF_FALSE skip_%d\n  CONSTANT %zu\n  ADD\nskip_%d:\n",
+                     block, block, count, block);
+            append(&buffer, line);
+        }
+        append(&buffer, "  RETURN\nENDFUNCTION\n");
+        count++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        snprintf(line, sizeof(line), "  CONSTANT fn_%zu\n  CONSTANT %zu\n  CALL 1\n", i, i);
+        append(&buffer, line);
+    }
+    append(&buffer, "  HALT\n");
+    *function_count = count;
+    return buffer.data;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    size_t max_mb = argc > 1 ? (size_t)atoi(argv[1]) : 16;
+    printf("%10s %10s %12s %10s\n", "size (MB)", "functions", "time (ms)", "MB/s");
+    for (size_t mb = 1; mb <= max_mb; mb *= 2) {
+        size_t function_count;
+        char* src = generate_program(mb << 20, &function_count);
+        double start = now_seconds();
+        Program program = assemble_program_from_string(src);
+        double elapsed = now_seconds() - start;
+        if (program.had_error || program.function_count != function_count) {
+            fprintf(stderr, "Assembly failed for %zu MB input\n", mb);
+            return 1;
+        }
+        double size_mb = strlen(src) / (double)(1 << 20);
+        printf("%10.2f %10zu %12.2f %10.1f\n", size_mb, function_count, elapsed * 1e3, size_mb / elapsed);
+        free_program(&program);
+        free(src);
+    }
+
+    size_t function_count;
+    char* src = generate_program(max_mb << 20, &function_count);
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    printf("\n%10s %12s %10s\n", "threads", "time (ms)", "speedup");
+    double serial_time = 0;
+    for (int threads = 1; threads <= cpus * 2; threads *= 2) {
+        double start = now_seconds();
+        Program program = assemble_program_from_string_parallel(src, threads);
+        double elapsed = now_seconds() - start;
+        if (program.had_error) {
+            fprintf(stderr, "Parallel assembly failed with %d threads\n", threads);
+            return 1;
+        }
+        if (threads == 1) serial_time = elapsed;
+        printf("%10d %12.2f %10.2f\n", threads, elapsed * 1e3, serial_time / elapsed);
+        free_program(&program);
+    }
+    free(src);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "../host.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Measures how many calls per second a host gets out of the embedding API:
+// warm calls through a Function* and by name on one long-lived VM, the same
+// spread over --threads threads that share the program, and, for
+// comparison, cold calls that load the program and set up a VM every time.
+// Without arguments it calls a small built-in function; otherwise it calls
+// the named function of a .kappa or .kbc file with integer arguments.
+
+static const char* USAGE =
+    "Usage: %s [--seconds <s>] [--threads <n>] [<program> <function> [<integer> ...]]\n";
+
+static const char* BUILTIN_SRC =
+    "FUNCTION add3\n"
+    "  GET_LOCAL 1\n"
+    "  GET_LOCAL 2\n"
+    "  ADD\n"
+    "  GET_LOCAL 3\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  HALT\n";
+
+#define MAX_ARGS 16
+
+typedef struct {
+    const char* path;       // NULL for the built-in program
+    const char* name;
+    Value args[MAX_ARGS];
+    size_t arg_count;
+    double seconds;
+} Options;
+
+typedef enum { CALL_FUNCTION, CALL_BY_NAME, CALL_COLD } Mode;
+
+typedef struct {
+    const Options* options;
+    const HostProgram* host;
+    Mode mode;
+    long calls;
+    int failed;
+} Worker;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load(HostProgram* host, const Options* options) {
+    return options->path ? host_load_file(host, options->path) : host_load_source(host, BUILTIN_SRC);
+}
+
+// Calls in batches until the time is up, checking the clock once per batch
+static void* run_worker(void* arg) {
+    Worker* worker = arg;
+    const Options* options = worker->options;
+    Function* function = host_find(worker->host, options->name);
+    VM vm;
+    vm_init(&vm);
+    const long batch = worker->mode == CALL_COLD ? 16 : 4096;
+    const double end = now_seconds() + options->seconds;
+    while (now_seconds() < end && !worker->failed) {
+        for (long i = 0; i < batch; i++) {
+            Value result;
+            VMResult status;
+            if (worker->mode == CALL_FUNCTION) {
+                status = vm_call(&vm, function, options->args, options->arg_count, &result);
+            } else if (worker->mode == CALL_BY_NAME) {
+                status = host_call(&vm, worker->host, options->name, options->args, options->arg_count, &result);
+            } else {
+                HostProgram host;
+                VM cold;
+                vm_init(&cold);
+                status = load(&host, options) == 0
+                             ? host_call(&cold, &host, options->name, options->args, options->arg_count, &result)
+                             : VM_RUNTIME_ERROR;
+                vm_free(&cold);
+                host_free(&host);
+            }
+            if (status != VM_OK) {
+                worker->failed = 1;
+                break;
+            }
+        }
+        worker->calls += batch;
+    }
+    vm_free(&vm);
+    return NULL;
+}
+
+static int measure(const char* label, Mode mode, int thread_count, const HostProgram* host, const Options* options) {
+    Worker workers[thread_count];
+    pthread_t threads[thread_count];
+    const double start = now_seconds();
+    for (int i = 0; i < thread_count; i++) {
+        workers[i] = (Worker){options, host, mode, 0, 0};
+        pthread_create(&threads[i], NULL, run_worker, &workers[i]);
+    }
+    long calls = 0;
+    int failed = 0;
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+        calls += workers[i].calls;
+        failed |= workers[i].failed;
+    }
+    const double elapsed = now_seconds() - start;
+    if (failed) {
+        fprintf(stderr, "%s: a call failed\n", label);
+        return -1;
+    }
+    printf("%-24s %8d %14.0f %10.1f\n", label, thread_count, calls / elapsed, elapsed * 1e9 / calls * thread_count);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Options options = {.name = "add3", .arg_count = 3, .seconds = 1};
+    for (size_t i = 0; i < 3; i++) options.args[i] = (Value){.type = VAL_NUMBER, .as.number = (int64_t)i + 1};
+    int thread_count = 4;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--seconds") == 0) options.seconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--threads") == 0) thread_count = atoi(argv[i + 1]);
+        else {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+    }
+    if (i < argc) {
+        if (argc - i < 2 || argc - i - 2 > MAX_ARGS) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+        options.path = argv[i];
+        options.name = argv[i + 1];
+        options.arg_count = (size_t)(argc - i - 2);
+        for (size_t a = 0; a < options.arg_count; a++) {
+            options.args[a] = (Value){.type = VAL_NUMBER, .as.number = strtoll(argv[i + 2 + (int)a], NULL, 10)};
+        }
+    }
+    if (options.seconds <= 0 || thread_count < 1 || thread_count > 256) {
+        fprintf(stderr, "--seconds must be positive and --threads between 1 and 256\n");
+        return 2;
+    }
+
+    HostProgram host;
+    if (load(&host, &options) != 0) return 2;
+    if (!host_find(&host, options.name)) {
+        fprintf(stderr, "No function named '%s'\n", options.name);
+        host_free(&host);
+        return 2;
+    }
+
+    printf("%-24s %8s %14s %10s\n", "mode", "threads", "calls/sec", "ns/call");
+    int status = 0;
+    status |= measure("warm Function*", CALL_FUNCTION, 1, &host, &options);
+    status |= measure("warm by name", CALL_BY_NAME, 1, &host, &options);
+    if (thread_count > 1) status |= measure("warm Function*", CALL_FUNCTION, thread_count, &host, &options);
+    status |= measure("cold load + VM", CALL_COLD, 1, &host, &options);
+    host_free(&host);
+    return status ? 1 : 0;
+}
@@ -0,0 +1,400 @@
+#include "../assembler.h"
+#include "../chunk.h"
+#include "../verifier.h"
+#include "../vm.h"
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Times each program of the benchmark corpus in three phases: assembling the
+// source, loading and verifying the bytecode, and running it. Each phase is
+// calibrated so that one repetition takes at least --min-time-ms, warmed up,
+// then repeated; the table reports nanoseconds per operation. --output writes
+// the same numbers as tab-separated values, and --baseline compares medians
+// against such a file and exits with status 1 if any phase got slower by more
+// than --threshold percent.
+
+#ifndef KAPPAVM_BENCH_CORPUS
+#define KAPPAVM_BENCH_CORPUS "bench/corpus"
+#endif
+
+#define MAX_REPS 1000
+#define RESULTS_HEADER "# benchmark\tphase\tmedian_ns\tmean_ns\tstddev_ns\tmin_ns\tmax_ns\treps"
+
+static const char* USAGE =
+    "Usage: %s [--reps <n>] [--warmup <n>] [--min-time-ms <ms>] [--iterations <n>]\n"
+    "          [--output <results.tsv>] [--baseline <results.tsv>] [--threshold <percent>]\n"
+    "          [program.kappa ...]\n";
+
+typedef struct {
+    int reps;
+    int warmup;
+    double min_time;      // seconds
+    long iterations;      // checkpoints a run may pass before it is stopped
+} Options;
+
+typedef enum { PHASE_ASSEMBLE, PHASE_LOAD, PHASE_RUN, PHASE_COUNT } Phase;
+
+static const char* PHASE_NAMES[PHASE_COUNT] = {"assemble", "load", "run"};
+
+typedef struct {
+    char name[64];
+    Phase phase;
+    double median, mean, stddev, min, max;   // nanoseconds per operation
+    int reps;
+} Result;
+
+typedef struct {
+    Result* items;
+    size_t count;
+    size_t capacity;
+} Results;
+
+typedef struct {
+    const char* source;
+    const char* bytecode_path;
+    Chunk* chunk;         // loaded and verified, for PHASE_RUN
+    long iterations;
+} Benchmark;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* read_file(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = malloc(size + 1);
+    size_t read = fread(data, 1, size, f);
+    fclose(f);
+    data[read] = '\0';
+    return data;
+}
+
+static int assemble_once(const Benchmark* benchmark) {
+    Program program = assemble_program_from_string(benchmark->source);
+    const int failed = program.had_error;
+    free_program(&program);
+    return failed ? -1 : 0;
+}
+
+static int load_once(const Benchmark* benchmark) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    int res = load_chunk(&chunk, benchmark->bytecode_path);
+    if (res == 0) res = verify_chunk(&chunk);
+    free_loaded_chunk(&chunk);
+    return res;
+}
+
+// Runs the program from the start until it halts or has passed iterations checkpoints
+static int run_once(const Benchmark* benchmark) {
+    VM vm;
+    vm_init(&vm);
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = benchmark->chunk;
+    frame->ip = benchmark->chunk->code.code;
+    frame->slots = vm.stack;
+    VMResult result;
+    long checkpoints = 0;
+    while ((result = vm_run(&vm)) == VM_CHECKPOINT && ++checkpoints < benchmark->iterations) {}
+    vm_free(&vm);
+    return result == VM_RUNTIME_ERROR ? -1 : 0;
+}
+
+static int run_phase(const Benchmark* benchmark, Phase phase, long count) {
+    for (long i = 0; i < count; i++) {
+        int res;
+        switch (phase) {
+            case PHASE_ASSEMBLE: res = assemble_once(benchmark); break;
+            case PHASE_LOAD: res = load_once(benchmark); break;
+            default: res = run_once(benchmark); break;
+        }
+        if (res != 0) return res;
+    }
+    return 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    const double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int measure(const Benchmark* benchmark, Phase phase, const Options* options, Result* result) {
+    // Double the operations per repetition until one repetition is long
+    // enough for the clock; this also serves as the first warm-up
+    long count = 1;
+    while (1) {
+        const double start = now_seconds();
+        if (run_phase(benchmark, phase, count) != 0) return -1;
+        if (now_seconds() - start >= options->min_time || count >= (1L << 30)) break;
+        count *= 2;
+    }
+    for (int i = 0; i < options->warmup; i++) {
+        if (run_phase(benchmark, phase, count) != 0) return -1;
+    }
+
+    double samples[MAX_REPS];
+    double sum = 0;
+    for (int i = 0; i < options->reps; i++) {
+        const double start = now_seconds();
+        if (run_phase(benchmark, phase, count) != 0) return -1;
+        samples[i] = (now_seconds() - start) * 1e9 / (double)count;
+        sum += samples[i];
+    }
+    qsort(samples, (size_t)options->reps, sizeof(double), compare_doubles);
+    const int n = options->reps;
+    result->phase = phase;
+    result->reps = n;
+    result->min = samples[0];
+    result->max = samples[n - 1];
+    result->median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    result->mean = sum / n;
+    double squares = 0;
+    for (int i = 0; i < n; i++) squares += (samples[i] - result->mean) * (samples[i] - result->mean);
+    result->stddev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+    return 0;
+}
+
+static void add_result(Results* results, Result result) {
+    if (results->count == results->capacity) {
+        results->capacity = results->capacity < 8 ? 8 : results->capacity * 2;
+        results->items = realloc(results->items, sizeof(Result) * results->capacity);
+    }
+    results->items[results->count++] = result;
+}
+
+// The file name without its directory and extension
+static void benchmark_name(const char* path, char* name, size_t size) {
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t length = strcspn(base, ".");
+    if (length >= size) length = size - 1;
+    memcpy(name, base, length);
+    name[length] = '\0';
+}
+
+static int bench_file(const char* path, const Options* options, Results* results) {
+    char* source = read_file(path);
+    if (!source) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        return -1;
+    }
+    Program program = assemble_program_from_string(source);
+    if (program.had_error) {
+        fprintf(stderr, "Failed to assemble %s\n", path);
+        free_program(&program);
+        free(source);
+        return -1;
+    }
+    char bytecode_path[] = "/tmp/kappavm_bench_XXXXXX";
+    const int fd = mkstemp(bytecode_path);
+    if (fd < 0 || save_chunk(&program.main_chunk, bytecode_path) != 0) {
+        fprintf(stderr, "Failed to write bytecode for %s\n", path);
+        if (fd >= 0) close(fd);
+        free_program(&program);
+        free(source);
+        return -1;
+    }
+    close(fd);
+    free_program(&program);
+
+    Chunk chunk;
+    init_chunk(&chunk);
+    Benchmark benchmark = {source, bytecode_path, &chunk, options->iterations};
+    int status = load_once(&benchmark) == 0 && load_chunk(&chunk, bytecode_path) == 0 && verify_chunk(&chunk) == 0
+                     ? 0 : -1;
+    if (status != 0) fprintf(stderr, "Failed to load %s\n", path);
+
+    Result result = {0};
+    benchmark_name(path, result.name, sizeof(result.name));
+    for (int phase = 0; phase < PHASE_COUNT && status == 0; phase++) {
+        if (measure(&benchmark, (Phase)phase, options, &result) != 0) {
+            fprintf(stderr, "%s failed during %s\n", path, PHASE_NAMES[phase]);
+            status = -1;
+            break;
+        }
+        printf("%-20s %-9s %12.1f %12.1f %10.1f %12.1f %12.1f\n", result.name, PHASE_NAMES[phase],
+               result.median, result.mean, result.stddev, result.min, result.max);
+        fflush(stdout);
+        add_result(results, result);
+    }
+    free_loaded_chunk(&chunk);
+    unlink(bytecode_path);
+    free(source);
+    return status;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// The .kappa files in directory, sorted by name
+static char** list_corpus(const char* directory, size_t* count) {
+    *count = 0;
+    DIR* dir = opendir(directory);
+    if (!dir) return NULL;
+    size_t capacity = 8;
+    char** paths = malloc(sizeof(char*) * capacity);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const size_t length = strlen(entry->d_name);
+        if (length < 7 || strcmp(entry->d_name + length - 6, ".kappa") != 0) continue;
+        if (*count == capacity) {
+            capacity *= 2;
+            paths = realloc(paths, sizeof(char*) * capacity);
+        }
+        char* path = malloc(strlen(directory) + length + 2);
+        sprintf(path, "%s/%s", directory, entry->d_name);
+        paths[(*count)++] = path;
+    }
+    closedir(dir);
+    qsort(paths, *count, sizeof(char*), compare_paths);
+    return paths;
+}
+
+static int write_results(const Results* results, const char* filename) {
+    FILE* out = fopen(filename, "w");
+    if (!out) return -1;
+    fprintf(out, "%s\n", RESULTS_HEADER);
+    for (size_t i = 0; i < results->count; i++) {
+        const Result* r = &results->items[i];
+        fprintf(out, "%s\t%s\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%d\n", r->name, PHASE_NAMES[r->phase],
+                r->median, r->mean, r->stddev, r->min, r->max, r->reps);
+    }
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+static int read_results(Results* results, const char* filename) {
+    FILE* in = fopen(filename, "r");
+    if (!in) return -1;
+    char line[256];
+    while (fgets(line, sizeof(line), in)) {
+        if (line[0] == '#') continue;
+        Result r = {0};
+        char phase[16];
+        if (sscanf(line, "%63[^\t]\t%15[^\t]\t%lf\t%lf\t%lf\t%lf\t%lf\t%d", r.name, phase,
+                   &r.median, &r.mean, &r.stddev, &r.min, &r.max, &r.reps) != 8) {
+            continue;
+        }
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            if (strcmp(phase, PHASE_NAMES[p]) == 0) {
+                r.phase = (Phase)p;
+                add_result(results, r);
+            }
+        }
+    }
+    fclose(in);
+    return 0;
+}
+
+// Prints the change in median for every benchmark in both sets and returns
+// the number that slowed down by more than threshold percent
+static int compare_results(const Results* current, const Results* baseline, double threshold) {
+    int regressions = 0;
+    printf("\n%-20s %-9s %12s %12s %9s\n", "benchmark", "phase", "baseline", "current", "change");
+    for (size_t i = 0; i < current->count; i++) {
+        const Result* now = &current->items[i];
+        for (size_t j = 0; j < baseline->count; j++) {
+            const Result* before = &baseline->items[j];
+            if (before->phase != now->phase || strcmp(before->name, now->name) != 0) continue;
+            const double change = before->median > 0 ? (now->median / before->median - 1) * 100 : 0;
+            const bool regressed = change > threshold;
+            regressions += regressed;
+            printf("%-20s %-9s %12.1f %12.1f %+8.1f%%%s\n", now->name, PHASE_NAMES[now->phase],
+                   before->median, now->median, change, regressed ? "  REGRESSION" : "");
+            break;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    Options options = {.reps = 10, .warmup = 3, .min_time = 0.01, .iterations = 10000};
+    const char* output = NULL;
+    const char* baseline = NULL;
+    double threshold = 10;
+    int first_file = argc;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            first_file = i;
+            break;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(argv[i - 1], "--reps") == 0) options.reps = atoi(value);
+        else if (strcmp(argv[i - 1], "--warmup") == 0) options.warmup = atoi(value);
+        else if (strcmp(argv[i - 1], "--min-time-ms") == 0) options.min_time = atof(value) / 1e3;
+        else if (strcmp(argv[i - 1], "--iterations") == 0) options.iterations = atol(value);
+        else if (strcmp(argv[i - 1], "--output") == 0) output = value;
+        else if (strcmp(argv[i - 1], "--baseline") == 0) baseline = value;
+        else if (strcmp(argv[i - 1], "--threshold") == 0) threshold = atof(value);
+        else {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+    }
+    if (options.reps < 1 || options.reps > MAX_REPS || options.warmup < 0 || options.iterations < 1) {
+        fprintf(stderr, "--reps must be between 1 and %d; --warmup and --iterations must not be negative\n",
+                MAX_REPS);
+        return 2;
+    }
+
+    size_t file_count;
+    char** files;
+    if (first_file < argc) {
+        file_count = (size_t)(argc - first_file);
+        files = malloc(sizeof(char*) * file_count);
+        for (size_t i = 0; i < file_count; i++) files[i] = strdup(argv[first_file + i]);
+    } else {
+        files = list_corpus(KAPPAVM_BENCH_CORPUS, &file_count);
+        if (file_count == 0) {
+            fprintf(stderr, "No .kappa files in %s\n", KAPPAVM_BENCH_CORPUS);
+            free(files);
+            return 2;
+        }
+    }
+
+    printf("%-20s %-9s %12s %12s %10s %12s %12s\n", "benchmark", "phase", "median (ns)", "mean (ns)",
+           "stddev", "min (ns)", "max (ns)");
+    Results results = {0};
+    int status = 0;
+    for (size_t i = 0; i < file_count; i++) {
+        if (bench_file(files[i], &options, &results) != 0) status = 2;
+        free(files[i]);
+    }
+    free(files);
+
+    if (output && write_results(&results, output) != 0) {
+        fprintf(stderr, "Failed to write results: %s\n", output);
+        status = 2;
+    }
+    if (baseline) {
+        Results previous = {0};
+        if (read_results(&previous, baseline) != 0) {
+            fprintf(stderr, "Failed to read baseline: %s\n", baseline);
+            status = 2;
+        } else {
+            const int regressions = compare_results(&results, &previous, threshold);
+            if (regressions > 0) {
+                printf("%d regression%s over %.1f%%\n", regressions, regressions == 1 ? "" : "s", threshold);
+                if (status == 0) status = 1;
+            }
+        }
+        free(previous.items);
+    }
+    free(results.items);
+    return status;
+}
@@ -0,0 +1,82 @@
+#include "../list.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Compares lists of integers in packed int64_t storage against the same
+// lists in generic Value storage, the way every list used to be kept: the
+// memory each takes, and the time to fill it with list_push and to sum it
+// with list_get. Past the cache sizes the sum streams from memory, where
+// the packed list has half as many bytes to read.
+
+static const char* USAGE = "Usage: %s [--max-length <n>]\n";
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile int64_t sink;
+
+// Nanoseconds per element to fill list with length integers
+static double time_fill(List* list, size_t length, bool generic) {
+    const double start = now_seconds();
+    if (generic) {
+        // Converts the empty list and then stores integers as usual
+        list_push(list, (Value){.type = VAL_NULL});
+        list_set(list, 0, (Value){.type = VAL_NUMBER, .as.number = 0});
+    }
+    for (size_t i = list->length; i < length; i++) {
+        list_push(list, (Value){.type = VAL_NUMBER, .as.number = (int64_t)i});
+    }
+    return (now_seconds() - start) * 1e9 / length;
+}
+
+// Nanoseconds per element to sum the list rounds times over
+static double time_sum(const List* list, size_t rounds) {
+    int64_t sum = 0;
+    const double start = now_seconds();
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < list->length; i++) sum += list_get(list, i).as.number;
+    }
+    const double elapsed = now_seconds() - start;
+    sink = sum;
+    return elapsed * 1e9 / ((double)rounds * list->length);
+}
+
+int main(int argc, char** argv) {
+    size_t max_length = 1 << 24;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 < argc && strcmp(argv[i], "--max-length") == 0) {
+            max_length = (size_t)atol(argv[i + 1]);
+        } else {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+    }
+    if (max_length == 0) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 2;
+    }
+
+    printf("%10s %12s %12s %10s %10s %10s %10s\n", "length", "packed KiB", "generic KiB", "fill ns", "generic",
+           "sum ns", "generic");
+    for (size_t length = 1024; length <= max_length; length *= 4) {
+        List packed, generic;
+        init_list(&packed);
+        init_list(&generic);
+        const double fill = time_fill(&packed, length, false);
+        const double generic_fill = time_fill(&generic, length, true);
+        // Around 64M elements summed per measurement
+        const size_t rounds = length < (1 << 26) ? (1 << 26) / length : 1;
+        const double sum = time_sum(&packed, rounds);
+        const double generic_sum = time_sum(&generic, rounds);
+        printf("%10zu %12zu %12zu %10.2f %10.2f %10.2f %10.2f\n", length, list_bytes(&packed) / 1024,
+               list_bytes(&generic) / 1024, fill, generic_fill, sum, generic_sum);
+        free_list(&packed);
+        free_list(&generic);
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "../object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Measures property lookup latency across object sizes, for keys that are
+// present and keys that are not, against the parallel key and value arrays
+// objects used to be: a strcmp against every key until one matches. Objects
+// up to OBJECT_SMALL_MAX properties are searched linearly here too, larger
+// ones go through the Swiss table.
+
+static const char* USAGE = "Usage: %s [--max-size <n>]\n";
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    size_t count;
+    char** keys;
+    Value* values;
+} LinearObject;
+
+// Kept out of line, as object_get is in its own translation unit
+static __attribute__((noinline)) bool linear_get(const LinearObject* object, const char* key, Value* value) {
+    for (size_t i = 0; i < object->count; i++) {
+        if (strcmp(object->keys[i], key) == 0) {
+            *value = object->values[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static char** make_keys(const char* prefix, size_t count) {
+    char** keys = malloc(sizeof(char*) * count);
+    char name[64];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "%s_%zu", prefix, i);
+        keys[i] = strdup(name);
+    }
+    // Shuffled so the lookups do not walk the keys in insertion order
+    srand(42);
+    for (size_t i = count; i > 1; i--) {
+        const size_t j = (size_t)rand() % i;
+        char* key = keys[i - 1];
+        keys[i - 1] = keys[j];
+        keys[j] = key;
+    }
+    return keys;
+}
+
+// Nanoseconds per lookup, looking up keys round robin; sink keeps the
+// compiler from dropping the lookups
+static volatile int64_t sink;
+
+static double time_object(const Object* object, char** keys, const size_t* lengths, size_t count, size_t lookups) {
+    int64_t found = 0;
+    const double start = now_seconds();
+    for (size_t i = 0; i < lookups; i++) {
+        const size_t k = i % count;
+        Value value;
+        if (object_get(object, keys[k], lengths[k], &value)) found += value.as.number;
+    }
+    const double elapsed = now_seconds() - start;
+    sink = found;
+    return elapsed * 1e9 / lookups;
+}
+
+static double time_linear(const LinearObject* object, char** keys, size_t count, size_t lookups) {
+    int64_t found = 0;
+    const double start = now_seconds();
+    for (size_t i = 0; i < lookups; i++) {
+        Value value;
+        if (linear_get(object, keys[i % count], &value)) found += value.as.number;
+    }
+    const double elapsed = now_seconds() - start;
+    sink = found;
+    return elapsed * 1e9 / lookups;
+}
+
+int main(int argc, char** argv) {
+    size_t max_size = 4096;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 < argc && strcmp(argv[i], "--max-size") == 0) {
+            max_size = (size_t)atol(argv[i + 1]);
+        } else {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+    }
+    if (max_size == 0) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 2;
+    }
+
+    printf("%8s %12s %12s %12s %12s\n", "size", "hit ns", "linear hit", "miss ns", "linear miss");
+    for (size_t size = 1; size <= max_size; size *= 2) {
+        char** keys = make_keys("key", size);
+        char** misses = make_keys("miss", size);
+        size_t* lengths = malloc(sizeof(size_t) * size);
+        size_t* miss_lengths = malloc(sizeof(size_t) * size);
+        Object object;
+        init_object(&object);
+        LinearObject linear = {size, malloc(sizeof(char*) * size), malloc(sizeof(Value) * size)};
+        for (size_t i = 0; i < size; i++) {
+            lengths[i] = strlen(keys[i]);
+            miss_lengths[i] = strlen(misses[i]);
+            const Value value = {.type = VAL_NUMBER, .as.number = (int64_t)i};
+            object_set(&object, keys[i], lengths[i], value);
+            linear.keys[i] = keys[i];
+            linear.values[i] = value;
+        }
+
+        // Enough lookups for a stable figure without the linear search
+        // taking minutes at the large sizes
+        const size_t lookups = size <= 64 ? 4000000 : 256000000 / size;
+        const size_t fast_lookups = 4000000;
+        const double hit = time_object(&object, keys, lengths, size, fast_lookups);
+        const double linear_hit = time_linear(&linear, keys, size, lookups);
+        const double miss = time_object(&object, misses, miss_lengths, size, fast_lookups);
+        const double linear_miss = time_linear(&linear, misses, size, lookups);
+        printf("%8zu %12.1f %12.1f %12.1f %12.1f\n", size, hit, linear_hit, miss, linear_miss);
+
+        free_object(&object);
+        free(linear.keys);
+        free(linear.values);
+        for (size_t i = 0; i < size; i++) {
+            free(keys[i]);
+            free(misses[i]);
+        }
+        free(keys);
+        free(misses);
+        free(lengths);
+        free(miss_lengths);
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Load generator for kappavm --serve. Each of --connections threads opens
+// its own connection and keeps --pipeline requests in flight until it has
+// had --requests answers, then the throughput and the latency percentiles
+// over all requests are printed. A request counts as failed unless its
+// response starts with "OK".
+
+static const char* USAGE =
+    "Usage: %s [--connections <n>] [--requests <n>] [--pipeline <n>] <socket> <function> [<integer> ...]\n";
+
+typedef struct {
+    const char* socket_path;
+    const char* request;        // the request line, newline included
+    size_t request_length;
+    long requests;              // per connection
+    int pipeline;
+} Options;
+
+typedef struct {
+    const Options* options;
+    double* latencies;          // seconds, one per request
+    long received;
+    long failed;
+    int error;
+} Client;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(const char* path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, path);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_request(int fd, const Options* options) {
+    const char* data = options->request;
+    size_t length = options->request_length;
+    while (length > 0) {
+        const ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+static void* run_client(void* arg) {
+    Client* client = arg;
+    const Options* options = client->options;
+    const int fd = connect_to(options->socket_path);
+    if (fd < 0) {
+        client->error = errno ? errno : EINVAL;
+        return NULL;
+    }
+    // Responses come back in order, so the send time of request i is kept
+    // in slot i % pipeline until its response arrives
+    double* sent_at = malloc(sizeof(double) * (size_t)options->pipeline);
+    long sent = 0;
+    while (sent < options->requests && sent < options->pipeline) {
+        sent_at[sent % options->pipeline] = now_seconds();
+        if (!send_request(fd, options)) client->error = errno;
+        sent++;
+    }
+    char buffer[65536];
+    size_t length = 0;
+    while (client->received < options->requests && !client->error) {
+        const ssize_t n = read(fd, buffer + length, sizeof(buffer) - length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            client->error = n < 0 ? errno : ECONNRESET;
+            break;
+        }
+        length += (size_t)n;
+        size_t start = 0;
+        for (char* newline; (newline = memchr(buffer + start, '\n', length - start)) != NULL;) {
+            const double now = now_seconds();
+            if (strncmp(buffer + start, "OK", 2) != 0) client->failed++;
+            client->latencies[client->received] = now - sent_at[client->received % options->pipeline];
+            client->received++;
+            start = (size_t)(newline - buffer) + 1;
+            if (sent < options->requests) {
+                sent_at[sent % options->pipeline] = now_seconds();
+                if (!send_request(fd, options)) client->error = errno;
+                sent++;
+            }
+        }
+        length -= start;
+        memmove(buffer, buffer + start, length);
+    }
+    free(sent_at);
+    close(fd);
+    return NULL;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    const double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double* sorted, size_t count, double p) {
+    if (count == 0) return 0;
+    size_t index = (size_t)(p / 100 * (double)count);
+    if (index >= count) index = count - 1;
+    return sorted[index];
+}
+
+int main(int argc, char** argv) {
+    Options options = {.requests = 100000, .pipeline = 1};
+    int connection_count = 4;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--connections") == 0) connection_count = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--requests") == 0) options.requests = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "--pipeline") == 0) options.pipeline = atoi(argv[i + 1]);
+        else {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+    }
+    if (argc - i < 2 || connection_count < 1 || connection_count > 1024 || options.requests < 1 ||
+        options.pipeline < 1) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 2;
+    }
+    options.socket_path = argv[i];
+    char request[1024];
+    size_t length = 0;
+    for (int a = i + 1; a < argc; a++) {
+        const int written = snprintf(request + length, sizeof(request) - length, "%s%s", argv[a],
+                                     a + 1 < argc ? " " : "\n");
+        if (written < 0 || (size_t)written >= sizeof(request) - length) {
+            fprintf(stderr, "Request too long\n");
+            return 2;
+        }
+        length += (size_t)written;
+    }
+    options.request = request;
+    options.request_length = length;
+
+    Client* clients = calloc((size_t)connection_count, sizeof(Client));
+    pthread_t* threads = malloc(sizeof(pthread_t) * (size_t)connection_count);
+    const double start = now_seconds();
+    for (int c = 0; c < connection_count; c++) {
+        clients[c].options = &options;
+        clients[c].latencies = malloc(sizeof(double) * (size_t)options.requests);
+        pthread_create(&threads[c], NULL, run_client, &clients[c]);
+    }
+    long received = 0, failed = 0;
+    int status = 0;
+    for (int c = 0; c < connection_count; c++) {
+        pthread_join(threads[c], NULL);
+        received += clients[c].received;
+        failed += clients[c].failed;
+        if (clients[c].error) {
+            fprintf(stderr, "connection %d: %s\n", c, strerror(clients[c].error));
+            status = 1;
+        }
+    }
+    const double elapsed = now_seconds() - start;
+
+    double* latencies = malloc(sizeof(double) * (size_t)(received ? received : 1));
+    size_t count = 0;
+    for (int c = 0; c < connection_count; c++) {
+        memcpy(latencies + count, clients[c].latencies, sizeof(double) * (size_t)clients[c].received);
+        count += (size_t)clients[c].received;
+        free(clients[c].latencies);
+    }
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    printf("%ld requests over %d connections (pipeline %d) in %.3f s: %.0f requests/sec, %ld failed\n",
+           received, connection_count, options.pipeline, elapsed, received / elapsed, failed);
+    printf("latency (us): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", percentile(latencies, count, 50) * 1e6,
+           percentile(latencies, count, 90) * 1e6, percentile(latencies, count, 99) * 1e6,
+           count ? latencies[count - 1] * 1e6 : 0);
+    free(latencies);
+    free(clients);
+    free(threads);
+    return failed ? 1 : status;
+}
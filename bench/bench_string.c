@@ -0,0 +1,109 @@
+#include "../string_value.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Measures the string paths against what bare char* strings cost: building
+// a string by appending pieces with a builder against concatenating into a
+// fresh allocation each time, and taking substrings as slices against
+// copying them out.
+
+static const char* USAGE = "Usage: %s [--max-pieces <n>]\n";
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile size_t sink;
+
+static const char PIECE[] = "piece-of-text ";
+#define PIECE_LENGTH (sizeof(PIECE) - 1)
+
+// Seconds to build pieces pieces with a builder
+static double time_builder(size_t pieces) {
+    const double start = now_seconds();
+    StringBuilder builder;
+    init_builder(&builder);
+    for (size_t i = 0; i < pieces; i++) builder_append(&builder, PIECE, PIECE_LENGTH);
+    sink = builder.length;
+    free_builder(&builder);
+    return now_seconds() - start;
+}
+
+// The same, each step allocating the concatenation and freeing the old string
+static double time_concat(size_t pieces) {
+    const double start = now_seconds();
+    char* string = calloc(1, 1);
+    size_t length = 0;
+    for (size_t i = 0; i < pieces; i++) {
+        char* longer = malloc(length + PIECE_LENGTH + 1);
+        memcpy(longer, string, length);
+        memcpy(longer + length, PIECE, PIECE_LENGTH + 1);
+        free(string);
+        string = longer;
+        length += PIECE_LENGTH;
+    }
+    sink = length;
+    free(string);
+    return now_seconds() - start;
+}
+
+// Nanoseconds per substring of width bytes, as a slice or as a copy
+static double time_substrings(const char* text, size_t length, size_t width, bool copy, size_t count) {
+    const Value string = {.type = VAL_STRING, .as.string = (char*)text};
+    size_t total = 0;
+    const double start = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        const size_t from = (i * 7) % (length - width);
+        if (copy) {
+            char* part = malloc(width + 1);
+            memcpy(part, text + from, width);
+            part[width] = '\0';
+            total += (unsigned char)part[width / 2];
+            free(part);
+        } else {
+            const Value part = string_slice(&string, from, from + width);
+            size_t part_length;
+            total += (unsigned char)string_chars(&part, &part_length)[width / 2];
+        }
+    }
+    const double elapsed = now_seconds() - start;
+    sink = total;
+    return elapsed * 1e9 / count;
+}
+
+int main(int argc, char** argv) {
+    size_t max_pieces = 16384;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 < argc && strcmp(argv[i], "--max-pieces") == 0) {
+            max_pieces = (size_t)atol(argv[i + 1]);
+        } else {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+    }
+    if (max_pieces == 0) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 2;
+    }
+
+    printf("%10s %14s %14s\n", "pieces", "builder ms", "concat ms");
+    for (size_t pieces = 256; pieces <= max_pieces; pieces *= 4) {
+        printf("%10zu %14.3f %14.3f\n", pieces, time_builder(pieces) * 1e3, time_concat(pieces) * 1e3);
+    }
+
+    const size_t length = 1 << 16;
+    char* text = malloc(length + 1);
+    for (size_t i = 0; i < length; i++) text[i] = (char)('a' + i % 26);
+    text[length] = '\0';
+    printf("\n%10s %14s %14s\n", "width", "slice ns", "copy ns");
+    for (size_t width = 4; width <= 4096; width *= 4) {
+        printf("%10zu %14.1f %14.1f\n", width, time_substrings(text, length, width, false, 4000000),
+               time_substrings(text, length, width, true, 4000000));
+    }
+    free(text);
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include "../zygote.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures what the prefork zygote costs and delivers: how long loading
+// takes once in the parent, how long each worker takes to start, how much
+// memory each worker has to itself once it has served requests, the job
+// throughput with one request in flight per worker, and how long replacing
+// a dead worker takes. Without arguments it calls a small built-in
+// function; otherwise it calls the named function of a .kappa or .kbc file.
+// Memory comes from /proc/<pid>/smaps_rollup, so it is reported on Linux
+// only.
+
+static const char* USAGE = "Usage: %s [--seconds <s>] [--workers <n>] [<program> <function> [<integer> ...]]\n";
+
+static const char* BUILTIN_SRC =
+    "FUNCTION add3\n"
+    "  GET_LOCAL 1\n"
+    "  GET_LOCAL 2\n"
+    "  ADD\n"
+    "  GET_LOCAL 3\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  HALT\n";
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The kB value of field in pid's smaps_rollup, or -1
+static long smaps_kb(pid_t pid, const char* field) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    char line[256];
+    long value = -1;
+    const size_t length = strlen(field);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, length) == 0 && line[length] == ':') {
+            value = strtol(line + length + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+int main(int argc, char** argv) {
+    double seconds = 1;
+    int worker_count = 4;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--seconds") == 0) seconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--workers") == 0) worker_count = atoi(argv[i + 1]);
+        else {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+    }
+    if (seconds <= 0 || worker_count < 1 || worker_count > 256 || (i < argc && argc - i < 2)) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 2;
+    }
+    char request[1024] = "add3 1 2 3";
+    if (i < argc) {
+        size_t length = 0;
+        for (int a = i + 1; a < argc && length < sizeof(request); a++) {
+            length += (size_t)snprintf(request + length, sizeof(request) - length, a > i + 1 ? " %s" : "%s",
+                                       argv[a]);
+        }
+        if (length >= sizeof(request)) {
+            fprintf(stderr, "Request too long\n");
+            return 2;
+        }
+    }
+
+    HostProgram host;
+    double start = now_seconds();
+    if ((i < argc ? host_load_file(&host, argv[i]) : host_load_source(&host, BUILTIN_SRC)) != 0) return 2;
+    const double load_time = now_seconds() - start;
+
+    Zygote zygote;
+    start = now_seconds();
+    if (zygote_start(&zygote, &host, 1, worker_count) != 0) {
+        host_free(&host);
+        return 2;
+    }
+    const double start_time = now_seconds() - start;
+    printf("load and verify once: %.1f us\n", load_time * 1e6);
+    printf("start %d workers:     %.1f us (%.1f us each)\n", worker_count, start_time * 1e6,
+           start_time * 1e6 / worker_count);
+
+    char response[HOST_MAX_LINE + 16];
+    long jobs = 0, failed = 0;
+    start = now_seconds();
+    const double end = start + seconds;
+    while (now_seconds() < end) {
+        for (int batch = 0; batch < 256; batch++) {
+            for (int w = 0; w < worker_count; w++) zygote_submit(&zygote, w, request);
+            for (int w = 0; w < worker_count; w++) {
+                zygote_collect(&zygote, w, response, sizeof(response));
+                failed += strncmp(response, "OK", 2) != 0;
+            }
+            jobs += worker_count;
+        }
+    }
+    const double elapsed = now_seconds() - start;
+    printf("%ld jobs in %.3f s: %.0f jobs/sec, %ld failed, last response %s", jobs, elapsed, jobs / elapsed,
+           failed, response);
+
+    // Private memory is what a worker does not share with the parent or
+    // the other workers; Pss splits the shared pages between their users
+    long private_kb = 0, pss_kb = 0, rss_kb = 0;
+    bool have_memory = true;
+    for (int w = 0; w < worker_count && have_memory; w++) {
+        const pid_t pid = zygote.workers[w].pid;
+        const long dirty = smaps_kb(pid, "Private_Dirty"), clean = smaps_kb(pid, "Private_Clean");
+        const long pss = smaps_kb(pid, "Pss"), rss = smaps_kb(pid, "Rss");
+        have_memory = dirty >= 0 && clean >= 0 && pss >= 0 && rss >= 0;
+        private_kb += dirty + clean;
+        pss_kb += pss;
+        rss_kb += rss;
+    }
+    if (have_memory) {
+        printf("per worker: %ld kB private, %ld kB pss, %ld kB rss; parent %ld kB rss\n",
+               private_kb / worker_count, pss_kb / worker_count, rss_kb / worker_count,
+               smaps_kb(getpid(), "Rss"));
+    }
+
+    start = now_seconds();
+    kill(zygote.workers[0].pid, SIGKILL);
+    zygote_submit(&zygote, 0, request);
+    zygote_collect(&zygote, 0, response, sizeof(response));
+    zygote_submit(&zygote, 0, request);
+    zygote_collect(&zygote, 0, response, sizeof(response));
+    printf("replace a dead worker and answer: %.1f us, %s", (now_seconds() - start) * 1e6, response);
+    failed += strncmp(response, "OK", 2) != 0;
+
+    zygote_stop(&zygote);
+    host_free(&host);
+    return failed ? 1 : 0;
+}
@@ -1,10 +1,22 @@
 #include "chunk.h"
+#include "numeric.h"
+#include "table.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 #define KAPPA_MAGIC "KBC0"
-#define KAPPA_VERSION 1
+// Version 2 stores a name before each function constant's chunk, version 3
+// adds jump tables after each chunk's code, version 4 a local count after
+// each function name, version 5 double constants, version 6 exception
+// handlers after the jump tables and version 7 string constants. Up to
+// version 7 each function constant is followed by its chunk, nested, so a
+// function referred to from several places is written several times and a
+// recursive one cannot be written at all. Version 8 writes every function
+// once, in a table ahead of the main chunk, and function constants hold
+// their index in it. Older files still load.
+#define KAPPA_VERSION 8
+#define KAPPA_MIN_VERSION 1
 
 void init_chunk(Chunk* chunk) {
     chunk->code.count = 0;
@@ -13,11 +25,26 @@ void init_chunk(Chunk* chunk) {
     chunk->constants.count = 0;
     chunk->constants.capacity = 0;
     chunk->constants.values = NULL;
+    chunk->jump_tables.count = 0;
+    chunk->jump_tables.capacity = 0;
+    chunk->jump_tables.tables = NULL;
+    chunk->handlers.count = 0;
+    chunk->handlers.capacity = 0;
+    chunk->handlers.handlers = NULL;
+    chunk->verified = false;
+    chunk->stack_needed = 0;
+    chunk->max_stack = 0;
 }
 
 void free_chunk(Chunk* chunk) {
     free(chunk->code.code);
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        if (chunk->constants.values[i].type == VAL_STRING) free(chunk->constants.values[i].as.string);
+    }
     free(chunk->constants.values);
+    for (size_t i = 0; i < chunk->jump_tables.count; i++) free(chunk->jump_tables.tables[i].targets);
+    free(chunk->jump_tables.tables);
+    free(chunk->handlers.handlers);
     init_chunk(chunk);
 }
 
@@ -28,10 +55,41 @@ size_t add_constant(Chunk* chunk, Value value) {
         chunk->constants.values = realloc(chunk->constants.values, sizeof(Value) * chunk->constants.capacity);
     }
 
+    // Each chunk keeps its own copy of a string, so constants can be copied
+    // from chunk to chunk without either worrying about the other's lifetime
+    if (value.type == VAL_STRING) value.as.string = strdup(value.as.string);
     chunk->constants.values[chunk->constants.count] = value;
     return chunk->constants.count++;
 }
 
+size_t add_jump_table(Chunk* chunk, size_t count) {
+    JumpTables* tables = &chunk->jump_tables;
+    if (tables->capacity < tables->count + 1) {
+        tables->capacity = tables->capacity < 4 ? 4 : tables->capacity * 2;
+        tables->tables = realloc(tables->tables, sizeof(JumpTable) * tables->capacity);
+    }
+    tables->tables[tables->count] = (JumpTable){count, calloc(count ? count : 1, sizeof(size_t))};
+    return tables->count++;
+}
+
+size_t add_handler(Chunk* chunk, Handler handler) {
+    HandlerTable* handlers = &chunk->handlers;
+    if (handlers->capacity < handlers->count + 1) {
+        handlers->capacity = handlers->capacity < 4 ? 4 : handlers->capacity * 2;
+        handlers->handlers = realloc(handlers->handlers, sizeof(Handler) * handlers->capacity);
+    }
+    handlers->handlers[handlers->count] = handler;
+    return handlers->count++;
+}
+
+const Handler* find_handler(const Chunk* chunk, size_t offset) {
+    for (size_t i = 0; i < chunk->handlers.count; i++) {
+        const Handler* handler = &chunk->handlers.handlers[i];
+        if (offset >= handler->start && offset < handler->end) return handler;
+    }
+    return NULL;
+}
+
 void write_instruction(Chunk* chunk, Instruction instruction) {
     if (chunk->code.capacity < chunk->code.count + 1) {
         size_t old_capacity = chunk->code.capacity;
@@ -43,8 +101,9 @@ void write_instruction(Chunk* chunk, Instruction instruction) {
     chunk->code.count++;
 }
 
-// Internal helper for recursive saving
-static int save_chunk_internal(const Chunk* chunk, FILE* f) {
+// Writes a chunk's counts, constants, code, jump tables and handlers.
+// Function constants are written as their index in functions.
+static int save_chunk_internal(const Chunk* chunk, PtrIndex* functions, FILE* f) {
     // Write counts
     uint64_t const_count = chunk->constants.count;
     uint64_t code_count = chunk->code.count;
@@ -57,34 +116,119 @@ static int save_chunk_internal(const Chunk* chunk, FILE* f) {
         if (type == VAL_NUMBER) {
             int64_t num = chunk->constants.values[i].as.number;
             fwrite(&num, sizeof(int64_t), 1, f);
+        } else if (type == VAL_DOUBLE) {
+            double num = chunk->constants.values[i].as.fp_number;
+            fwrite(&num, sizeof(double), 1, f);
+        } else if (type == VAL_STRING) {
+            const char* string = chunk->constants.values[i].as.string;
+            const uint32_t length = (uint32_t)strlen(string);
+            fwrite(&length, sizeof(uint32_t), 1, f);
+            fwrite(string, 1, length, f);
         } else if (type == VAL_FUNCTION) {
-            Function* fn = chunk->constants.values[i].as.function;
-            if (!fn || !fn->chunk) return -3;
-            int res = save_chunk_internal(fn->chunk, f);
-            if (res != 0) return res;
+            const uint32_t index = (uint32_t)ptr_index_add(functions, chunk->constants.values[i].as.function);
+            fwrite(&index, sizeof(uint32_t), 1, f);
         } else {
             return -2;
         }
     }
     // Write instructions
     fwrite(chunk->code.code, sizeof(Instruction), chunk->code.count, f);
+    // Write jump tables
+    uint64_t table_count = chunk->jump_tables.count;
+    fwrite(&table_count, sizeof(uint64_t), 1, f);
+    for (size_t i = 0; i < chunk->jump_tables.count; i++) {
+        const JumpTable* table = &chunk->jump_tables.tables[i];
+        uint64_t entry_count = table->count;
+        fwrite(&entry_count, sizeof(uint64_t), 1, f);
+        for (size_t e = 0; e < table->count; e++) {
+            uint64_t target = table->targets[e];
+            fwrite(&target, sizeof(uint64_t), 1, f);
+        }
+    }
+    // Write exception handlers
+    uint64_t handler_count = chunk->handlers.count;
+    fwrite(&handler_count, sizeof(uint64_t), 1, f);
+    for (size_t i = 0; i < chunk->handlers.count; i++) {
+        const Handler* handler = &chunk->handlers.handlers[i];
+        const uint64_t fields[4] = {handler->start, handler->end, handler->target, (uint64_t)handler->depth};
+        fwrite(fields, sizeof(uint64_t), 4, f);
+    }
     return 0;
 }
 
+// Numbers every function reachable from chunk, each once however many
+// constants refer to it
+static int number_functions(const Chunk* chunk, PtrIndex* functions) {
+    for (size_t next = 0;; next++) {
+        for (size_t i = 0; i < chunk->constants.count; i++) {
+            const Value value = chunk->constants.values[i];
+            if (value.type != VAL_FUNCTION) continue;
+            if (!value.as.function || !value.as.function->chunk) return -3;
+            ptr_index_add(functions, value.as.function);
+        }
+        if (next == functions->count) return 0;
+        chunk = ((const Function*)functions->items[next])->chunk;
+    }
+}
+
 int save_chunk(const Chunk* chunk, const char* filename) {
+    PtrIndex functions;
+    init_ptr_index(&functions);
+    int res = number_functions(chunk, &functions);
+    if (res != 0) {
+        free_ptr_index(&functions);
+        return res;
+    }
     FILE* f = fopen(filename, "wb");
-    if (!f) return -1;
+    if (!f) {
+        free_ptr_index(&functions);
+        return -1;
+    }
     // Write header
     fwrite(KAPPA_MAGIC, 1, 4, f);
     uint32_t version = KAPPA_VERSION;
     fwrite(&version, sizeof(uint32_t), 1, f);
-    int res = save_chunk_internal(chunk, f);
+    // Write the function table, then the main chunk
+    const uint64_t function_count = functions.count;
+    fwrite(&function_count, sizeof(uint64_t), 1, f);
+    for (size_t i = 0; i < functions.count && res == 0; i++) {
+        const Function* fn = functions.items[i];
+        const uint32_t name_length = fn->name ? (uint32_t)strlen(fn->name) : 0;
+        fwrite(&name_length, sizeof(uint32_t), 1, f);
+        fwrite(fn->name, 1, name_length, f);
+        const uint32_t local_count = (uint32_t)fn->local_count;
+        fwrite(&local_count, sizeof(uint32_t), 1, f);
+        res = save_chunk_internal(fn->chunk, &functions, f);
+    }
+    if (res == 0) res = save_chunk_internal(chunk, &functions, f);
     fclose(f);
+    free_ptr_index(&functions);
     return res;
 }
 
-// Internal helper for recursive loading
-static int load_chunk_internal(Chunk* chunk, FILE* f, const int depth) {
+// Functions of a version 8 file, allocated before any chunk is read so
+// constants can refer to functions that come later
+typedef struct {
+    Function** functions;
+    uint64_t count;
+} FunctionTable;
+
+static char* read_name(FILE* f) {
+    uint32_t name_length = 0;
+    if (fread(&name_length, sizeof(uint32_t), 1, f) != 1) return NULL;
+    char* name = malloc((size_t)name_length + 1);
+    if (fread(name, 1, name_length, f) != name_length) {
+        free(name);
+        return NULL;
+    }
+    name[name_length] = '\0';
+    return name;
+}
+
+// Reads a chunk. Before version 8 function constants are followed by their
+// chunks, read recursively; from version 8 they are indices into table.
+static int load_chunk_internal(Chunk* chunk, FILE* f, const uint32_t version, const int depth,
+                               const FunctionTable* table) {
     if (depth > 1000) {
         fprintf(stderr, "Maximum chunk depth exceeded\n");
         return -5;
@@ -101,17 +245,57 @@ static int load_chunk_internal(Chunk* chunk, FILE* f, const int depth) {
             int64_t num = 0;
             fread(&num, sizeof(int64_t), 1, f);
             add_constant(chunk, (Value){.type = VAL_NUMBER, .as.number = num});
+        } else if (type == VAL_DOUBLE) {
+            double num = 0;
+            if (fread(&num, sizeof(double), 1, f) != 1) return -4;
+            add_constant(chunk, (Value){.type = VAL_DOUBLE, .as.fp_number = num});
+        } else if (type == VAL_STRING && version >= 7) {
+            uint32_t length = 0;
+            if (fread(&length, sizeof(uint32_t), 1, f) != 1) return -4;
+            char* string = malloc((size_t)length + 1);
+            if (fread(string, 1, length, f) != length) {
+                free(string);
+                return -4;
+            }
+            string[length] = '\0';
+            add_constant(chunk, (Value){.type = VAL_STRING, .as.string = string});
+            free(string);
+        } else if (type == VAL_FUNCTION && version >= 8) {
+            uint32_t index = 0;
+            if (fread(&index, sizeof(uint32_t), 1, f) != 1 || index >= table->count) return -4;
+            add_constant(chunk, (Value){.type = VAL_FUNCTION, .as.function = table->functions[index]});
         } else if (type == VAL_FUNCTION) {
+            char* name = NULL;
+            uint32_t name_length = 0;
+            if (version >= 2) {
+                if (fread(&name_length, sizeof(uint32_t), 1, f) != 1) return -4;
+            }
+            if (name_length > 0) {
+                name = malloc(name_length + 1);
+                if (fread(name, 1, name_length, f) != name_length) {
+                    free(name);
+                    return -4;
+                }
+                name[name_length] = '\0';
+            }
+            uint32_t local_count = 0;
+            if (version >= 4 && fread(&local_count, sizeof(uint32_t), 1, f) != 1) {
+                free(name);
+                return -4;
+            }
             Chunk* fn_chunk = malloc(sizeof(Chunk));
             init_chunk(fn_chunk);
-            const int res = load_chunk_internal(fn_chunk, f, depth + 1);
+            const int res = load_chunk_internal(fn_chunk, f, version, depth + 1, table);
             if (res != 0) {
                 free_chunk(fn_chunk);
                 free(fn_chunk);
+                free(name);
                 return res;
             }
             Function* fn = malloc(sizeof(Function));
             fn->chunk = fn_chunk;
+            fn->name = name;
+            fn->local_count = local_count;
             add_constant(chunk, (Value){.type = VAL_FUNCTION, .as.function = fn});
         } else {
             return -4;
@@ -123,6 +307,30 @@ static int load_chunk_internal(Chunk* chunk, FILE* f, const int depth) {
         fread(&inst, sizeof(Instruction), 1, f);
         write_instruction(chunk, inst);
     }
+    if (version < 3) return 0;
+    // Read jump tables
+    uint64_t table_count = 0;
+    if (fread(&table_count, sizeof(uint64_t), 1, f) != 1) return -4;
+    for (uint64_t i = 0; i < table_count; i++) {
+        uint64_t entry_count = 0;
+        if (fread(&entry_count, sizeof(uint64_t), 1, f) != 1) return -4;
+        const size_t index = add_jump_table(chunk, entry_count);
+        JumpTable* table = &chunk->jump_tables.tables[index];
+        for (uint64_t e = 0; e < entry_count; e++) {
+            uint64_t target = 0;
+            if (fread(&target, sizeof(uint64_t), 1, f) != 1) return -4;
+            table->targets[e] = target;
+        }
+    }
+    if (version < 6) return 0;
+    // Read exception handlers
+    uint64_t handler_count = 0;
+    if (fread(&handler_count, sizeof(uint64_t), 1, f) != 1) return -4;
+    for (uint64_t i = 0; i < handler_count; i++) {
+        uint64_t fields[4];
+        if (fread(fields, sizeof(uint64_t), 4, f) != 4) return -4;
+        add_handler(chunk, (Handler){fields[0], fields[1], fields[2], (int64_t)fields[3]});
+    }
     return 0;
 }
 
@@ -134,23 +342,125 @@ int load_chunk(Chunk* chunk, const char* filename) {
     if (strcmp(magic, KAPPA_MAGIC) != 0) { fclose(f); return -2; }
     uint32_t version = 0;
     fread(&version, sizeof(uint32_t), 1, f);
-    if (version != KAPPA_VERSION) { fclose(f); return -3; }
-    const int res = load_chunk_internal(chunk, f, 0);
+    if (version < KAPPA_MIN_VERSION || version > KAPPA_VERSION) { fclose(f); return -3; }
+    FunctionTable table = {NULL, 0};
+    int res = 0;
+    if (version >= 8) {
+        // Each function takes at least 40 bytes, its name and local count
+        // and five u64 counts, which bounds what a corrupt count can make us
+        // allocate
+        uint64_t count = 0;
+        if (fread(&count, sizeof(uint64_t), 1, f) != 1) res = -4;
+        const long start = ftell(f);
+        fseek(f, 0, SEEK_END);
+        const long end = ftell(f);
+        fseek(f, start, SEEK_SET);
+        if (res == 0 && count > (uint64_t)(end - start) / 40) res = -4;
+        if (res == 0 && count > 0) {
+            table.functions = calloc(count, sizeof(Function*));
+            for (uint64_t i = 0; i < count; i++) {
+                Function* fn = malloc(sizeof(Function));
+                fn->chunk = malloc(sizeof(Chunk));
+                init_chunk(fn->chunk);
+                fn->name = NULL;
+                fn->local_count = 0;
+                table.functions[i] = fn;
+            }
+            table.count = count;
+        }
+        for (uint64_t i = 0; i < table.count && res == 0; i++) {
+            Function* fn = table.functions[i];
+            char* name = read_name(f);
+            uint32_t local_count = 0;
+            if (!name || fread(&local_count, sizeof(uint32_t), 1, f) != 1) {
+                free(name);
+                res = -4;
+                break;
+            }
+            // Unnamed functions have an empty name on disk
+            if (name[0] == '\0') {
+                free(name);
+                name = NULL;
+            }
+            fn->name = name;
+            fn->local_count = local_count;
+            res = load_chunk_internal(fn->chunk, f, version, 0, &table);
+        }
+    }
+    if (res == 0) res = load_chunk_internal(chunk, f, version, 0, &table);
+    if (res != 0 && table.count > 0) {
+        // The main chunk's function constants point into the table
+        free_chunk(chunk);
+        init_chunk(chunk);
+        for (uint64_t i = 0; i < table.count; i++) {
+            free_chunk(table.functions[i]->chunk);
+            free(table.functions[i]->chunk);
+            free(table.functions[i]->name);
+            free(table.functions[i]);
+        }
+    }
+    free(table.functions);
     fclose(f);
     return res;
 }
 
-static void disassemble_chunk_with_indent(const Chunk* chunk, FILE* out, int indent);
+void free_loaded_chunk(Chunk* chunk) {
+    PtrIndex functions;
+    init_ptr_index(&functions);
+    // number_functions only fails on a function without a chunk, which
+    // load_chunk never makes
+    number_functions(chunk, &functions);
+    for (size_t i = 0; i < functions.count; i++) {
+        Function* fn = (Function*)functions.items[i];
+        free_chunk(fn->chunk);
+        free(fn->chunk);
+        free(fn->name);
+        free(fn);
+    }
+    free_ptr_index(&functions);
+    free_chunk(chunk);
+}
+
+static void disassemble_chunk_with_indent(const Chunk* chunk, FILE* out, int indent, PtrIndex* seen);
+
+void disassemble_instruction(const Chunk* chunk, size_t offset, FILE* out) {
+    const Instruction inst = chunk->code.code[offset];
+    const uint8_t opcode = get_opcode(inst);
+    const unsigned long long operand = (unsigned long long)get_operand(inst);
+    if (opcode < OPCODE_COUNT) {
+        fprintf(out, "%zu: %s %llu\n", offset, opcode_name(opcode), operand);
+    } else {
+        fprintf(out, "%zu: [unknown opcode %u] %llu\n", offset, opcode, operand);
+    }
+}
 
 void disassemble_chunk(const Chunk* chunk, FILE* out) {
-    disassemble_chunk_with_indent(chunk, out, 0);
+    PtrIndex seen;
+    init_ptr_index(&seen);
+    disassemble_chunk_with_indent(chunk, out, 0, &seen);
+    free_ptr_index(&seen);
+}
+
+// Prints string as the assembler reads it between quotes
+static void print_escaped(FILE* out, const char* string) {
+    for (const char* p = string; *p; p++) {
+        switch (*p) {
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\t': fputs("\\t", out); break;
+            default: fputc(*p, out); break;
+        }
+    }
 }
 
 static void print_indent(FILE* out, int indent) {
     for (int i = 0; i < indent; i++) fputc(' ', out);
 }
 
-static void disassemble_chunk_with_indent(const Chunk* chunk, FILE* out, int indent) {
+// Functions already in seen are not disassembled again, which would never
+// end for recursive ones
+static void disassemble_chunk_with_indent(const Chunk* chunk, FILE* out, int indent, PtrIndex* seen) {
     print_indent(out, indent);
     fprintf(out, "== constants ==\n");
     for (size_t i = 0; i < chunk->constants.count; i++) {
@@ -158,12 +468,30 @@ static void disassemble_chunk_with_indent(const Chunk* chunk, FILE* out, int ind
         print_indent(out, indent);
         if (v.type == VAL_NUMBER) {
             fprintf(out, "  %zu: number %lld\n", i, (long long)v.as.number);
+        } else if (v.type == VAL_DOUBLE) {
+            char text[32];
+            format_double(v.as.fp_number, text, sizeof(text));
+            fprintf(out, "  %zu: double %s\n", i, text);
+        } else if (v.type == VAL_STRING) {
+            fprintf(out, "  %zu: string \"", i);
+            print_escaped(out, v.as.string);
+            fprintf(out, "\"\n");
         } else if (v.type == VAL_FUNCTION) {
-            fprintf(out, "  %zu: function <#%p>\n", i, (void*)v.as.function);
+            if (v.as.function && v.as.function->name) {
+                fprintf(out, "  %zu: function %s <#%p>\n", i, v.as.function->name, (void*)v.as.function);
+            } else {
+                fprintf(out, "  %zu: function <#%p>\n", i, (void*)v.as.function);
+            }
+            const size_t seen_count = seen->count;
+            if (v.as.function) ptr_index_add(seen, v.as.function);
             print_indent(out, indent);
+            if (v.as.function && seen->count == seen_count) {
+                fprintf(out, "  -- function constant %zu disassembled above --\n", i);
+                continue;
+            }
             fprintf(out, "  -- function constant %zu disassembly --\n", i);
             if (v.as.function && v.as.function->chunk) {
-                disassemble_chunk_with_indent(v.as.function->chunk, out, indent + 4);
+                disassemble_chunk_with_indent(v.as.function->chunk, out, indent + 4, seen);
             } else {
                 print_indent(out, indent + 4);
                 fprintf(out, "<null function chunk>\n");
@@ -175,35 +503,29 @@ static void disassemble_chunk_with_indent(const Chunk* chunk, FILE* out, int ind
     print_indent(out, indent);
     fprintf(out, "== code ==\n");
     for (size_t i = 0; i < chunk->code.count; i++) {
-        Instruction inst = chunk->code.code[i];
-        uint8_t opcode = get_opcode(inst);
-        uint64_t operand = get_operand(inst);
         print_indent(out, indent);
-        switch (opcode) {
-            case OP_CONSTANT:
-                fprintf(out, "  %zu: OP_CONSTANT %llu\n", i, (unsigned long long)operand);
-                break;
-            case OP_ADD:
-                fprintf(out, "  %zu: OP_ADD %llu\n", i, (unsigned long long)operand);
-                break;
-            case OP_HALT:
-                fprintf(out, "  %zu: OP_HALT %llu\n", i, (unsigned long long)operand);
-                break;
-            case OP_RETURN:
-                fprintf(out, "  %zu: OP_RETURN %llu\n", i, (unsigned long long)operand);
-                break;
-            case OP_JMP:
-                fprintf(out, "  %zu: OP_JMP %llu\n", i, (unsigned long long)operand);
-                break;
-            case OP_JMP_IF_FALSE:
-                fprintf(out, "  %zu: OP_JMP_IF_FALSE %llu\n", i, (unsigned long long)operand);
-                break;
-            case OP_CALL:
-                fprintf(out, "  %zu: OP_CALL %llu\n", i, (unsigned long long)operand);
-                break;
-            default:
-                fprintf(out, "  %zu: [unknown opcode %u] %llu\n", i, opcode, (unsigned long long)operand);
-                break;
-        }
+        fprintf(out, "  ");
+        disassemble_instruction(chunk, i, out);
+    }
+    if (chunk->jump_tables.count > 0) {
+        print_indent(out, indent);
+        fprintf(out, "== jump tables ==\n");
+    }
+    for (size_t i = 0; i < chunk->jump_tables.count; i++) {
+        const JumpTable* table = &chunk->jump_tables.tables[i];
+        print_indent(out, indent);
+        fprintf(out, "  %zu:", i);
+        for (size_t e = 0; e < table->count; e++) fprintf(out, " %zu", table->targets[e]);
+        fprintf(out, "\n");
+    }
+    if (chunk->handlers.count > 0) {
+        print_indent(out, indent);
+        fprintf(out, "== handlers ==\n");
+    }
+    for (size_t i = 0; i < chunk->handlers.count; i++) {
+        const Handler* handler = &chunk->handlers.handlers[i];
+        print_indent(out, indent);
+        fprintf(out, "  %zu: [%zu, %zu) -> %zu depth %lld\n", i, handler->start, handler->end, handler->target,
+                (long long)handler->depth);
     }
 } 
\ No newline at end of file
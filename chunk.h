@@ -21,18 +21,66 @@ typedef struct {
     // TODO: Add line number information for debugging
 } Code;
 
+// Targets of one OP_SWITCH, as absolute instruction indices
+typedef struct {
+    size_t count;
+    size_t* targets;
+} JumpTable;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    JumpTable* tables;
+} JumpTables;
+
+// An exception handler: a value thrown while executing an instruction in
+// [start, end) cuts the stack back to depth, relative to the height on entry
+// to the chunk, pushes the value and continues at target. Nothing is
+// executed on entering or leaving the range. When ranges nest, the inner
+// one comes first, and the first handler covering an instruction wins.
+typedef struct {
+    size_t start;
+    size_t end;
+    size_t target;
+    int64_t depth;
+} Handler;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Handler* handlers;
+} HandlerTable;
+
 struct Chunk {
     Code code;
     ConstantPool constants;
+    JumpTables jump_tables;
+    HandlerTable handlers;
+    // Filled in by verify_chunk
+    bool verified;
+    size_t stack_needed; // values that must already be above the frame's slots on entry
+    size_t max_stack;    // deepest growth above the entry stack height
 };
 
 
 void init_chunk(Chunk* chunk);
 void free_chunk(Chunk* chunk);
 size_t add_constant(Chunk* chunk, Value value);
+// Adds a jump table with count entries, all targeting instruction 0, and
+// returns its index
+size_t add_jump_table(Chunk* chunk, size_t count);
+// Appends a handler and returns its index
+size_t add_handler(Chunk* chunk, Handler handler);
+// The first handler whose range covers offset, or NULL
+const Handler* find_handler(const Chunk* chunk, size_t offset);
 void write_instruction(Chunk* chunk, Instruction instruction);
 int save_chunk(const Chunk* chunk, const char* filename);
 int load_chunk(Chunk* chunk, const char* filename);
+// Frees a chunk from load_chunk along with every function it reaches, each
+// once even when functions refer to one another
+void free_loaded_chunk(Chunk* chunk);
 void disassemble_chunk(const Chunk* chunk, FILE* out);
+// Prints the instruction at offset as one line of disassemble_chunk's code listing, without the indent
+void disassemble_instruction(const Chunk* chunk, size_t offset, FILE* out);
 
 #endif //KAPPAVM_CHUNK_H 
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "host.h"
+#include "numeric.h"
+#include "string_value.h"
+#include "verifier.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void add_function(Program* program, Function* function) {
+    if (program->function_count == program->function_capacity) {
+        program->function_capacity = program->function_capacity < 8 ? 8 : program->function_capacity * 2;
+        program->functions = realloc(program->functions, sizeof(FunctionDef) * program->function_capacity);
+    }
+    program->functions[program->function_count++] = (FunctionDef){function->name, function->chunk, function};
+}
+
+// Hands the Functions that load_chunk allocated for function constants to
+// program, which then frees them along with their names and chunks
+static void collect_functions(Program* program, const Chunk* chunk) {
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        const Value value = chunk->constants.values[i];
+        if (value.type != VAL_FUNCTION || !value.as.function) continue;
+        bool seen = false;
+        for (size_t f = 0; f < program->function_count && !seen; f++) {
+            seen = program->functions[f].function == value.as.function;
+        }
+        if (seen) continue;
+        add_function(program, value.as.function);
+        if (value.as.function->chunk) collect_functions(program, value.as.function->chunk);
+    }
+}
+
+// Verifies every chunk up front, including functions main never refers to,
+// so that calls never have to
+static int finish_load(HostProgram* host) {
+    Program* program = &host->program;
+    int res = verify_chunk(&program->main_chunk);
+    for (size_t i = 0; i < program->function_count && res == 0; i++) {
+        if (!program->functions[i].chunk) {
+            fprintf(stderr, "VerifyError: function without a chunk\n");
+            res = -1;
+        } else {
+            res = verify_chunk(program->functions[i].chunk);
+        }
+    }
+    if (res != 0) {
+        host_free(host);
+        return -1;
+    }
+    for (size_t i = 0; i < program->function_count; i++) {
+        const char* name = program->functions[i].name;
+        size_t index;
+        if (name && !table_get(&host->names, name, strlen(name), &index)) {
+            table_set(&host->names, name, strlen(name), i);
+        }
+    }
+    return 0;
+}
+
+int host_load_source(HostProgram* host, const char* src) {
+    init_table(&host->names);
+    host->program = assemble_program_from_string(src);
+    if (host->program.had_error) {
+        host_free(host);
+        return -1;
+    }
+    return finish_load(host);
+}
+
+static char* read_file(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = malloc(size + 1);
+    size_t read = fread(data, 1, size, f);
+    fclose(f);
+    data[read] = '\0';
+    return data;
+}
+
+int host_load_file(HostProgram* host, const char* filename) {
+    const size_t length = strlen(filename);
+    if (length >= 6 && strcmp(filename + length - 6, ".kappa") == 0) {
+        char* src = read_file(filename);
+        if (!src) {
+            fprintf(stderr, "Failed to read source file: %s\n", filename);
+            init_table(&host->names);
+            memset(&host->program, 0, sizeof(Program));
+            return -1;
+        }
+        const int res = host_load_source(host, src);
+        free(src);
+        return res;
+    }
+
+    init_table(&host->names);
+    memset(&host->program, 0, sizeof(Program));
+    init_chunk(&host->program.main_chunk);
+    const int res = load_chunk(&host->program.main_chunk, filename);
+    // Whatever was loaded, even on failure, now belongs to the program
+    collect_functions(&host->program, &host->program.main_chunk);
+    if (res != 0) {
+        fprintf(stderr, "Failed to load bytecode file: %s\n", filename);
+        host_free(host);
+        return -1;
+    }
+    return finish_load(host);
+}
+
+void host_free(HostProgram* host) {
+    free_program(&host->program);
+    free_table(&host->names);
+    memset(&host->program, 0, sizeof(Program));
+}
+
+Function* host_find(const HostProgram* host, const char* name) {
+    size_t index;
+    if (!table_get(&host->names, name, strlen(name), &index)) return NULL;
+    return host->program.functions[index].function;
+}
+
+VMResult host_call(VM* vm, const HostProgram* host, const char* name, const Value* args, const size_t arg_count,
+                   Value* result) {
+    Function* function = host_find(host, name);
+    if (!function) {
+        fprintf(stderr, "RuntimeError: Undefined function '%s'.\n", name);
+        return VM_RUNTIME_ERROR;
+    }
+    return vm_call(vm, function, args, arg_count, result);
+}
+
+static void format_value(Value value, char* text, size_t size) {
+    switch (value.type) {
+        case VAL_NUMBER: snprintf(text, size, "%lld", (long long)value.as.number); break;
+        case VAL_DOUBLE: format_double(value.as.fp_number, text, size); break;
+        case VAL_STRING:
+        case VAL_SHORT_STRING:
+        case VAL_SLICE:
+        case VAL_HEAP_STRING: {
+            size_t length;
+            const char* chars = string_chars(&value, &length);
+            snprintf(text, size, "%.*s", (int)length, chars);
+            break;
+        }
+        case VAL_FUNCTION:
+            snprintf(text, size, "<fn %s>", value.as.function->name ? value.as.function->name : "?");
+            break;
+        case VAL_NULL: snprintf(text, size, "null"); break;
+        default: snprintf(text, size, "<value>"); break;
+    }
+}
+
+static Function* find_function(const HostProgram* programs, const size_t program_count, const char* name) {
+    for (size_t i = 0; i < program_count; i++) {
+        Function* function = host_find(&programs[i], name);
+        if (function) return function;
+    }
+    return NULL;
+}
+
+void host_handle_request(const HostProgram* programs, const size_t program_count, VM* vm, const char* line,
+                         char* response, const size_t size) {
+    char copy[HOST_MAX_LINE];
+    snprintf(copy, sizeof(copy), "%s", line);
+    char* save = NULL;
+    const char* name = strtok_r(copy, " \t\r", &save);
+    if (!name) {
+        snprintf(response, size, "ERR Empty request\n");
+        return;
+    }
+    Value args[HOST_MAX_ARGS];
+    size_t arg_count = 0;
+    for (char* token = strtok_r(NULL, " \t\r", &save); token; token = strtok_r(NULL, " \t\r", &save)) {
+        if (arg_count == HOST_MAX_ARGS) {
+            snprintf(response, size, "ERR Too many arguments\n");
+            return;
+        }
+        char* end;
+        errno = 0;
+        const long long number = strtoll(token, &end, 10);
+        if (*end != '\0' || errno == ERANGE) {
+            snprintf(response, size, "ERR Invalid argument '%.64s'\n", token);
+            return;
+        }
+        args[arg_count++] = (Value){.type = VAL_NUMBER, .as.number = number};
+    }
+    Function* function = find_function(programs, program_count, name);
+    if (!function) {
+        snprintf(response, size, "ERR Undefined function '%.64s'\n", name);
+        return;
+    }
+    Value result;
+    const VMResult status = vm_call(vm, function, args, arg_count, &result);
+    if (status != VM_OK) {
+        snprintf(response, size, status == VM_LIMIT_EXCEEDED ? "ERR Limit exceeded\n" : "ERR Runtime error\n");
+        return;
+    }
+    char text[HOST_MAX_LINE];
+    format_value(result, text, sizeof(text));
+    snprintf(response, size, "OK %s\n", text);
+}
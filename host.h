@@ -0,0 +1,43 @@
+#ifndef KAPPAVM_HOST_H
+#define KAPPAVM_HOST_H
+
+#include "assembler.h"
+#include "table.h"
+#include "vm.h"
+
+// A program loaded once for a host to call into. Every chunk is verified
+// when it is loaded and nothing writes to them afterwards, so threads can
+// share one HostProgram as long as each calls through its own VM.
+typedef struct {
+    Program program;        // owns the chunks, whichever way they were loaded
+    Table names;            // function name -> index in program.functions
+} HostProgram;
+
+// Assembles src and verifies it. Returns 0 on success; problems are
+// reported on stderr and leave host empty.
+int host_load_source(HostProgram* host, const char* src);
+// Loads a .kappa source or a .kbc bytecode file, by its extension
+int host_load_file(HostProgram* host, const char* filename);
+void host_free(HostProgram* host);
+
+// The function defined under name, or NULL. Where a .kbc file from before
+// version 8 holds several copies of one function, this is the first in
+// depth-first order.
+Function* host_find(const HostProgram* host, const char* name);
+
+// Longest request line host_handle_request accepts, newline included
+#define HOST_MAX_LINE 4096
+#define HOST_MAX_ARGS 16
+
+// Looks name up and calls it through vm_call
+VMResult host_call(VM* vm, const HostProgram* host, const char* name, const Value* args, size_t arg_count,
+                   Value* result);
+
+// Answers a request line, a function name followed by integer arguments
+// such as "add 2 3", with "OK <result>" or "ERR <message>" and a newline in
+// response. The function is looked up in each of programs in turn. This is
+// the protocol of --serve and of zygote workers.
+void host_handle_request(const HostProgram* programs, size_t program_count, VM* vm, const char* line,
+                         char* response, size_t size);
+
+#endif //KAPPAVM_HOST_H
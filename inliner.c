@@ -0,0 +1,281 @@
+#include "inliner.h"
+#include "verifier.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    Chunk** chunks;
+    size_t count;
+    size_t capacity;
+} ChunkList;
+
+static bool list_contains(const ChunkList* list, const Chunk* chunk) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->chunks[i] == chunk) return true;
+    }
+    return false;
+}
+
+static void list_add(ChunkList* list, Chunk* chunk) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity < 8 ? 8 : list->capacity * 2;
+        list->chunks = realloc(list->chunks, sizeof(Chunk*) * list->capacity);
+    }
+    list->chunks[list->count++] = chunk;
+}
+
+// Sign-extends a 56-bit operand
+static int64_t signed_operand(Instruction inst) {
+    return (int64_t)(get_operand(inst) << 8) >> 8;
+}
+
+// Whether target is reachable through the function constants of chunk
+static bool reaches(const Chunk* chunk, const Chunk* target, ChunkList* seen) {
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        const Value value = chunk->constants.values[i];
+        if (value.type != VAL_FUNCTION) continue;
+        Chunk* callee = value.as.function->chunk;
+        if (callee == target) return true;
+        if (list_contains(seen, callee)) continue;
+        list_add(seen, callee);
+        if (reaches(callee, target, seen)) return true;
+    }
+    return false;
+}
+
+// Why a call with arg_count arguments cannot be replaced by the callee's
+// body, or NULL if it can. Once inlined there is no frame to unwind, so every
+// RETURN must find exactly one value where the arguments started.
+// Functions without a name from a FUNCTION header go by their address
+static void print_function_name(FILE* out, const Function* function) {
+    if (function->name) {
+        fprintf(out, "%s", function->name);
+    } else {
+        fprintf(out, "<#%p>", (const void*)function);
+    }
+}
+
+static const char* inline_blocker(const Function* callee, uint8_t arg_count) {
+    const Chunk* body = callee->chunk;
+    if (body->code.count > INLINE_MAX_INSTRUCTIONS) return "too large";
+    if (body->stack_needed > arg_count) return "reads below its arguments";
+    if (callee->local_count > 0) return "has locals";
+    if (body->handlers.count > 0) return "has exception handlers";
+
+    ChunkList seen = {0};
+    const bool recursive = reaches(body, body, &seen);
+    free(seen.chunks);
+    if (recursive) return "recursive";
+
+    int64_t* heights = malloc(sizeof(int64_t) * body->code.count);
+    const char* blocker = stack_heights(body, heights) != 0 ? "unverifiable" : NULL;
+    for (size_t i = 0; i < body->code.count && !blocker; i++) {
+        if (heights[i] == UNVISITED) continue;
+        const uint8_t op = get_opcode(body->code.code[i]);
+        if (op == OP_HALT || op == OP_CHECKPOINT) {
+            blocker = "halts or checkpoints";
+        } else if (op == OP_SWITCH) {
+            blocker = "uses a jump table";
+        } else if (op == OP_GET_LOCAL || op == OP_SET_LOCAL) {
+            blocker = "uses frame slots";
+        } else if (op == OP_RETURN && heights[i] != 1 - (int64_t)arg_count) {
+            blocker = "does not consume exactly its arguments";
+        }
+    }
+    free(heights);
+    return blocker;
+}
+
+// Finds the CONSTANT that pushed the callee of the CALL at index call. The
+// two must be joined by straight-line code that leaves the callee in place.
+static size_t find_callee_push(const Chunk* chunk, const int64_t* heights, const bool* is_target, size_t call) {
+    const int64_t base = heights[call] - (int64_t)get_operand(chunk->code.code[call]) - 1;
+    for (size_t q = call; q-- > 0;) {
+        if (is_target[q + 1]) return SIZE_MAX;
+        const Instruction inst = chunk->code.code[q];
+        const uint8_t op = get_opcode(inst);
+        if (heights[q] == UNVISITED || is_jump_opcode(op) || op == OP_RETURN || op == OP_HALT) return SIZE_MAX;
+        if (heights[q] == base) {
+            const bool pushes_function = op == OP_CONSTANT &&
+                chunk->constants.values[get_operand(inst)].type == VAL_FUNCTION;
+            return pushes_function ? q : SIZE_MAX;
+        }
+        int64_t pops, pushes;
+        stack_effect(inst, &pops, &pushes);
+        if (heights[q] - pops < base + 1) return SIZE_MAX;
+    }
+    return SIZE_MAX;
+}
+
+// Copies body into code at out. RETURNs become jumps past the copy and the
+// body's constants are added to the caller's pool. Returns the new end.
+static size_t splice_body(Chunk* caller, Instruction* code, size_t out, const Chunk* body) {
+    int64_t* heights = malloc(sizeof(int64_t) * body->code.count);
+    stack_heights(body, heights);
+    size_t* constant_map = malloc(sizeof(size_t) * (body->constants.count ? body->constants.count : 1));
+    for (size_t i = 0; i < body->constants.count; i++) constant_map[i] = SIZE_MAX;
+
+    const size_t end = out + body->code.count;
+    for (size_t i = 0; i < body->code.count; i++) {
+        Instruction inst = body->code.code[i];
+        if (heights[i] == UNVISITED) {
+            // Never executed; kept so that jump offsets within the body still line up
+            inst = make_instruction(OP_HALT, 0);
+        } else if (get_opcode(inst) == OP_CONSTANT) {
+            const uint64_t index = get_operand(inst);
+            if (constant_map[index] == SIZE_MAX) {
+                constant_map[index] = add_constant(caller, body->constants.values[index]);
+            }
+            inst = make_instruction(OP_CONSTANT, constant_map[index]);
+        } else if (get_opcode(inst) == OP_RETURN) {
+            inst = make_instruction(OP_JMP, (uint64_t)((int64_t)end - (int64_t)(out + 1)));
+        }
+        code[out++] = inst;
+    }
+    free(heights);
+    free(constant_map);
+    return end;
+}
+
+static void inline_into(Chunk* chunk, InlineStats* stats, FILE* report) {
+    const size_t count = chunk->code.count;
+    int64_t* heights = malloc(sizeof(int64_t) * count);
+    if (stack_heights(chunk, heights) != 0) {
+        free(heights);
+        return;
+    }
+    bool* is_target = calloc(count + 1, sizeof(bool));
+    for (size_t i = 0; i < count; i++) {
+        const Instruction inst = chunk->code.code[i];
+        if (heights[i] == UNVISITED || !is_jump_opcode(get_opcode(inst))) continue;
+        is_target[(int64_t)i + 1 + signed_operand(inst)] = true;
+    }
+    for (size_t t = 0; t < chunk->jump_tables.count; t++) {
+        const JumpTable* table = &chunk->jump_tables.tables[t];
+        for (size_t e = 0; e < table->count; e++) {
+            if (table->targets[e] <= count) is_target[table->targets[e]] = true;
+        }
+    }
+    // A callee push and its CALL must lie on the same side of every range edge
+    for (size_t h = 0; h < chunk->handlers.count; h++) {
+        const Handler* handler = &chunk->handlers.handlers[h];
+        if (handler->start <= count) is_target[handler->start] = true;
+        if (handler->end <= count) is_target[handler->end] = true;
+        if (handler->target <= count) is_target[handler->target] = true;
+    }
+
+    // Each inlined site drops the callee's CONSTANT and expands its CALL
+    bool* dropped = calloc(count, sizeof(bool));
+    Function** expanded = calloc(count, sizeof(Function*));
+    size_t new_count = count;
+    size_t inlined = 0;
+    for (size_t call = 0; call < count; call++) {
+        const Instruction inst = chunk->code.code[call];
+        if (heights[call] == UNVISITED || get_opcode(inst) != OP_CALL) continue;
+        const size_t push = find_callee_push(chunk, heights, is_target, call);
+        if (push == SIZE_MAX) continue;
+        Function* callee = chunk->constants.values[get_operand(chunk->code.code[push])].as.function;
+
+        const char* blocker = inline_blocker(callee, (uint8_t)get_operand(inst));
+        if (!blocker && new_count - 2 + callee->chunk->code.count > INLINE_MAX_CHUNK_SIZE) {
+            blocker = "caller too large";
+        }
+        if (blocker) {
+            stats->skipped_calls++;
+            if (report) {
+                fprintf(report, "kept call at instruction %zu to function ", call);
+                print_function_name(report, callee);
+                fprintf(report, ": %s\n", blocker);
+            }
+            continue;
+        }
+        dropped[push] = true;
+        expanded[call] = callee;
+        new_count = new_count - 2 + callee->chunk->code.count;
+        inlined++;
+        stats->inlined_calls++;
+        if (report) {
+            fprintf(report, "inlined function ");
+            print_function_name(report, callee);
+            fprintf(report, " (%zu instructions) at instruction %zu\n", callee->chunk->code.count, call);
+        }
+    }
+
+    if (inlined > 0) {
+        Instruction* code = malloc(sizeof(Instruction) * (new_count ? new_count : 1));
+        size_t* new_index = malloc(sizeof(size_t) * (count + 1));
+        size_t out = 0;
+        for (size_t i = 0; i < count; i++) {
+            new_index[i] = out;
+            if (dropped[i]) continue;
+            if (expanded[i]) {
+                out = splice_body(chunk, code, out, expanded[i]->chunk);
+            } else {
+                code[out++] = chunk->code.code[i];
+            }
+        }
+        new_index[count] = out;
+
+        // Re-encode the caller's own jumps; unreachable ones are left as they were
+        for (size_t i = 0; i < count; i++) {
+            const Instruction inst = chunk->code.code[i];
+            if (dropped[i] || expanded[i] || !is_jump_opcode(get_opcode(inst))) continue;
+            const int64_t target = (int64_t)i + 1 + signed_operand(inst);
+            if (target < 0 || (size_t)target > count) continue;
+            const int64_t offset = (int64_t)new_index[target] - (int64_t)(new_index[i] + 1);
+            code[new_index[i]] = make_instruction(get_opcode(inst), (uint64_t)offset);
+        }
+        for (size_t t = 0; t < chunk->jump_tables.count; t++) {
+            const JumpTable* table = &chunk->jump_tables.tables[t];
+            for (size_t e = 0; e < table->count; e++) {
+                if (table->targets[e] <= count) table->targets[e] = new_index[table->targets[e]];
+            }
+        }
+        // A body inlined inside a range is covered by it, as its frame was
+        for (size_t h = 0; h < chunk->handlers.count; h++) {
+            Handler* handler = &chunk->handlers.handlers[h];
+            if (handler->start <= count) handler->start = new_index[handler->start];
+            if (handler->end <= count) handler->end = new_index[handler->end];
+            if (handler->target <= count) handler->target = new_index[handler->target];
+        }
+        free(new_index);
+
+        free(chunk->code.code);
+        chunk->code.code = code;
+        chunk->code.count = new_count;
+        chunk->code.capacity = new_count;
+        // Refresh stack requirements for callers that inline this chunk in turn
+        chunk->verified = false;
+        verify_chunk(chunk);
+    }
+
+    free(heights);
+    free(is_target);
+    free(dropped);
+    free(expanded);
+}
+
+// Inlines bottom-up, so that a function's own calls are already expanded
+// when it is considered for inlining into its callers
+static void inline_recursive(Chunk* chunk, ChunkList* visited, InlineStats* stats, FILE* report) {
+    if (list_contains(visited, chunk)) return;
+    list_add(visited, chunk);
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        const Value value = chunk->constants.values[i];
+        if (value.type == VAL_FUNCTION) inline_recursive(value.as.function->chunk, visited, stats, report);
+    }
+    inline_into(chunk, stats, report);
+}
+
+int inline_chunk(Chunk* chunk, InlineStats* stats, FILE* report) {
+    InlineStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(InlineStats));
+    if (verify_chunk(chunk) != 0) return -1;
+
+    ChunkList visited = {0};
+    inline_recursive(chunk, &visited, stats, report);
+    for (size_t i = 0; i < visited.count; i++) visited.chunks[i]->verified = false;
+    free(visited.chunks);
+    return verify_chunk(chunk);
+}
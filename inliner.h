@@ -0,0 +1,25 @@
+#ifndef KAPPAVM_INLINER_H
+#define KAPPAVM_INLINER_H
+
+#include <stdio.h>
+#include "chunk.h"
+
+// Callees longer than this are always called
+#define INLINE_MAX_INSTRUCTIONS 16
+// Inlining stops growing a chunk past the reach of a 16-bit jump offset
+#define INLINE_MAX_CHUNK_SIZE INT16_MAX
+
+typedef struct {
+    size_t inlined_calls;
+    size_t skipped_calls; // statically known callees that were not inlined
+} InlineStats;
+
+// Replaces `CONSTANT fn; ...; CALL n` sites in a chunk and every function
+// chunk reachable from it with the body of fn, when fn is small, not
+// recursive, never halts or checkpoints, and consumes exactly its n
+// arguments before each RETURN. Each decision is written to report unless it
+// is NULL. The chunk must pass verify_chunk, and is verified again
+// afterwards. Returns 0 on success; stats may be NULL.
+int inline_chunk(Chunk* chunk, InlineStats* stats, FILE* report);
+
+#endif //KAPPAVM_INLINER_H
@@ -0,0 +1,992 @@
+#include "ir.h"
+#include "numeric.h"
+#include "verifier.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Sign-extends a 56-bit operand
+static int64_t signed_operand(Instruction inst) {
+    return (int64_t)(get_operand(inst) << 8) >> 8;
+}
+
+static size_t jump_target(const Chunk* chunk, size_t index) {
+    return (size_t)((int64_t)index + 1 + signed_operand(chunk->code.code[index]));
+}
+
+static size_t new_value(IrFunction* ir, IrOp op, size_t block, size_t operand_count) {
+    if (ir->value_count == ir->value_capacity) {
+        ir->value_capacity = ir->value_capacity < 16 ? 16 : ir->value_capacity * 2;
+        ir->values = realloc(ir->values, sizeof(IrValue) * ir->value_capacity);
+    }
+    IrValue* value = &ir->values[ir->value_count];
+    memset(value, 0, sizeof(IrValue));
+    value->op = op;
+    value->block = block;
+    value->operand_count = operand_count;
+    value->operands = operand_count ? malloc(sizeof(size_t) * operand_count) : NULL;
+    value->number = ir->value_count;
+    return ir->value_count++;
+}
+
+// Appends an incoming edge to block, growing every phi's operand list with it
+static size_t add_edge(IrFunction* ir, size_t block, size_t pred, const size_t* exits) {
+    IrBlock* b = &ir->blocks[block];
+    if (b->pred_count == b->pred_capacity) {
+        b->pred_capacity = b->pred_capacity < 2 ? 2 : b->pred_capacity * 2;
+        b->preds = realloc(b->preds, sizeof(size_t) * b->pred_capacity);
+        b->executable = realloc(b->executable, sizeof(bool) * b->pred_capacity);
+        for (size_t j = 0; j < b->phi_count; j++) {
+            IrValue* phi = &ir->values[b->phis[j]];
+            phi->operands = realloc(phi->operands, sizeof(size_t) * b->pred_capacity);
+        }
+    }
+    const size_t edge = b->pred_count++;
+    b->preds[edge] = pred;
+    b->executable[edge] = false;
+    for (size_t j = 0; j < b->phi_count; j++) {
+        IrValue* phi = &ir->values[b->phis[j]];
+        phi->operands[edge] = exits[j];
+        phi->operand_count = b->pred_count;
+    }
+    return edge;
+}
+
+static void push_observed(IrBlock* block, const size_t* stack, size_t height) {
+    block->observed = realloc(block->observed, sizeof(size_t) * (block->observed_count + height + 1));
+    memcpy(block->observed + block->observed_count, stack, sizeof(size_t) * height);
+    block->observed_count += height;
+}
+
+static size_t new_binary(IrFunction* ir, uint8_t opcode, size_t block, size_t left, size_t right) {
+    const size_t value = new_value(ir, IR_BINARY, block, 2);
+    ir->values[value].opcode = opcode;
+    ir->values[value].operands[0] = left;
+    ir->values[value].operands[1] = right;
+    return value;
+}
+
+// Symbolically executes a block's instructions over a stack of value ids
+static void build_block(IrFunction* ir, size_t index, const size_t* block_of, size_t* stack) {
+    const Chunk* chunk = ir->chunk;
+    IrBlock* block = &ir->blocks[index];
+    size_t height = block->phi_count;
+    memcpy(stack, block->phis, sizeof(size_t) * height);
+    block->terminator = IR_JUMP;
+    block->succ_count = 1;
+    block->succs[0] = block_of[block->end];
+
+    for (size_t i = block->start; i < block->end; i++) {
+        const Instruction inst = chunk->code.code[i];
+        const uint64_t operand = get_operand(inst);
+        const uint8_t op = get_opcode(inst);
+        size_t value;
+        if (is_binary_opcode(op)) {
+            value = new_binary(ir, op, index, stack[height - 2], stack[height - 1]);
+            ir->produced[i] = value;
+            height -= 2;
+            stack[height++] = value;
+            continue;
+        }
+        switch (op) {
+            case OP_CONSTANT:
+                value = new_value(ir, IR_CONST, index, 0);
+                ir->values[value].constant = chunk->constants.values[operand];
+                ir->produced[i] = value;
+                stack[height++] = value;
+                break;
+            case OP_DUP:
+                value = new_value(ir, IR_COPY, index, 1);
+                ir->values[value].operands[0] = stack[height - 1];
+                ir->produced[i] = value;
+                stack[height++] = value;
+                break;
+            case OP_SWAP:
+                value = stack[height - 1];
+                ir->moved[2 * i] = value;
+                ir->moved[2 * i + 1] = stack[height - 2];
+                stack[height - 1] = stack[height - 2];
+                stack[height - 2] = value;
+                break;
+            case OP_POP:
+                ir->moved[2 * i] = stack[--height];
+                break;
+            case OP_GET_LOCAL:
+                push_observed(block, stack, height);
+                value = new_value(ir, IR_LOCAL, index, 0);
+                ir->produced[i] = value;
+                stack[height++] = value;
+                break;
+            case OP_SET_LOCAL:
+                // The slot written may be any of the values on the stack
+                push_observed(block, stack, height);
+                height--;
+                for (size_t k = 0; k < height; k++) stack[k] = new_value(ir, IR_LOCAL, index, 0);
+                push_observed(block, stack, height);
+                break;
+            case OP_CALL:
+                // A CHECKPOINT in the callee shows the caller's stack too
+                push_observed(block, stack, height - operand - 1);
+                value = new_value(ir, IR_CALL, index, operand + 1);
+                memcpy(ir->values[value].operands, stack + height - operand - 1, sizeof(size_t) * (operand + 1));
+                ir->produced[i] = value;
+                height -= operand + 1;
+                stack[height++] = value;
+                break;
+            case OP_CHECKPOINT:
+                push_observed(block, stack, height);
+                break;
+            case OP_HALT:
+                push_observed(block, stack, height);
+                block->terminator = IR_HALT;
+                block->succ_count = 0;
+                break;
+            case OP_RETURN:
+                block->result = stack[--height];
+                block->terminator = IR_RETURN;
+                block->succ_count = 0;
+                break;
+            case OP_JMP:
+                block->succs[0] = block_of[jump_target(chunk, i)];
+                break;
+            case OP_JMP_IF_FALSE:
+                block->condition = stack[--height];
+                block->terminator = IR_BRANCH;
+                block->succ_count = 2;
+                block->succs[0] = block_of[i + 1];
+                block->succs[1] = block_of[jump_target(chunk, i)];
+                break;
+            case OP_JMP_IF_EQUAL:
+            case OP_JMP_IF_NOT_EQUAL:
+            case OP_JMP_IF_LESS:
+            case OP_JMP_IF_LESS_EQUAL:
+            case OP_JMP_IF_GREATER:
+            case OP_JMP_IF_GREATER_EQUAL:
+                // Jumps when the comparison holds
+                value = new_binary(ir, jump_comparison(op), index, stack[height - 2], stack[height - 1]);
+                ir->produced[i] = value;
+                height -= 2;
+                block->condition = value;
+                block->terminator = IR_BRANCH;
+                block->succ_count = 2;
+                block->succs[0] = block_of[jump_target(chunk, i)];
+                block->succs[1] = block_of[i + 1];
+                break;
+            default:
+                break;
+        }
+    }
+    block->exits = malloc(sizeof(size_t) * (height ? height : 1));
+    memcpy(block->exits, stack, sizeof(size_t) * height);
+    block->exit_count = height;
+}
+
+int ir_build(IrFunction* ir, const Chunk* chunk) {
+    memset(ir, 0, sizeof(IrFunction));
+    ir->chunk = chunk;
+    const size_t count = chunk->code.count;
+    // Handler edges are not modelled as block successors
+    if (chunk->handlers.count > 0) return -1;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t op = get_opcode(chunk->code.code[i]);
+        if (is_binary_opcode(op) || is_jump_opcode(op)) continue;
+        switch (op) {
+            case OP_CONSTANT: case OP_CALL: case OP_CHECKPOINT: case OP_HALT: case OP_RETURN:
+            case OP_DUP: case OP_SWAP: case OP_POP: case OP_GET_LOCAL: case OP_SET_LOCAL:
+                break;
+            default:
+                return -1;
+        }
+    }
+    int64_t* heights = malloc(sizeof(int64_t) * (count ? count : 1));
+    if (!chunk->verified || stack_heights(chunk, heights) != 0) {
+        free(heights);
+        return -1;
+    }
+    ir->param_count = chunk->stack_needed;
+
+    // Leaders start basic blocks: the entry, jump targets and whatever
+    // follows a jump or a terminator
+    bool* leader = calloc(count + 1, sizeof(bool));
+    leader[0] = true;
+    for (size_t i = 0; i < count; i++) {
+        if (heights[i] == UNVISITED) continue;
+        const uint8_t op = get_opcode(chunk->code.code[i]);
+        if (is_jump_opcode(op)) leader[jump_target(chunk, i)] = true;
+        if (is_jump_opcode(op) || op == OP_RETURN || op == OP_HALT) leader[i + 1] = true;
+    }
+    size_t* block_of = malloc(sizeof(size_t) * (count + 1));
+    ir->produced = malloc(sizeof(size_t) * count);
+    ir->moved = malloc(sizeof(size_t) * 2 * count);
+    size_t block_capacity = 0;
+    for (size_t i = 0; i <= count; i++) block_of[i] = IR_NONE;
+    for (size_t i = 0; i < count; i++) {
+        ir->produced[i] = IR_NONE;
+        ir->moved[2 * i] = ir->moved[2 * i + 1] = IR_NONE;
+        if (heights[i] == UNVISITED) continue;
+        if (leader[i]) {
+            if (ir->block_count == block_capacity) {
+                block_capacity = block_capacity < 8 ? 8 : block_capacity * 2;
+                ir->blocks = realloc(ir->blocks, sizeof(IrBlock) * block_capacity);
+            }
+            IrBlock* block = &ir->blocks[ir->block_count++];
+            memset(block, 0, sizeof(IrBlock));
+            block->start = i;
+            block->folded = -1;
+            block->idom = IR_NONE;
+            block->loop_header = IR_NONE;
+        }
+        block_of[i] = ir->block_count - 1;
+        ir->blocks[ir->block_count - 1].end = i + 1;
+    }
+
+    // Every entry slot is a phi; the function entry feeds the first block's
+    // phis with the params
+    size_t max_height = ir->param_count;
+    for (size_t b = 0; b < ir->block_count; b++) {
+        IrBlock* block = &ir->blocks[b];
+        block->phi_count = ir->param_count + (size_t)heights[block->start];
+        block->phis = malloc(sizeof(size_t) * (block->phi_count ? block->phi_count : 1));
+        for (size_t j = 0; j < block->phi_count; j++) {
+            block->phis[j] = new_value(ir, IR_PHI, b, 0);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (heights[i] != UNVISITED && ir->param_count + (size_t)heights[i] + 1 > max_height) {
+            max_height = ir->param_count + (size_t)heights[i] + 1;
+        }
+    }
+    size_t* params = malloc(sizeof(size_t) * (ir->param_count ? ir->param_count : 1));
+    for (size_t k = 0; k < ir->param_count; k++) params[k] = new_value(ir, IR_PARAM, IR_NONE, 0);
+    add_edge(ir, 0, IR_NONE, params);
+    free(params);
+
+    size_t* stack = malloc(sizeof(size_t) * (max_height + 1));
+    for (size_t b = 0; b < ir->block_count; b++) build_block(ir, b, block_of, stack);
+    free(stack);
+
+    for (size_t b = 0; b < ir->block_count; b++) {
+        IrBlock* block = &ir->blocks[b];
+        for (size_t s = 0; s < block->succ_count; s++) {
+            block->succ_edges[s] = add_edge(ir, block->succs[s], b, block->exits);
+        }
+    }
+    free(leader);
+    free(block_of);
+    free(heights);
+    return 0;
+}
+
+void ir_free(IrFunction* ir) {
+    for (size_t i = 0; i < ir->value_count; i++) free(ir->values[i].operands);
+    for (size_t b = 0; b < ir->block_count; b++) {
+        free(ir->blocks[b].phis);
+        free(ir->blocks[b].preds);
+        free(ir->blocks[b].executable);
+        free(ir->blocks[b].exits);
+        free(ir->blocks[b].observed);
+    }
+    free(ir->values);
+    free(ir->blocks);
+    free(ir->produced);
+    free(ir->moved);
+    memset(ir, 0, sizeof(IrFunction));
+}
+
+typedef struct {
+    size_t position;
+    size_t block;
+} JumpFixup;
+
+typedef struct {
+    Chunk* out;
+    size_t* labels;
+    JumpFixup* fixups;
+    size_t fixup_count;
+    size_t fixup_capacity;
+    size_t first_folded_constant;
+} Emitter;
+
+static void emit_jump(Emitter* emitter, uint8_t op, size_t block) {
+    if (emitter->fixup_count == emitter->fixup_capacity) {
+        emitter->fixup_capacity = emitter->fixup_capacity < 8 ? 8 : emitter->fixup_capacity * 2;
+        emitter->fixups = realloc(emitter->fixups, sizeof(JumpFixup) * emitter->fixup_capacity);
+    }
+    emitter->fixups[emitter->fixup_count++] = (JumpFixup){emitter->out->code.count, block};
+    write_instruction(emitter->out, make_instruction(op, 0));
+}
+
+static bool same_constant(Value a, Value b) {
+    if (a.type != b.type) return false;
+    // Doubles compare bitwise, so 0.0 and -0.0 stay apart
+    if (a.type == VAL_NUMBER || a.type == VAL_DOUBLE) return a.as.number == b.as.number;
+    if (a.type == VAL_FUNCTION) return a.as.function == b.as.function;
+    if (a.type == VAL_STRING) return strcmp(a.as.string, b.as.string) == 0;
+    return true;
+}
+
+// Pool index for a folded value; folded values are few, so a linear search
+// over the ones added so far keeps the pool free of duplicates
+static size_t folded_constant(Emitter* emitter, Value value) {
+    const ConstantPool* pool = &emitter->out->constants;
+    for (size_t i = emitter->first_folded_constant; i < pool->count; i++) {
+        if (same_constant(pool->values[i], value)) return i;
+    }
+    return add_constant(emitter->out, value);
+}
+
+static void emit_block(const IrFunction* ir, size_t index, size_t next, Emitter* emitter, IrStats* stats) {
+    const IrBlock* block = &ir->blocks[index];
+    Chunk* out = emitter->out;
+    for (size_t i = block->start; i < block->end; i++) {
+        const Instruction inst = ir->chunk->code.code[i];
+        const uint8_t op = get_opcode(inst);
+        const size_t produced = ir->produced[i];
+        const size_t* moved = &ir->moved[2 * i];
+        if (is_jump_opcode(op)) continue; // generated from the terminator below
+        switch (op) {
+            case OP_CONSTANT:
+            case OP_GET_LOCAL:
+                if (ir->values[produced].physical) write_instruction(out, inst);
+                break;
+            case OP_SWAP:
+                // With only one of the two pushed there is nothing to exchange
+                if (ir->values[moved[0]].physical && ir->values[moved[1]].physical) write_instruction(out, inst);
+                break;
+            case OP_POP:
+                if (ir->values[moved[0]].physical) write_instruction(out, inst);
+                break;
+            case OP_SET_LOCAL:
+            case OP_CALL:
+            case OP_CHECKPOINT:
+            case OP_HALT:
+            case OP_RETURN:
+                write_instruction(out, inst);
+                break;
+            default: {
+                // DUP's copy, an arithmetic or a comparison
+                const IrValue* value = &ir->values[produced];
+                if (!value->physical) break;
+                bool operands_pushed = false;
+                for (size_t k = 0; k < value->operand_count; k++) {
+                    operands_pushed |= ir->values[value->operands[k]].physical;
+                }
+                if (value->lattice == IR_KNOWN && !operands_pushed) {
+                    write_instruction(out, make_instruction(OP_CONSTANT, folded_constant(emitter, value->known)));
+                    stats->folded_values++;
+                } else {
+                    write_instruction(out, inst);
+                }
+                break;
+            }
+        }
+    }
+
+    if (block->terminator == IR_JUMP) {
+        if (block->succs[0] != next) emit_jump(emitter, OP_JMP, block->succs[0]);
+    } else if (block->terminator == IR_BRANCH) {
+        // JMP_IF_FALSE jumps to the falsey successor, a compare-and-branch
+        // to the truthy one
+        const uint8_t op = get_opcode(ir->chunk->code.code[block->end - 1]);
+        const int jumps_to = op == OP_JMP_IF_FALSE ? 1 : 0;
+        size_t taken = block->succs[1 - jumps_to];
+        if (block->folded < 0) {
+            emit_jump(emitter, op, block->succs[jumps_to]);
+        } else {
+            stats->folded_branches++;
+            taken = block->succs[block->folded];
+            if (ir->values[block->condition].physical) {
+                // The condition or the compared values are on the stack
+                // anyway: a branch that is always taken, or one that just
+                // pops them and falls through
+                if (block->folded == jumps_to) {
+                    emit_jump(emitter, op, taken);
+                } else {
+                    write_instruction(out, make_instruction(op, 0));
+                }
+            }
+        }
+        if (taken != next) emit_jump(emitter, OP_JMP, taken);
+    }
+}
+
+void ir_codegen(const IrFunction* ir, Chunk* out, IrStats* stats) {
+    init_chunk(out);
+    for (size_t i = 0; i < ir->chunk->constants.count; i++) add_constant(out, ir->chunk->constants.values[i]);
+
+    Emitter emitter = {0};
+    emitter.out = out;
+    emitter.first_folded_constant = out->constants.count;
+    emitter.labels = malloc(sizeof(size_t) * (ir->block_count ? ir->block_count : 1));
+    for (size_t b = 0; b < ir->block_count; b++) {
+        if (!ir->blocks[b].reachable) continue;
+        size_t next = b + 1;
+        while (next < ir->block_count && !ir->blocks[next].reachable) next++;
+        emitter.labels[b] = out->code.count;
+        emit_block(ir, b, next, &emitter, stats);
+    }
+    for (size_t i = 0; i < emitter.fixup_count; i++) {
+        const JumpFixup fixup = emitter.fixups[i];
+        const int64_t offset = (int64_t)emitter.labels[fixup.block] - (int64_t)(fixup.position + 1);
+        const uint8_t op = get_opcode(out->code.code[fixup.position]);
+        out->code.code[fixup.position] = make_instruction(op, (uint64_t)offset);
+    }
+    free(emitter.labels);
+    free(emitter.fixups);
+}
+
+static bool is_falsey(Value value) {
+    return value.type == VAL_NULL || (value.type == VAL_NUMBER && value.as.number == 0) ||
+           (value.type == VAL_DOUBLE && value.as.fp_number == 0);
+}
+
+// Moves a value down the lattice; returns true if it moved
+static bool lower(IrValue* value, IrLattice lattice, Value known) {
+    if (value->lattice == IR_VARYING || lattice == IR_UNKNOWN) return false;
+    if (lattice == IR_VARYING || (value->lattice == IR_KNOWN && !same_constant(value->known, known))) {
+        value->lattice = IR_VARYING;
+        return true;
+    }
+    if (value->lattice == IR_KNOWN) return false;
+    value->lattice = IR_KNOWN;
+    value->known = known;
+    return true;
+}
+
+static bool mark_edge(IrFunction* ir, size_t block, size_t s) {
+    const IrBlock* from = &ir->blocks[block];
+    IrBlock* to = &ir->blocks[from->succs[s]];
+    if (to->executable[from->succ_edges[s]]) return false;
+    to->executable[from->succ_edges[s]] = true;
+    to->reachable = true;
+    return true;
+}
+
+static bool evaluate_phi(IrFunction* ir, size_t block, size_t phi) {
+    const IrBlock* b = &ir->blocks[block];
+    IrLattice lattice = IR_UNKNOWN;
+    Value known = {0};
+    for (size_t e = 0; e < b->pred_count && lattice != IR_VARYING; e++) {
+        if (!b->executable[e]) continue;
+        const IrValue* operand = &ir->values[ir->values[phi].operands[e]];
+        if (operand->lattice == IR_VARYING) {
+            lattice = IR_VARYING;
+        } else if (operand->lattice == IR_KNOWN) {
+            if (lattice == IR_UNKNOWN) {
+                lattice = IR_KNOWN;
+                known = operand->known;
+            } else if (!same_constant(known, operand->known)) {
+                lattice = IR_VARYING;
+            }
+        }
+    }
+    return lower(&ir->values[phi], lattice, known);
+}
+
+static bool evaluate_value(IrFunction* ir, size_t v) {
+    IrValue* value = &ir->values[v];
+    switch (value->op) {
+        case IR_CONST:
+            return lower(value, IR_KNOWN, value->constant);
+        case IR_BINARY: {
+            const IrValue* a = &ir->values[value->operands[0]];
+            const IrValue* b = &ir->values[value->operands[1]];
+            if (a->lattice == IR_VARYING || b->lattice == IR_VARYING) return lower(value, IR_VARYING, value->known);
+            if (a->lattice != IR_KNOWN || b->lattice != IR_KNOWN) return false;
+            // numeric_binary is what vm_run does with numbers. Anything
+            // else, and division by zero, is left to raise its error at run
+            // time.
+            Value result;
+            if (numeric_binary(value->opcode, a->known, b->known, &result) != NUMERIC_OK) {
+                return lower(value, IR_VARYING, value->known);
+            }
+            return lower(value, IR_KNOWN, result);
+        }
+        case IR_COPY: {
+            const IrValue* original = &ir->values[value->operands[0]];
+            return lower(value, original->lattice, original->known);
+        }
+        default:
+            return lower(value, IR_VARYING, value->known);
+    }
+}
+
+typedef struct {
+    uint64_t key[3];
+    size_t value;
+} NumberSlot;
+
+typedef struct {
+    NumberSlot* slots;
+    size_t capacity;
+} NumberTable;
+
+// Returns the value already numbered under key, or records value under it
+static size_t number_lookup(NumberTable* table, uint64_t k0, uint64_t k1, uint64_t k2, size_t value) {
+    uint64_t hash = 14695981039346656037ULL;
+    const uint64_t key[3] = {k0, k1, k2};
+    for (int i = 0; i < 3; i++) {
+        hash ^= key[i];
+        hash *= 1099511628211ULL;
+    }
+    for (size_t i = hash & (table->capacity - 1);; i = (i + 1) & (table->capacity - 1)) {
+        NumberSlot* slot = &table->slots[i];
+        if (slot->value == IR_NONE) {
+            memcpy(slot->key, key, sizeof(key));
+            slot->value = value;
+            return value;
+        }
+        if (memcmp(slot->key, key, sizeof(key)) == 0) return slot->value;
+    }
+}
+
+static size_t value_number(IrFunction* ir, NumberTable* table, size_t v) {
+    const IrValue* value = &ir->values[v];
+    if (value->lattice == IR_KNOWN) {
+        const uint64_t payload = value->known.type == VAL_NUMBER || value->known.type == VAL_DOUBLE
+                               ? (uint64_t)value->known.as.number
+                               : (uint64_t)(uintptr_t)value->known.as.function;
+        return number_lookup(table, 1, value->known.type, payload, v);
+    }
+    if (value->op == IR_COPY) return ir->values[value->operands[0]].number;
+    if (value->op == IR_BINARY) {
+        // Order the operand numbers of the operators that commute
+        size_t a = ir->values[value->operands[0]].number;
+        size_t b = ir->values[value->operands[1]].number;
+        const bool commutes = value->opcode == OP_ADD || value->opcode == OP_MUL || value->opcode == OP_EQUAL ||
+                              value->opcode == OP_NOT_EQUAL;
+        if (commutes && a > b) {
+            const size_t t = a;
+            a = b;
+            b = t;
+        }
+        return number_lookup(table, 2 + (uint64_t)value->opcode, a, b, v);
+    }
+    if (value->op == IR_PHI) {
+        // A phi whose incoming values are all congruent, ignoring the phi
+        // itself on back edges, is congruent to them
+        const IrBlock* block = &ir->blocks[value->block];
+        size_t number = IR_NONE;
+        for (size_t e = 0; e < block->pred_count; e++) {
+            if (!block->executable[e]) continue;
+            const size_t operand = ir->values[value->operands[e]].number;
+            if (operand == value->number) continue;
+            if (number == IR_NONE) {
+                number = operand;
+            } else if (number != operand) {
+                return v;
+            }
+        }
+        return number == IR_NONE ? v : number;
+    }
+    return v;
+}
+
+void ir_number_values(IrFunction* ir, IrStats* stats) {
+    for (size_t v = 0; v < ir->value_count; v++) {
+        const IrOp op = ir->values[v].op;
+        ir->values[v].lattice = op == IR_PARAM || op == IR_LOCAL ? IR_VARYING : IR_UNKNOWN;
+        ir->values[v].number = v;
+    }
+    for (size_t b = 0; b < ir->block_count; b++) {
+        IrBlock* block = &ir->blocks[b];
+        block->reachable = false;
+        block->folded = -1;
+        for (size_t e = 0; e < block->pred_count; e++) block->executable[e] = false;
+    }
+    ir->blocks[0].reachable = true;
+    ir->blocks[0].executable[0] = true;
+
+    // Constant propagation only follows edges that can execute given the
+    // constants found so far, so branches on constants fold
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < ir->block_count; b++) {
+            const IrBlock* block = &ir->blocks[b];
+            if (!block->reachable) continue;
+            for (size_t j = 0; j < block->phi_count; j++) changed |= evaluate_phi(ir, b, block->phis[j]);
+            for (size_t i = block->start; i < block->end; i++) {
+                if (ir->produced[i] != IR_NONE) changed |= evaluate_value(ir, ir->produced[i]);
+            }
+            if (block->terminator == IR_JUMP) {
+                changed |= mark_edge(ir, b, 0);
+            } else if (block->terminator == IR_BRANCH) {
+                const IrValue* condition = &ir->values[block->condition];
+                if (condition->lattice == IR_KNOWN) {
+                    changed |= mark_edge(ir, b, is_falsey(condition->known) ? 1 : 0);
+                } else if (condition->lattice == IR_VARYING) {
+                    changed |= mark_edge(ir, b, 0);
+                    changed |= mark_edge(ir, b, 1);
+                }
+            }
+        }
+    }
+    for (size_t b = 0; b < ir->block_count; b++) {
+        IrBlock* block = &ir->blocks[b];
+        if (block->reachable && block->terminator == IR_BRANCH && ir->values[block->condition].lattice == IR_KNOWN) {
+            block->folded = is_falsey(ir->values[block->condition].known) ? 1 : 0;
+        }
+    }
+
+    // Value numbering over the executable blocks, repeated until the phis
+    // in loops settle
+    NumberTable table;
+    table.capacity = 16;
+    while (table.capacity < ir->value_count * 2) table.capacity *= 2;
+    table.slots = malloc(sizeof(NumberSlot) * table.capacity);
+    changed = true;
+    for (size_t round = 0; changed && round <= ir->block_count + 1; round++) {
+        changed = false;
+        for (size_t i = 0; i < table.capacity; i++) table.slots[i].value = IR_NONE;
+        for (size_t b = 0; b < ir->block_count; b++) {
+            const IrBlock* block = &ir->blocks[b];
+            if (!block->reachable) continue;
+            for (size_t j = 0; j < block->phi_count; j++) {
+                const size_t number = value_number(ir, &table, block->phis[j]);
+                changed |= number != ir->values[block->phis[j]].number;
+                ir->values[block->phis[j]].number = number;
+            }
+            for (size_t i = block->start; i < block->end; i++) {
+                const size_t v = ir->produced[i];
+                if (v == IR_NONE) continue;
+                const size_t number = value_number(ir, &table, v);
+                changed |= number != ir->values[v].number;
+                ir->values[v].number = number;
+            }
+        }
+    }
+    free(table.slots);
+
+    for (size_t v = 0; v < ir->value_count; v++) {
+        const IrValue* value = &ir->values[v];
+        if (value->op != IR_PARAM && value->number != v && ir->blocks[value->block].reachable) {
+            stats->congruent_values++;
+        }
+    }
+}
+
+static size_t rpo_order(const IrFunction* ir, size_t* order, size_t* rpo_index) {
+    // Iterative depth-first search over executable edges
+    size_t* stack = malloc(sizeof(size_t) * ir->block_count);
+    size_t* next_succ = calloc(ir->block_count, sizeof(size_t));
+    bool* seen = calloc(ir->block_count, sizeof(bool));
+    size_t depth = 0, count = 0;
+    stack[depth++] = 0;
+    seen[0] = true;
+    size_t* postorder = malloc(sizeof(size_t) * ir->block_count);
+    while (depth > 0) {
+        const size_t b = stack[depth - 1];
+        const IrBlock* block = &ir->blocks[b];
+        if (next_succ[b] < block->succ_count) {
+            const size_t s = next_succ[b]++;
+            const size_t succ = block->succs[s];
+            if (ir->blocks[succ].executable[block->succ_edges[s]] && !seen[succ]) {
+                seen[succ] = true;
+                stack[depth++] = succ;
+            }
+        } else {
+            postorder[count++] = b;
+            depth--;
+        }
+    }
+    for (size_t i = 0; i < ir->block_count; i++) rpo_index[i] = IR_NONE;
+    for (size_t i = 0; i < count; i++) {
+        order[i] = postorder[count - 1 - i];
+        rpo_index[order[i]] = i;
+    }
+    free(postorder);
+    free(stack);
+    free(next_succ);
+    free(seen);
+    return count;
+}
+
+static bool dominates(const IrFunction* ir, size_t a, size_t b) {
+    while (b != a && b != 0) b = ir->blocks[b].idom;
+    return b == a;
+}
+
+static bool defined_outside(const IrValue* value, const bool* in_loop) {
+    return value->block == IR_NONE || !in_loop[value->block];
+}
+
+// Marks the invariant values of the loop headed by header, whose body is in_loop
+static void mark_invariants(IrFunction* ir, size_t header, const bool* in_loop, IrStats* stats) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < ir->block_count; b++) {
+            if (!in_loop[b]) continue;
+            const IrBlock* block = &ir->blocks[b];
+            for (size_t j = 0; j < block->phi_count; j++) {
+                IrValue* phi = &ir->values[block->phis[j]];
+                if (phi->invariant) continue;
+                // Invariant if every value flowing in is the same value from
+                // outside the loop, or the phi itself coming round again
+                size_t number = IR_NONE;
+                bool invariant = true;
+                for (size_t e = 0; e < block->pred_count && invariant; e++) {
+                    if (!block->executable[e]) continue;
+                    const size_t operand = phi->operands[e];
+                    const IrValue* value = &ir->values[operand];
+                    if (operand == block->phis[j]) continue;
+                    if (!defined_outside(value, in_loop) && !value->invariant) {
+                        invariant = value->number == phi->number;
+                    } else if (number == IR_NONE) {
+                        number = value->number;
+                    } else if (number != value->number) {
+                        invariant = false;
+                    }
+                }
+                if (invariant && number != IR_NONE) {
+                    phi->invariant = true;
+                    if (b == header) phi->number = number;
+                    stats->invariant_values++;
+                    changed = true;
+                }
+            }
+            for (size_t i = block->start; i < block->end; i++) {
+                const size_t v = ir->produced[i];
+                if (v == IR_NONE || ir->values[v].invariant || ir->values[v].op == IR_CALL ||
+                    ir->values[v].op == IR_LOCAL) {
+                    continue;
+                }
+                bool invariant = true;
+                for (size_t k = 0; k < ir->values[v].operand_count; k++) {
+                    const IrValue* operand = &ir->values[ir->values[v].operands[k]];
+                    if (!defined_outside(operand, in_loop) && !operand->invariant) invariant = false;
+                }
+                if (invariant) {
+                    ir->values[v].invariant = true;
+                    if (ir->values[v].op != IR_CONST) stats->invariant_values++;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+void ir_mark_invariants(IrFunction* ir, IrStats* stats) {
+    if (ir->block_count == 0) return;
+    size_t* order = malloc(sizeof(size_t) * ir->block_count);
+    size_t* rpo_index = malloc(sizeof(size_t) * ir->block_count);
+    const size_t count = rpo_order(ir, order, rpo_index);
+
+    // Dominators by the iterative algorithm of Cooper, Harvey and Kennedy
+    for (size_t b = 0; b < ir->block_count; b++) {
+        ir->blocks[b].idom = IR_NONE;
+        ir->blocks[b].loop_header = IR_NONE;
+    }
+    for (size_t v = 0; v < ir->value_count; v++) ir->values[v].invariant = false;
+    ir->blocks[0].idom = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < count; i++) {
+            IrBlock* block = &ir->blocks[order[i]];
+            size_t idom = IR_NONE;
+            for (size_t e = 0; e < block->pred_count; e++) {
+                size_t pred = block->preds[e];
+                if (!block->executable[e] || pred == IR_NONE || ir->blocks[pred].idom == IR_NONE) continue;
+                if (idom == IR_NONE) {
+                    idom = pred;
+                    continue;
+                }
+                while (pred != idom) {
+                    while (rpo_index[pred] > rpo_index[idom]) pred = ir->blocks[pred].idom;
+                    while (rpo_index[idom] > rpo_index[pred]) idom = ir->blocks[idom].idom;
+                }
+            }
+            if (idom != block->idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    // Each header's natural loop is everything that reaches one of its back
+    // edges without passing through the header. Headers are visited in
+    // reverse order so that inner loops claim their blocks last.
+    bool* in_loop = malloc(sizeof(bool) * ir->block_count);
+    size_t* worklist = malloc(sizeof(size_t) * ir->block_count);
+    for (size_t i = count; i-- > 0;) {
+        const size_t header = order[i];
+        const IrBlock* h = &ir->blocks[header];
+        size_t pending = 0;
+        memset(in_loop, 0, sizeof(bool) * ir->block_count);
+        in_loop[header] = true;
+        for (size_t e = 0; e < h->pred_count; e++) {
+            const size_t latch = h->preds[e];
+            if (!h->executable[e] || latch == IR_NONE || !dominates(ir, header, latch) || in_loop[latch]) continue;
+            in_loop[latch] = true;
+            worklist[pending++] = latch;
+        }
+        bool is_header = pending > 0;
+        for (size_t e = 0; e < h->pred_count && !is_header; e++) {
+            // A block that jumps to itself
+            is_header = h->executable[e] && h->preds[e] == header;
+        }
+        if (!is_header) continue;
+        while (pending > 0) {
+            const IrBlock* block = &ir->blocks[worklist[--pending]];
+            for (size_t e = 0; e < block->pred_count; e++) {
+                const size_t pred = block->preds[e];
+                if (!block->executable[e] || pred == IR_NONE || in_loop[pred]) continue;
+                in_loop[pred] = true;
+                worklist[pending++] = pred;
+            }
+        }
+        for (size_t b = 0; b < ir->block_count; b++) {
+            if (in_loop[b]) ir->blocks[b].loop_header = header;
+        }
+        mark_invariants(ir, header, in_loop, stats);
+    }
+    free(in_loop);
+    free(worklist);
+    free(order);
+    free(rpo_index);
+}
+
+static bool make_physical(IrFunction* ir, size_t v) {
+    if (ir->values[v].physical) return false;
+    ir->values[v].physical = true;
+    return true;
+}
+
+// Arithmetic and the ordered comparisons raise an error on operands that
+// are not numbers and on division by zero, so they stay unless they folded
+static bool may_fail(const IrValue* value) {
+    return value->op == IR_BINARY && value->opcode != OP_EQUAL && value->opcode != OP_NOT_EQUAL &&
+           value->lattice != IR_KNOWN;
+}
+
+void ir_remove_dead_stores(IrFunction* ir) {
+    // Values the generated code observes or consumes, and operations that
+    // may raise an error, are roots. A value on the stack has to be consumed
+    // by its one consumer, so physical-ness also flows forward from
+    // operands, and across edges to the phis of every successor sharing the
+    // same exit stack.
+    for (size_t v = 0; v < ir->value_count; v++) ir->values[v].physical = ir->values[v].op == IR_PARAM;
+    for (size_t b = 0; b < ir->block_count; b++) {
+        const IrBlock* block = &ir->blocks[b];
+        if (!block->reachable) continue;
+        for (size_t i = 0; i < block->observed_count; i++) make_physical(ir, block->observed[i]);
+        if (block->terminator == IR_BRANCH && block->folded < 0) make_physical(ir, block->condition);
+        if (block->terminator == IR_RETURN) make_physical(ir, block->result);
+        for (size_t i = block->start; i < block->end; i++) {
+            const size_t v = ir->produced[i];
+            if (v != IR_NONE && (ir->values[v].op == IR_CALL || may_fail(&ir->values[v]))) make_physical(ir, v);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < ir->block_count; b++) {
+            const IrBlock* block = &ir->blocks[b];
+            if (!block->reachable) continue;
+            for (size_t j = 0; j < block->phi_count; j++) {
+                const size_t phi = block->phis[j];
+                for (size_t e = 0; e < block->pred_count; e++) {
+                    if (!block->executable[e]) continue;
+                    if (ir->values[phi].physical) changed |= make_physical(ir, ir->values[phi].operands[e]);
+                    if (ir->values[ir->values[phi].operands[e]].physical) changed |= make_physical(ir, phi);
+                }
+            }
+            for (size_t i = block->start; i < block->end; i++) {
+                const size_t v = ir->produced[i];
+                if (v == IR_NONE) continue;
+                IrValue* value = &ir->values[v];
+                bool operand_physical = false;
+                for (size_t k = 0; k < value->operand_count; k++) {
+                    operand_physical |= ir->values[value->operands[k]].physical;
+                }
+                if (operand_physical) changed |= make_physical(ir, v);
+                // A known value is pushed as a constant unless one of its
+                // operands is already on the stack and must be consumed
+                if (value->physical && (value->op == IR_CALL || value->lattice != IR_KNOWN || operand_physical)) {
+                    for (size_t k = 0; k < value->operand_count; k++) {
+                        changed |= make_physical(ir, value->operands[k]);
+                    }
+                }
+            }
+            if (block->succ_count == 2 && block->folded < 0) {
+                const IrBlock* taken = &ir->blocks[block->succs[0]];
+                const IrBlock* other = &ir->blocks[block->succs[1]];
+                for (size_t j = 0; j < block->exit_count; j++) {
+                    if (ir->values[taken->phis[j]].physical || ir->values[other->phis[j]].physical) {
+                        changed |= make_physical(ir, taken->phis[j]);
+                        changed |= make_physical(ir, other->phis[j]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+typedef struct {
+    Chunk** chunks;
+    size_t count;
+    size_t capacity;
+} ChunkList;
+
+static void optimize_one(Chunk* chunk, IrStats* stats) {
+    IrFunction ir;
+    if (ir_build(&ir, chunk) != 0) {
+        ir_free(&ir);
+        stats->skipped_chunks++;
+        return;
+    }
+    IrStats local = *stats;
+    ir_number_values(&ir, &local);
+    ir_mark_invariants(&ir, &local);
+    ir_remove_dead_stores(&ir);
+    Chunk out;
+    ir_codegen(&ir, &out, &local);
+    ir_free(&ir);
+
+    if (out.code.count > chunk->code.count || verify_chunk(&out) != 0) {
+        free_chunk(&out);
+        stats->skipped_chunks++;
+        return;
+    }
+    local.removed_instructions += chunk->code.count - out.code.count;
+    *stats = local;
+    free(chunk->code.code);
+    // ir_codegen copied every constant with add_constant
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        if (chunk->constants.values[i].type == VAL_STRING) free(chunk->constants.values[i].as.string);
+    }
+    free(chunk->constants.values);
+    *chunk = out;
+}
+
+static void optimize_recursive(Chunk* chunk, ChunkList* visited, IrStats* stats) {
+    for (size_t i = 0; i < visited->count; i++) {
+        if (visited->chunks[i] == chunk) return;
+    }
+    if (visited->count == visited->capacity) {
+        visited->capacity = visited->capacity < 8 ? 8 : visited->capacity * 2;
+        visited->chunks = realloc(visited->chunks, sizeof(Chunk*) * visited->capacity);
+    }
+    visited->chunks[visited->count++] = chunk;
+
+    optimize_one(chunk, stats);
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        const Value value = chunk->constants.values[i];
+        if (value.type == VAL_FUNCTION) optimize_recursive(value.as.function->chunk, visited, stats);
+    }
+}
+
+int ir_optimize_chunk(Chunk* chunk, IrStats* stats) {
+    IrStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(IrStats));
+    if (verify_chunk(chunk) != 0) return -1;
+
+    ChunkList visited = {0};
+    optimize_recursive(chunk, &visited, stats);
+    for (size_t i = 0; i < visited.count; i++) visited.chunks[i]->verified = false;
+    free(visited.chunks);
+    return verify_chunk(chunk);
+}
@@ -0,0 +1,137 @@
+#ifndef KAPPAVM_IR_H
+#define KAPPAVM_IR_H
+
+#include "chunk.h"
+
+// SSA form of a chunk. Each value-producing instruction defines one value,
+// every stack slot live on entry to a basic block is a phi, and the values a
+// function consumes from below its own pushes are params. Blocks keep the
+// range of source instructions they were built from, and ir_codegen replays
+// that range, so the stack layout at block boundaries is the original one.
+// DUP defines a copy; SWAP and POP only move values about. A local slot may
+// lie anywhere below the top of the stack, so whatever is on the stack at
+// GET_LOCAL or SET_LOCAL stays there, and SET_LOCAL replaces it all with
+// unknown values.
+
+#define IR_NONE SIZE_MAX
+
+typedef enum {
+    IR_PARAM,
+    IR_PHI,
+    IR_CONST,
+    IR_BINARY,
+    IR_COPY,
+    IR_CALL,
+    IR_LOCAL,              // read from a local slot, or overwritten by SET_LOCAL
+} IrOp;
+
+typedef enum {
+    IR_UNKNOWN, // no executable definition seen yet
+    IR_KNOWN,   // always the constant in known
+    IR_VARYING,
+} IrLattice;
+
+typedef struct {
+    IrOp op;
+    size_t block;
+    size_t* operands;      // IR_BINARY: left, right; IR_COPY: the original; IR_CALL: callee, then arguments;
+                           // IR_PHI: one per incoming edge
+    size_t operand_count;
+    Value constant;        // IR_CONST
+    uint8_t opcode;        // IR_BINARY: the arithmetic or comparison
+    // Filled in by ir_number_values and ir_mark_invariants
+    IrLattice lattice;
+    Value known;
+    size_t number;         // congruent values share a number
+    bool invariant;        // loop-invariant inside the loop that defines it
+    // Filled in by ir_remove_dead_stores
+    bool physical;         // must be pushed by the generated code
+} IrValue;
+
+typedef enum {
+    IR_JUMP,
+    IR_BRANCH,
+    IR_RETURN,
+    IR_HALT,
+} IrTerminator;
+
+typedef struct {
+    size_t start;          // source instructions [start, end)
+    size_t end;
+    size_t* phis;          // entry stack, bottom first
+    size_t phi_count;
+    size_t* preds;         // predecessor of each incoming edge; IR_NONE for the function entry
+    bool* executable;      // per incoming edge
+    size_t pred_count;
+    size_t pred_capacity;
+    IrTerminator terminator;
+    // IR_BRANCH: succs[0] is taken when the condition is truthy, succs[1]
+    // when it is falsey. A compare-and-branch's condition is its comparison.
+    // succ_edges holds the incoming edge index in each.
+    size_t succs[2];
+    size_t succ_edges[2];
+    size_t succ_count;
+    size_t condition;      // IR_BRANCH
+    size_t result;         // IR_RETURN
+    size_t* exits;         // stack passed to the successors, bottom first
+    size_t exit_count;
+    size_t* observed;      // values on the stack at each CHECKPOINT, call, local access and the HALT
+    size_t observed_count;
+    // Filled in by ir_number_values
+    bool reachable;
+    int folded;            // index into succs that a constant branch always takes, or -1
+    // Filled in by ir_mark_invariants
+    size_t idom;
+    size_t loop_header;    // innermost loop containing the block, or IR_NONE
+} IrBlock;
+
+typedef struct {
+    const Chunk* chunk;
+    IrBlock* blocks;
+    size_t block_count;
+    IrValue* values;
+    size_t value_count;
+    size_t value_capacity;
+    size_t* produced;      // value defined by each source instruction, or IR_NONE
+    size_t* moved;         // two per source instruction: the value a POP drops, or the two a SWAP
+                           // exchanges, top first; IR_NONE otherwise
+    size_t param_count;
+} IrFunction;
+
+typedef struct {
+    size_t congruent_values;
+    size_t invariant_values;
+    size_t folded_values;
+    size_t folded_branches;
+    size_t removed_instructions;
+    size_t skipped_chunks; // chunks the IR cannot represent, left as they were
+} IrStats;
+
+// Builds the IR for a verified chunk. Returns 0 on success and -1 if the
+// chunk uses instructions the IR does not model.
+int ir_build(IrFunction* ir, const Chunk* chunk);
+void ir_free(IrFunction* ir);
+
+// Sparse conditional constant propagation plus global value numbering:
+// finds executable blocks and edges, constant values and branches, and
+// numbers congruent values alike. Only the constants are used; congruent
+// values are counted, but the code still computes each of them.
+void ir_number_values(IrFunction* ir, IrStats* stats);
+// Finds natural loops and marks values that do not change inside them. It
+// moves nothing; the marks only feed the statistics. Hoisting would need a
+// slot to keep the value in across the loop, and ir_codegen keeps the
+// original stack layout at every block boundary.
+void ir_mark_invariants(IrFunction* ir, IrStats* stats);
+// Decides which values the generated code must push; everything else is a
+// dead store or is rematerialized as a constant.
+void ir_remove_dead_stores(IrFunction* ir);
+// Generates stack bytecode for the executable blocks, in source order.
+// Constants for folded values are appended to out's pool.
+void ir_codegen(const IrFunction* ir, Chunk* out, IrStats* stats);
+
+// Runs the whole pipeline over a chunk and every function chunk reachable
+// from it, replacing code only where the result is verified and no longer
+// than the original. Returns 0 on success; stats may be NULL.
+int ir_optimize_chunk(Chunk* chunk, IrStats* stats);
+
+#endif //KAPPAVM_IR_H
@@ -0,0 +1,61 @@
+#include "list.h"
+#include <stdlib.h>
+#include <string.h>
+
+void init_list(List* list) {
+    memset(list, 0, sizeof(List));
+    list->kind = ELEMENTS_INTEGER;
+}
+
+void free_list(List* list) {
+    if (list->kind == ELEMENTS_INTEGER) {
+        free(list->as.numbers);
+    } else {
+        free(list->as.items);
+    }
+    init_list(list);
+}
+
+static size_t element_size(const List* list) {
+    return list->kind == ELEMENTS_INTEGER ? sizeof(int64_t) : sizeof(Value);
+}
+
+// Boxes every element, keeping the capacity
+static void make_generic(List* list) {
+    Value* items = malloc(sizeof(Value) * (list->capacity ? list->capacity : 1));
+    for (size_t i = 0; i < list->length; i++) {
+        items[i] = (Value){.type = VAL_NUMBER, .as.number = list->as.numbers[i]};
+    }
+    free(list->as.numbers);
+    list->as.items = items;
+    list->kind = ELEMENTS_GENERIC;
+}
+
+void list_set(List* list, size_t index, Value value) {
+    if (list->kind == ELEMENTS_INTEGER) {
+        if (value.type == VAL_NUMBER) {
+            list->as.numbers[index] = value.as.number;
+            return;
+        }
+        make_generic(list);
+    }
+    list->as.items[index] = value;
+}
+
+void list_push(List* list, Value value) {
+    if (list->kind == ELEMENTS_INTEGER && value.type != VAL_NUMBER) make_generic(list);
+    if (list->length == list->capacity) {
+        list->capacity = list->capacity < 8 ? 8 : list->capacity * 2;
+        if (list->kind == ELEMENTS_INTEGER) {
+            list->as.numbers = realloc(list->as.numbers, sizeof(int64_t) * list->capacity);
+        } else {
+            list->as.items = realloc(list->as.items, sizeof(Value) * list->capacity);
+        }
+    }
+    list->length++;
+    list_set(list, list->length - 1, value);
+}
+
+size_t list_bytes(const List* list) {
+    return sizeof(List) + list->capacity * element_size(list);
+}
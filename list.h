@@ -0,0 +1,28 @@
+#ifndef KAPPAVM_LIST_H
+#define KAPPAVM_LIST_H
+
+#include "value.h"
+
+// Lists start out holding bare int64_t, half the size of a Value, and stay
+// that way while every element stored is an integer. Storing anything else
+// converts the list to an array of Values for good. Lists of integers, the
+// common case for numeric arrays, thus take half the memory and pack twice
+// as many elements into each cache line.
+
+void init_list(List* list);
+void free_list(List* list);
+
+// The element at index, which must be below list->length
+static inline Value list_get(const List* list, size_t index) {
+    if (list->kind == ELEMENTS_INTEGER) return (Value){.type = VAL_NUMBER, .as.number = list->as.numbers[index]};
+    return list->as.items[index];
+}
+
+// Replaces the element at index, which must be below list->length
+void list_set(List* list, size_t index, Value value);
+// Appends value, growing the list geometrically
+void list_push(List* list, Value value);
+// Memory the list holds, for the VM's heap limit
+size_t list_bytes(const List* list);
+
+#endif //KAPPAVM_LIST_H
@@ -1,31 +1,467 @@
 #include "assembler.h"
 #include "chunk.h"
+#include "inliner.h"
+#include "ir.h"
+#include "numeric.h"
+#include "optimizer.h"
+#include "perf_stats.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "server.h"
+#include "snapshot.h"
+#include "string_value.h"
+#include "trace.h"
+#include "verifier.h"
 #include "vm.h"
+#include "zygote.h"
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+static const char *USAGE =
+    "Usage: %s [--dis | --assemble <in> <out> [--jobs <n>] | --optimize <in> <out> |\n"
+    "          --snapshot <file> <out> | --restore <snapshot> | run [--no-cache] <source.kappa> |\n"
+    "          --profile <file> | --perf-stats <file> | --sample <out.folded> <file> | --trace <out.ktrace> <file> |\n"
+    "          --decode-trace <trace.ktrace> <file> | --serve <socket> [--workers <n>] <program>... |\n"
+    "          --zygote [--workers <n>] <program>... | <file>]\n";
+
+static void print_result(VM *vm) {
+    if (vm->stack_top > vm->stack) {
+        const Value result = *(vm->stack_top - 1);
+        if (result.type == VAL_NUMBER) {
+            printf("%lld\n", result.as.number);
+        } else if (result.type == VAL_DOUBLE) {
+            char text[32];
+            format_double(result.as.fp_number, text, sizeof(text));
+            printf("%s\n", text);
+        } else if (is_string(result)) {
+            size_t length;
+            const char *chars = string_chars(&result, &length);
+            printf("%.*s\n", (int)length, chars);
+        } else {
+            printf("[non-number result]\n");
+        }
+    } else {
+        printf("[no result]\n");
+    }
+}
+
+// Runs chunk to completion, recording into profile unless it is NULL
+static void execute(Chunk *chunk, Profile *profile) {
+    VM vm;
+    vm_init(&vm);
+    vm.profile = profile;
+
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = chunk;
+    frame->ip = chunk->code.code;
+    frame->slots = vm.stack;
+
+    // Checkpoints only matter when snapshotting; a plain run goes straight past them
+    while (vm_run(&vm) == VM_CHECKPOINT) {}
+    print_result(&vm);
+    vm_free(&vm);
+}
+
+static char *read_source(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *src = malloc(size + 1);
+    size_t read = fread(src, 1, size, f);
+    fclose(f);
+    src[read] = '\0';
+    return src;
+}
+
+// Assembles a source file in memory, reusing cached function bodies, and runs it
+static int run_source(const char *filename, bool use_cache) {
+    char *src = read_source(filename);
+    if (!src) {
+        fprintf(stderr, "Failed to read source file: %s\n", filename);
+        return 2;
+    }
+    Program program = assemble_program_cached(src, use_cache ? default_cache_dir() : NULL, 0, NULL);
+    free(src);
+    if (program.had_error) {
+        fprintf(stderr, "Failed to assemble %s\n", filename);
+        free_program(&program);
+        return 1;
+    }
+    if (verify_chunk(&program.main_chunk) != 0) {
+        fprintf(stderr, "Bytecode verification failed: %s\n", filename);
+        free_program(&program);
+        return 1;
+    }
+    execute(&program.main_chunk, NULL);
+    free_program(&program);
+    return 0;
+}
+
+// Runs a program up to its first CHECKPOINT and writes the VM image to out_filename
+static int run_to_snapshot(const char *filename, const char *out_filename) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    if (load_chunk(&chunk, filename) != 0) {
+        fprintf(stderr, "Failed to load bytecode file: %s\n", filename);
+        return 2;
+    }
+    if (verify_chunk(&chunk) != 0) {
+        fprintf(stderr, "Bytecode verification failed: %s\n", filename);
+        free_chunk(&chunk);
+        return 2;
+    }
+    VM vm;
+    vm_init(&vm);
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = &chunk;
+    frame->ip = chunk.code.code;
+    frame->slots = vm.stack;
+
+    int status = 0;
+    if (vm_run(&vm) != VM_CHECKPOINT) {
+        fprintf(stderr, "Program finished without reaching a CHECKPOINT\n");
+        status = 1;
+    } else if (save_snapshot(&vm, out_filename) != 0) {
+        fprintf(stderr, "Failed to write snapshot: %s\n", out_filename);
+        status = 1;
+    }
+    vm_free(&vm);
+    free_chunk(&chunk);
+    return status;
+}
+
+// Optimizes a bytecode file and writes the result to out_filename
+static int optimize_file(const char *filename, const char *out_filename) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    if (load_chunk(&chunk, filename) != 0) {
+        fprintf(stderr, "Failed to load bytecode file: %s\n", filename);
+        return 2;
+    }
+    InlineStats inline_stats;
+    IrStats ir_stats;
+    OptimizeStats stats;
+    int status = 0;
+    // Inlining first gives the SSA passes and folding a chance to see through the calls
+    if (inline_chunk(&chunk, &inline_stats, stdout) != 0 || ir_optimize_chunk(&chunk, &ir_stats) != 0 ||
+        optimize_chunk(&chunk, &stats) != 0) {
+        fprintf(stderr, "Bytecode verification failed: %s\n", filename);
+        status = 2;
+    } else if (save_chunk(&chunk, out_filename) != 0) {
+        fprintf(stderr, "Failed to write bytecode file: %s\n", out_filename);
+        status = 1;
+    } else {
+        printf("Inlined %zu calls, kept %zu\n", inline_stats.inlined_calls, inline_stats.skipped_calls);
+        printf("SSA: found %zu congruent and %zu loop-invariant values (not reused or moved), folded %zu values "
+               "and %zu branches, removed %zu instructions\n", ir_stats.congruent_values, ir_stats.invariant_values,
+               ir_stats.folded_values, ir_stats.folded_branches, ir_stats.removed_instructions);
+        printf("Folded %zu operations and %zu branches, fused %zu compare-and-branches, threaded %zu jumps, "
+               "removed %zu instructions\n", stats.folded_operations, stats.folded_branches, stats.fused_branches,
+               stats.threaded_jumps, stats.removed_instructions);
+    }
+    free_chunk(&chunk);
+    return status;
+}
+
+// Runs a program under the sampling profiler and writes its folded stacks to out_filename
+static int sample_file(const char *filename, const char *out_filename) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    if (load_chunk(&chunk, filename) != 0) {
+        fprintf(stderr, "Failed to load bytecode file: %s\n", filename);
+        return 2;
+    }
+    if (verify_chunk(&chunk) != 0) {
+        fprintf(stderr, "Bytecode verification failed: %s\n", filename);
+        free_chunk(&chunk);
+        return 2;
+    }
+    VM vm;
+    vm_init(&vm);
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = &chunk;
+    frame->ip = chunk.code.code;
+    frame->slots = vm.stack;
+
+    Sampler sampler;
+    sampler_init(&sampler, SAMPLER_DEFAULT_MAX_SAMPLES);
+    if (sampler_start(&sampler, &vm, SAMPLER_DEFAULT_INTERVAL_US) != 0) {
+        fprintf(stderr, "Failed to start the sampling timer\n");
+        sampler_free(&sampler);
+        free_chunk(&chunk);
+        return 1;
+    }
+    while (vm_run(&vm) == VM_CHECKPOINT) {}
+    sampler_stop();
+    print_result(&vm);
+
+    int status = 0;
+    FILE *out = fopen(out_filename, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to write samples: %s\n", out_filename);
+        status = 1;
+    } else {
+        sampler_write_folded(&sampler, &chunk, out, false);
+        fclose(out);
+        fprintf(stderr, "%zu samples, %zu dropped\n", sampler.sample_count, sampler.dropped);
+    }
+    sampler_free(&sampler);
+    vm_free(&vm);
+    free_chunk(&chunk);
+    return status;
+}
+
+// Runs a program with the execution tracer and writes its last instructions
+// to out_filename. The trace is also written if the process gets SIGUSR1 or
+// dies of a fatal signal while running.
+static int trace_file(const char *filename, const char *out_filename) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    if (load_chunk(&chunk, filename) != 0) {
+        fprintf(stderr, "Failed to load bytecode file: %s\n", filename);
+        return 2;
+    }
+    if (verify_chunk(&chunk) != 0) {
+        fprintf(stderr, "Bytecode verification failed: %s\n", filename);
+        free_chunk(&chunk);
+        return 2;
+    }
+    Tracer tracer;
+    tracer_init(&tracer, &chunk, TRACE_DEFAULT_CAPACITY);
+    if (trace_install_signal_dump(&tracer, out_filename) != 0) {
+        fprintf(stderr, "Failed to write trace: %s\n", out_filename);
+        tracer_free(&tracer);
+        free_chunk(&chunk);
+        return 1;
+    }
+    VM vm;
+    vm_init(&vm);
+    vm.tracer = &tracer;
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = &chunk;
+    frame->ip = chunk.code.code;
+    frame->slots = vm.stack;
+
+    while (vm_run(&vm) == VM_CHECKPOINT) {}
+    trace_remove_signal_dump();
+    print_result(&vm);
+
+    int status = 0;
+    if (trace_save(&tracer, out_filename) != 0) {
+        fprintf(stderr, "Failed to write trace: %s\n", out_filename);
+        status = 1;
+    }
+    tracer_free(&tracer);
+    vm_free(&vm);
+    free_chunk(&chunk);
+    return status;
+}
+
+// Prints a trace written by --trace, using the bytecode it was recorded from
+static int decode_trace(const char *trace_filename, const char *filename) {
+    TraceLog log;
+    if (trace_load(&log, trace_filename) != 0) {
+        fprintf(stderr, "Failed to load trace: %s\n", trace_filename);
+        return 2;
+    }
+    Chunk chunk;
+    init_chunk(&chunk);
+    if (load_chunk(&chunk, filename) != 0) {
+        fprintf(stderr, "Failed to load bytecode file: %s\n", filename);
+        free_trace_log(&log);
+        return 2;
+    }
+    TraceChunkTable table;
+    trace_chunk_table(&table, &chunk);
+    trace_print(log.records, log.count, log.first_sequence, &table, stdout);
+    free_trace_chunk_table(&table);
+    free_trace_log(&log);
+    free_chunk(&chunk);
+    return 0;
+}
+
+static int run_from_snapshot(const char *filename) {
+    VM vm;
+    Snapshot snapshot;
+    if (load_snapshot(&vm, &snapshot, filename) != 0) {
+        fprintf(stderr, "Failed to load snapshot: %s\n", filename);
+        return 2;
+    }
+    while (vm_run(&vm) == VM_CHECKPOINT) {}
+    print_result(&vm);
+    vm_free(&vm);
+    free_snapshot(&snapshot);
+    return 0;
+}
+
+// Preloads the programs and answers requests on socket_path until SIGINT or SIGTERM
+static int serve(const char *socket_path, int worker_count, char **filenames, int file_count) {
+    HostProgram *programs = malloc(sizeof(HostProgram) * (size_t)file_count);
+    int loaded = 0;
+    for (; loaded < file_count; loaded++) {
+        if (host_load_file(&programs[loaded], filenames[loaded]) != 0) break;
+    }
+    int status = 0;
+    if (loaded < file_count) {
+        fprintf(stderr, "Failed to load %s\n", filenames[loaded]);
+        status = 2;
+    } else {
+        // Blocked before the threads start so that they inherit the mask and
+        // only sigwait sees the signals
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        Server server;
+        if (server_start(&server, socket_path, programs, (size_t)file_count, worker_count) != 0) {
+            status = 2;
+        } else {
+            fprintf(stderr, "Serving on %s with %d workers\n", socket_path, server.worker_count);
+            int signal_number;
+            sigwait(&signals, &signal_number);
+            server_stop(&server);
+            unlink(socket_path);
+        }
+    }
+    for (int i = 0; i < loaded; i++) host_free(&programs[i]);
+    free(programs);
+    return status;
+}
+
+// Preloads the programs, forks the workers and answers the request lines on
+// stdin, in order, on stdout. Worker w gets every worker_count-th line, so
+// each has at most one request in flight.
+static int run_zygote(int worker_count, char **filenames, int file_count) {
+    HostProgram *programs = malloc(sizeof(HostProgram) * (size_t)file_count);
+    int loaded = 0;
+    for (; loaded < file_count; loaded++) {
+        if (host_load_file(&programs[loaded], filenames[loaded]) != 0) break;
+    }
+    int status = 0;
+    Zygote zygote;
+    if (loaded < file_count) {
+        fprintf(stderr, "Failed to load %s\n", filenames[loaded]);
+        status = 2;
+    } else if (zygote_start(&zygote, programs, (size_t)file_count, worker_count) != 0) {
+        status = 2;
+    } else {
+        char response[HOST_MAX_LINE + 16];
+        char *line = NULL;
+        size_t capacity = 0;
+        ssize_t length;
+        int next = 0;
+        while ((length = getline(&line, &capacity, stdin)) >= 0) {
+            if (length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+            if (zygote.workers[next].pending > 0) {
+                zygote_collect(&zygote, next, response, sizeof(response));
+                fputs(response, stdout);
+            }
+            if (zygote_submit(&zygote, next, line) != 0) {
+                // Everything in flight is older, so it goes out first
+                for (int i = 1; i < zygote.worker_count; i++) {
+                    const int w = (next + i) % zygote.worker_count;
+                    if (zygote.workers[w].pending == 0) continue;
+                    zygote_collect(&zygote, w, response, sizeof(response));
+                    fputs(response, stdout);
+                }
+                puts("ERR Request too long");
+            }
+            next = (next + 1) % zygote.worker_count;
+        }
+        for (int i = 0; i < zygote.worker_count; i++) {
+            const int w = (next + i) % zygote.worker_count;
+            if (zygote.workers[w].pending == 0) continue;
+            zygote_collect(&zygote, w, response, sizeof(response));
+            fputs(response, stdout);
+        }
+        free(line);
+        zygote_stop(&zygote);
+    }
+    for (int i = 0; i < loaded; i++) host_free(&programs[i]);
+    free(programs);
+    return status;
+}
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s [--dis | --assemble <in> <out> | <file>]\n", argv[0]);
+        fprintf(stderr, USAGE, argv[0]);
         return 1;
     }
-    if (argc == 4 && strcmp(argv[1], "--assemble") == 0) {
-        if (assemble_chunk_from_file(argv[2], argv[3]) != 0) {
+    if (argc == 4 && strcmp(argv[1], "--snapshot") == 0) {
+        return run_to_snapshot(argv[2], argv[3]);
+    }
+    if (argc == 4 && strcmp(argv[1], "--optimize") == 0) {
+        return optimize_file(argv[2], argv[3]);
+    }
+    if (argc == 4 && strcmp(argv[1], "--sample") == 0) {
+        return sample_file(argv[3], argv[2]);
+    }
+    if (argc == 4 && strcmp(argv[1], "--trace") == 0) {
+        return trace_file(argv[3], argv[2]);
+    }
+    if (argc == 4 && strcmp(argv[1], "--decode-trace") == 0) {
+        return decode_trace(argv[2], argv[3]);
+    }
+    if (argc >= 4 && strcmp(argv[1], "--serve") == 0) {
+        // --workers 0 uses one worker per CPU
+        const bool has_workers = strcmp(argv[3], "--workers") == 0;
+        if (has_workers ? argc < 6 : argc < 4) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 1;
+        }
+        const int first_program = has_workers ? 5 : 3;
+        return serve(argv[2], has_workers ? atoi(argv[4]) : 0, argv + first_program, argc - first_program);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--zygote") == 0) {
+        const bool has_workers = strcmp(argv[2], "--workers") == 0;
+        if (has_workers && argc < 5) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 1;
+        }
+        const int first_program = has_workers ? 4 : 2;
+        return run_zygote(has_workers ? atoi(argv[3]) : 0, argv + first_program, argc - first_program);
+    }
+    if (argc == 3 && strcmp(argv[1], "--restore") == 0) {
+        return run_from_snapshot(argv[2]);
+    }
+    if (argc == 3 && strcmp(argv[1], "run") == 0) {
+        return run_source(argv[2], true);
+    }
+    if (argc == 4 && strcmp(argv[1], "run") == 0 && strcmp(argv[2], "--no-cache") == 0) {
+        return run_source(argv[3], false);
+    }
+    if ((argc == 4 || (argc == 6 && strcmp(argv[4], "--jobs") == 0)) && strcmp(argv[1], "--assemble") == 0) {
+        // --jobs 0 uses one thread per CPU
+        const int jobs = argc == 6 ? atoi(argv[5]) : 1;
+        if (assemble_program_from_file_parallel(argv[2], argv[3], jobs) != 0) {
             fprintf(stderr, "Failed to assemble %s to %s\n", argv[2], argv[3]);
             return 1;
         }
         return 0;
     }
     int disassemble = 0;
+    int profile = 0;
+    int perf_stats = 0;
     const char *filename = NULL;
     if (argc == 3 && strcmp(argv[1], "--dis") == 0) {
         disassemble = 1;
         filename = argv[2];
+    } else if (argc == 3 && strcmp(argv[1], "--profile") == 0) {
+        profile = 1;
+        filename = argv[2];
+    } else if (argc == 3 && strcmp(argv[1], "--perf-stats") == 0) {
+        perf_stats = 1;
+        filename = argv[2];
     } else if (argc == 2) {
         filename = argv[1];
     } else {
-        fprintf(stderr, "Usage: %s [--dis | --assemble <in> <out> | <file>]\n", argv[0]);
+        fprintf(stderr, USAGE, argv[0]);
         return 1;
     }
     Chunk chunk;
@@ -39,27 +475,39 @@ int main(int argc, char **argv) {
         free_chunk(&chunk);
         return 0;
     }
-    VM vm;
-    vm_init(&vm);
-    
-    CallFrame* frame = &vm.frames[vm.frame_count++];
-    frame->chunk = &chunk;
-    frame->ip = chunk.code.code;
-    frame->slots = vm.stack;
-
-    vm_run(&vm);
-
-    if (vm.stack_top > vm.stack) {
-        const Value result = *(vm.stack_top - 1);
-        if (result.type == VAL_NUMBER) {
-            printf("%lld\n", result.as.number);
-        } else {
-            printf("[non-number result]\n");
-        }
+    if (verify_chunk(&chunk) != 0) {
+        fprintf(stderr, "Bytecode verification failed: %s\n", filename);
+        free_chunk(&chunk);
+        return 2;
+    }
+    if (profile) {
+        // The summary goes to stderr so that stdout still holds just the result
+        Profile stats;
+        profile_init(&stats);
+        execute(&chunk, &stats);
+        profile_report(&stats, &chunk, stderr);
+        profile_free(&stats);
+    } else if (perf_stats) {
+        // The totals come from a plain run; a second, instrumented run counts
+        // VM instructions and reads the counters whenever the function changes
+        PerfStats stats;
+        perf_stats_init(&stats);
+        perf_stats_begin(&stats);
+        execute(&chunk, NULL);
+        perf_stats_end(&stats, stats.run_counts);
+        VM vm;
+        vm_init(&vm);
+        vm.perf = &stats;
+        vm.frames[vm.frame_count++] = (CallFrame){&chunk, chunk.code.code, vm.stack, vm.stack};
+        perf_stats_begin(&stats);
+        while (vm_run(&vm) == VM_CHECKPOINT) {}
+        perf_stats_end(&stats, NULL);
+        vm_free(&vm);
+        perf_stats_report(&stats, &chunk, stderr);
+        perf_stats_free(&stats);
     } else {
-        printf("[no result]\n");
+        execute(&chunk, NULL);
     }
-    vm_free(&vm);
     free_chunk(&chunk);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "numeric.h"
+#include "opcode.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static Value integer(int64_t number) {
+    return (Value){.type = VAL_NUMBER, .as.number = number};
+}
+
+static Value floating(double number) {
+    return (Value){.type = VAL_DOUBLE, .as.fp_number = number};
+}
+
+NumericResult numeric_binary(const uint8_t opcode, const Value a, const Value b, Value* result) {
+    if (!is_numeric(a) || !is_numeric(b)) return NUMERIC_NOT_A_NUMBER;
+    if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
+        int64_t number;
+        if (evaluate_binary(opcode, a.as.number, b.as.number, &number)) {
+            *result = integer(number);
+            return NUMERIC_OK;
+        }
+        // Otherwise the result overflowed and is worked out again as a double
+        if ((opcode == OP_DIV || opcode == OP_MOD) && b.as.number == 0) return NUMERIC_DIVISION_BY_ZERO;
+    }
+    const double x = numeric_as_double(a), y = numeric_as_double(b);
+    switch (opcode) {
+        case OP_ADD: *result = floating(x + y); break;
+        case OP_SUB: *result = floating(x - y); break;
+        case OP_MUL: *result = floating(x * y); break;
+        case OP_DIV:
+            if (y == 0) return NUMERIC_DIVISION_BY_ZERO;
+            *result = floating(x / y);
+            break;
+        case OP_MOD:
+            if (y == 0) return NUMERIC_DIVISION_BY_ZERO;
+            *result = floating(fmod(x, y));
+            break;
+        case OP_EQUAL: *result = integer(x == y); break;
+        case OP_NOT_EQUAL: *result = integer(x != y); break;
+        case OP_LESS: *result = integer(x < y); break;
+        case OP_LESS_EQUAL: *result = integer(x <= y); break;
+        case OP_GREATER: *result = integer(x > y); break;
+        case OP_GREATER_EQUAL: *result = integer(x >= y); break;
+        default: return NUMERIC_NOT_A_NUMBER;
+    }
+    return NUMERIC_OK;
+}
+
+void format_double(const double number, char* buffer, const size_t size) {
+    snprintf(buffer, size, "%.15g", number);
+    if (strtod(buffer, NULL) != number) snprintf(buffer, size, "%.17g", number);
+    const size_t length = strlen(buffer);
+    if (strspn(buffer, "-0123456789") == length && length + 3 <= size) memcpy(buffer + length, ".0", 3);
+}
+
+// Small enough that neither half sum below can overflow within a block
+#define SUM_BLOCK ((size_t)1 << 31)
+
+bool numeric_sum_int64(const int64_t* values, const size_t count, int64_t* sum) {
+    // Each value is split into a signed high half and an unsigned low half,
+    // which are summed separately and only combined at the end, so the
+    // result is exact whatever the intermediate sums are
+    int64_t high_total = 0;
+    uint64_t low_total = 0;
+    for (size_t start = 0; start < count; start += SUM_BLOCK) {
+        const size_t end = count - start < SUM_BLOCK ? count : start + SUM_BLOCK;
+        int64_t high = 0;
+        uint64_t low = 0;
+        for (size_t i = start; i < end; i++) {
+            high += values[i] >> 32;
+            low += (uint64_t)values[i] & 0xffffffffu;
+        }
+        if (__builtin_add_overflow(high_total, high + (int64_t)(low >> 32), &high_total)) return false;
+        low_total += low & 0xffffffffu;
+    }
+    high_total += (int64_t)(low_total >> 32);
+    low_total &= 0xffffffffu;
+    // high_total * 2^32 + low_total fits exactly when high_total fits in 32 bits
+    if (high_total < INT32_MIN || high_total > INT32_MAX) return false;
+    *sum = (int64_t)(((uint64_t)high_total << 32) | low_total);
+    return true;
+}
+
+double numeric_sum_double(const double* values, const size_t count) {
+    double lanes[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (size_t lane = 0; lane < 4; lane++) lanes[lane] += values[i + lane];
+    }
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) sum += values[i];
+    return sum;
+}
+
+bool numeric_add_int64(int64_t* out, const int64_t* a, const int64_t* b, const size_t count) {
+    uint64_t overflow = 0;
+    for (size_t i = 0; i < count; i++) {
+        const int64_t x = a[i], y = b[i];
+        const int64_t r = (int64_t)((uint64_t)x + (uint64_t)y);
+        // The sign bit is set when both operands differ in sign from the result
+        overflow |= (uint64_t)((x ^ r) & (y ^ r));
+        out[i] = r;
+    }
+    return (overflow >> 63) == 0;
+}
+
+void numeric_add_double(double* out, const double* a, const double* b, const size_t count) {
+    for (size_t i = 0; i < count; i++) out[i] = a[i] + b[i];
+}
+
+void numeric_int64_to_double(double* out, const int64_t* in, const size_t count) {
+    for (size_t i = 0; i < count; i++) out[i] = (double)in[i];
+}
@@ -0,0 +1,49 @@
+#ifndef KAPPAVM_NUMERIC_H
+#define KAPPAVM_NUMERIC_H
+
+#include "value.h"
+
+typedef enum {
+    NUMERIC_OK,
+    NUMERIC_DIVISION_BY_ZERO,
+    NUMERIC_NOT_A_NUMBER,                   // an operand is neither an integer nor a double
+} NumericResult;
+
+static inline bool is_numeric(Value value) {
+    return value.type == VAL_NUMBER || value.type == VAL_DOUBLE;
+}
+
+static inline double numeric_as_double(Value value) {
+    return value.type == VAL_DOUBLE ? value.as.fp_number : (double)value.as.number;
+}
+
+// Applies an arithmetic or comparison opcode to two numbers. Two integers
+// give an integer while the result fits in int64_t and are promoted to a
+// double when it does not; a double operand makes the whole operation a
+// double one. Comparisons give 0 or 1. This is the slow path: vm_run tries
+// evaluate_binary first when both operands are integers.
+NumericResult numeric_binary(uint8_t opcode, Value a, Value b, Value* result);
+
+// Writes the shorter of %.15g and %.17g that reads back as the same double,
+// adding ".0" where the text would otherwise read as an integer
+void format_double(double number, char* buffer, size_t size);
+
+// Bulk operations over plain arrays of numbers, for hosts; the VM itself
+// does not call them, and packed lists only ever convert to Values (see
+// list.h). The loops have no early exits and track integer overflow in a
+// flag rather than branching on it, so the compiler can vectorize them.
+
+// Sums count integers exactly; returns false if the total does not fit in
+// int64_t, in which case *sum is left alone
+bool numeric_sum_int64(const int64_t* values, size_t count, int64_t* sum);
+// Sums in four interleaved lanes, so rounding may differ from a
+// left-to-right sum in the last bits
+double numeric_sum_double(const double* values, size_t count);
+// out[i] = a[i] + b[i]; returns false if any element overflowed, in which
+// case out holds the wrapped results. out may alias a or b.
+bool numeric_add_int64(int64_t* out, const int64_t* a, const int64_t* b, size_t count);
+void numeric_add_double(double* out, const double* a, const double* b, size_t count);
+// Widens integers to doubles
+void numeric_int64_to_double(double* out, const int64_t* in, size_t count);
+
+#endif //KAPPAVM_NUMERIC_H
@@ -0,0 +1,245 @@
+#include "object.h"
+#include "table.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) && !defined(KAPPAVM_NO_SIMD)
+#include <emmintrin.h>
+#define OBJECT_SSE2
+#endif
+
+// The table is probed a group of slots at a time. Each control byte is
+// EMPTY, DELETED or, for a full slot, the low 7 bits of its key's hash.
+#define GROUP_WIDTH 16
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+// Bit i is set for control byte i of a group
+typedef uint32_t GroupMask;
+
+static inline GroupMask match_byte(const uint8_t* group, uint8_t byte) {
+#ifdef OBJECT_SSE2
+    const __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) mask |= (GroupMask)(group[i] == byte) << i;
+    return mask;
+#endif
+}
+
+// Empty and deleted slots are the ones with the high bit set
+static inline GroupMask match_free(const uint8_t* group) {
+#ifdef OBJECT_SSE2
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) mask |= (GroupMask)(group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+static inline uint8_t hash_tag(uint32_t hash) {
+    return hash & 0x7F;
+}
+
+// Keeps an eighth of the slots empty, so every probe sequence meets one
+static size_t max_load(size_t capacity) {
+    return capacity - capacity / 8;
+}
+
+void init_object(Object* object) {
+    memset(object, 0, sizeof(Object));
+}
+
+void free_object(Object* object) {
+    const size_t slots = object->control ? object->capacity : object->used;
+    for (size_t i = 0; i < slots; i++) free(object->properties[i].key);
+    free(object->properties);
+    free(object->control);
+    init_object(object);
+}
+
+static bool same_key(const Property* property, const char* key, size_t length, uint32_t hash) {
+    return property->hash == hash && property->length == length && memcmp(property->key, key, length) == 0;
+}
+
+// Comparing a few short keys outright is cheaper than hashing the one
+// looked up, so small objects never need its hash
+static Property* find_small(const Object* object, const char* key, size_t length) {
+    for (size_t i = 0; i < object->used; i++) {
+        Property* property = &object->properties[i];
+        if (property->key && property->length == length && memcmp(property->key, key, length) == 0) return property;
+    }
+    return NULL;
+}
+
+// Groups are visited at triangular offsets from the one the hash picks,
+// which covers every group of a power-of-two table
+static Property* find_hashed(const Object* object, const char* key, size_t length, uint32_t hash) {
+    const size_t group_mask = object->capacity / GROUP_WIDTH - 1;
+    const uint8_t tag = hash_tag(hash);
+    size_t group = (hash >> 7) & group_mask;
+    for (size_t step = 1;; step++) {
+        const uint8_t* control = object->control + group * GROUP_WIDTH;
+        for (GroupMask match = match_byte(control, tag); match; match &= match - 1) {
+            Property* property = &object->properties[group * GROUP_WIDTH + __builtin_ctz(match)];
+            if (same_key(property, key, length, hash)) return property;
+        }
+        if (match_byte(control, CTRL_EMPTY)) return NULL;
+        group = (group + step) & group_mask;
+    }
+}
+
+// *hash is computed on first use and then reused
+static Property* find_property(const Object* object, const char* key, size_t length, uint32_t* hash,
+                               bool* hashed) {
+    if (!object->control) return find_small(object, key, length);
+    if (!*hashed) {
+        *hash = hash_string(key, length);
+        *hashed = true;
+    }
+    return find_hashed(object, key, length, *hash);
+}
+
+// The first empty or deleted slot on hash's probe sequence
+static size_t find_free_slot(const Object* object, uint32_t hash) {
+    const size_t group_mask = object->capacity / GROUP_WIDTH - 1;
+    size_t group = (hash >> 7) & group_mask;
+    for (size_t step = 1;; step++) {
+        const GroupMask free_slots = match_free(object->control + group * GROUP_WIDTH);
+        if (free_slots) return group * GROUP_WIDTH + __builtin_ctz(free_slots);
+        group = (group + step) & group_mask;
+    }
+}
+
+// Moves every property into a fresh table of capacity slots, which also
+// clears out the deleted ones. A small object becomes a hashed one here.
+static void rehash(Object* object, size_t capacity) {
+    Property* old_properties = object->properties;
+    const size_t old_slots = object->control ? object->capacity : object->used;
+    object->properties = calloc(capacity, sizeof(Property));
+    free(object->control);
+    object->control = malloc(capacity);
+    memset(object->control, CTRL_EMPTY, capacity);
+    object->capacity = capacity;
+    object->growth_left = max_load(capacity) - object->count;
+    object->used = 0;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (!old_properties[i].key) continue;
+        const size_t slot = find_free_slot(object, old_properties[i].hash);
+        object->control[slot] = hash_tag(old_properties[i].hash);
+        object->properties[slot] = old_properties[i];
+    }
+    free(old_properties);
+}
+
+// A free slot for a new key, making room first if there is none
+static Property* claim_slot(Object* object, uint32_t hash) {
+    if (!object->control) {
+        if (object->used == object->capacity) {
+            if (object->count < object->used) {
+                // Squeeze out the holes deletions left
+                size_t kept = 0;
+                for (size_t i = 0; i < object->used; i++) {
+                    if (object->properties[i].key) object->properties[kept++] = object->properties[i];
+                }
+                object->used = kept;
+            } else if (object->capacity < OBJECT_SMALL_MAX) {
+                object->capacity = object->capacity < 4 ? 4 : object->capacity * 2;
+                if (object->capacity > OBJECT_SMALL_MAX) object->capacity = OBJECT_SMALL_MAX;
+                object->properties = realloc(object->properties, sizeof(Property) * object->capacity);
+            } else {
+                rehash(object, 2 * GROUP_WIDTH);
+            }
+        }
+        if (!object->control) return &object->properties[object->used++];
+    }
+    size_t slot = find_free_slot(object, hash);
+    if (object->control[slot] == CTRL_EMPTY && object->growth_left == 0) {
+        // Full of live properties it doubles; mostly deleted ones, it only
+        // needs cleaning out
+        rehash(object, object->count + 1 > max_load(object->capacity) / 2 ? object->capacity * 2 : object->capacity);
+        slot = find_free_slot(object, hash);
+    }
+    if (object->control[slot] == CTRL_EMPTY) object->growth_left--;
+    object->control[slot] = hash_tag(hash);
+    return &object->properties[slot];
+}
+
+bool object_get(const Object* object, const char* key, size_t length, Value* value) {
+    uint32_t hash = 0;
+    bool hashed = false;
+    for (; object; object = object->prototype) {
+        const Property* property = find_property(object, key, length, &hash, &hashed);
+        if (property) {
+            *value = property->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool object_set(Object* object, const char* key, size_t length, Value value) {
+    uint32_t hash = 0;
+    bool hashed = false;
+    Property* property = find_property(object, key, length, &hash, &hashed);
+    if (property) {
+        property->value = value;
+        return false;
+    }
+    if (!hashed) hash = hash_string(key, length);
+    property = claim_slot(object, hash);
+    property->key = malloc(length + 1);
+    memcpy(property->key, key, length);
+    property->key[length] = '\0';
+    property->length = (uint32_t)length;
+    property->hash = hash;
+    property->value = value;
+    object->count++;
+    object->key_bytes += length + 1;
+    return true;
+}
+
+bool object_delete(Object* object, const char* key, size_t length) {
+    uint32_t hash = 0;
+    bool hashed = false;
+    Property* property = find_property(object, key, length, &hash, &hashed);
+    if (!property) return false;
+    // key may be this very copy, so it is not looked at again
+    object->key_bytes -= property->length + 1;
+    free(property->key);
+    property->key = NULL;
+    object->count--;
+
+    const size_t slot = (size_t)(property - object->properties);
+    if (!object->control) {
+        if (slot == object->used - 1) object->used--;
+    } else if (match_byte(object->control + (slot & ~(size_t)(GROUP_WIDTH - 1)), CTRL_EMPTY)) {
+        // No probe goes past a group with an empty slot, so this one can
+        // be empty again rather than deleted
+        object->control[slot] = CTRL_EMPTY;
+        object->growth_left++;
+    } else {
+        object->control[slot] = CTRL_DELETED;
+    }
+    return true;
+}
+
+bool object_next(const Object* object, size_t* cursor, const Property** property) {
+    const size_t slots = object->control ? object->capacity : object->used;
+    for (size_t i = *cursor; i < slots; i++) {
+        if (object->properties[i].key) {
+            *property = &object->properties[i];
+            *cursor = i + 1;
+            return true;
+        }
+    }
+    *cursor = slots;
+    return false;
+}
+
+size_t object_bytes(const Object* object) {
+    return sizeof(Object) + object->capacity * sizeof(Property) + (object->control ? object->capacity : 0) +
+           object->key_bytes;
+}
@@ -0,0 +1,38 @@
+#ifndef KAPPAVM_OBJECT_H
+#define KAPPAVM_OBJECT_H
+
+#include "value.h"
+
+// Objects map string keys to values. Up to OBJECT_SMALL_MAX properties they
+// are a plain array searched front to back, which beats hashing for the
+// handful of fields most objects have. Past that the object switches to a
+// Swiss table: one control byte per slot holds 7 bits of the key's hash,
+// and a lookup compares a whole group of 16 control bytes against them at
+// once, so it touches a property only when those bits match.
+#define OBJECT_SMALL_MAX 8
+
+typedef struct Property {
+    char* key;          // owned copy, NULL for a free slot
+    uint32_t length;
+    uint32_t hash;
+    Value value;
+} Property;
+
+void init_object(Object* object);
+void free_object(Object* object);
+// Looks key up in object and then along its prototype chain
+bool object_get(const Object* object, const char* key, size_t length, Value* value);
+// Returns true if the key was not present before
+bool object_set(Object* object, const char* key, size_t length, Value value);
+// Returns true if the key was present, and frees the object's copy of it
+bool object_delete(Object* object, const char* key, size_t length);
+// Steps through the object's own properties in no particular order. Start
+// with *cursor 0; each call stores the next property in *property and
+// returns true until there are none left. Deleting properties while
+// iterating is safe, though deleting one frees its key; adding them may
+// skip or repeat some.
+bool object_next(const Object* object, size_t* cursor, const Property** property);
+// Memory the object holds, for the VM's heap limit
+size_t object_bytes(const Object* object);
+
+#endif //KAPPAVM_OBJECT_H
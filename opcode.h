@@ -1,6 +1,7 @@
 #ifndef KAPPAVM_OPCODE_H
 #define KAPPAVM_OPCODE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef enum {
@@ -11,8 +12,73 @@ typedef enum {
     OP_JMP,
     OP_CALL,
     OP_RETURN,
+    OP_CHECKPOINT,
+    // Arithmetic on the two top values, the left operand below the right
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    // Comparisons push 1 or 0
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_LESS,
+    OP_LESS_EQUAL,
+    OP_GREATER,
+    OP_GREATER_EQUAL,
+    OP_DUP,
+    OP_SWAP,
+    OP_POP,
+    // Pop two values and jump if they compare true, in the order of the
+    // comparisons above
+    OP_JMP_IF_EQUAL,
+    OP_JMP_IF_NOT_EQUAL,
+    OP_JMP_IF_LESS,
+    OP_JMP_IF_LESS_EQUAL,
+    OP_JMP_IF_GREATER,
+    OP_JMP_IF_GREATER_EQUAL,
+    // Pops a number and jumps through entry n of the chunk's jump table
+    // given by the operand; falls through when n is out of the table's range
+    OP_SWITCH,
+    // Push / pop into frame slot n. Slot 0 holds the called function, the
+    // arguments follow it and the function's locals come after them.
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_THROW,
+    // Objects: NEW_OBJECT pushes an empty one. The others take the object
+    // and a string key, [object key] for GET_PROPERTY, which pushes the
+    // value or null, and DELETE_PROPERTY, and [object key value] for
+    // SET_PROPERTY; those two leave the object. NEXT_PROPERTY turns
+    // [object cursor] into [object cursor key], the key being null once
+    // there are no more; iteration starts from cursor 0.
+    OP_NEW_OBJECT,
+    OP_GET_PROPERTY,
+    OP_SET_PROPERTY,
+    OP_DELETE_PROPERTY,
+    OP_NEXT_PROPERTY,
+    // Strings: CONCAT turns [a b] into their concatenation, SLICE
+    // [string start end] into bytes [start, end), LENGTH [string] into its
+    // byte count, or a list's length, and COMPARE [a b] into -1, 0 or 1. NEW_BUILDER pushes an
+    // empty string builder, APPEND [builder value] adds a string or a
+    // number's text and leaves the builder, and BUILD turns [builder] into
+    // the string it holds.
+    OP_CONCAT,
+    OP_SLICE,
+    OP_LENGTH,
+    OP_COMPARE,
+    OP_NEW_BUILDER,
+    OP_APPEND,
+    OP_BUILD,
+    // Lists: NEW_LIST pushes an empty one. LIST_PUSH [list value] appends
+    // and LIST_SET [list index value] replaces an element, both leaving the
+    // list, and LIST_GET turns [list index] into the element.
+    OP_NEW_LIST,
+    OP_LIST_PUSH,
+    OP_LIST_GET,
+    OP_LIST_SET,
 } OpCode;
 
+#define OPCODE_COUNT (OP_LIST_SET + 1)
+
 typedef uint64_t Instruction;
 
 #define OPERAND_MASK 0x00FFFFFFFFFFFFFFULL
@@ -29,4 +95,116 @@ static inline Instruction make_instruction(const uint8_t opcode, const uint64_t
     return (uint64_t)opcode << 56 | operand & OPERAND_MASK;
 }
 
-#endif //KAPPAVM_OPCODE_H 
\ No newline at end of file
+static inline const char* opcode_name(const uint8_t opcode) {
+    switch (opcode) {
+        case OP_CONSTANT: return "OP_CONSTANT";
+        case OP_ADD: return "OP_ADD";
+        case OP_HALT: return "OP_HALT";
+        case OP_JMP_IF_FALSE: return "OP_JMP_IF_FALSE";
+        case OP_JMP: return "OP_JMP";
+        case OP_CALL: return "OP_CALL";
+        case OP_RETURN: return "OP_RETURN";
+        case OP_CHECKPOINT: return "OP_CHECKPOINT";
+        case OP_SUB: return "OP_SUB";
+        case OP_MUL: return "OP_MUL";
+        case OP_DIV: return "OP_DIV";
+        case OP_MOD: return "OP_MOD";
+        case OP_EQUAL: return "OP_EQUAL";
+        case OP_NOT_EQUAL: return "OP_NOT_EQUAL";
+        case OP_LESS: return "OP_LESS";
+        case OP_LESS_EQUAL: return "OP_LESS_EQUAL";
+        case OP_GREATER: return "OP_GREATER";
+        case OP_GREATER_EQUAL: return "OP_GREATER_EQUAL";
+        case OP_DUP: return "OP_DUP";
+        case OP_SWAP: return "OP_SWAP";
+        case OP_POP: return "OP_POP";
+        case OP_JMP_IF_EQUAL: return "OP_JMP_IF_EQUAL";
+        case OP_JMP_IF_NOT_EQUAL: return "OP_JMP_IF_NOT_EQUAL";
+        case OP_JMP_IF_LESS: return "OP_JMP_IF_LESS";
+        case OP_JMP_IF_LESS_EQUAL: return "OP_JMP_IF_LESS_EQUAL";
+        case OP_JMP_IF_GREATER: return "OP_JMP_IF_GREATER";
+        case OP_JMP_IF_GREATER_EQUAL: return "OP_JMP_IF_GREATER_EQUAL";
+        case OP_SWITCH: return "OP_SWITCH";
+        case OP_GET_LOCAL: return "OP_GET_LOCAL";
+        case OP_SET_LOCAL: return "OP_SET_LOCAL";
+        case OP_THROW: return "OP_THROW";
+        case OP_NEW_OBJECT: return "OP_NEW_OBJECT";
+        case OP_GET_PROPERTY: return "OP_GET_PROPERTY";
+        case OP_SET_PROPERTY: return "OP_SET_PROPERTY";
+        case OP_DELETE_PROPERTY: return "OP_DELETE_PROPERTY";
+        case OP_NEXT_PROPERTY: return "OP_NEXT_PROPERTY";
+        case OP_CONCAT: return "OP_CONCAT";
+        case OP_SLICE: return "OP_SLICE";
+        case OP_LENGTH: return "OP_LENGTH";
+        case OP_COMPARE: return "OP_COMPARE";
+        case OP_NEW_BUILDER: return "OP_NEW_BUILDER";
+        case OP_APPEND: return "OP_APPEND";
+        case OP_BUILD: return "OP_BUILD";
+        case OP_NEW_LIST: return "OP_NEW_LIST";
+        case OP_LIST_PUSH: return "OP_LIST_PUSH";
+        case OP_LIST_GET: return "OP_LIST_GET";
+        case OP_LIST_SET: return "OP_LIST_SET";
+        default: return "OP_UNKNOWN";
+    }
+}
+
+// Compare-and-branch: pops two values and jumps on the comparison
+static inline bool is_fused_jump_opcode(const uint8_t opcode) {
+    return opcode >= OP_JMP_IF_EQUAL && opcode <= OP_JMP_IF_GREATER_EQUAL;
+}
+
+// Instructions whose operand is a signed offset from the next instruction
+static inline bool is_jump_opcode(const uint8_t opcode) {
+    return opcode == OP_JMP || opcode == OP_JMP_IF_FALSE || is_fused_jump_opcode(opcode);
+}
+
+// Arithmetic and comparisons: pop two numbers, push one
+static inline bool is_binary_opcode(const uint8_t opcode) {
+    return opcode == OP_ADD || (opcode >= OP_SUB && opcode <= OP_GREATER_EQUAL);
+}
+
+static inline bool is_comparison_opcode(const uint8_t opcode) {
+    return opcode >= OP_EQUAL && opcode <= OP_GREATER_EQUAL;
+}
+
+// The comparison a fused compare-and-branch performs
+static inline uint8_t jump_comparison(const uint8_t jump) {
+    return (uint8_t)(jump - OP_JMP_IF_EQUAL + OP_EQUAL);
+}
+
+// The fused jump taken exactly when an OP_EQUAL or OP_NOT_EQUAL comparison
+// is false, so that it and a following OP_JMP_IF_FALSE can become one
+// instruction. The ordered comparisons have no such jump: with NaN, a < b
+// and a >= b are both false.
+static inline uint8_t negated_jump(const uint8_t comparison) {
+    return comparison == OP_EQUAL ? OP_JMP_IF_NOT_EQUAL : OP_JMP_IF_EQUAL;
+}
+
+// Evaluates a binary opcode on two integers. Returns false when the result
+// does not fit in int64_t, which numeric_binary then works out as a double,
+// and for division or modulo by zero.
+static inline bool evaluate_binary(const uint8_t opcode, const int64_t a, const int64_t b, int64_t* result) {
+    switch (opcode) {
+        case OP_ADD: return !__builtin_add_overflow(a, b, result);
+        case OP_SUB: return !__builtin_sub_overflow(a, b, result);
+        case OP_MUL: return !__builtin_mul_overflow(a, b, result);
+        case OP_DIV:
+            // INT64_MIN / -1 is the one quotient that overflows
+            if (b == 0 || (b == -1 && a == INT64_MIN)) return false;
+            *result = a / b;
+            return true;
+        case OP_MOD:
+            if (b == 0) return false;
+            *result = b == -1 ? 0 : a % b;
+            return true;
+        case OP_EQUAL: *result = a == b; return true;
+        case OP_NOT_EQUAL: *result = a != b; return true;
+        case OP_LESS: *result = a < b; return true;
+        case OP_LESS_EQUAL: *result = a <= b; return true;
+        case OP_GREATER: *result = a > b; return true;
+        case OP_GREATER_EQUAL: *result = a >= b; return true;
+        default: return false;
+    }
+}
+
+#endif //KAPPAVM_OPCODE_H
\ No newline at end of file
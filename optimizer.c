@@ -0,0 +1,379 @@
+#include "optimizer.h"
+#include "verifier.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Working copy of a chunk's code. Jumps hold absolute targets while the
+// passes run, and deleted instructions stay in place with live cleared, so
+// an index that was deleted stands for the next live instruction after it.
+// Jump tables and exception handlers already hold absolute indices and are
+// updated in place.
+typedef struct {
+    size_t count;
+    JumpTables* tables;
+    HandlerTable* handlers;
+    uint8_t* ops;
+    uint64_t* operands;
+    size_t* targets;
+    bool* live;
+    bool* marks;
+    size_t* scratch;
+} Body;
+
+typedef struct {
+    Chunk** chunks;
+    size_t count;
+    size_t capacity;
+} ChunkList;
+
+static bool is_falsey(Value value) {
+    return value.type == VAL_NULL || (value.type == VAL_NUMBER && value.as.number == 0) ||
+           (value.type == VAL_DOUBLE && value.as.fp_number == 0);
+}
+
+// Sign-extends a 56-bit operand
+static int64_t signed_operand(Instruction inst) {
+    return (int64_t)(get_operand(inst) << 8) >> 8;
+}
+
+static size_t resolve(const Body* body, size_t index) {
+    while (index < body->count && !body->live[index]) index++;
+    return index;
+}
+
+static size_t next_live(const Body* body, size_t index) {
+    return resolve(body, index + 1);
+}
+
+// Points every jump at the end of its chain of unconditional jumps, and
+// replaces a jump to RETURN or HALT with the instruction itself
+static bool thread_jumps(Body* body, OptimizeStats* stats) {
+    bool changed = false;
+    for (size_t i = 0; i < body->count; i++) {
+        if (!body->live[i] || !is_jump_opcode(body->ops[i])) continue;
+        const size_t start = resolve(body, body->targets[i]);
+        size_t target = start;
+        size_t hops = 0;
+        while (target < body->count && body->ops[target] == OP_JMP && hops < body->count) {
+            target = resolve(body, body->targets[target]);
+            hops++;
+        }
+        // A chain that never ends is a jump cycle; leave it alone
+        if (hops == body->count) target = start;
+        if (target != start) {
+            stats->threaded_jumps++;
+            changed = true;
+        }
+        body->targets[i] = target;
+        if (body->ops[i] == OP_JMP && target < body->count &&
+            (body->ops[target] == OP_RETURN || body->ops[target] == OP_HALT)) {
+            body->ops[i] = body->ops[target];
+            body->operands[i] = body->operands[target];
+            stats->threaded_jumps++;
+            changed = true;
+        }
+    }
+    for (size_t t = 0; t < body->tables->count; t++) {
+        const JumpTable* table = &body->tables->tables[t];
+        for (size_t e = 0; e < table->count; e++) {
+            size_t target = resolve(body, table->targets[e]);
+            size_t hops = 0;
+            while (target < body->count && body->ops[target] == OP_JMP && hops < body->count) {
+                target = resolve(body, body->targets[target]);
+                hops++;
+            }
+            if (hops == 0 || hops == body->count) continue;
+            table->targets[e] = target;
+            stats->threaded_jumps++;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Marks index as reachable and queues it if it was not already
+static void reach(Body* body, size_t index, size_t* pending) {
+    if (index < body->count && !body->marks[index]) {
+        body->marks[index] = true;
+        body->scratch[(*pending)++] = index;
+    }
+}
+
+static bool remove_unreachable(Body* body) {
+    memset(body->marks, 0, sizeof(bool) * body->count);
+    size_t pending = 0;
+    reach(body, resolve(body, 0), &pending);
+    while (pending > 0) {
+        const size_t i = body->scratch[--pending];
+        const uint8_t op = body->ops[i];
+        if (is_jump_opcode(op)) reach(body, resolve(body, body->targets[i]), &pending);
+        if (op == OP_SWITCH) {
+            const JumpTable* table = &body->tables->tables[body->operands[i]];
+            for (size_t e = 0; e < table->count; e++) reach(body, resolve(body, table->targets[e]), &pending);
+        }
+        if (op != OP_JMP && op != OP_RETURN && op != OP_HALT && op != OP_THROW) {
+            reach(body, next_live(body, i), &pending);
+        }
+        for (size_t h = 0; h < body->handlers->count; h++) {
+            const Handler* handler = &body->handlers->handlers[h];
+            if (i >= handler->start && i < handler->end) reach(body, resolve(body, handler->target), &pending);
+        }
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < body->count; i++) {
+        if (body->live[i] && !body->marks[i]) {
+            body->live[i] = false;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Peephole pass over adjacent live instructions. Instructions other than the
+// first of a pattern must not be jump targets, since a jump into the middle
+// would see a different stack.
+static bool fold_constants(Body* body, Chunk* chunk, OptimizeStats* stats) {
+    memset(body->marks, 0, sizeof(bool) * body->count);
+    for (size_t i = 0; i < body->count; i++) {
+        if (!body->live[i] || !is_jump_opcode(body->ops[i])) continue;
+        const size_t target = resolve(body, body->targets[i]);
+        if (target < body->count) body->marks[target] = true;
+    }
+    for (size_t t = 0; t < body->tables->count; t++) {
+        const JumpTable* table = &body->tables->tables[t];
+        for (size_t e = 0; e < table->count; e++) {
+            const size_t target = resolve(body, table->targets[e]);
+            if (target < body->count) body->marks[target] = true;
+        }
+    }
+    // Nothing may be merged across the edges of a handler's range either
+    for (size_t h = 0; h < body->handlers->count; h++) {
+        const Handler* handler = &body->handlers->handlers[h];
+        const size_t edges[3] = {handler->start, handler->end, handler->target};
+        for (size_t e = 0; e < 3; e++) {
+            const size_t index = resolve(body, edges[e]);
+            if (index < body->count) body->marks[index] = true;
+        }
+    }
+
+    bool changed = false;
+    for (size_t i = resolve(body, 0); i < body->count; i = next_live(body, i)) {
+        const size_t j = next_live(body, i);
+        if (j >= body->count) break;
+
+        if (body->ops[i] == OP_JMP && resolve(body, body->targets[i]) == j) {
+            body->live[i] = false;
+            changed = true;
+            continue;
+        }
+        if (body->marks[j]) continue;
+
+        if ((body->ops[i] == OP_EQUAL || body->ops[i] == OP_NOT_EQUAL) && body->ops[j] == OP_JMP_IF_FALSE) {
+            // Compare and branch in one dispatch. Only equality negates
+            // exactly: with NaN, LESS and GREATER_EQUAL are both false.
+            body->ops[i] = negated_jump(body->ops[i]);
+            body->targets[i] = body->targets[j];
+            body->live[j] = false;
+            stats->fused_branches++;
+            changed = true;
+            continue;
+        }
+        if (body->ops[i] != OP_CONSTANT) continue;
+        const Value a = chunk->constants.values[body->operands[i]];
+
+        if (body->ops[j] == OP_JMP_IF_FALSE) {
+            // The constant is pushed and popped straight away; only the jump
+            // can remain, and only if it is always taken
+            body->live[i] = false;
+            if (is_falsey(a)) {
+                body->ops[j] = OP_JMP;
+            } else {
+                body->live[j] = false;
+            }
+            stats->folded_branches++;
+            changed = true;
+            continue;
+        }
+        if (body->ops[j] == OP_SWITCH) {
+            // A constant selector picks one case, or the fall-through
+            const JumpTable* table = &body->tables->tables[body->operands[j]];
+            body->live[i] = false;
+            if (a.type == VAL_NUMBER && a.as.number >= 0 && (uint64_t)a.as.number < table->count) {
+                body->ops[j] = OP_JMP;
+                body->targets[j] = table->targets[a.as.number];
+            } else {
+                body->live[j] = false;
+            }
+            stats->folded_branches++;
+            changed = true;
+            continue;
+        }
+        if (body->ops[j] == OP_POP) {
+            body->live[i] = false;
+            body->live[j] = false;
+            changed = true;
+            continue;
+        }
+
+        const size_t k = next_live(body, j);
+        if (body->ops[j] != OP_CONSTANT || k >= body->count || body->marks[k]) continue;
+        const Value b = chunk->constants.values[body->operands[j]];
+        if (a.type != VAL_NUMBER || b.type != VAL_NUMBER) continue;
+        int64_t result;
+        if (is_fused_jump_opcode(body->ops[k])) {
+            evaluate_binary(jump_comparison(body->ops[k]), a.as.number, b.as.number, &result);
+            body->live[i] = false;
+            body->live[j] = false;
+            if (result) {
+                body->ops[k] = OP_JMP;
+            } else {
+                body->live[k] = false;
+            }
+            stats->folded_branches++;
+            changed = true;
+            continue;
+        }
+        // Division by zero is left for vm_run to report
+        if (!is_binary_opcode(body->ops[k]) ||
+            !evaluate_binary(body->ops[k], a.as.number, b.as.number, &result)) continue;
+        body->operands[i] = add_constant(chunk, (Value){.type = VAL_NUMBER, .as.number = result});
+        body->live[j] = false;
+        body->live[k] = false;
+        stats->folded_operations++;
+        changed = true;
+    }
+    return changed;
+}
+
+// Writes the live instructions back to the chunk, re-encoding jump offsets,
+// and keeps only the constants that are still referenced
+static void rebuild_chunk(Body* body, Chunk* chunk) {
+    size_t* new_index = body->scratch;
+    size_t new_count = 0;
+    for (size_t i = 0; i < body->count; i++) {
+        if (body->live[i]) new_index[i] = new_count++;
+    }
+
+    const size_t old_constant_count = chunk->constants.count;
+    Value* old_constants = chunk->constants.values;
+    size_t* constant_map = malloc(sizeof(size_t) * (old_constant_count ? old_constant_count : 1));
+    for (size_t i = 0; i < old_constant_count; i++) constant_map[i] = SIZE_MAX;
+    chunk->constants.values = NULL;
+    chunk->constants.count = 0;
+    chunk->constants.capacity = 0;
+
+    for (size_t i = 0; i < body->count; i++) {
+        if (!body->live[i]) continue;
+        uint64_t operand = body->operands[i];
+        if (body->ops[i] == OP_CONSTANT) {
+            if (constant_map[operand] == SIZE_MAX) {
+                constant_map[operand] = add_constant(chunk, old_constants[operand]);
+            }
+            operand = constant_map[operand];
+        } else if (is_jump_opcode(body->ops[i])) {
+            const size_t target = resolve(body, body->targets[i]);
+            const size_t new_target = target < body->count ? new_index[target] : new_count;
+            operand = (uint64_t)((int64_t)new_target - (int64_t)(new_index[i] + 1));
+        }
+        // Compaction only moves instructions backwards, so this can be done in place
+        chunk->code.code[new_index[i]] = make_instruction(body->ops[i], operand);
+    }
+    chunk->code.count = new_count;
+    for (size_t t = 0; t < chunk->jump_tables.count; t++) {
+        const JumpTable* table = &chunk->jump_tables.tables[t];
+        for (size_t e = 0; e < table->count; e++) {
+            const size_t target = resolve(body, table->targets[e]);
+            table->targets[e] = target < body->count ? new_index[target] : new_count;
+        }
+    }
+    // Ranges whose instructions were all removed are dropped
+    HandlerTable* handlers = &chunk->handlers;
+    size_t kept = 0;
+    for (size_t h = 0; h < handlers->count; h++) {
+        Handler handler = handlers->handlers[h];
+        const size_t start = resolve(body, handler.start), end = resolve(body, handler.end);
+        const size_t target = resolve(body, handler.target);
+        handler.start = start < body->count ? new_index[start] : new_count;
+        handler.end = end < body->count ? new_index[end] : new_count;
+        handler.target = target < body->count ? new_index[target] : new_count;
+        if (handler.start < handler.end) handlers->handlers[kept++] = handler;
+    }
+    handlers->count = kept;
+    free(constant_map);
+    // The live strings were copied by add_constant
+    for (size_t i = 0; i < old_constant_count; i++) {
+        if (old_constants[i].type == VAL_STRING) free(old_constants[i].as.string);
+    }
+    free(old_constants);
+}
+
+static void optimize_code(Chunk* chunk, OptimizeStats* stats) {
+    Body body;
+    const size_t count = chunk->code.count;
+    body.count = count;
+    body.tables = &chunk->jump_tables;
+    body.handlers = &chunk->handlers;
+    body.ops = malloc(count);
+    body.operands = malloc(sizeof(uint64_t) * count);
+    body.targets = malloc(sizeof(size_t) * count);
+    body.live = malloc(sizeof(bool) * count);
+    body.marks = malloc(sizeof(bool) * count);
+    body.scratch = malloc(sizeof(size_t) * count);
+    for (size_t i = 0; i < count; i++) {
+        const Instruction inst = chunk->code.code[i];
+        body.ops[i] = get_opcode(inst);
+        body.operands[i] = get_operand(inst);
+        body.targets[i] = is_jump_opcode(body.ops[i]) ? (size_t)((int64_t)i + 1 + signed_operand(inst)) : 0;
+        body.live[i] = true;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = thread_jumps(&body, stats);
+        changed |= remove_unreachable(&body);
+        changed |= fold_constants(&body, chunk, stats);
+    }
+    rebuild_chunk(&body, chunk);
+    stats->removed_instructions += count - chunk->code.count;
+
+    free(body.ops);
+    free(body.operands);
+    free(body.targets);
+    free(body.live);
+    free(body.marks);
+    free(body.scratch);
+}
+
+static void optimize_recursive(Chunk* chunk, ChunkList* visited, OptimizeStats* stats) {
+    for (size_t i = 0; i < visited->count; i++) {
+        if (visited->chunks[i] == chunk) return;
+    }
+    if (visited->count == visited->capacity) {
+        visited->capacity = visited->capacity < 8 ? 8 : visited->capacity * 2;
+        visited->chunks = realloc(visited->chunks, sizeof(Chunk*) * visited->capacity);
+    }
+    visited->chunks[visited->count++] = chunk;
+
+    optimize_code(chunk, stats);
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        const Value value = chunk->constants.values[i];
+        if (value.type == VAL_FUNCTION) optimize_recursive(value.as.function->chunk, visited, stats);
+    }
+}
+
+int optimize_chunk(Chunk* chunk, OptimizeStats* stats) {
+    OptimizeStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(OptimizeStats));
+    // The passes rely on the verifier's guarantees: in-range jumps and
+    // constants, and no path falling off the end of the code
+    if (verify_chunk(chunk) != 0) return -1;
+
+    ChunkList visited = {0};
+    optimize_recursive(chunk, &visited, stats);
+    // Stack requirements may have shrunk
+    for (size_t i = 0; i < visited.count; i++) visited.chunks[i]->verified = false;
+    free(visited.chunks);
+    return verify_chunk(chunk);
+}
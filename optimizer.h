@@ -0,0 +1,23 @@
+#ifndef KAPPAVM_OPTIMIZER_H
+#define KAPPAVM_OPTIMIZER_H
+
+#include "chunk.h"
+
+typedef struct {
+    size_t folded_operations;
+    size_t folded_branches;
+    size_t fused_branches;
+    size_t threaded_jumps;
+    size_t removed_instructions;
+} OptimizeStats;
+
+// Rewrites a chunk and every function chunk reachable from it in place:
+// folds arithmetic and comparisons of two constants and branches on
+// constants, fuses a comparison followed by OP_JMP_IF_FALSE into one
+// compare-and-branch, threads jump chains, and removes unreachable
+// instructions and unused constants. The
+// chunk must pass verify_chunk, and is verified again afterwards.
+// Returns 0 on success; stats may be NULL.
+int optimize_chunk(Chunk* chunk, OptimizeStats* stats);
+
+#endif //KAPPAVM_OPTIMIZER_H
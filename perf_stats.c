@@ -0,0 +1,225 @@
+#include "perf_stats.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+static const char* COUNTER_NAMES[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "branches", "branch-misses", "cache-references", "cache-misses",
+};
+
+#ifdef __linux__
+static const uint64_t COUNTER_CONFIGS[PERF_COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static int open_counter(PerfCounter counter, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = COUNTER_CONFIGS[counter];
+    attr.disabled = group_fd == -1;         // members follow the leader
+    attr.exclude_kernel = 1;                // also what unprivileged users may count
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+void perf_stats_init(PerfStats* stats) {
+    memset(stats, 0, sizeof(PerfStats));
+    stats->group_fd = -1;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        stats->fds[i] = -1;
+        stats->slots[i] = -1;
+    }
+#ifdef __linux__
+    int first_errno = 0;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        const int fd = open_counter((PerfCounter)i, stats->group_fd);
+        if (fd < 0) {
+            if (!first_errno) first_errno = errno;
+            continue;
+        }
+        if (stats->group_fd == -1) stats->group_fd = fd;
+        stats->fds[i] = fd;
+        stats->slots[i] = stats->opened++;
+    }
+    if (stats->opened == 0) {
+        if (first_errno == EACCES || first_errno == EPERM) {
+            snprintf(stats->error, sizeof(stats->error),
+                     "%s; see /proc/sys/kernel/perf_event_paranoid", strerror(first_errno));
+        } else if (first_errno == ENOENT || first_errno == EOPNOTSUPP) {
+            snprintf(stats->error, sizeof(stats->error), "no hardware counters on this CPU (%s)",
+                     strerror(first_errno));
+        } else {
+            snprintf(stats->error, sizeof(stats->error), "%s", strerror(first_errno));
+        }
+    }
+#else
+    snprintf(stats->error, sizeof(stats->error), "perf_event_open is only available on Linux");
+#endif
+}
+
+void perf_stats_free(PerfStats* stats) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (stats->fds[i] != -1) close(stats->fds[i]);
+    }
+    free(stats->functions);
+    memset(stats, 0, sizeof(PerfStats));
+    stats->group_fd = -1;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        stats->fds[i] = -1;
+        stats->slots[i] = -1;
+    }
+}
+
+// Reads all open counters into counts, scaled up if the kernel had to
+// multiplex them. Counters that are not open read as zero.
+static void read_counters(const PerfStats* stats, uint64_t counts[PERF_COUNTER_COUNT]) {
+    memset(counts, 0, sizeof(uint64_t) * PERF_COUNTER_COUNT);
+#ifdef __linux__
+    if (stats->group_fd == -1) return;
+    uint64_t buffer[3 + PERF_COUNTER_COUNT];
+    if (read(stats->group_fd, buffer, sizeof(buffer)) < (ssize_t)(sizeof(uint64_t) * (3 + stats->opened))) return;
+    const uint64_t enabled = buffer[1], running = buffer[2];
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (stats->slots[i] < 0) continue;
+        uint64_t value = buffer[3 + stats->slots[i]];
+        if (running && running < enabled) value = (uint64_t)((double)value * (double)enabled / (double)running);
+        counts[i] = value;
+    }
+#endif
+}
+
+void perf_stats_begin(PerfStats* stats) {
+#ifdef __linux__
+    if (stats->group_fd == -1) return;
+    ioctl(stats->group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(stats->group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+void perf_stats_end(PerfStats* stats, uint64_t totals[PERF_COUNTER_COUNT]) {
+#ifdef __linux__
+    if (stats->group_fd == -1) return;
+    ioctl(stats->group_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (!totals) return;
+    uint64_t counts[PERF_COUNTER_COUNT];
+    read_counters(stats, counts);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) totals[i] += counts[i];
+#else
+    (void)totals;
+#endif
+}
+
+static size_t perf_function(PerfStats* stats, const Chunk* chunk) {
+    for (size_t i = 0; i < stats->function_count; i++) {
+        if (stats->functions[i].chunk == chunk) return i;
+    }
+    if (stats->function_count == stats->function_capacity) {
+        stats->function_capacity = stats->function_capacity < 8 ? 8 : stats->function_capacity * 2;
+        stats->functions = realloc(stats->functions, sizeof(FunctionPerf) * stats->function_capacity);
+    }
+    stats->functions[stats->function_count] = (FunctionPerf){.chunk = chunk};
+    return stats->function_count++;
+}
+
+// Adds the counts since the last read to the current function and returns
+// the new readings in last
+static void charge(PerfStats* stats) {
+    uint64_t now[PERF_COUNTER_COUNT];
+    read_counters(stats, now);
+    if (stats->charging) {
+        FunctionPerf* function = &stats->functions[stats->current_function];
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) function->counts[i] += now[i] - stats->last[i];
+    }
+    memcpy(stats->last, now, sizeof(now));
+}
+
+void perf_switch(PerfStats* stats, const Chunk* chunk) {
+    charge(stats);
+    stats->current_function = perf_function(stats, chunk);
+    stats->current_chunk = chunk;
+    stats->charging = true;
+}
+
+void perf_stop(PerfStats* stats) {
+    if (!stats->charging) return;
+    charge(stats);
+    stats->charging = false;
+}
+
+static double ratio(uint64_t part, uint64_t whole) {
+    return whole ? (double)part / (double)whole : 0.0;
+}
+
+static void print_counter_table(const uint64_t counts[PERF_COUNTER_COUNT], uint64_t instructions,
+                                const PerfStats* stats, FILE* out) {
+    fprintf(out, "  %-18s %16s %14s\n", "counter", "count", "per VM instr");
+    fprintf(out, "  %-18s %16llu\n", "VM instructions", (unsigned long long)instructions);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (stats->slots[i] < 0) continue;
+        fprintf(out, "  %-18s %16llu %14.2f\n", COUNTER_NAMES[i], (unsigned long long)counts[i],
+                ratio(counts[i], instructions));
+    }
+    if (stats->slots[PERF_CYCLES] >= 0 && stats->slots[PERF_INSTRUCTIONS] >= 0) {
+        fprintf(out, "  IPC %.2f", ratio(counts[PERF_INSTRUCTIONS], counts[PERF_CYCLES]));
+    }
+    if (stats->slots[PERF_BRANCHES] >= 0 && stats->slots[PERF_BRANCH_MISSES] >= 0) {
+        fprintf(out, "  branch miss rate %.2f%%", 100 * ratio(counts[PERF_BRANCH_MISSES], counts[PERF_BRANCHES]));
+    }
+    if (stats->slots[PERF_CACHE_REFERENCES] >= 0 && stats->slots[PERF_CACHE_MISSES] >= 0) {
+        fprintf(out, "  cache miss rate %.2f%%", 100 * ratio(counts[PERF_CACHE_MISSES], counts[PERF_CACHE_REFERENCES]));
+    }
+    fprintf(out, "\n");
+}
+
+void perf_stats_report(const PerfStats* stats, const Chunk* root, FILE* out) {
+    uint64_t instructions = 0;
+    for (size_t i = 0; i < stats->function_count; i++) instructions += stats->functions[i].instructions;
+
+    fprintf(out, "== perf stats ==\n");
+    if (!perf_stats_available(stats)) {
+        fprintf(out, "hardware counters unavailable: %s\n", stats->error);
+        fprintf(out, "%llu VM instructions\n", (unsigned long long)instructions);
+    } else {
+        print_counter_table(stats->run_counts, instructions, stats, out);
+    }
+
+    // Without counters the breakdown still shows where the instructions went
+    TraceChunkTable names;
+    trace_chunk_table(&names, root);
+    fprintf(out, "== functions ==\n");
+    fprintf(out, "  %-20s %14s", "function", "VM instrs");
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (stats->slots[i] >= 0) fprintf(out, " %16s", COUNTER_NAMES[i]);
+    }
+    fprintf(out, "\n");
+    for (size_t f = 0; f < stats->function_count; f++) {
+        const FunctionPerf* function = &stats->functions[f];
+        char name[32];
+        snprintf(name, sizeof(name), "<#%p>", (const void*)function->chunk);
+        for (size_t n = 0; n < names.count; n++) {
+            if (names.chunks[n].chunk == function->chunk && names.chunks[n].name) {
+                snprintf(name, sizeof(name), "%s", names.chunks[n].name);
+            }
+        }
+        fprintf(out, "  %-20s %14llu", name, (unsigned long long)function->instructions);
+        // Per VM instruction, as in the table above
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            if (stats->slots[i] >= 0) fprintf(out, " %16.2f", ratio(function->counts[i], function->instructions));
+        }
+        fprintf(out, "\n");
+    }
+    free_trace_chunk_table(&names);
+}
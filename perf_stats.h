@@ -0,0 +1,71 @@
+#ifndef KAPPAVM_PERF_STATS_H
+#define KAPPAVM_PERF_STATS_H
+
+#include <stdio.h>
+#include "chunk.h"
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCHES,
+    PERF_BRANCH_MISSES,
+    PERF_CACHE_REFERENCES,
+    PERF_CACHE_MISSES,
+    PERF_COUNTER_COUNT,
+} PerfCounter;
+
+typedef struct {
+    const Chunk* chunk;
+    uint64_t instructions;                  // VM instructions dispatched
+    uint64_t counts[PERF_COUNTER_COUNT];
+} FunctionPerf;
+
+// Hardware counters of the calling thread, read through perf_event_open.
+// Counters the kernel or the CPU does not provide are left out; when none
+// can be opened, error says why and everything else still works, with the
+// counts staying zero.
+typedef struct PerfStats {
+    int group_fd;                           // -1 when no counter is open
+    int fds[PERF_COUNTER_COUNT];            // -1 for counters that could not be opened
+    int slots[PERF_COUNTER_COUNT];          // position in a group read, or -1
+    int opened;
+    char error[128];
+    // Filled by perf_stats_end for a run without vm->perf set
+    uint64_t run_counts[PERF_COUNTER_COUNT];
+    // Per-function counts, gathered while vm->perf is set
+    FunctionPerf* functions;
+    size_t function_count;
+    size_t function_capacity;
+    const Chunk* current_chunk;
+    size_t current_function;
+    bool charging;                          // last holds the counts at the current function's entry
+    uint64_t last[PERF_COUNTER_COUNT];
+} PerfStats;
+
+void perf_stats_init(PerfStats* stats);
+void perf_stats_free(PerfStats* stats);
+static inline bool perf_stats_available(const PerfStats* stats) { return stats->opened > 0; }
+
+// Reset and start the counters / stop them and add what they counted to
+// totals, which may be NULL
+void perf_stats_begin(PerfStats* stats);
+void perf_stats_end(PerfStats* stats, uint64_t totals[PERF_COUNTER_COUNT]);
+
+// Charges the counts since the last switch to the function that was running
+// and makes chunk the current one
+void perf_switch(PerfStats* stats, const Chunk* chunk);
+// Charges the counts so far; called when vm_run returns
+void perf_stop(PerfStats* stats);
+
+// Called by vm_run for every instruction while vm->perf is set. Counters are
+// only read when execution moves to another chunk.
+static inline void perf_step(PerfStats* stats, const Chunk* chunk) {
+    if (chunk != stats->current_chunk || !stats->charging) perf_switch(stats, chunk);
+    stats->functions[stats->current_function].instructions++;
+}
+
+// Prints run_counts per VM instruction and the per-function breakdown.
+// Functions are named after root's FUNCTION definitions when root is given.
+void perf_stats_report(const PerfStats* stats, const Chunk* root, FILE* out);
+
+#endif //KAPPAVM_PERF_STATS_H
@@ -0,0 +1,105 @@
+#include "profiler.h"
+#include <stdlib.h>
+#include <string.h>
+
+void profile_init(Profile* profile) {
+    memset(profile, 0, sizeof(Profile));
+    profile->last_opcode = -1;
+}
+
+void profile_free(Profile* profile) {
+    free(profile->functions);
+    profile_init(profile);
+}
+
+size_t profile_function(Profile* profile, const Chunk* chunk) {
+    for (size_t i = 0; i < profile->function_count; i++) {
+        if (profile->functions[i].chunk == chunk) return i;
+    }
+    if (profile->function_count == profile->function_capacity) {
+        profile->function_capacity = profile->function_capacity < 8 ? 8 : profile->function_capacity * 2;
+        profile->functions = realloc(profile->functions, sizeof(FunctionProfile) * profile->function_capacity);
+    }
+    profile->functions[profile->function_count] = (FunctionProfile){.chunk = chunk};
+    return profile->function_count++;
+}
+
+void profile_stop(Profile* profile) {
+    if (!profile->timing) return;
+    const uint64_t now = profile_clock();
+    if (profile->last_opcode >= 0) profile->opcode_ticks[profile->last_opcode] += now - profile->last_tick;
+    profile->functions[profile->last_function].ticks += now - profile->last_tick;
+    profile->timing = false;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * (double)part / (double)total : 0.0;
+}
+
+static int compare_counts_desc(const void* a, const void* b) {
+    const uint64_t x = ((const uint64_t*)a)[0];
+    const uint64_t y = ((const uint64_t*)b)[0];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void profile_report(const Profile* profile, const Chunk* root, FILE* out) {
+    uint64_t instructions = 0, ticks = 0;
+    for (size_t i = 0; i < profile->function_count; i++) {
+        instructions += profile->functions[i].instructions;
+        ticks += profile->functions[i].ticks;
+    }
+    fprintf(out, "== profile ==\n");
+    fprintf(out, "%llu instructions, %llu %s\n",
+            (unsigned long long)instructions, (unsigned long long)ticks, PROFILE_CLOCK_UNIT);
+
+    // Rows are {count, index} so one comparison sorts all three tables
+    uint64_t rows[OPCODE_COUNT * OPCODE_COUNT][2];
+    size_t row_count = 0;
+    for (int op = 0; op < OPCODE_COUNT; op++) {
+        if (!profile->opcode_counts[op]) continue;
+        rows[row_count][0] = profile->opcode_counts[op];
+        rows[row_count++][1] = (uint64_t)op;
+    }
+    qsort(rows, row_count, sizeof(rows[0]), compare_counts_desc);
+    fprintf(out, "== opcodes ==\n");
+    fprintf(out, "  %-16s %14s %7s %16s %10s\n", "opcode", "count", "%", PROFILE_CLOCK_UNIT, "per instr");
+    for (size_t i = 0; i < row_count; i++) {
+        const int op = (int)rows[i][1];
+        const uint64_t count = profile->opcode_counts[op];
+        fprintf(out, "  %-16s %14llu %6.2f%% %16llu %10.1f\n", opcode_name(op), (unsigned long long)count,
+                percent(count, instructions), (unsigned long long)profile->opcode_ticks[op],
+                (double)profile->opcode_ticks[op] / (double)count);
+    }
+
+    fprintf(out, "== functions ==\n");
+    fprintf(out, "  %-20s %14s %10s %16s %7s\n", "chunk", "instructions", "calls", PROFILE_CLOCK_UNIT, "%");
+    for (size_t i = 0; i < profile->function_count; i++) {
+        const FunctionProfile* function = &profile->functions[i];
+        char name[32];
+        if (function->name) {
+            snprintf(name, sizeof(name), "%s", function->name);
+        } else if (function->chunk == root) {
+            snprintf(name, sizeof(name), "main");
+        } else {
+            snprintf(name, sizeof(name), "<#%p>", (const void*)function->chunk);
+        }
+        fprintf(out, "  %-20s %14llu %10llu %16llu %6.2f%%\n", name, (unsigned long long)function->instructions,
+                (unsigned long long)function->calls, (unsigned long long)function->ticks,
+                percent(function->ticks, ticks));
+    }
+
+    row_count = 0;
+    for (int a = 0; a < OPCODE_COUNT; a++) {
+        for (int b = 0; b < OPCODE_COUNT; b++) {
+            if (!profile->pair_counts[a][b]) continue;
+            rows[row_count][0] = profile->pair_counts[a][b];
+            rows[row_count++][1] = (uint64_t)(a * OPCODE_COUNT + b);
+        }
+    }
+    qsort(rows, row_count, sizeof(rows[0]), compare_counts_desc);
+    fprintf(out, "== opcode pairs ==\n");
+    for (size_t i = 0; i < row_count && i < PROFILE_TOP_PAIRS; i++) {
+        const int a = (int)(rows[i][1] / OPCODE_COUNT), b = (int)(rows[i][1] % OPCODE_COUNT);
+        fprintf(out, "  %-16s -> %-16s %14llu\n", opcode_name(a), opcode_name(b), (unsigned long long)rows[i][0]);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef KAPPAVM_PROFILER_H
+#define KAPPAVM_PROFILER_H
+
+#include <stdio.h>
+#include "chunk.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_CLOCK_UNIT "cycles"
+#else
+#include <time.h>
+#define PROFILE_CLOCK_UNIT "ns"
+#endif
+
+// Pairs printed by profile_report, most frequent first
+#define PROFILE_TOP_PAIRS 10
+
+typedef struct {
+    const Chunk* chunk;
+    const char* name;      // the called function's name, once it is called
+    uint64_t instructions;
+    uint64_t calls;
+    uint64_t ticks;        // time spent in the function itself, not its callees
+} FunctionProfile;
+
+// Execution statistics gathered by vm_run while vm->profile is set. Time is
+// measured between consecutive instructions, so each instruction is charged
+// with its own cost plus the profiler's.
+typedef struct Profile {
+    uint64_t opcode_counts[OPCODE_COUNT];
+    uint64_t opcode_ticks[OPCODE_COUNT];
+    uint64_t pair_counts[OPCODE_COUNT][OPCODE_COUNT]; // [previous][next]
+    FunctionProfile* functions;
+    size_t function_count;
+    size_t function_capacity;
+    // State carried between instructions
+    const Chunk* current_chunk;
+    size_t current_function;
+    int last_opcode;       // -1 before the first instruction
+    size_t last_function;
+    uint64_t last_tick;
+    bool timing;           // last_tick is the start of the instruction being executed
+} Profile;
+
+void profile_init(Profile* profile);
+void profile_free(Profile* profile);
+// Entry for chunk, added on first use; returns its index in functions
+size_t profile_function(Profile* profile, const Chunk* chunk);
+// Charges the time since the last instruction; called when vm_run returns
+void profile_stop(Profile* profile);
+// Prints opcode counts and times, per-function totals and the most frequent
+// opcode pairs. Functions go by the name they were called with, and root,
+// when given, as main.
+void profile_report(const Profile* profile, const Chunk* root, FILE* out);
+
+static inline uint64_t profile_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Records one instruction of chunk about to execute
+static inline void profile_step(Profile* profile, const Chunk* chunk, const uint8_t opcode) {
+    const uint64_t now = profile_clock();
+    if (profile->timing) {
+        if (profile->last_opcode >= 0) profile->opcode_ticks[profile->last_opcode] += now - profile->last_tick;
+        profile->functions[profile->last_function].ticks += now - profile->last_tick;
+    }
+    if (chunk != profile->current_chunk) {
+        profile->current_function = profile_function(profile, chunk);
+        profile->current_chunk = chunk;
+    }
+    profile->functions[profile->current_function].instructions++;
+    if (opcode < OPCODE_COUNT) {
+        profile->opcode_counts[opcode]++;
+        if (profile->last_opcode >= 0) profile->pair_counts[profile->last_opcode][opcode]++;
+        profile->last_opcode = opcode;
+    } else {
+        profile->last_opcode = -1;
+    }
+    profile->last_function = profile->current_function;
+    profile->last_tick = now;
+    profile->timing = true;
+}
+
+#endif //KAPPAVM_PROFILER_H
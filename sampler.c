@@ -0,0 +1,177 @@
+#include "sampler.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Average depth the frame pool is sized for; deeper samples use up the pool sooner
+#define SAMPLER_FRAMES_PER_SAMPLE 8
+
+static Sampler* volatile active_sampler = NULL;
+static VM* volatile active_vm = NULL;
+static struct sigaction previous_action;
+
+void sampler_init(Sampler* sampler, size_t max_samples) {
+    memset(sampler, 0, sizeof(Sampler));
+    sampler->max_samples = max_samples;
+    sampler->max_frames = max_samples * SAMPLER_FRAMES_PER_SAMPLE;
+    sampler->samples = malloc(sizeof(Sample) * (max_samples ? max_samples : 1));
+    sampler->frames = malloc(sizeof(SampleFrame) * (sampler->max_frames ? sampler->max_frames : 1));
+}
+
+void sampler_free(Sampler* sampler) {
+    free(sampler->samples);
+    free(sampler->frames);
+    memset(sampler, 0, sizeof(Sampler));
+}
+
+void sampler_record(Sampler* sampler, const VM* vm) {
+    const int depth = vm->frame_count;
+    if (sampler->sample_count == sampler->max_samples ||
+        sampler->max_frames - sampler->frame_count < (size_t)depth) {
+        sampler->dropped++;
+        return;
+    }
+    Sample* sample = &sampler->samples[sampler->sample_count];
+    sample->first_frame = sampler->frame_count;
+    sample->depth = (size_t)depth;
+    for (int i = 0; i < depth; i++) {
+        const CallFrame* frame = &vm->frames[i];
+        sampler->frames[sampler->frame_count++] = (SampleFrame){
+            .chunk = frame->chunk,
+            .ip = (size_t)(frame->ip - frame->chunk->code.code),
+        };
+    }
+    sampler->sample_count++;
+}
+
+static void handle_sigprof(int signal) {
+    (void)signal;
+    const int saved_errno = errno;
+    Sampler* sampler = active_sampler;
+    VM* vm = active_vm;
+    if (sampler && vm) sampler_record(sampler, vm);
+    errno = saved_errno;
+}
+
+int sampler_start(Sampler* sampler, VM* vm, long interval_us) {
+    if (active_sampler) return -1;
+    active_vm = vm;
+    active_sampler = sampler;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &previous_action) != 0) {
+        active_sampler = NULL;
+        active_vm = NULL;
+        return -1;
+    }
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = interval_us / 1000000, .tv_usec = interval_us % 1000000},
+        .it_value = {.tv_sec = interval_us / 1000000, .tv_usec = interval_us % 1000000},
+    };
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &previous_action, NULL);
+        active_sampler = NULL;
+        active_vm = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void sampler_stop(void) {
+    if (!active_sampler) return;
+    const struct itimerval off = {0};
+    setitimer(ITIMER_PROF, &off, NULL);
+    sigaction(SIGPROF, &previous_action, NULL);
+    active_sampler = NULL;
+    active_vm = NULL;
+}
+
+typedef struct {
+    const Chunk* chunk;
+    const char* name;
+} ChunkName;
+
+typedef struct {
+    ChunkName* items;
+    size_t count;
+    size_t capacity;
+} ChunkNames;
+
+static const ChunkName* find_name(const ChunkNames* names, const Chunk* chunk) {
+    for (size_t i = 0; i < names->count; i++) {
+        if (names->items[i].chunk == chunk) return &names->items[i];
+    }
+    return NULL;
+}
+
+static void collect_names(ChunkNames* names, const Chunk* chunk, const char* name) {
+    if (find_name(names, chunk)) return;
+    if (names->count == names->capacity) {
+        names->capacity = names->capacity < 8 ? 8 : names->capacity * 2;
+        names->items = realloc(names->items, sizeof(ChunkName) * names->capacity);
+    }
+    names->items[names->count++] = (ChunkName){chunk, name};
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        const Value value = chunk->constants.values[i];
+        if (value.type == VAL_FUNCTION && value.as.function && value.as.function->chunk) {
+            collect_names(names, value.as.function->chunk, value.as.function->name);
+        }
+    }
+}
+
+static int compare_lines(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+void sampler_write_folded(const Sampler* sampler, const Chunk* root, FILE* out, bool with_offsets) {
+    ChunkNames names = {0};
+    if (root) collect_names(&names, root, "main");
+
+    char** lines = malloc(sizeof(char*) * (sampler->sample_count ? sampler->sample_count : 1));
+    size_t line_count = 0;
+    for (size_t s = 0; s < sampler->sample_count; s++) {
+        const Sample* sample = &sampler->samples[s];
+        // Taken after the outermost frame returned
+        if (sample->depth == 0) continue;
+        size_t length = 0, capacity = 64;
+        char* line = malloc(capacity);
+        line[0] = '\0';
+        for (size_t d = 0; d < sample->depth; d++) {
+            const SampleFrame* frame = &sampler->frames[sample->first_frame + d];
+            const ChunkName* entry = find_name(&names, frame->chunk);
+            char label[96];
+            int n;
+            if (entry && entry->name) {
+                n = snprintf(label, sizeof(label), "%s%.64s", d ? ";" : "", entry->name);
+            } else {
+                n = snprintf(label, sizeof(label), "%s<#%p>", d ? ";" : "", (const void*)frame->chunk);
+            }
+            if (with_offsets) n += snprintf(label + n, sizeof(label) - n, "+%zu", frame->ip);
+            if (length + (size_t)n + 1 > capacity) {
+                while (length + (size_t)n + 1 > capacity) capacity *= 2;
+                line = realloc(line, capacity);
+            }
+            memcpy(line + length, label, (size_t)n + 1);
+            length += (size_t)n;
+        }
+        lines[line_count++] = line;
+    }
+
+    // Identical stacks are adjacent once sorted
+    qsort(lines, line_count, sizeof(char*), compare_lines);
+    for (size_t s = 0; s < line_count;) {
+        size_t run = 1;
+        while (s + run < line_count && strcmp(lines[s], lines[s + run]) == 0) run++;
+        fprintf(out, "%s %zu\n", lines[s], run);
+        s += run;
+    }
+    for (size_t s = 0; s < line_count; s++) free(lines[s]);
+    free(lines);
+    free(names.items);
+}
@@ -0,0 +1,50 @@
+#ifndef KAPPAVM_SAMPLER_H
+#define KAPPAVM_SAMPLER_H
+
+#include <stdio.h>
+#include "chunk.h"
+#include "vm.h"
+
+#define SAMPLER_DEFAULT_INTERVAL_US 1000
+#define SAMPLER_DEFAULT_MAX_SAMPLES 65536
+
+typedef struct {
+    const Chunk* chunk;
+    size_t ip;             // offset of the next instruction in chunk
+} SampleFrame;
+
+typedef struct {
+    size_t first_frame;    // index into frames
+    size_t depth;
+} Sample;
+
+// Kappa call stacks captured by a SIGPROF timer. Storage is allocated up
+// front so the signal handler never allocates; samples that do not fit are
+// counted in dropped.
+typedef struct {
+    Sample* samples;
+    size_t sample_count;
+    size_t max_samples;
+    SampleFrame* frames;   // outermost frame first within each sample
+    size_t frame_count;
+    size_t max_frames;
+    size_t dropped;
+} Sampler;
+
+void sampler_init(Sampler* sampler, size_t max_samples);
+void sampler_free(Sampler* sampler);
+// Samples vm every interval_us microseconds of CPU time until sampler_stop.
+// Only one sampler can run at a time. Returns 0 on success and -1 if one is
+// already running or the timer cannot be set up.
+int sampler_start(Sampler* sampler, VM* vm, long interval_us);
+void sampler_stop(void);
+// Captures vm's current call stack; async-signal-safe. The instruction
+// pointer is read from memory, so the innermost offset may lag slightly.
+void sampler_record(Sampler* sampler, const VM* vm);
+// Writes one `frame;frame;... count` line per distinct stack, the format
+// flame-graph tools read. Frames are named after their functions, with main
+// for root and the chunk address for functions without a name. With
+// with_offsets each frame also gets the offset of its next instruction.
+void sampler_write_folded(const Sampler* sampler, const Chunk* root, FILE* out, bool with_offsets);
+
+#endif //KAPPAVM_SAMPLER_H
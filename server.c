@@ -0,0 +1,277 @@
+#include "server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct Connection {
+    int fd;
+    size_t length;                      // bytes of an unfinished request in buffer
+    char buffer[HOST_MAX_LINE];
+} Connection;
+
+static bool send_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        const ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} Output;
+
+static void append(Output* out, const char* text) {
+    const size_t length = strlen(text);
+    if (out->length + length > out->capacity) {
+        while (out->length + length > out->capacity) out->capacity = out->capacity < 4096 ? 4096 : out->capacity * 2;
+        out->data = realloc(out->data, out->capacity);
+    }
+    memcpy(out->data + out->length, text, length);
+    out->length += length;
+}
+
+// Reads what has arrived on a readable connection and answers every complete
+// request in it with a single write. Returns false once the connection is
+// finished with: closed by the client, failed, or sent an overlong line.
+static bool serve_connection(const Server* server, VM* vm, Connection* conn, Output* out) {
+    ssize_t received;
+    do {
+        received = read(conn->fd, conn->buffer + conn->length, sizeof(conn->buffer) - conn->length);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) return false;
+    conn->length += (size_t)received;
+
+    out->length = 0;
+    char response[HOST_MAX_LINE + 16];
+    size_t start = 0;
+    for (char* newline; (newline = memchr(conn->buffer + start, '\n', conn->length - start)) != NULL;) {
+        *newline = '\0';
+        host_handle_request(server->programs, server->program_count, vm, conn->buffer + start, response,
+                            sizeof(response));
+        append(out, response);
+        start = (size_t)(newline - conn->buffer) + 1;
+    }
+    conn->length -= start;
+    memmove(conn->buffer, conn->buffer + start, conn->length);
+    bool keep = true;
+    if (conn->length == sizeof(conn->buffer)) {
+        append(out, "ERR Request too long\n");
+        keep = false;
+    }
+    return send_all(conn->fd, out->data, out->length) && keep;
+}
+
+static void close_connection(Connection* conn) {
+    close(conn->fd);
+    free(conn);
+}
+
+static void push_connection(Connection*** items, size_t* count, size_t* capacity, Connection* conn) {
+    if (*count == *capacity) {
+        *capacity = *capacity < 8 ? 8 : *capacity * 2;
+        *items = realloc(*items, sizeof(Connection*) * *capacity);
+    }
+    (*items)[(*count)++] = conn;
+}
+
+// Queues a readable connection for the workers; called with lock held
+static void enqueue(Server* server, Connection* conn) {
+    if (server->queue_head + server->queue_count == server->queue_capacity && server->queue_head > 0) {
+        memmove(server->queue, server->queue + server->queue_head, sizeof(Connection*) * server->queue_count);
+        server->queue_head = 0;
+    }
+    size_t end = server->queue_head + server->queue_count;
+    push_connection(&server->queue, &end, &server->queue_capacity, conn);
+    server->queue_count++;
+}
+
+static void* worker_loop(void* arg) {
+    Server* server = arg;
+    VM vm;
+    vm_init(&vm);
+    Output out = {0};
+    while (true) {
+        pthread_mutex_lock(&server->lock);
+        while (server->queue_count == 0 && !server->stopping) pthread_cond_wait(&server->ready, &server->lock);
+        if (server->queue_count == 0) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        Connection* conn = server->queue[server->queue_head++];
+        server->queue_count--;
+        pthread_mutex_unlock(&server->lock);
+
+        if (!serve_connection(server, &vm, conn, &out)) {
+            close_connection(conn);
+            continue;
+        }
+        pthread_mutex_lock(&server->lock);
+        push_connection(&server->returned, &server->returned_count, &server->returned_capacity, conn);
+        pthread_mutex_unlock(&server->lock);
+        const char wake = 0;
+        while (write(server->wake_fds[1], &wake, 1) < 0 && errno == EINTR) {}
+    }
+    free(out.data);
+    vm_free(&vm);
+    return NULL;
+}
+
+static void* poll_loop(void* arg) {
+    Server* server = arg;
+    Connection** idle = NULL;
+    size_t idle_count = 0, idle_capacity = 0;
+    struct pollfd* fds = NULL;
+    size_t fds_capacity = 0;
+    while (true) {
+        pthread_mutex_lock(&server->lock);
+        const bool stopping = server->stopping;
+        for (size_t i = 0; i < server->returned_count; i++) {
+            push_connection(&idle, &idle_count, &idle_capacity, server->returned[i]);
+        }
+        server->returned_count = 0;
+        pthread_mutex_unlock(&server->lock);
+        if (stopping) break;
+
+        if (idle_count + 2 > fds_capacity) {
+            fds_capacity = (idle_count + 2) * 2;
+            fds = realloc(fds, sizeof(struct pollfd) * fds_capacity);
+        }
+        fds[0] = (struct pollfd){.fd = server->listen_fd, .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = server->wake_fds[0], .events = POLLIN};
+        for (size_t i = 0; i < idle_count; i++) fds[i + 2] = (struct pollfd){.fd = idle[i]->fd, .events = POLLIN};
+        if (poll(fds, idle_count + 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        // Backwards, so that removing a connection leaves the rest in place
+        pthread_mutex_lock(&server->lock);
+        size_t queued = 0;
+        for (size_t i = idle_count; i-- > 0;) {
+            if (!(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            enqueue(server, idle[i]);
+            idle[i] = idle[--idle_count];
+            queued++;
+        }
+        if (queued == 1) pthread_cond_signal(&server->ready);
+        else if (queued > 1) pthread_cond_broadcast(&server->ready);
+        pthread_mutex_unlock(&server->lock);
+
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(server->wake_fds[0], drain, sizeof(drain)) == (ssize_t)sizeof(drain)) {}
+        }
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept(server->listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                Connection* conn = malloc(sizeof(Connection));
+                conn->fd = fd;
+                conn->length = 0;
+                push_connection(&idle, &idle_count, &idle_capacity, conn);
+            }
+        }
+    }
+    for (size_t i = 0; i < idle_count; i++) close_connection(idle[i]);
+    free(idle);
+    free(fds);
+    return NULL;
+}
+
+int server_start(Server* server, const char* socket_path, HostProgram* programs, const size_t program_count,
+                 int worker_count) {
+    memset(server, 0, sizeof(Server));
+    server->programs = programs;
+    server->program_count = program_count;
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+    // A socket file left behind by a server that is gone would make bind fail
+    struct stat st;
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socket_path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listen_fd >= 0) fcntl(server->listen_fd, F_SETFD, FD_CLOEXEC);
+    if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(server->listen_fd, 128) != 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", socket_path, strerror(errno));
+        if (server->listen_fd >= 0) close(server->listen_fd);
+        return -1;
+    }
+    if (pipe(server->wake_fds) != 0) {
+        perror("pipe");
+        close(server->listen_fd);
+        return -1;
+    }
+    // Draining must not block once the pipe is empty
+    for (int i = 0; i < 2; i++) {
+        fcntl(server->wake_fds[i], F_SETFD, FD_CLOEXEC);
+        fcntl(server->wake_fds[i], F_SETFL, O_NONBLOCK);
+    }
+    if (worker_count <= 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cpus > 0 ? (int)cpus : 1;
+    }
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready, NULL);
+    server->workers = malloc(sizeof(pthread_t) * (size_t)worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&server->workers[i], NULL, worker_loop, server) != 0) break;
+        server->worker_count++;
+    }
+    if (server->worker_count == 0 || pthread_create(&server->poll_thread, NULL, poll_loop, server) != 0) {
+        fprintf(stderr, "Failed to start server threads\n");
+        pthread_mutex_lock(&server->lock);
+        server->stopping = true;
+        pthread_cond_broadcast(&server->ready);
+        pthread_mutex_unlock(&server->lock);
+        for (int i = 0; i < server->worker_count; i++) pthread_join(server->workers[i], NULL);
+        free(server->workers);
+        close(server->listen_fd);
+        close(server->wake_fds[0]);
+        close(server->wake_fds[1]);
+        pthread_mutex_destroy(&server->lock);
+        pthread_cond_destroy(&server->ready);
+        return -1;
+    }
+    return 0;
+}
+
+void server_stop(Server* server) {
+    pthread_mutex_lock(&server->lock);
+    server->stopping = true;
+    pthread_cond_broadcast(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+    const char wake = 0;
+    while (write(server->wake_fds[1], &wake, 1) < 0 && errno == EINTR) {}
+    pthread_join(server->poll_thread, NULL);
+    for (int i = 0; i < server->worker_count; i++) pthread_join(server->workers[i], NULL);
+
+    // Workers finish the queue before they exit, so only returned connections are left
+    for (size_t i = 0; i < server->returned_count; i++) close_connection(server->returned[i]);
+    free(server->returned);
+    free(server->queue);
+    free(server->workers);
+    close(server->listen_fd);
+    close(server->wake_fds[0]);
+    close(server->wake_fds[1]);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->ready);
+}
@@ -0,0 +1,51 @@
+#ifndef KAPPAVM_SERVER_H
+#define KAPPAVM_SERVER_H
+
+#include <pthread.h>
+#include "host.h"
+
+struct Connection;
+
+// Serves calls into preloaded programs over a Unix domain socket. Each
+// request is one line, a function name followed by integer arguments:
+//
+//     add 2 3
+//
+// and each gets one line back, in order, from host_handle_request. Clients
+// may send several requests before reading the responses. A line longer
+// than HOST_MAX_LINE gets an error and the connection is closed.
+//
+// A poll thread watches the listening socket and the idle connections and
+// queues each connection that becomes readable for the worker pool. A
+// worker reads what has arrived, answers every complete request line on its
+// own VM and hands the connection back, so a few workers can serve many
+// connections and one busy client cannot hold a worker between requests.
+typedef struct {
+    HostProgram* programs;              // searched in order for a function name
+    size_t program_count;
+    int listen_fd;
+    int wake_fds[2];                    // a pipe that wakes the poll thread
+    pthread_t poll_thread;
+    pthread_t* workers;
+    int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    // Readable connections waiting for a worker, and served connections
+    // waiting to go back to the poll thread; both guarded by lock
+    struct Connection** queue;
+    size_t queue_head, queue_count, queue_capacity;
+    struct Connection** returned;
+    size_t returned_count, returned_capacity;
+    bool stopping;
+} Server;
+
+// Binds socket_path, replacing a stale socket file, and starts the poll
+// thread and worker_count workers (0 = one per CPU). The programs must stay
+// loaded until server_stop returns. Returns 0 on success.
+int server_start(Server* server, const char* socket_path, HostProgram* programs, size_t program_count,
+                 int worker_count);
+// Stops accepting, closes every connection, joins the threads and removes
+// nothing from the file system; the caller unlinks the socket if it wants to
+void server_stop(Server* server);
+
+#endif //KAPPAVM_SERVER_H
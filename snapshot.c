@@ -0,0 +1,703 @@
+#include "snapshot.h"
+#include "list.h"
+#include "object.h"
+#include "string_value.h"
+#include "table.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define KAPPA_SNAPSHOT_MAGIC "KSN0"
+#define KAPPA_SNAPSHOT_VERSION 6
+
+// On-disk layout. Every record is a multiple of 8 bytes so that instruction
+// arrays stay aligned inside the mapping and can be executed in place.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t chunk_count;
+    uint64_t function_count;
+    uint64_t object_count;
+    uint64_t list_count;
+    uint64_t builder_count;
+    uint64_t stack_count;
+    uint64_t frame_count;
+    uint64_t pool_size;
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t chunk;
+    uint64_t name_length; // 0 for an unnamed function
+    uint64_t local_count;
+} SnapshotFunction;
+
+// Function names follow the function table, each NUL-terminated and padded
+static uint64_t padded_name_size(uint64_t name_length) {
+    return name_length ? (name_length + 1 + 7) & ~(uint64_t)7 : 0;
+}
+
+typedef struct {
+    uint32_t type;
+    uint32_t length;  // strings: the byte count
+    uint64_t payload; // number, a short string's bytes, offset into the string pool, or index into the
+                      // function, object, list or builder table
+} SnapshotValue;
+
+// The bytes of every other string go in a pool at the end of the file,
+// each NUL-terminated and padded
+static uint64_t padded_string_size(uint64_t length) {
+    return (length + 8) & ~(uint64_t)7;
+}
+
+// Followed by the properties
+typedef struct {
+    uint64_t property_count;
+    uint64_t prototype; // index into the object table plus one, 0 for none
+} SnapshotObject;
+
+typedef struct {
+    SnapshotValue key;
+    SnapshotValue value;
+} SnapshotProperty;
+
+// Followed by the elements, as int64_t for ELEMENTS_INTEGER and as
+// SnapshotValues otherwise
+typedef struct {
+    uint64_t kind;
+    uint64_t length;
+} SnapshotList;
+
+typedef struct {
+    uint64_t length;
+    uint64_t offset;    // of the bytes in the string pool
+} SnapshotBuilder;
+
+typedef struct {
+    uint64_t chunk;
+    uint64_t ip;
+    uint64_t slots;
+    uint64_t base;
+} SnapshotFrame;
+
+// Each chunk record holds its constant, instruction, jump table and handler
+// counts, the constants, the code, every jump table as its entry count
+// followed by its targets, and then the handlers. Targets and handlers are
+// used in place.
+_Static_assert(sizeof(size_t) == sizeof(uint64_t), "jump table targets are mapped as size_t");
+_Static_assert(sizeof(Handler) == 4 * sizeof(uint64_t), "handlers are mapped in place");
+
+typedef struct {
+    PtrIndex functions;
+    PtrIndex objects;
+    PtrIndex lists;
+    PtrIndex builders;
+    char* pool;
+    size_t pool_size;
+    size_t pool_capacity;
+} SnapshotWriter;
+
+static uint64_t pool_add(SnapshotWriter* writer, const char* chars, size_t length) {
+    const size_t size = padded_string_size(length);
+    if (writer->pool_size + size > writer->pool_capacity) {
+        while (writer->pool_size + size > writer->pool_capacity) {
+            writer->pool_capacity = writer->pool_capacity < 256 ? 256 : writer->pool_capacity * 2;
+        }
+        writer->pool = realloc(writer->pool, writer->pool_capacity);
+    }
+    const uint64_t offset = writer->pool_size;
+    if (length) memcpy(writer->pool + offset, chars, length);
+    memset(writer->pool + offset + length, 0, size - length);
+    writer->pool_size += size;
+    return offset;
+}
+
+// Numbers the function, object, list or builder value refers to, so that
+// it is saved too
+static int reach_value(SnapshotWriter* writer, Value value) {
+    switch (value.type) {
+        case VAL_NULL:
+        case VAL_NUMBER:
+        case VAL_DOUBLE:
+        case VAL_SHORT_STRING:
+        case VAL_SLICE:
+            return 0;
+        case VAL_STRING:
+            return strlen(value.as.string) > UINT32_MAX ? -2 : 0;
+        case VAL_HEAP_STRING:
+            return value.as.heap_string->length > UINT32_MAX ? -2 : 0;
+        case VAL_FUNCTION:
+            if (!value.as.function || !value.as.function->chunk) return -3;
+            ptr_index_add(&writer->functions, value.as.function);
+            return 0;
+        case VAL_OBJECT:
+            ptr_index_add(&writer->objects, value.as.object);
+            return 0;
+        case VAL_LIST:
+            ptr_index_add(&writer->lists, value.as.list);
+            return 0;
+        case VAL_BUILDER:
+            ptr_index_add(&writer->builders, value.as.builder);
+            return 0;
+    }
+    return -2;
+}
+
+// Encodes a value that went through reach_value. Strings of every kind are
+// copied into the pool, except short ones, which fit in the record.
+static SnapshotValue snapshot_value(SnapshotWriter* writer, Value value) {
+    SnapshotValue out = {.type = value.type};
+    switch (value.type) {
+        case VAL_NUMBER:
+        case VAL_DOUBLE:
+            memcpy(&out.payload, &value.as.number, sizeof(int64_t));
+            break;
+        case VAL_SHORT_STRING:
+            out.length = value.length;
+            memcpy(&out.payload, value.as.chars, sizeof(out.payload));
+            break;
+        case VAL_STRING:
+        case VAL_SLICE:
+        case VAL_HEAP_STRING: {
+            size_t length;
+            const char* chars = string_chars(&value, &length);
+            out.length = (uint32_t)length;
+            out.payload = pool_add(writer, chars, length);
+            break;
+        }
+        case VAL_FUNCTION:
+            out.payload = ptr_index_add(&writer->functions, value.as.function);
+            break;
+        case VAL_OBJECT:
+            out.payload = ptr_index_add(&writer->objects, value.as.object);
+            break;
+        case VAL_LIST:
+            out.payload = ptr_index_add(&writer->lists, value.as.list);
+            break;
+        case VAL_BUILDER:
+            out.payload = ptr_index_add(&writer->builders, value.as.builder);
+            break;
+        case VAL_NULL:
+            break;
+    }
+    return out;
+}
+
+static void write_value(SnapshotWriter* writer, Value value, FILE* f) {
+    const SnapshotValue record = snapshot_value(writer, value);
+    fwrite(&record, sizeof(record), 1, f);
+}
+
+static void write_object(SnapshotWriter* writer, const Object* object, FILE* f) {
+    const SnapshotObject record = {
+        .property_count = object->count,
+        .prototype = object->prototype ? ptr_index_add(&writer->objects, object->prototype) + 1 : 0,
+    };
+    fwrite(&record, sizeof(record), 1, f);
+    size_t cursor = 0;
+    const Property* property;
+    while (object_next(object, &cursor, &property)) {
+        // Keys carry their length, so they may hold NUL bytes
+        const SnapshotValue key = {VAL_STRING, property->length, pool_add(writer, property->key, property->length)};
+        const SnapshotProperty entry = {key, snapshot_value(writer, property->value)};
+        fwrite(&entry, sizeof(entry), 1, f);
+    }
+}
+
+static void write_list(SnapshotWriter* writer, const List* list, FILE* f) {
+    const SnapshotList record = {.kind = list->kind, .length = list->length};
+    fwrite(&record, sizeof(record), 1, f);
+    if (list->kind == ELEMENTS_INTEGER) {
+        fwrite(list->as.numbers, sizeof(int64_t), list->length, f);
+    } else {
+        for (size_t i = 0; i < list->length; i++) write_value(writer, list->as.items[i], f);
+    }
+}
+
+int save_snapshot(const VM* vm, const char* filename) {
+    PtrIndex chunks;
+    init_ptr_index(&chunks);
+    SnapshotWriter writer = {0};
+    init_ptr_index(&writer.functions);
+    init_ptr_index(&writer.objects);
+    init_ptr_index(&writer.lists);
+    init_ptr_index(&writer.builders);
+    int res = 0;
+
+    // Number every chunk, function, object, list and builder reachable from
+    // the frames and stack
+    const size_t stack_count = vm->stack_top - vm->stack;
+    for (size_t i = 0; i < stack_count && res == 0; i++) {
+        res = reach_value(&writer, vm->stack[i]);
+    }
+    for (int i = 0; i < vm->frame_count; i++) {
+        ptr_index_add(&chunks, vm->frames[i].chunk);
+    }
+    size_t function_cursor = 0, chunk_cursor = 0, object_cursor = 0, list_cursor = 0;
+    while (res == 0) {
+        if (function_cursor < writer.functions.count) {
+            const Function* fn = writer.functions.items[function_cursor++];
+            ptr_index_add(&chunks, fn->chunk);
+        } else if (chunk_cursor < chunks.count) {
+            const Chunk* chunk = chunks.items[chunk_cursor++];
+            for (size_t i = 0; i < chunk->constants.count && res == 0; i++) {
+                res = reach_value(&writer, chunk->constants.values[i]);
+            }
+        } else if (object_cursor < writer.objects.count) {
+            const Object* object = writer.objects.items[object_cursor++];
+            if (object->prototype) ptr_index_add(&writer.objects, object->prototype);
+            size_t cursor = 0;
+            const Property* property;
+            while (res == 0 && object_next(object, &cursor, &property)) {
+                res = reach_value(&writer, property->value);
+            }
+        } else if (list_cursor < writer.lists.count) {
+            const List* list = writer.lists.items[list_cursor++];
+            for (size_t i = 0; list->kind == ELEMENTS_GENERIC && i < list->length && res == 0; i++) {
+                res = reach_value(&writer, list->as.items[i]);
+            }
+        } else {
+            break;
+        }
+    }
+    if (res != 0) goto done;
+
+    FILE* f = fopen(filename, "wb");
+    if (!f) { res = -1; goto done; }
+
+    SnapshotHeader header = {
+        .version = KAPPA_SNAPSHOT_VERSION,
+        .chunk_count = chunks.count,
+        .function_count = writer.functions.count,
+        .object_count = writer.objects.count,
+        .list_count = writer.lists.count,
+        .builder_count = writer.builders.count,
+        .stack_count = stack_count,
+        .frame_count = (uint64_t)vm->frame_count,
+    };
+    memcpy(header.magic, KAPPA_SNAPSHOT_MAGIC, 4);
+    fwrite(&header, sizeof(header), 1, f);
+
+    for (size_t i = 0; i < writer.functions.count; i++) {
+        const Function* fn = writer.functions.items[i];
+        const SnapshotFunction record = {
+            .chunk = ptr_index_add(&chunks, fn->chunk),
+            .name_length = fn->name ? strlen(fn->name) : 0,
+            .local_count = fn->local_count,
+        };
+        fwrite(&record, sizeof(record), 1, f);
+    }
+    for (size_t i = 0; i < writer.functions.count; i++) {
+        const Function* fn = writer.functions.items[i];
+        if (!fn->name) continue;
+        const uint64_t length = strlen(fn->name);
+        static const char padding[8] = {0};
+        fwrite(fn->name, 1, length, f);
+        fwrite(padding, 1, padded_name_size(length) - length, f);
+    }
+    for (size_t c = 0; c < chunks.count; c++) {
+        const Chunk* chunk = chunks.items[c];
+        const uint64_t counts[4] = {chunk->constants.count, chunk->code.count, chunk->jump_tables.count,
+                                    chunk->handlers.count};
+        fwrite(counts, sizeof(uint64_t), 4, f);
+        for (size_t i = 0; i < chunk->constants.count; i++) {
+            write_value(&writer, chunk->constants.values[i], f);
+        }
+        fwrite(chunk->code.code, sizeof(Instruction), chunk->code.count, f);
+        for (size_t i = 0; i < chunk->jump_tables.count; i++) {
+            const JumpTable* table = &chunk->jump_tables.tables[i];
+            const uint64_t entry_count = table->count;
+            fwrite(&entry_count, sizeof(uint64_t), 1, f);
+            fwrite(table->targets, sizeof(size_t), table->count, f);
+        }
+        fwrite(chunk->handlers.handlers, sizeof(Handler), chunk->handlers.count, f);
+    }
+    for (size_t i = 0; i < writer.objects.count; i++) write_object(&writer, writer.objects.items[i], f);
+    for (size_t i = 0; i < writer.lists.count; i++) write_list(&writer, writer.lists.items[i], f);
+    for (size_t i = 0; i < writer.builders.count; i++) {
+        const StringBuilder* builder = writer.builders.items[i];
+        const SnapshotBuilder record = {builder->length, pool_add(&writer, builder->chars, builder->length)};
+        fwrite(&record, sizeof(record), 1, f);
+    }
+    for (size_t i = 0; i < stack_count; i++) write_value(&writer, vm->stack[i], f);
+    for (int i = 0; i < vm->frame_count; i++) {
+        const CallFrame* frame = &vm->frames[i];
+        SnapshotFrame record = {
+            .chunk = ptr_index_add(&chunks, frame->chunk),
+            .ip = (uint64_t)(frame->ip - frame->chunk->code.code),
+            .slots = (uint64_t)(frame->slots - vm->stack),
+            .base = (uint64_t)(frame->base - vm->stack),
+        };
+        fwrite(&record, sizeof(record), 1, f);
+    }
+    // The pool is complete only now, so the header is written again with its size
+    fwrite(writer.pool, 1, writer.pool_size, f);
+    header.pool_size = writer.pool_size;
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+    if (fclose(f) != 0) res = -1;
+
+done:
+    free_ptr_index(&chunks);
+    free_ptr_index(&writer.functions);
+    free_ptr_index(&writer.objects);
+    free_ptr_index(&writer.lists);
+    free_ptr_index(&writer.builders);
+    free(writer.pool);
+    return res;
+}
+
+// Bounds-checked cursor over the mapping
+typedef struct {
+    uint8_t* pos;
+    uint8_t* end;
+} Reader;
+
+static void* take(Reader* reader, uint64_t count, size_t size) {
+    if (size != 0 && count > (uint64_t)(reader->end - reader->pos) / size) return NULL;
+    void* ptr = reader->pos;
+    reader->pos += count * size;
+    return ptr;
+}
+
+// What restored values refer to. The objects, lists and builders are
+// allocated before any value is restored, so references between them
+// resolve in any order.
+typedef struct {
+    const Snapshot* snapshot;
+    VM* vm;
+    char* pool;
+    uint64_t pool_size;
+    Object** objects;
+    uint64_t object_count;
+    List** lists;
+    uint64_t list_count;
+    StringBuilder** builders;
+    uint64_t builder_count;
+} Restorer;
+
+// The NUL-terminated bytes at offset in the pool, or NULL if they are not there
+static char* pooled(const Restorer* restorer, uint64_t offset, uint64_t length) {
+    if (offset > restorer->pool_size || length >= restorer->pool_size - offset) return NULL;
+    char* chars = restorer->pool + offset;
+    return chars[length] == '\0' ? chars : NULL;
+}
+
+// Restored objects, lists, builders and heap strings go on the VM's heap,
+// as if the program had just made them
+static Object* restore_object_shell(VM* vm) {
+    Object* object = malloc(sizeof(Object));
+    init_object(object);
+    object->next = vm->objects;
+    vm->objects = object;
+    return object;
+}
+
+static List* restore_list_shell(VM* vm) {
+    List* list = malloc(sizeof(List));
+    init_list(list);
+    list->next = vm->lists;
+    vm->lists = list;
+    return list;
+}
+
+static StringBuilder* restore_builder_shell(VM* vm) {
+    StringBuilder* builder = malloc(sizeof(StringBuilder));
+    init_builder(builder);
+    builder->next = vm->builders;
+    vm->builders = builder;
+    return builder;
+}
+
+static String* restore_heap_string(VM* vm, const char* chars, size_t length) {
+    String* string = malloc(sizeof(String) + length + 1);
+    string->length = length;
+    memcpy(string->chars, chars, length + 1);
+    string->next = vm->strings;
+    vm->strings = string;
+    vm->heap_bytes += sizeof(String) + length + 1;
+    return string;
+}
+
+static int restore_value(const SnapshotValue* in, const Restorer* restorer, Value* out) {
+    *out = (Value){.type = (ValueType)in->type};
+    switch (in->type) {
+        case VAL_NULL:
+            return 0;
+        case VAL_NUMBER:
+        case VAL_DOUBLE:
+            memcpy(&out->as.number, &in->payload, sizeof(int64_t));
+            return 0;
+        case VAL_SHORT_STRING:
+            if (in->length > STRING_SHORT_MAX) return -4;
+            out->length = in->length;
+            memcpy(out->as.chars, &in->payload, sizeof(in->payload));
+            return 0;
+        case VAL_STRING:
+        case VAL_SLICE:
+        case VAL_HEAP_STRING: {
+            char* chars = pooled(restorer, in->payload, in->length);
+            if (!chars) return -4;
+            if (in->type == VAL_HEAP_STRING) {
+                out->as.heap_string = restore_heap_string(restorer->vm, chars, in->length);
+            } else {
+                out->length = in->type == VAL_SLICE ? in->length : 0;
+                out->as.string = chars;
+            }
+            return 0;
+        }
+        case VAL_FUNCTION:
+            if (in->payload >= restorer->snapshot->function_count) return -4;
+            out->as.function = &restorer->snapshot->functions[in->payload];
+            return 0;
+        case VAL_OBJECT:
+            if (in->payload >= restorer->object_count) return -4;
+            out->as.object = restorer->objects[in->payload];
+            return 0;
+        case VAL_LIST:
+            if (in->payload >= restorer->list_count) return -4;
+            out->as.list = restorer->lists[in->payload];
+            return 0;
+        case VAL_BUILDER:
+            if (in->payload >= restorer->builder_count) return -4;
+            out->as.builder = restorer->builders[in->payload];
+            return 0;
+    }
+    return -4;
+}
+
+// Fills in the objects, lists and builders from their records, which
+// load_snapshot has already bounds-checked
+static int restore_heap(Restorer* restorer, Reader* reader, const SnapshotBuilder* builders) {
+    VM* vm = restorer->vm;
+    for (uint64_t i = 0; i < restorer->object_count; i++) {
+        const SnapshotObject* record = take(reader, 1, sizeof(SnapshotObject));
+        const SnapshotProperty* properties = take(reader, record->property_count, sizeof(SnapshotProperty));
+        Object* object = restorer->objects[i];
+        if (record->prototype > restorer->object_count) return -4;
+        object->prototype = record->prototype ? restorer->objects[record->prototype - 1] : NULL;
+        for (uint64_t p = 0; p < record->property_count; p++) {
+            const SnapshotValue* key = &properties[p].key;
+            const char* chars = key->type == VAL_STRING ? pooled(restorer, key->payload, key->length) : NULL;
+            Value value;
+            if (!chars || restore_value(&properties[p].value, restorer, &value) != 0) return -4;
+            object_set(object, chars, key->length, value);
+        }
+        vm->heap_bytes += object_bytes(object);
+    }
+    for (uint64_t i = 0; i < restorer->list_count; i++) {
+        const SnapshotList* record = take(reader, 1, sizeof(SnapshotList));
+        List* list = restorer->lists[i];
+        list->kind = (ElementsKind)record->kind;
+        if (record->kind == ELEMENTS_INTEGER) {
+            const int64_t* numbers = take(reader, record->length, sizeof(int64_t));
+            list->as.numbers = malloc(sizeof(int64_t) * (record->length ? record->length : 1));
+            memcpy(list->as.numbers, numbers, sizeof(int64_t) * record->length);
+        } else {
+            const SnapshotValue* items = take(reader, record->length, sizeof(SnapshotValue));
+            list->as.items = malloc(sizeof(Value) * (record->length ? record->length : 1));
+            for (uint64_t e = 0; e < record->length; e++) {
+                if (restore_value(&items[e], restorer, &list->as.items[e]) != 0) return -4;
+            }
+        }
+        list->length = list->capacity = record->length;
+        vm->heap_bytes += list_bytes(list);
+    }
+    for (uint64_t i = 0; i < restorer->builder_count; i++) {
+        const char* chars = pooled(restorer, builders[i].offset, builders[i].length);
+        if (!chars) return -4;
+        builder_append(restorer->builders[i], chars, builders[i].length);
+        vm->heap_bytes += sizeof(StringBuilder) + restorer->builders[i]->capacity;
+    }
+    return 0;
+}
+
+int load_snapshot(VM* vm, Snapshot* snapshot, const char* filename) {
+    memset(snapshot, 0, sizeof(Snapshot));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return -2;
+    }
+    void* mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return -1;
+    snapshot->mapping = mapping;
+    snapshot->mapping_size = st.st_size;
+
+    Reader reader = { .pos = mapping, .end = (uint8_t*)mapping + st.st_size };
+    const SnapshotHeader* header = take(&reader, 1, sizeof(SnapshotHeader));
+    if (memcmp(header->magic, KAPPA_SNAPSHOT_MAGIC, 4) != 0) { free_snapshot(snapshot); return -2; }
+    if (header->version != KAPPA_SNAPSHOT_VERSION) { free_snapshot(snapshot); return -3; }
+    if (header->frame_count == 0 || header->frame_count > MAX_FRAMES ||
+        header->stack_count > VM_INIT_STACK_SIZE) {
+        free_snapshot(snapshot);
+        return -4;
+    }
+
+    const SnapshotFunction* function_table = take(&reader, header->function_count, sizeof(SnapshotFunction));
+    if (!function_table) { free_snapshot(snapshot); return -4; }
+    char* names = (char*)reader.pos;
+    for (uint64_t i = 0; i < header->function_count; i++) {
+        const uint64_t length = function_table[i].name_length;
+        if (length >= (uint64_t)(reader.end - reader.pos)) { free_snapshot(snapshot); return -4; }
+        char* name = take(&reader, padded_name_size(length), 1);
+        if (!name || (length && name[length] != '\0')) { free_snapshot(snapshot); return -4; }
+    }
+
+    // First walk: validate chunk records and size the shared constant array
+    uint8_t* chunk_records = reader.pos;
+    uint64_t total_constants = 0, total_tables = 0;
+    for (uint64_t c = 0; c < header->chunk_count; c++) {
+        const uint64_t* counts = take(&reader, 4, sizeof(uint64_t));
+        if (!counts || !take(&reader, counts[0], sizeof(SnapshotValue)) ||
+            !take(&reader, counts[1], sizeof(Instruction))) {
+            free_snapshot(snapshot);
+            return -4;
+        }
+        for (uint64_t t = 0; t < counts[2]; t++) {
+            const uint64_t* entry_count = take(&reader, 1, sizeof(uint64_t));
+            if (!entry_count || !take(&reader, *entry_count, sizeof(uint64_t))) {
+                free_snapshot(snapshot);
+                return -4;
+            }
+        }
+        if (!take(&reader, counts[3], sizeof(Handler))) {
+            free_snapshot(snapshot);
+            return -4;
+        }
+        total_constants += counts[0];
+        total_tables += counts[2];
+    }
+    // Likewise the object and list records
+    uint8_t* heap_records = reader.pos;
+    for (uint64_t i = 0; i < header->object_count; i++) {
+        const SnapshotObject* record = take(&reader, 1, sizeof(SnapshotObject));
+        if (!record || !take(&reader, record->property_count, sizeof(SnapshotProperty))) {
+            free_snapshot(snapshot);
+            return -4;
+        }
+    }
+    for (uint64_t i = 0; i < header->list_count; i++) {
+        const SnapshotList* record = take(&reader, 1, sizeof(SnapshotList));
+        if (!record || record->kind > ELEMENTS_GENERIC ||
+            !take(&reader, record->length, record->kind == ELEMENTS_INTEGER ? sizeof(int64_t) : sizeof(SnapshotValue))) {
+            free_snapshot(snapshot);
+            return -4;
+        }
+    }
+    const SnapshotBuilder* builders = take(&reader, header->builder_count, sizeof(SnapshotBuilder));
+    const SnapshotValue* stack = take(&reader, header->stack_count, sizeof(SnapshotValue));
+    const SnapshotFrame* frames = take(&reader, header->frame_count, sizeof(SnapshotFrame));
+    char* pool = take(&reader, header->pool_size, 1);
+    if (!builders || !stack || !frames || !pool) { free_snapshot(snapshot); return -4; }
+
+    snapshot->chunk_count = header->chunk_count;
+    snapshot->function_count = header->function_count;
+    snapshot->chunks = calloc(header->chunk_count ? header->chunk_count : 1, sizeof(Chunk));
+    snapshot->functions = calloc(header->function_count ? header->function_count : 1, sizeof(Function));
+    snapshot->constants = malloc(sizeof(Value) * (total_constants ? total_constants : 1));
+    snapshot->jump_tables = malloc(sizeof(JumpTable) * (total_tables ? total_tables : 1));
+
+    for (uint64_t i = 0; i < header->function_count; i++) {
+        if (function_table[i].chunk >= header->chunk_count) { free_snapshot(snapshot); return -4; }
+        snapshot->functions[i].chunk = &snapshot->chunks[function_table[i].chunk];
+        snapshot->functions[i].name = function_table[i].name_length ? names : NULL;
+        snapshot->functions[i].local_count = function_table[i].local_count;
+        names += padded_name_size(function_table[i].name_length);
+    }
+
+    // The heap goes on the VM, so from here on failing frees the VM as well
+    vm_init(vm);
+    Restorer restorer = {
+        .snapshot = snapshot,
+        .vm = vm,
+        .pool = pool,
+        .pool_size = header->pool_size,
+        .object_count = header->object_count,
+        .list_count = header->list_count,
+        .builder_count = header->builder_count,
+    };
+    restorer.objects = malloc(sizeof(Object*) * (header->object_count ? header->object_count : 1));
+    restorer.lists = malloc(sizeof(List*) * (header->list_count ? header->list_count : 1));
+    restorer.builders = malloc(sizeof(StringBuilder*) * (header->builder_count ? header->builder_count : 1));
+    for (uint64_t i = 0; i < header->object_count; i++) restorer.objects[i] = restore_object_shell(vm);
+    for (uint64_t i = 0; i < header->list_count; i++) restorer.lists[i] = restore_list_shell(vm);
+    for (uint64_t i = 0; i < header->builder_count; i++) restorer.builders[i] = restore_builder_shell(vm);
+
+    // Second walk: wire chunks to the mapping and relocate constants
+    int res = 0;
+    reader.pos = chunk_records;
+    Value* constants = snapshot->constants;
+    JumpTable* tables = snapshot->jump_tables;
+    for (uint64_t c = 0; c < header->chunk_count && res == 0; c++) {
+        const uint64_t* counts = take(&reader, 4, sizeof(uint64_t));
+        const SnapshotValue* values = take(&reader, counts[0], sizeof(SnapshotValue));
+        Instruction* code = take(&reader, counts[1], sizeof(Instruction));
+        Chunk* chunk = &snapshot->chunks[c];
+        chunk->constants.values = constants;
+        chunk->constants.count = chunk->constants.capacity = counts[0];
+        chunk->code.code = code;
+        chunk->code.count = chunk->code.capacity = counts[1];
+        chunk->jump_tables.tables = tables;
+        chunk->jump_tables.count = chunk->jump_tables.capacity = counts[2];
+        for (uint64_t t = 0; t < counts[2]; t++) {
+            tables->count = *(const uint64_t*)take(&reader, 1, sizeof(uint64_t));
+            tables->targets = take(&reader, tables->count, sizeof(size_t));
+            tables++;
+        }
+        chunk->handlers.handlers = take(&reader, counts[3], sizeof(Handler));
+        chunk->handlers.count = chunk->handlers.capacity = counts[3];
+        for (uint64_t i = 0; i < counts[0] && res == 0; i++) {
+            res = restore_value(&values[i], &restorer, &constants[i]);
+        }
+        constants += counts[0];
+    }
+    reader.pos = heap_records;
+    if (res == 0) res = restore_heap(&restorer, &reader, builders);
+    for (uint64_t i = 0; i < header->stack_count && res == 0; i++) {
+        res = restore_value(&stack[i], &restorer, &vm->stack[i]);
+    }
+    vm->stack_top = vm->stack + header->stack_count;
+    for (uint64_t i = 0; i < header->frame_count && res == 0; i++) {
+        if (frames[i].chunk >= header->chunk_count || frames[i].slots > header->stack_count ||
+            frames[i].base > header->stack_count ||
+            frames[i].ip > snapshot->chunks[frames[i].chunk].code.count) {
+            res = -4;
+            break;
+        }
+        Chunk* chunk = &snapshot->chunks[frames[i].chunk];
+        vm->frames[i].chunk = chunk;
+        vm->frames[i].ip = chunk->code.code + frames[i].ip;
+        vm->frames[i].slots = vm->stack + frames[i].slots;
+        vm->frames[i].base = vm->stack + frames[i].base;
+    }
+    vm->frame_count = (int)header->frame_count;
+    free(restorer.objects);
+    free(restorer.lists);
+    free(restorer.builders);
+    if (res != 0) {
+        vm_free(vm);
+        vm_init(vm);
+        free_snapshot(snapshot);
+    }
+    return res;
+}
+
+void free_snapshot(Snapshot* snapshot) {
+    if (snapshot->mapping) munmap(snapshot->mapping, snapshot->mapping_size);
+    free(snapshot->chunks);
+    free(snapshot->functions);
+    free(snapshot->constants);
+    free(snapshot->jump_tables);
+    memset(snapshot, 0, sizeof(Snapshot));
+}
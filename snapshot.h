@@ -0,0 +1,31 @@
+#ifndef KAPPAVM_SNAPSHOT_H
+#define KAPPAVM_SNAPSHOT_H
+
+#include "common.h"
+#include "chunk.h"
+#include "vm.h"
+
+// A VM image restored from a snapshot file. The instruction arrays, jump
+// table targets and handler tables of the restored chunks point straight
+// into the (private, copy-on-write) file mapping, so they must not be grown
+// with write_instruction or released with free_chunk; free_snapshot
+// releases everything at once. So do the bytes of restored VAL_STRING and
+// VAL_SLICE values. The objects, lists, string builders and heap strings
+// reachable from the stack are rebuilt on the restored VM's heap, shared
+// references and cycles included, and vm_free releases them as usual.
+typedef struct {
+    void* mapping;
+    size_t mapping_size;
+    Chunk* chunks;
+    size_t chunk_count;
+    Function* functions;
+    size_t function_count;
+    Value* constants;
+    JumpTable* jump_tables;
+} Snapshot;
+
+int save_snapshot(const VM* vm, const char* filename);
+int load_snapshot(VM* vm, Snapshot* snapshot, const char* filename);
+void free_snapshot(Snapshot* snapshot);
+
+#endif //KAPPAVM_SNAPSHOT_H
@@ -0,0 +1,44 @@
+#include "string_value.h"
+#include <stdlib.h>
+
+Value make_short_string(const char *chars, size_t length) {
+    Value value = {.type = VAL_SHORT_STRING, .length = (uint32_t)length};
+    memcpy(value.as.chars, chars, length);
+    return value;
+}
+
+Value string_slice(const Value *string, size_t start, size_t end) {
+    size_t length;
+    const char *chars = string_chars(string, &length);
+    if (end - start <= STRING_SHORT_MAX) return make_short_string(chars + start, end - start);
+    return (Value){.type = VAL_SLICE, .length = (uint32_t)(end - start), .as.string = (char *)chars + start};
+}
+
+int string_compare(const char *a, size_t a_length, const char *b, size_t b_length) {
+    const int order = memcmp(a, b, a_length < b_length ? a_length : b_length);
+    if (order != 0) return order;
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+void init_builder(StringBuilder *builder) {
+    builder->chars = NULL;
+    builder->length = 0;
+    builder->capacity = 0;
+    builder->next = NULL;
+}
+
+void free_builder(StringBuilder *builder) {
+    free(builder->chars);
+    init_builder(builder);
+}
+
+void builder_append(StringBuilder *builder, const char *chars, size_t length) {
+    if (builder->capacity - builder->length < length) {
+        size_t capacity = builder->capacity < 16 ? 16 : builder->capacity * 2;
+        while (capacity - builder->length < length) capacity *= 2;
+        builder->chars = realloc(builder->chars, capacity);
+        builder->capacity = capacity;
+    }
+    memcpy(builder->chars + builder->length, chars, length);
+    builder->length += length;
+}
@@ -0,0 +1,55 @@
+#ifndef KAPPAVM_STRING_VALUE_H
+#define KAPPAVM_STRING_VALUE_H
+
+#include <string.h>
+#include "value.h"
+
+// Strings come in four kinds, which compare, print and serve as property
+// keys alike:
+//
+//   VAL_STRING        a NUL-terminated string owned elsewhere: a chunk's
+//                     constant, an object's key or an error message
+//   VAL_SHORT_STRING  up to STRING_SHORT_MAX bytes kept inside the Value,
+//                     so short strings made at run time allocate nothing
+//   VAL_SLICE         a view of part of a longer string's bytes, made
+//                     without copying or allocating
+//   VAL_HEAP_STRING   a String on the VM heap, one allocation for the
+//                     header and the bytes
+//
+// Only VAL_STRING and VAL_HEAP_STRING are NUL-terminated. Nothing on the VM
+// heap is freed before all of it is, so a slice never outlives its bytes.
+#define STRING_SHORT_MAX 8
+
+static inline bool is_string(Value value) {
+    return value.type == VAL_STRING || value.type == VAL_SHORT_STRING || value.type == VAL_SLICE ||
+           value.type == VAL_HEAP_STRING;
+}
+
+// The bytes of a string value and their count. A short string's bytes are
+// inside *value, so they are only good for as long as it is.
+static inline const char *string_chars(const Value *value, size_t *length) {
+    switch (value->type) {
+        case VAL_SHORT_STRING: *length = value->length; return value->as.chars;
+        case VAL_SLICE: *length = value->length; return value->as.string;
+        case VAL_HEAP_STRING: *length = value->as.heap_string->length; return value->as.heap_string->chars;
+        default: *length = strlen(value->as.string); return value->as.string;
+    }
+}
+
+// A short string of length bytes; length must be at most STRING_SHORT_MAX
+Value make_short_string(const char *chars, size_t length);
+// Bytes [start, end) of string, which must be in range and, unless they fit
+// in a short string, no more than UINT32_MAX. Short results are copied into
+// the value; longer ones view string's bytes.
+Value string_slice(const Value *string, size_t start, size_t end);
+// Negative, zero or positive as a sorts before, with or after b, byte by
+// byte, a prefix first
+int string_compare(const char *a, size_t a_length, const char *b, size_t b_length);
+
+void init_builder(StringBuilder *builder);
+void free_builder(StringBuilder *builder);
+// Appends length bytes. The buffer at least doubles whenever it grows, so
+// building a string of n bytes copies O(n) bytes however it is split up.
+void builder_append(StringBuilder *builder, const char *chars, size_t length);
+
+#endif //KAPPAVM_STRING_VALUE_H
@@ -0,0 +1,135 @@
+#include "table.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_MAX_LOAD 0.75
+
+void init_table(Table* table) {
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+}
+
+void free_table(Table* table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        free(table->entries[i].key);
+    }
+    free(table->entries);
+    init_table(table);
+}
+
+// FNV-1a
+uint32_t hash_string(const char* key, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static Entry* find_entry(Entry* entries, size_t capacity, const char* key, size_t length, uint32_t hash) {
+    size_t index = hash & (capacity - 1);
+    for (;;) {
+        Entry* entry = &entries[index];
+        if (entry->key == NULL ||
+            (entry->hash == hash && entry->length == length && memcmp(entry->key, key, length) == 0)) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void adjust_capacity(Table* table, size_t capacity) {
+    Entry* entries = calloc(capacity, sizeof(Entry));
+    for (size_t i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+        Entry* dest = find_entry(entries, capacity, entry->key, entry->length, entry->hash);
+        *dest = *entry;
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+bool table_get(const Table* table, const char* key, size_t length, size_t* value) {
+    if (table->count == 0) return false;
+    Entry* entry = find_entry(table->entries, table->capacity, key, length, hash_string(key, length));
+    if (entry->key == NULL) return false;
+    *value = entry->value;
+    return true;
+}
+
+bool table_set(Table* table, const char* key, size_t length, size_t value) {
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+        adjust_capacity(table, table->capacity < 8 ? 8 : table->capacity * 2);
+    }
+    uint32_t hash = hash_string(key, length);
+    Entry* entry = find_entry(table->entries, table->capacity, key, length, hash);
+    bool is_new = entry->key == NULL;
+    if (is_new) {
+        entry->key = malloc(length + 1);
+        memcpy(entry->key, key, length);
+        entry->key[length] = '\0';
+        entry->length = length;
+        entry->hash = hash;
+        table->count++;
+    }
+    entry->value = value;
+    return is_new;
+}
+
+void init_ptr_index(PtrIndex* index) {
+    memset(index, 0, sizeof(PtrIndex));
+}
+
+void free_ptr_index(PtrIndex* index) {
+    free(index->keys);
+    free(index->indices);
+    free(index->items);
+    init_ptr_index(index);
+}
+
+static size_t ptr_hash(const void* ptr) {
+    uint64_t x = (uint64_t)(uintptr_t)ptr;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+static void ptr_index_grow(PtrIndex* index) {
+    size_t new_capacity = index->capacity < 16 ? 16 : index->capacity * 2;
+    const void** keys = calloc(new_capacity, sizeof(void*));
+    size_t* indices = malloc(sizeof(size_t) * new_capacity);
+    for (size_t i = 0; i < index->capacity; i++) {
+        if (!index->keys[i]) continue;
+        size_t slot = ptr_hash(index->keys[i]) & (new_capacity - 1);
+        while (keys[slot]) slot = (slot + 1) & (new_capacity - 1);
+        keys[slot] = index->keys[i];
+        indices[slot] = index->indices[i];
+    }
+    free(index->keys);
+    free(index->indices);
+    index->keys = keys;
+    index->indices = indices;
+    index->capacity = new_capacity;
+}
+
+size_t ptr_index_add(PtrIndex* index, const void* ptr) {
+    if ((index->count + 1) * 2 > index->capacity) ptr_index_grow(index);
+    size_t slot = ptr_hash(ptr) & (index->capacity - 1);
+    while (index->keys[slot]) {
+        if (index->keys[slot] == ptr) return index->indices[slot];
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    if (index->count == index->items_capacity) {
+        index->items_capacity = index->items_capacity < 8 ? 8 : index->items_capacity * 2;
+        index->items = realloc(index->items, sizeof(void*) * index->items_capacity);
+    }
+    index->keys[slot] = ptr;
+    index->indices[slot] = index->count;
+    index->items[index->count] = ptr;
+    return index->count++;
+}
@@ -0,0 +1,44 @@
+#ifndef KAPPAVM_TABLE_H
+#define KAPPAVM_TABLE_H
+
+#include "common.h"
+
+// Open-addressing hash table from string keys to size_t values. Keys are
+// copied on insert, so callers may pass slices of a larger buffer.
+typedef struct {
+    char* key;
+    size_t length;
+    uint32_t hash;
+    size_t value;
+} Entry;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Entry* entries;
+} Table;
+
+void init_table(Table* table);
+void free_table(Table* table);
+uint32_t hash_string(const char* key, size_t length);
+bool table_get(const Table* table, const char* key, size_t length, size_t* value);
+// Returns true if the key was not present before
+bool table_set(Table* table, const char* key, size_t length, size_t value);
+
+// Map from pointers to dense indices, used to number the chunks and
+// functions of a program while saving it
+typedef struct {
+    const void** keys;
+    size_t* indices;
+    size_t capacity;
+    const void** items; // insertion order, doubles as the worklist
+    size_t count;
+    size_t items_capacity;
+} PtrIndex;
+
+void init_ptr_index(PtrIndex* index);
+void free_ptr_index(PtrIndex* index);
+// Returns the index of ptr, adding it to the end of items if it is new
+size_t ptr_index_add(PtrIndex* index, const void* ptr);
+
+#endif //KAPPAVM_TABLE_H
@@ -10,6 +10,7 @@ int main() {
     program.functions = NULL;
     program.function_count = 0;
     program.function_capacity = 0;
+    program.had_error = false;
 
     // Create a simple add function
     Chunk* func_chunk = malloc(sizeof(Chunk));
@@ -20,6 +21,9 @@ int main() {
     Function* func = malloc(sizeof(Function));
     func->chunk = func_chunk;
     
+    func->local_count = 0;
+    func->name = "add";
+    
     // Add constants to main chunk in correct order
     size_t func_idx = add_constant(&program.main_chunk, (Value){.type = VAL_FUNCTION, .as.function = func});
     size_t arg1_idx = add_constant(&program.main_chunk, (Value){.type = VAL_NUMBER, .as.number = 5});
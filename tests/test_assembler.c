@@ -1,6 +1,7 @@
 #include "../assembler.h"
 #include "../chunk.h"
 #include "test_macros.h"
+#include <stdlib.h>
 #include <string.h>
 
 TEST(test_assemble_labels_and_jumps) {
@@ -109,11 +110,295 @@ TEST(test_assemble_function_definition) {
     free_program(&program);
 }
 
+TEST(test_assemble_forward_function_reference) {
+    const char *src =
+        "  CONSTANT add_func\n"
+        "  CONSTANT 5\n"
+        "  CONSTANT 10\n"
+        "  CALL 2\n"
+        "  HALT\n"
+        "FUNCTION add_func\n"
+        "  # comments and blank lines do not count as instructions\n"
+        "\n"
+        "  JMP body\n"
+        "body:\n"
+        "  ADD\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n";
+
+    Program program = assemble_program_from_string(src);
+
+    ASSERT_EQ(program.had_error, false, "%d");
+    ASSERT_EQ(program.function_count, (size_t)1, "%zu");
+    ASSERT_EQ(program.main_chunk.constants.values[0].type, VAL_FUNCTION, "%d");
+    ASSERT_EQ(program.main_chunk.constants.values[0].as.function, program.functions[0].function, "%p");
+    ASSERT_EQ(program.functions[0].chunk->code.count, (size_t)3, "%zu"); // JMP, ADD, RETURN
+    ASSERT_EQ(get_operand(program.functions[0].chunk->code.code[0]), (uint64_t)0, "%llu");
+
+    free_program(&program);
+}
+
+TEST(test_assemble_jumps_in_main_with_functions) {
+    const char *src =
+        "FUNCTION unused\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "loop:\n"
+        "  CONSTANT 0\n"
+        "  JMP_IF_FALSE done\n"
+        "  JMP loop\n"
+        "done:\n"
+        "  HALT\n";
+
+    Program program = assemble_program_from_string(src);
+
+    ASSERT_EQ(program.had_error, false, "%d");
+    ASSERT_EQ(program.main_chunk.code.count, (size_t)4, "%zu");
+    ASSERT_EQ(get_operand(program.main_chunk.code.code[1]), (uint64_t)1, "%llu");
+    ASSERT_EQ((int16_t)get_operand(program.main_chunk.code.code[2]), (int16_t)-3, "%d");
+
+    free_program(&program);
+}
+
+TEST(test_assemble_reports_errors) {
+    Program undefined_label = assemble_program_from_string("  JMP nowhere\n  HALT\n");
+    ASSERT_EQ(undefined_label.had_error, true, "%d");
+    free_program(&undefined_label);
+
+    Program undefined_function = assemble_program_from_string("  CONSTANT missing\n  HALT\n");
+    ASSERT_EQ(undefined_function.had_error, true, "%d");
+    free_program(&undefined_function);
+
+    Program unterminated = assemble_program_from_string("FUNCTION f\n  RETURN\n");
+    ASSERT_EQ(unterminated.had_error, true, "%d");
+    free_program(&unterminated);
+}
+
+// A jump over padding DUPs, forwards or backwards
+static Program assemble_long_jump(size_t padding, bool forward) {
+    const char *before = forward ? "  CONSTANT 0\n  JMP far\n" : "  CONSTANT 0\nfar:\n";
+    const char *after = forward ? "far:\n  HALT\n" : "  JMP far\n";
+    const size_t size = strlen(before) + padding * 6 + strlen(after) + 1;
+    char *src = malloc(size);
+    char *end = stpcpy(src, before);
+    for (size_t i = 0; i < padding; i++) end = stpcpy(end, "  DUP\n");
+    strcpy(end, after);
+    Program program = assemble_program_from_string(src);
+    free(src);
+    return program;
+}
+
+TEST(test_assemble_rejects_long_jumps) {
+    // Offsets are stored for vm_run to read as int16_t
+    Program fits = assemble_long_jump(INT16_MAX, true);
+    ASSERT_EQ(fits.had_error, false, "%d");
+    free_program(&fits);
+    Program too_far = assemble_long_jump(INT16_MAX + 1, true);
+    ASSERT_EQ(too_far.had_error, true, "%d");
+    free_program(&too_far);
+
+    // A backward jump goes one further, to the instruction before it
+    Program fits_back = assemble_long_jump(-(INT16_MIN + 1), false);
+    ASSERT_EQ(fits_back.had_error, false, "%d");
+    free_program(&fits_back);
+    Program too_far_back = assemble_long_jump(-(INT16_MIN + 1) + 1, false);
+    ASSERT_EQ(too_far_back.had_error, true, "%d");
+    free_program(&too_far_back);
+}
+
+TEST(test_parallel_assembly_matches_serial) {
+    // Functions call the next one so cross-references span blocks
+    char *src = malloc(64 * 1024);
+    size_t len = 0;
+    for (int i = 0; i < 64; i++) {
+        len += sprintf(src + len, "FUNCTION fn_%d\n  CONSTANT %d\n  JMP_IF_FALSE out\n", i, i % 3);
+        if (i + 1 < 64) len += sprintf(src + len, "  CONSTANT fn_%d\n  CONSTANT %d\n  CALL 1\n", i + 1, i);
+        len += sprintf(src + len, "out:\n  ADD\n  RETURN\nENDFUNCTION\n");
+        len += sprintf(src + len, "  CONSTANT fn_%d\n  CONSTANT 1\n  CALL 1\n", 63 - i);
+    }
+    sprintf(src + len, "  HALT\n");
+
+    Program serial = assemble_program_from_string(src);
+    Program parallel = assemble_program_from_string_parallel(src, 4);
+    ASSERT_EQ(serial.had_error, false, "%d");
+    ASSERT_EQ(parallel.had_error, false, "%d");
+    ASSERT_EQ(parallel.function_count, serial.function_count, "%zu");
+
+    for (size_t f = 0; f <= serial.function_count; f++) {
+        const Chunk *a = f == 0 ? &serial.main_chunk : serial.functions[f - 1].chunk;
+        const Chunk *b = f == 0 ? &parallel.main_chunk : parallel.functions[f - 1].chunk;
+        if (f > 0) ASSERT_EQ(strcmp(serial.functions[f - 1].name, parallel.functions[f - 1].name), 0, "%d");
+        ASSERT_EQ(b->code.count, a->code.count, "%zu");
+        ASSERT_EQ(memcmp(b->code.code, a->code.code, a->code.count * sizeof(Instruction)), 0, "%d");
+        ASSERT_EQ(b->constants.count, a->constants.count, "%zu");
+        for (size_t i = 0; i < a->constants.count; i++) {
+            ASSERT_EQ(b->constants.values[i].type, a->constants.values[i].type, "%d");
+            if (a->constants.values[i].type != VAL_FUNCTION) continue;
+            // Function constants must refer to the same definition
+            size_t ia = 0, ib = 0;
+            while (serial.functions[ia].function != a->constants.values[i].as.function) ia++;
+            while (parallel.functions[ib].function != b->constants.values[i].as.function) ib++;
+            ASSERT_EQ(ib, ia, "%zu");
+        }
+    }
+
+    free_program(&serial);
+    free_program(&parallel);
+    free(src);
+}
+
+TEST(test_assemble_switch) {
+    const char *src =
+        "back:\n"                  // (address 0)
+        "  CONSTANT 1\n"           // 0
+        "  SWITCH one back two  # comment\n" // 1
+        "  HALT\n"                 // 2
+        "one:\n"                   // (address 3)
+        "  HALT\n"                 // 3
+        "two:\n"                   // (address 4)
+        "  HALT\n";                // 4
+    Chunk chunk = assemble_chunk_from_string(src);
+    ASSERT_EQ(chunk.code.count, (size_t)5, "%zu");
+    ASSERT_EQ(get_opcode(chunk.code.code[1]), OP_SWITCH, "%d");
+    ASSERT_EQ(get_operand(chunk.code.code[1]), (uint64_t)0, "%llu");
+    ASSERT_EQ(chunk.jump_tables.count, (size_t)1, "%zu");
+    const JumpTable *table = &chunk.jump_tables.tables[0];
+    ASSERT_EQ(table->count, (size_t)3, "%zu");
+    ASSERT_EQ(table->targets[0], (size_t)3, "%zu");
+    ASSERT_EQ(table->targets[1], (size_t)0, "%zu");
+    ASSERT_EQ(table->targets[2], (size_t)4, "%zu");
+    free_chunk(&chunk);
+
+    Program undefined = assemble_program_from_string("  CONSTANT 0\n  SWITCH a nowhere\na:\n  HALT\n");
+    ASSERT_EQ(undefined.had_error, true, "%d");
+    free_program(&undefined);
+    Program empty = assemble_program_from_string("  CONSTANT 0\n  SWITCH\n  HALT\n");
+    ASSERT_EQ(empty.had_error, true, "%d");
+    free_program(&empty);
+}
+
+TEST(test_assemble_locals) {
+    const char *src =
+        "FUNCTION swap_sub 1  # one local\n"
+        "  GET_LOCAL 1\n"
+        "  SET_LOCAL 3\n"
+        "  GET_LOCAL 2\n"
+        "  GET_LOCAL 3\n"
+        "  SUB\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "FUNCTION plain\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  HALT\n";
+    Program serial = assemble_program_from_string(src);
+    Program parallel = assemble_program_from_string_parallel(src, 2);
+    ASSERT_EQ(serial.had_error, false, "%d");
+    ASSERT_EQ(parallel.had_error, false, "%d");
+    ASSERT_EQ(serial.functions[0].function->local_count, (size_t)1, "%zu");
+    ASSERT_EQ(parallel.functions[0].function->local_count, (size_t)1, "%zu");
+    ASSERT_EQ(serial.functions[1].function->local_count, (size_t)0, "%zu");
+    ASSERT_EQ(get_opcode(serial.functions[0].chunk->code.code[1]), OP_SET_LOCAL, "%d");
+    ASSERT_EQ(get_operand(serial.functions[0].chunk->code.code[1]), (uint64_t)3, "%llu");
+    free_program(&serial);
+    free_program(&parallel);
+
+    Program bad_count = assemble_program_from_string("FUNCTION f x\n  RETURN\nENDFUNCTION\n  HALT\n");
+    ASSERT_EQ(bad_count.had_error, true, "%d");
+    free_program(&bad_count);
+    Program trailing = assemble_program_from_string("FUNCTION f 1 2\n  RETURN\nENDFUNCTION\n  HALT\n");
+    ASSERT_EQ(trailing.had_error, true, "%d");
+    free_program(&trailing);
+}
+
+TEST(test_assemble_try) {
+    const char *src =
+        "  TRY outer\n"
+        "  CONSTANT 1\n"              // 0
+        "  TRY inner\n"
+        "  CONSTANT 2\n"              // 1
+        "  THROW\n"                   // 2
+        "  ENDTRY\n"
+        "inner:\n"
+        "  ADD\n"                     // 3
+        "  ENDTRY\n"
+        "outer:\n"
+        "  HALT\n";                   // 4
+    Program program = assemble_program_from_string(src);
+    ASSERT_EQ(program.had_error, false, "%d");
+    const HandlerTable *handlers = &program.main_chunk.handlers;
+    // Inner ranges close first, so they come first
+    ASSERT_EQ(handlers->count, (size_t)2, "%zu");
+    ASSERT_EQ(handlers->handlers[0].start, (size_t)1, "%zu");
+    ASSERT_EQ(handlers->handlers[0].end, (size_t)3, "%zu");
+    ASSERT_EQ(handlers->handlers[0].target, (size_t)3, "%zu");
+    ASSERT_EQ(handlers->handlers[0].depth, (int64_t)1, "%lld");
+    ASSERT_EQ(handlers->handlers[1].start, (size_t)0, "%zu");
+    ASSERT_EQ(handlers->handlers[1].end, (size_t)4, "%zu");
+    ASSERT_EQ(handlers->handlers[1].target, (size_t)4, "%zu");
+    ASSERT_EQ(handlers->handlers[1].depth, (int64_t)0, "%lld");
+    free_program(&program);
+
+    const char *errors[] = {
+        "  TRY done\n  HALT\ndone:\n  HALT\n",          // no ENDTRY
+        "  HALT\n  ENDTRY\n",                           // no TRY
+        "  TRY done\n  ENDTRY\ndone:\n  HALT\n",        // nothing inside
+        "  TRY\n  HALT\n  ENDTRY\n",                    // no handler
+        "  TRY nowhere\n  HALT\n  ENDTRY\n",            // undefined handler
+        "  CONSTANT 1\n  TRY done\n  THROW\n  ENDTRY\ndone:\n  HALT\n", // throws from below the range
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        Program bad = assemble_program_from_string(errors[i]);
+        ASSERT_EQ(bad.had_error, true, "%d");
+        free_program(&bad);
+    }
+}
+
+TEST(test_assemble_strings) {
+    const char *src =
+        "  CONSTANT \"two words\"   # a comment\n"
+        "  CONSTANT \"# not a comment\"\n"
+        "  CONSTANT \"say \\\"hi\\\"\\n\\\\\"\n"
+        "  CONSTANT \"\"\n"
+        "  HALT\n";
+    Program program = assemble_program_from_string(src);
+    ASSERT_EQ(program.had_error, false, "%d");
+    const ConstantPool *constants = &program.main_chunk.constants;
+    ASSERT_EQ(constants->count, (size_t)4, "%zu");
+    ASSERT_EQ(constants->values[0].type, VAL_STRING, "%d");
+    ASSERT_EQ(strcmp(constants->values[0].as.string, "two words"), 0, "%d");
+    ASSERT_EQ(strcmp(constants->values[1].as.string, "# not a comment"), 0, "%d");
+    ASSERT_EQ(strcmp(constants->values[2].as.string, "say \"hi\"\n\\"), 0, "%d");
+    ASSERT_EQ(strcmp(constants->values[3].as.string, ""), 0, "%d");
+    free_program(&program);
+
+    const char *errors[] = {
+        "  CONSTANT \"unterminated\n  HALT\n",
+        "  CONSTANT \"bad \\q escape\"\n  HALT\n",
+        "  CONSTANT \"a\"b\"\n  HALT\n",
+        "  CONSTANT \"a\" \"b\"\n  HALT\n",
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        Program bad = assemble_program_from_string(errors[i]);
+        ASSERT_EQ(bad.had_error, true, "%d");
+        free_program(&bad);
+    }
+}
+
 int main(void) {
     RUN_TEST(test_assemble_labels_and_jumps);
     RUN_TEST(test_assemble_call_and_return);
     RUN_TEST(test_assemble_program);
     RUN_TEST(test_assemble_function_definition);
+    RUN_TEST(test_assemble_forward_function_reference);
+    RUN_TEST(test_assemble_jumps_in_main_with_functions);
+    RUN_TEST(test_assemble_reports_errors);
+    RUN_TEST(test_assemble_rejects_long_jumps);
+    RUN_TEST(test_parallel_assembly_matches_serial);
+    RUN_TEST(test_assemble_switch);
+    RUN_TEST(test_assemble_locals);
+    RUN_TEST(test_assemble_try);
+    RUN_TEST(test_assemble_strings);
     printf("✔︎ All assembler tests passed.\n");
     return 0;
 } 
\ No newline at end of file
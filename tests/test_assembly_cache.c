@@ -0,0 +1,123 @@
+#include "../assembler.h"
+#include "../assembly_cache.h"
+#include "test_macros.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *CACHE_DIR = "test_assembly_cache_dir";
+
+static const char *SOURCE_V1 =
+    "FUNCTION add_one\n"
+    "  CONSTANT 0\n"
+    "  SWITCH one\n"
+    "one:\n"
+    "  CONSTANT 1\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION add_two\n"
+    "  CONSTANT add_one\n"
+    "  CONSTANT 1\n"
+    "  CALL 1\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  CONSTANT add_two\n"
+    "  CONSTANT 40\n"
+    "  CALL 1\n"
+    "  HALT\n";
+
+// Same as SOURCE_V1 with add_one's body edited and the functions swapped
+static const char *SOURCE_V2 =
+    "FUNCTION add_two\n"
+    "  CONSTANT add_one\n"
+    "  CONSTANT 1\n"
+    "  CALL 1\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION add_one\n"
+    "  CONSTANT 2\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  CONSTANT add_two\n"
+    "  CONSTANT 40\n"
+    "  CALL 1\n"
+    "  HALT\n";
+
+static void clear_cache_dir(void) {
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", CACHE_DIR);
+    system(command);
+}
+
+static size_t function_index(const Program *program, const char *name) {
+    for (size_t i = 0; i < program->function_count; i++) {
+        if (strcmp(program->functions[i].name, name) == 0) return i;
+    }
+    return program->function_count;
+}
+
+TEST(test_cache_hits_reproduce_assembly) {
+    clear_cache_dir();
+    CacheStats stats;
+
+    Program cold = assemble_program_cached(SOURCE_V1, CACHE_DIR, 2, &stats);
+    ASSERT_EQ(cold.had_error, false, "%d");
+    ASSERT_EQ(stats.hits, (size_t)0, "%zu");
+    ASSERT_EQ(stats.misses, (size_t)2, "%zu");
+
+    Program warm = assemble_program_cached(SOURCE_V1, CACHE_DIR, 2, &stats);
+    ASSERT_EQ(warm.had_error, false, "%d");
+    ASSERT_EQ(stats.hits, (size_t)2, "%zu");
+    ASSERT_EQ(stats.misses, (size_t)0, "%zu");
+
+    for (size_t f = 0; f < cold.function_count; f++) {
+        const Chunk *a = cold.functions[f].chunk;
+        const Chunk *b = warm.functions[f].chunk;
+        ASSERT_EQ(b->code.count, a->code.count, "%zu");
+        ASSERT_EQ(memcmp(b->code.code, a->code.code, a->code.count * sizeof(Instruction)), 0, "%d");
+        ASSERT_EQ(b->constants.count, a->constants.count, "%zu");
+        ASSERT_EQ(b->jump_tables.count, a->jump_tables.count, "%zu");
+        for (size_t t = 0; t < a->jump_tables.count; t++) {
+            ASSERT_EQ(b->jump_tables.tables[t].count, a->jump_tables.tables[t].count, "%zu");
+            ASSERT_EQ(b->jump_tables.tables[t].targets[0], a->jump_tables.tables[t].targets[0], "%zu");
+        }
+    }
+    // add_two's reference to add_one is resolved against the new program
+    const Chunk *add_two = warm.functions[function_index(&warm, "add_two")].chunk;
+    ASSERT_EQ(add_two->constants.values[0].as.function,
+              warm.functions[function_index(&warm, "add_one")].function, "%p");
+
+    free_program(&cold);
+    free_program(&warm);
+}
+
+TEST(test_cache_reassembles_only_changed_functions) {
+    clear_cache_dir();
+    CacheStats stats;
+
+    Program first = assemble_program_cached(SOURCE_V1, CACHE_DIR, 1, &stats);
+    free_program(&first);
+
+    Program second = assemble_program_cached(SOURCE_V2, CACHE_DIR, 1, &stats);
+    ASSERT_EQ(second.had_error, false, "%d");
+    ASSERT_EQ(stats.hits, (size_t)1, "%zu");
+    ASSERT_EQ(stats.misses, (size_t)1, "%zu");
+    const Chunk *add_one = second.functions[function_index(&second, "add_one")].chunk;
+    ASSERT_EQ(add_one->constants.values[0].as.number, (int64_t)2, "%lld");
+    const Chunk *add_two = second.functions[function_index(&second, "add_two")].chunk;
+    ASSERT_EQ(add_two->constants.values[0].as.function,
+              second.functions[function_index(&second, "add_one")].function, "%p");
+
+    free_program(&second);
+    clear_cache_dir();
+}
+
+int main(void) {
+    RUN_TEST(test_cache_hits_reproduce_assembly);
+    RUN_TEST(test_cache_reassembles_only_changed_functions);
+    printf("✔︎ All assembly cache tests passed.\n");
+    return 0;
+}
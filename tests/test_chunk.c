@@ -1,4 +1,6 @@
+#include "../assembler.h"
 #include "../chunk.h"
+#include "../vm.h"
 #include "test_macros.h"
 #include <stdlib.h>
 #include <string.h>
@@ -187,6 +189,8 @@ TEST(test_chunk_save_load_function_constant) {
     write_instruction(func_chunk, make_instruction(OP_RETURN, 0));
     Function* func = malloc(sizeof(Function));
     func->chunk = func_chunk;
+    func->local_count = 3;
+    func->name = "answer";
 
     // Create a main chunk and add the function as a constant
     Chunk main_chunk;
@@ -212,6 +216,8 @@ TEST(test_chunk_save_load_function_constant) {
     ASSERT_EQ(loaded_func_val.type, VAL_FUNCTION, "%d");
     ASSERT_NE(loaded_func_val.as.function, NULL, "%p");
     ASSERT_NE(loaded_func_val.as.function->chunk, NULL, "%p");
+    ASSERT_EQ(strcmp(loaded_func_val.as.function->name, "answer"), 0, "%d");
+    ASSERT_EQ(loaded_func_val.as.function->local_count, (size_t)3, "%zu");
     // Check that the nested chunk has the right constant and code
     Chunk* loaded_func_chunk = loaded_func_val.as.function->chunk;
     ASSERT_EQ(loaded_func_chunk->constants.count, (size_t)1, "%zu");
@@ -223,10 +229,9 @@ TEST(test_chunk_save_load_function_constant) {
     // Cleanup
     free_chunk(&main_chunk);
     free_chunk(func_chunk);
+    free(func_chunk);
     free(func);
-    free_chunk(&loaded);
-    free(loaded_func_chunk);
-    free(loaded_func_val.as.function);
+    free_loaded_chunk(&loaded);
     remove(filename);
 }
 
@@ -239,6 +244,8 @@ TEST(test_disassemble_chunk_with_function_constant) {
     write_instruction(func_chunk, make_instruction(OP_RETURN, 0));
     Function* func = malloc(sizeof(Function));
     func->chunk = func_chunk;
+    func->local_count = 0;
+    func->name = NULL;
 
     // Create a main chunk and add the function as a constant
     Chunk main_chunk;
@@ -277,9 +284,233 @@ TEST(test_disassemble_chunk_with_function_constant) {
     free(buf);
     free_chunk(&main_chunk);
     free_chunk(func_chunk);
+    free(func_chunk);
     free(func);
 }
 
+TEST(test_chunk_load_version_1) {
+    // Version 1 files have no function names
+    const char *filename = "test_version_1.kbc";
+    FILE *f = fopen(filename, "wb");
+    const uint32_t version = 1;
+    const uint64_t main_counts[2] = {1, 2};
+    const uint8_t type = VAL_FUNCTION;
+    const uint64_t function_counts[2] = {0, 1};
+    const Instruction function_code = make_instruction(OP_RETURN, 0);
+    const Instruction main_code[2] = {make_instruction(OP_CONSTANT, 0), make_instruction(OP_HALT, 0)};
+    fwrite("KBC0", 1, 4, f);
+    fwrite(&version, sizeof(version), 1, f);
+    fwrite(main_counts, sizeof(uint64_t), 2, f);
+    fwrite(&type, 1, 1, f);
+    fwrite(function_counts, sizeof(uint64_t), 2, f);
+    fwrite(&function_code, sizeof(Instruction), 1, f);
+    fwrite(main_code, sizeof(Instruction), 2, f);
+    fclose(f);
+
+    Chunk loaded;
+    init_chunk(&loaded);
+    ASSERT_EQ(load_chunk(&loaded, filename), 0, "%d");
+    ASSERT_EQ(loaded.code.count, (size_t)2, "%zu");
+    Function *function = loaded.constants.values[0].as.function;
+    ASSERT_EQ(function->name, NULL, "%p");
+    ASSERT_EQ(function->chunk->code.count, (size_t)1, "%zu");
+    free_chunk(function->chunk);
+    free(function->chunk);
+    free(function);
+    free_chunk(&loaded);
+    remove(filename);
+}
+
+TEST(test_chunk_save_load_jump_tables) {
+    Chunk chunk = assemble_chunk_from_string(
+        "  CONSTANT 2\n  SWITCH a b c\n  HALT\na:\n  HALT\nb:\n  SWITCH c\nc:\n  HALT\n");
+    ASSERT_EQ(chunk.jump_tables.count, (size_t)2, "%zu");
+    const char *filename = "test_jump_tables.kbc";
+    ASSERT_EQ(save_chunk(&chunk, filename), 0, "%d");
+
+    Chunk loaded;
+    init_chunk(&loaded);
+    ASSERT_EQ(load_chunk(&loaded, filename), 0, "%d");
+    ASSERT_EQ(loaded.jump_tables.count, (size_t)2, "%zu");
+    for (size_t t = 0; t < chunk.jump_tables.count; t++) {
+        ASSERT_EQ(loaded.jump_tables.tables[t].count, chunk.jump_tables.tables[t].count, "%zu");
+        ASSERT_EQ(memcmp(loaded.jump_tables.tables[t].targets, chunk.jump_tables.tables[t].targets,
+                         sizeof(size_t) * chunk.jump_tables.tables[t].count), 0, "%d");
+    }
+
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    disassemble_chunk(&loaded, out);
+    fclose(out);
+    ASSERT_NE(strstr(buf, "1: OP_SWITCH 0\n"), NULL, "%p");
+    ASSERT_NE(strstr(buf, "== jump tables ==\n  0: 3 4 5\n  1: 5\n"), NULL, "%p");
+    free(buf);
+
+    free_chunk(&loaded);
+    free_chunk(&chunk);
+    remove(filename);
+}
+
+TEST(test_chunk_save_load_doubles) {
+    // Too large for int64_t, so it becomes a double too
+    Chunk chunk = assemble_chunk_from_string(
+        "  CONSTANT 2.5\n  CONSTANT -1e-3\n  CONSTANT 100000000000000000000\n  CONSTANT 3\n  HALT\n");
+    ASSERT_EQ(chunk.constants.count, (size_t)4, "%zu");
+    ASSERT_EQ(chunk.constants.values[0].type, VAL_DOUBLE, "%d");
+    ASSERT_EQ(chunk.constants.values[2].type, VAL_DOUBLE, "%d");
+    ASSERT_EQ(chunk.constants.values[3].type, VAL_NUMBER, "%d");
+    const char *filename = "test_doubles.kbc";
+    ASSERT_EQ(save_chunk(&chunk, filename), 0, "%d");
+
+    Chunk loaded;
+    init_chunk(&loaded);
+    ASSERT_EQ(load_chunk(&loaded, filename), 0, "%d");
+    ASSERT_EQ(loaded.constants.count, (size_t)4, "%zu");
+    ASSERT_EQ(loaded.constants.values[0].as.fp_number, 2.5, "%f");
+    ASSERT_EQ(loaded.constants.values[1].as.fp_number, -1e-3, "%f");
+    ASSERT_EQ(loaded.constants.values[2].as.fp_number, 1e20, "%f");
+    ASSERT_EQ(loaded.constants.values[3].as.number, (int64_t)3, "%lld");
+
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    disassemble_chunk(&loaded, out);
+    fclose(out);
+    ASSERT_NE(strstr(buf, "0: double 2.5\n  1: double -0.001\n  2: double 1e+20\n  3: number 3\n"), NULL, "%p");
+    free(buf);
+
+    free_chunk(&loaded);
+    free_chunk(&chunk);
+    remove(filename);
+}
+
+TEST(test_chunk_save_load_handlers) {
+    Chunk chunk = assemble_chunk_from_string(
+        "  CONSTANT 1\n  TRY caught\n  CONSTANT 2\n  THROW\n  ENDTRY\ncaught:\n  ADD\n  HALT\n");
+    ASSERT_EQ(chunk.handlers.count, (size_t)1, "%zu");
+    const char *filename = "test_handlers.kbc";
+    ASSERT_EQ(save_chunk(&chunk, filename), 0, "%d");
+
+    Chunk loaded;
+    init_chunk(&loaded);
+    ASSERT_EQ(load_chunk(&loaded, filename), 0, "%d");
+    ASSERT_EQ(loaded.handlers.count, (size_t)1, "%zu");
+    ASSERT_EQ(memcmp(loaded.handlers.handlers, chunk.handlers.handlers, sizeof(Handler)), 0, "%d");
+    ASSERT_EQ(find_handler(&loaded, 2), &loaded.handlers.handlers[0], "%p");
+    ASSERT_EQ(find_handler(&loaded, 3), NULL, "%p");
+
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    disassemble_chunk(&loaded, out);
+    fclose(out);
+    ASSERT_NE(strstr(buf, "2: OP_THROW 0\n"), NULL, "%p");
+    ASSERT_NE(strstr(buf, "== handlers ==\n  0: [1, 3) -> 3 depth 1\n"), NULL, "%p");
+    free(buf);
+
+    free_chunk(&loaded);
+    free_chunk(&chunk);
+    remove(filename);
+}
+
+TEST(test_chunk_save_load_strings) {
+    Chunk chunk = assemble_chunk_from_string("  CONSTANT \"tab\\there\"\n  CONSTANT \"\"\n  HALT\n");
+    ASSERT_EQ(chunk.constants.count, (size_t)2, "%zu");
+    const char *filename = "test_strings.kbc";
+    ASSERT_EQ(save_chunk(&chunk, filename), 0, "%d");
+
+    Chunk loaded;
+    init_chunk(&loaded);
+    ASSERT_EQ(load_chunk(&loaded, filename), 0, "%d");
+    ASSERT_EQ(loaded.constants.count, (size_t)2, "%zu");
+    ASSERT_EQ(loaded.constants.values[0].type, VAL_STRING, "%d");
+    ASSERT_EQ(strcmp(loaded.constants.values[0].as.string, "tab\there"), 0, "%d");
+    ASSERT_EQ(strcmp(loaded.constants.values[1].as.string, ""), 0, "%d");
+    // Each chunk owns its copy
+    ASSERT_NE(loaded.constants.values[0].as.string, chunk.constants.values[0].as.string, "%p");
+
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    disassemble_chunk(&loaded, out);
+    fclose(out);
+    ASSERT_NE(strstr(buf, "0: string \"tab\\there\"\n  1: string \"\"\n"), NULL, "%p");
+    free(buf);
+
+    free_chunk(&loaded);
+    free_chunk(&chunk);
+    remove(filename);
+}
+
+// sum calls itself; even and odd call each other
+static const char *RECURSIVE_PROGRAM =
+    "FUNCTION sum\n"
+    "  GET_LOCAL 1\n  CONSTANT 0\n  JMP_IF_EQUAL sum_done\n"
+    "  GET_LOCAL 1\n  CONSTANT sum\n  GET_LOCAL 1\n  CONSTANT 1\n  SUB\n  CALL 1\n  ADD\n  RETURN\n"
+    "sum_done:\n  CONSTANT 0\n  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION even\n"
+    "  GET_LOCAL 1\n  CONSTANT 0\n  JMP_IF_EQUAL even_done\n"
+    "  CONSTANT odd\n  GET_LOCAL 1\n  CONSTANT 1\n  SUB\n  CALL 1\n  RETURN\n"
+    "even_done:\n  CONSTANT 1\n  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION odd\n"
+    "  GET_LOCAL 1\n  CONSTANT 0\n  JMP_IF_EQUAL odd_done\n"
+    "  CONSTANT even\n  GET_LOCAL 1\n  CONSTANT 1\n  SUB\n  CALL 1\n  RETURN\n"
+    "odd_done:\n  CONSTANT 0\n  RETURN\n"
+    "ENDFUNCTION\n"
+    "  CONSTANT sum\n  CONSTANT 10\n  CALL 1\n"
+    "  CONSTANT even\n  CONSTANT 8\n  CALL 1\n"
+    "  ADD\n  HALT\n";
+
+static int64_t run_chunk(Chunk *chunk) {
+    VM vm;
+    vm_init(&vm);
+    CallFrame *frame = &vm.frames[vm.frame_count++];
+    frame->chunk = chunk;
+    frame->ip = chunk->code.code;
+    frame->slots = vm.stack;
+    ASSERT_EQ(vm_run(&vm), VM_OK, "%d");
+    const int64_t top = vm.stack_top[-1].as.number;
+    vm_free(&vm);
+    return top;
+}
+
+TEST(test_chunk_save_load_recursive_functions) {
+    Program program = assemble_program_from_string(RECURSIVE_PROGRAM);
+    ASSERT_EQ(program.had_error, false, "%d");
+    ASSERT_EQ(run_chunk(&program.main_chunk), (int64_t)56, "%lld");
+    const char *filename = "test_recursive.kbc";
+    ASSERT_EQ(save_chunk(&program.main_chunk, filename), 0, "%d");
+
+    Chunk loaded;
+    init_chunk(&loaded);
+    ASSERT_EQ(load_chunk(&loaded, filename), 0, "%d");
+    ASSERT_EQ(run_chunk(&loaded), (int64_t)56, "%lld");
+    // Each function is loaded once, however many constants refer to it
+    const Function *sum = loaded.constants.values[0].as.function;
+    ASSERT_EQ(strcmp(sum->name, "sum"), 0, "%d");
+    ASSERT_EQ(sum->chunk->constants.values[1].as.function, sum, "%p");
+    const Function *even = loaded.constants.values[2].as.function;
+    const Function *odd = even->chunk->constants.values[1].as.function;
+    ASSERT_EQ(strcmp(odd->name, "odd"), 0, "%d");
+    ASSERT_EQ(odd->chunk->constants.values[1].as.function, even, "%p");
+
+    // and disassembled once
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    disassemble_chunk(&loaded, out);
+    fclose(out);
+    ASSERT_NE(strstr(buf, "-- function constant 1 disassembled above --"), NULL, "%p");
+    free(buf);
+
+    free_loaded_chunk(&loaded);
+    free_program(&program);
+    remove(filename);
+}
+
 int main(void) {
     RUN_TEST(test_init_chunk);
     RUN_TEST(test_write_and_grow_chunk);
@@ -289,6 +520,12 @@ int main(void) {
     RUN_TEST(test_assemble_chunk_from_string);
     RUN_TEST(test_chunk_save_load_function_constant);
     RUN_TEST(test_disassemble_chunk_with_function_constant);
+    RUN_TEST(test_chunk_load_version_1);
+    RUN_TEST(test_chunk_save_load_jump_tables);
+    RUN_TEST(test_chunk_save_load_doubles);
+    RUN_TEST(test_chunk_save_load_handlers);
+    RUN_TEST(test_chunk_save_load_strings);
+    RUN_TEST(test_chunk_save_load_recursive_functions);
     printf("✔︎ All chunk tests passed.\n");
     return 0;
 } 
\ No newline at end of file
@@ -125,10 +125,83 @@ static int test_cli_assembly() {
     return 0;
 }
 
+static int test_cli_run_source() {
+    const char *src_filename = "test_run.kappa";
+    FILE *f = fopen(src_filename, "w");
+    if (!f) return 1;
+    fprintf(f, "FUNCTION add\n  ADD\n  RETURN\nENDFUNCTION\n"
+               "  CONSTANT add\n  CONSTANT 20\n  CONSTANT 22\n  CALL 2\n  HALT\n");
+    fclose(f);
+
+    // Run twice so the second run goes through the cache
+    for (int i = 0; i < 2; i++) {
+        FILE *fp = popen("KAPPA_CACHE_DIR=test_run_cache ./kappavm run test_run.kappa", "r");
+        if (!fp) {
+            remove(src_filename);
+            return 2;
+        }
+        char buf[128] = {0};
+        fgets(buf, sizeof(buf), fp);
+        int status = pclose(fp);
+        if (status != 0 || atoi(buf) != 42) {
+            fprintf(stderr, "kappavm run output was not 42 (exit code %d), got: %s\n", status, buf);
+            remove(src_filename);
+            return 3;
+        }
+    }
+    remove(src_filename);
+    system("rm -rf test_run_cache");
+    printf("✔︎ CLI run test passed.\n");
+    return 0;
+}
+
+// Reads what cmd prints into buf, returning its exit status
+static int capture_output(const char *cmd, char *buf, size_t size) {
+    FILE *fp = popen(cmd, "r");
+    if (!fp) return -1;
+    size_t length = fread(buf, 1, size - 1, fp);
+    buf[length] = '\0';
+    return pclose(fp);
+}
+
+static int test_cli_assembly_errors() {
+    const char *src_filename = "test_errors.kappa";
+    FILE *f = fopen(src_filename, "w");
+    if (!f) return 1;
+    fprintf(f, "FUNCTION f\nFUNCTION g\n  RETURN\nENDFUNCTION\n  NOPE\nENDFUNCTION\n  HALT\n"
+               "FUNCTION h\n  BOGUS\n  RETURN\nENDFUNCTION\n");
+    fclose(f);
+
+    // Reports come out once each and in source order, however many threads assemble
+    const char *expected =
+        "AssemblerError: line 2: Nested FUNCTION 'g'\n"
+        "AssemblerError: line 5: Unknown instruction 'NOPE'\n"
+        "AssemblerError: line 6: Unexpected 'ENDFUNCTION'\n"
+        "AssemblerError: line 9: Unknown instruction 'BOGUS'\n";
+    const char *commands[] = {
+        "./kappavm --assemble test_errors.kappa test_errors.kbc --jobs 1 2>&1 >/dev/null",
+        "./kappavm --assemble test_errors.kappa test_errors.kbc --jobs 4 2>&1 >/dev/null",
+    };
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        char buf[512];
+        int status = capture_output(commands[i], buf, sizeof(buf));
+        if (status == 0 || strncmp(buf, expected, strlen(expected)) != 0) {
+            fprintf(stderr, "%s reported (exit code %d):\n%s\nExpected:\n%s\n", commands[i], status, buf, expected);
+            remove(src_filename);
+            return 2;
+        }
+    }
+    remove(src_filename);
+    printf("✔︎ CLI assembly error test passed.\n");
+    return 0;
+}
+
 int main(void) {
     if (test_cli_execution() != 0) return 1;
     if (test_cli_disassembly() != 0) return 1;
     if (test_cli_assembly() != 0) return 1;
+    if (test_cli_run_source() != 0) return 1;
+    if (test_cli_assembly_errors() != 0) return 1;
     printf("✔︎ All CLI tests passed.\n");
     return 0;
 } 
\ No newline at end of file
@@ -1,8 +1,12 @@
 #include "../vm.h"
+#include "../assembler.h"
 #include "../chunk.h"
+#include "../list.h"
 #include "../opcode.h"
+#include "../string_value.h"
 #include "test_macros.h"
 #include <stdlib.h>
+#include <string.h>
 
 TEST(test_simple_addition) {
     VM vm;
@@ -168,12 +172,739 @@ TEST(test_op_call) {
     free_chunk(&main_chunk);
 }
 
+// Assembles and runs src, storing the top of the stack when it succeeds
+static VMResult run_source_value(const char *src, Value *top) {
+    Program program = assemble_program_from_string(src);
+    ASSERT_EQ(program.had_error, false, "%d");
+    VM vm;
+    vm_init(&vm);
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = &program.main_chunk;
+    frame->ip = program.main_chunk.code.code;
+    frame->slots = vm.stack;
+    const VMResult result = vm_run(&vm);
+    if (result == VM_OK) *top = vm.stack_top[-1];
+    vm_free(&vm);
+    free_program(&program);
+    return result;
+}
+
+static VMResult run_source(const char *src, int64_t *top) {
+    Value value;
+    const VMResult result = run_source_value(src, &value);
+    if (result == VM_OK) *top = value.as.number;
+    return result;
+}
+
+TEST(test_arithmetic_and_stack_ops) {
+    int64_t top = 0;
+    // (7 - 10) * 6 / 4 = -4, then -4 % 3 = -1
+    ASSERT_EQ(run_source("  CONSTANT 7\n  CONSTANT 10\n  SUB\n  CONSTANT 6\n  MUL\n  CONSTANT 4\n  DIV\n"
+                         "  CONSTANT 3\n  MOD\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)-1, "%lld");
+    // 2 1 SWAP SUB is 1 - 2; DUP and POP cancel out
+    ASSERT_EQ(run_source("  CONSTANT 2\n  CONSTANT 1\n  SWAP\n  SUB\n  DUP\n  POP\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)-1, "%lld");
+    ASSERT_EQ(run_source("  CONSTANT 3\n  CONSTANT 5\n  LESS_EQUAL\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)1, "%lld");
+    ASSERT_EQ(run_source("  CONSTANT 3\n  CONSTANT 5\n  GREATER\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)0, "%lld");
+    ASSERT_EQ(run_source("  CONSTANT 4\n  CONSTANT 4\n  NOT_EQUAL\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)0, "%lld");
+    ASSERT_EQ(run_source("  CONSTANT 1\n  CONSTANT 0\n  DIV\n  HALT\n", &top), VM_RUNTIME_ERROR, "%d");
+    ASSERT_EQ(run_source("  CONSTANT 1\n  CONSTANT 0\n  MOD\n  HALT\n", &top), VM_RUNTIME_ERROR, "%d");
+}
+
+TEST(test_fused_jumps) {
+    int64_t top = 0;
+    // Doubles 1 until it reaches 1000
+    const char *doubling =
+        "  CONSTANT 1\n"
+        "loop:\n"
+        "  DUP\n"
+        "  ADD\n"
+        "  DUP\n"
+        "  CONSTANT 1000\n"
+        "  JMP_IF_LESS loop\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source(doubling, &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)1024, "%lld");
+    // A branch that is not taken pops its operands all the same
+    const char *not_taken =
+        "  CONSTANT 5\n"
+        "  CONSTANT 2\n"
+        "  CONSTANT 3\n"
+        "  JMP_IF_GREATER_EQUAL skip\n"
+        "  CONSTANT 1\n"
+        "  ADD\n"
+        "skip:\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source(not_taken, &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)6, "%lld");
+}
+
+TEST(test_switch) {
+    // Each case pushes its own value; anything else falls through to 99
+    const char *cases[] = {"0", "1", "2", "3", "-1"};
+    const int64_t expected[] = {10, 20, 20, 99, 99};
+    for (size_t i = 0; i < 5; i++) {
+        char src[256];
+        snprintf(src, sizeof(src),
+                 "  CONSTANT %s\n"
+                 "  SWITCH ten twenty twenty\n"
+                 "  CONSTANT 99\n"
+                 "  HALT\n"
+                 "ten:\n"
+                 "  CONSTANT 10\n"
+                 "  HALT\n"
+                 "twenty:\n"
+                 "  CONSTANT 20\n"
+                 "  HALT\n", cases[i]);
+        int64_t top = 0;
+        ASSERT_EQ(run_source(src, &top), VM_OK, "%d");
+        ASSERT_EQ(top, expected[i], "%lld");
+    }
+}
+
+TEST(test_locals) {
+    int64_t top = 0;
+    // Sums 1..n into a local instead of shuffling the stack
+    const char *sum_to =
+        "FUNCTION sum_to 1\n"
+        "  CONSTANT 0\n"
+        "  SET_LOCAL 2\n"
+        "loop:\n"
+        "  GET_LOCAL 1\n"
+        "  CONSTANT 0\n"
+        "  JMP_IF_EQUAL done\n"
+        "  GET_LOCAL 2\n"
+        "  GET_LOCAL 1\n"
+        "  ADD\n"
+        "  SET_LOCAL 2\n"
+        "  GET_LOCAL 1\n"
+        "  CONSTANT 1\n"
+        "  SUB\n"
+        "  SET_LOCAL 1\n"
+        "  JMP loop\n"
+        "done:\n"
+        "  GET_LOCAL 2\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT sum_to\n"
+        "  CONSTANT 10\n"
+        "  CALL 1\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source(sum_to, &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)55, "%lld");
+
+    // Slot 0 holds the function itself, so it can call itself
+    const char *factorial =
+        "FUNCTION fact\n"
+        "  GET_LOCAL 1\n"
+        "  CONSTANT 1\n"
+        "  JMP_IF_GREATER recurse\n"
+        "  CONSTANT 1\n"
+        "  RETURN\n"
+        "recurse:\n"
+        "  GET_LOCAL 0\n"
+        "  GET_LOCAL 1\n"
+        "  CONSTANT 1\n"
+        "  SUB\n"
+        "  CALL 1\n"
+        "  GET_LOCAL 1\n"
+        "  MUL\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT fact\n"
+        "  CONSTANT 10\n"
+        "  CALL 1\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source(factorial, &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)3628800, "%lld");
+}
+
+TEST(test_numeric_tower) {
+    Value top;
+    // INT64_MAX + 1 no longer wraps to INT64_MIN
+    ASSERT_EQ(run_source_value("  CONSTANT 9223372036854775807\n  CONSTANT 1\n  ADD\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.type, VAL_DOUBLE, "%d");
+    ASSERT_EQ(top.as.fp_number, 9223372036854775808.0, "%f");
+    ASSERT_EQ(run_source_value("  CONSTANT -9223372036854775808\n  CONSTANT -1\n  DIV\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.type, VAL_DOUBLE, "%d");
+    ASSERT_EQ(top.as.fp_number, 9223372036854775808.0, "%f");
+    ASSERT_EQ(run_source_value("  CONSTANT 4294967296\n  DUP\n  MUL\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.type, VAL_DOUBLE, "%d");
+    // Results that fit stay integers
+    ASSERT_EQ(run_source_value("  CONSTANT 9223372036854775807\n  CONSTANT -1\n  ADD\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.type, VAL_NUMBER, "%d");
+    ASSERT_EQ(top.as.number, (int64_t)9223372036854775806LL, "%lld");
+
+    // A double operand makes the operation a double one
+    ASSERT_EQ(run_source_value("  CONSTANT 7\n  CONSTANT 2.0\n  DIV\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.type, VAL_DOUBLE, "%d");
+    ASSERT_EQ(top.as.fp_number, 3.5, "%f");
+    ASSERT_EQ(run_source_value("  CONSTANT 7.5\n  CONSTANT 2\n  MOD\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.as.fp_number, 1.5, "%f");
+    ASSERT_EQ(run_source_value("  CONSTANT 1.0\n  CONSTANT 0\n  DIV\n  HALT\n", &top), VM_RUNTIME_ERROR, "%d");
+
+    // Comparisons and equality mix integers and doubles and give integers
+    ASSERT_EQ(run_source_value("  CONSTANT 2\n  CONSTANT 2.0\n  EQUAL\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.type, VAL_NUMBER, "%d");
+    ASSERT_EQ(top.as.number, (int64_t)1, "%lld");
+    ASSERT_EQ(run_source_value("  CONSTANT 2.5\n  CONSTANT 3\n  JMP_IF_LESS yes\n  CONSTANT 0\n  HALT\n"
+                               "yes:\n  CONSTANT 1\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.as.number, (int64_t)1, "%lld");
+    // 0.0 is false like 0
+    ASSERT_EQ(run_source_value("  CONSTANT 1\n  CONSTANT 0.0\n  JMP_IF_FALSE done\n  POP\n  CONSTANT 2\n"
+                               "done:\n  HALT\n", &top), VM_OK, "%d");
+    ASSERT_EQ(top.as.number, (int64_t)1, "%lld");
+
+    // Arithmetic on anything but numbers is an error rather than garbage
+    ASSERT_EQ(run_source_value("FUNCTION f\n  RETURN\nENDFUNCTION\n  CONSTANT f\n  CONSTANT 1\n  ADD\n  HALT\n", &top),
+              VM_RUNTIME_ERROR, "%d");
+}
+
+TEST(test_exceptions) {
+    Value top;
+    // The handler gets the thrown value on top of what the stack held at TRY;
+    // the 7 and the frame of fail are abandoned
+    const char *from_call =
+        "FUNCTION fail\n"
+        "  CONSTANT 42\n"
+        "  THROW\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT 1\n"
+        "  TRY caught\n"
+        "  CONSTANT 7\n"
+        "  CONSTANT fail\n"
+        "  CALL 0\n"
+        "  ENDTRY\n"
+        "  HALT\n"
+        "caught:\n"
+        "  ADD\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source_value(from_call, &top), VM_OK, "%d");
+    ASSERT_EQ(top.as.number, (int64_t)43, "%lld");
+
+    // Runtime errors are thrown as their message
+    const char *division =
+        "  TRY caught\n"
+        "  CONSTANT 1\n"
+        "  CONSTANT 0\n"
+        "  DIV\n"
+        "  ENDTRY\n"
+        "  HALT\n"
+        "caught:\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source_value(division, &top), VM_OK, "%d");
+    ASSERT_EQ(top.type, VAL_STRING, "%d");
+    ASSERT_EQ(strcmp(top.as.string, "Division by zero."), 0, "%d");
+
+    // A handler inside a function catches before its caller sees anything
+    const char *local_handler =
+        "FUNCTION safe_div\n"
+        "  TRY zero\n"
+        "  GET_LOCAL 1\n"
+        "  GET_LOCAL 2\n"
+        "  DIV\n"
+        "  RETURN\n"
+        "  ENDTRY\n"
+        "zero:\n"
+        "  POP\n"
+        "  CONSTANT 0\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT 100\n"
+        "  CONSTANT safe_div\n"
+        "  CONSTANT 7\n"
+        "  CONSTANT 0\n"
+        "  CALL 2\n"
+        "  ADD\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source_value(local_handler, &top), VM_OK, "%d");
+    ASSERT_EQ(top.as.number, (int64_t)100, "%lld");
+
+    // The innermost range wins; its handler rethrows to the outer one
+    const char *nested =
+        "  TRY outer\n"
+        "  TRY inner\n"
+        "  CONSTANT 5\n"
+        "  THROW\n"
+        "  ENDTRY\n"
+        "inner:\n"
+        "  CONSTANT 1\n"
+        "  ADD\n"
+        "  THROW\n"
+        "  ENDTRY\n"
+        "outer:\n"
+        "  CONSTANT 10\n"
+        "  MUL\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source_value(nested, &top), VM_OK, "%d");
+    ASSERT_EQ(top.as.number, (int64_t)60, "%lld");
+
+    // Uncaught, the error ends the run and leaves the VM empty
+    Program program = assemble_program_from_string("  CONSTANT 1\n  CONSTANT 2\n  THROW\n");
+    ASSERT_EQ(program.had_error, false, "%d");
+    VM vm;
+    vm_init(&vm);
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = &program.main_chunk;
+    frame->ip = program.main_chunk.code.code;
+    frame->slots = vm.stack;
+    ASSERT_EQ(vm_run(&vm), VM_RUNTIME_ERROR, "%d");
+    ASSERT_EQ(vm.frame_count, 0, "%d");
+    ASSERT_EQ(vm.stack_top, vm.stack, "%p");
+    vm_free(&vm);
+    free_program(&program);
+}
+
+// Sets vm up to run the main chunk of program from the start
+static void start_program(VM *vm, Program *program) {
+    vm_init(vm);
+    CallFrame *frame = &vm->frames[vm->frame_count++];
+    frame->chunk = &program->main_chunk;
+    frame->ip = program->main_chunk.code.code;
+    frame->slots = vm->stack;
+}
+
+TEST(test_limits) {
+    // Counts to 100; each backward jump charges the five instructions of
+    // the loop body
+    Program count = assemble_program_from_string(
+        "  CONSTANT 0\n"
+        "loop:\n"
+        "  CONSTANT 1\n"
+        "  ADD\n"
+        "  DUP\n"
+        "  CONSTANT 100\n"
+        "  JMP_IF_LESS loop\n"
+        "  HALT\n");
+    ASSERT_EQ(count.had_error, false, "%d");
+    VM vm;
+    start_program(&vm, &count);
+    vm_set_limits(&vm, &(VMLimits){.max_instructions = 200});
+    ASSERT_EQ(vm_run(&vm), VM_LIMIT_EXCEEDED, "%d");
+    ASSERT_EQ(vm.exceeded, LIMIT_INSTRUCTIONS, "%d");
+    ASSERT_EQ(vm.instructions, (uint64_t)205, "%llu");
+    // The run stopped at the loop's head and picks up from there
+    ASSERT_EQ(vm.frame_count, 1, "%d");
+    ASSERT_EQ(vm.stack_top[-1].as.number, (int64_t)41, "%lld");
+    ASSERT_EQ(vm_run(&vm), VM_LIMIT_EXCEEDED, "%d");
+    vm_set_limits(&vm, &(VMLimits){0});
+    ASSERT_EQ(vm_run(&vm), VM_OK, "%d");
+    ASSERT_EQ(vm.stack_top[-1].as.number, (int64_t)100, "%lld");
+    vm_free(&vm);
+
+    // Under a limit it never reaches, the program runs as before
+    start_program(&vm, &count);
+    vm_set_limits(&vm, &(VMLimits){.max_instructions = 495, .deadline_ns = vm_clock_ns() + 60000000000u});
+    ASSERT_EQ(vm_run(&vm), VM_OK, "%d");
+    ASSERT_EQ(vm.stack_top[-1].as.number, (int64_t)100, "%lld");
+    vm_free(&vm);
+    free_program(&count);
+
+    // A handler cannot catch a limit, and an endless loop ends at the deadline
+    Program endless = assemble_program_from_string(
+        "  TRY caught\n"
+        "loop:\n"
+        "  JMP loop\n"
+        "  ENDTRY\n"
+        "caught:\n"
+        "  HALT\n");
+    ASSERT_EQ(endless.had_error, false, "%d");
+    start_program(&vm, &endless);
+    const uint64_t start = vm_clock_ns();
+    vm_set_limits(&vm, &(VMLimits){.deadline_ns = start + 20000000u});
+    ASSERT_EQ(vm_run(&vm), VM_LIMIT_EXCEEDED, "%d");
+    ASSERT_EQ(vm.exceeded, LIMIT_DEADLINE, "%d");
+    ASSERT_GT(vm_clock_ns(), start + 20000000u - 1, "%llu");
+    vm_free(&vm);
+
+    // Heap is charged by whatever allocates; here it is over from the start
+    start_program(&vm, &endless);
+    vm.heap_bytes = 4096;
+    vm_set_limits(&vm, &(VMLimits){.max_heap_bytes = 1024});
+    ASSERT_EQ(vm_run(&vm), VM_LIMIT_EXCEEDED, "%d");
+    ASSERT_EQ(vm.exceeded, LIMIT_HEAP, "%d");
+    vm_free(&vm);
+    free_program(&endless);
+
+    // Calls charge one each, so unbounded recursion without loops stops too,
+    // and vm_call leaves the VM idle
+    Program recursive = assemble_program_from_string(
+        "FUNCTION again\n"
+        "  GET_LOCAL 0\n"
+        "  CALL 0\n"
+        "  POP\n"
+        "  GET_LOCAL 0\n"
+        "  CALL 0\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  HALT\n");
+    ASSERT_EQ(recursive.had_error, false, "%d");
+    Function *again = recursive.functions[0].function;
+    vm_init(&vm);
+    vm_set_limits(&vm, &(VMLimits){.max_instructions = 10});
+    Value result;
+    ASSERT_EQ(vm_call(&vm, again, NULL, 0, &result), VM_LIMIT_EXCEEDED, "%d");
+    ASSERT_EQ(vm.instructions, (uint64_t)11, "%llu");
+    ASSERT_EQ(vm.frame_count, 0, "%d");
+    ASSERT_EQ(vm.stack_top, vm.stack, "%p");
+    vm_free(&vm);
+    free_program(&recursive);
+}
+
+TEST(test_objects) {
+    int64_t top = 0;
+    // o.x = 2, o.y = 5, then o.x * o.y, adding 100 if o.missing were set
+    const char *fields =
+        "  NEW_OBJECT\n"
+        "  CONSTANT \"x\"\n"
+        "  CONSTANT 2\n"
+        "  SET_PROPERTY\n"
+        "  CONSTANT \"y\"\n"
+        "  CONSTANT 5\n"
+        "  SET_PROPERTY\n"
+        "  DUP\n"
+        "  CONSTANT \"x\"\n"
+        "  GET_PROPERTY\n"
+        "  SWAP\n"
+        "  DUP\n"
+        "  CONSTANT \"y\"\n"
+        "  GET_PROPERTY\n"
+        "  SWAP\n"
+        "  CONSTANT \"missing\"\n"
+        "  GET_PROPERTY\n"
+        "  JMP_IF_FALSE absent\n"
+        "  CONSTANT 100\n"
+        "  ADD\n"
+        "absent:\n"
+        "  MUL\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source(fields, &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)10, "%lld");
+
+    // Sums the values left after deleting b by iterating over the keys
+    const char *sum =
+        "FUNCTION total 3\n"
+        "  NEW_OBJECT\n"
+        "  CONSTANT \"a\"\n"
+        "  CONSTANT 1\n"
+        "  SET_PROPERTY\n"
+        "  CONSTANT \"b\"\n"
+        "  CONSTANT 20\n"
+        "  SET_PROPERTY\n"
+        "  CONSTANT \"c\"\n"
+        "  CONSTANT 300\n"
+        "  SET_PROPERTY\n"
+        "  CONSTANT \"b\"\n"
+        "  DELETE_PROPERTY\n"
+        "  SET_LOCAL 1\n"             // the object
+        "  CONSTANT 0\n"
+        "  SET_LOCAL 2\n"             // the cursor
+        "  CONSTANT 0\n"
+        "  SET_LOCAL 3\n"             // the sum
+        "next:\n"
+        "  GET_LOCAL 1\n"
+        "  GET_LOCAL 2\n"
+        "  NEXT_PROPERTY\n"
+        "  DUP\n"
+        "  JMP_IF_FALSE done\n"
+        "  SWAP\n"
+        "  SET_LOCAL 2\n"
+        "  GET_PROPERTY\n"
+        "  GET_LOCAL 3\n"
+        "  ADD\n"
+        "  SET_LOCAL 3\n"
+        "  JMP next\n"
+        "done:\n"
+        "  GET_LOCAL 3\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT total\n"
+        "  CALL 0\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source(sum, &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)301, "%lld");
+
+    // The key NEXT_PROPERTY pushes outlives deleting its property
+    const char *deleted =
+        "  NEW_OBJECT\n"
+        "  CONSTANT \"a-key-longer-than-a-short-string\"\n"
+        "  CONSTANT 1\n"
+        "  SET_PROPERTY\n"
+        "  CONSTANT 0\n"
+        "  NEXT_PROPERTY\n"
+        "  SWAP\n"
+        "  POP\n"
+        "  GET_LOCAL 0\n"
+        "  GET_LOCAL 1\n"
+        "  DELETE_PROPERTY\n"
+        "  POP\n"
+        "  LENGTH\n"
+        "  HALT\n";
+    ASSERT_EQ(run_source(deleted, &top), VM_OK, "%d");
+    ASSERT_EQ(top, (int64_t)32, "%lld");
+
+    const char *errors[] = {
+        "  CONSTANT 1\n  CONSTANT \"x\"\n  GET_PROPERTY\n  HALT\n",
+        "  NEW_OBJECT\n  CONSTANT 1\n  CONSTANT 2\n  SET_PROPERTY\n  HALT\n",
+        "  NEW_OBJECT\n  CONSTANT -1\n  NEXT_PROPERTY\n  HALT\n",
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        ASSERT_EQ(run_source(errors[i], &top), VM_RUNTIME_ERROR, "%d");
+    }
+
+    // Objects count against the heap limit, and vm_free releases them
+    Program endless = assemble_program_from_string("loop:\n  NEW_OBJECT\n  POP\n  JMP loop\n");
+    ASSERT_EQ(endless.had_error, false, "%d");
+    VM vm;
+    start_program(&vm, &endless);
+    vm_set_limits(&vm, &(VMLimits){.max_heap_bytes = 1 << 20});
+    ASSERT_EQ(vm_run(&vm), VM_LIMIT_EXCEEDED, "%d");
+    ASSERT_EQ(vm.exceeded, LIMIT_HEAP, "%d");
+    ASSERT_GT(vm.heap_bytes, (size_t)1 << 20, "%zu");
+    vm_free(&vm);
+    ASSERT_EQ(vm.heap_bytes, (size_t)0, "%zu");
+    ASSERT_EQ(vm.objects, NULL, "%p");
+    free_program(&endless);
+}
+
+// Runs src on vm, leaving it unfreed so the strings it made stay readable
+static Value run_on(VM *vm, Program *program, const char *src) {
+    *program = assemble_program_from_string(src);
+    ASSERT_EQ(program->had_error, false, "%d");
+    start_program(vm, program);
+    ASSERT_EQ(vm_run(vm), VM_OK, "%d");
+    return vm->stack_top[-1];
+}
+
+static bool holds(Value value, const char *expected) {
+    size_t length;
+    const char *chars = string_chars(&value, &length);
+    return is_string(value) && length == strlen(expected) && memcmp(chars, expected, length) == 0;
+}
+
+TEST(test_strings) {
+    VM vm;
+    Program program;
+    Value top = run_on(&vm, &program, "  CONSTANT \"hello, \"\n  CONSTANT \"world\"\n  CONCAT\n  HALT\n");
+    ASSERT_EQ(top.type, VAL_HEAP_STRING, "%d");
+    ASSERT_EQ(holds(top, "hello, world"), true, "%d");
+    vm_free(&vm);
+    free_program(&program);
+
+    // Short results live in the value, allocating nothing
+    top = run_on(&vm, &program, "  CONSTANT \"ab\"\n  CONSTANT \"cd\"\n  CONCAT\n  HALT\n");
+    ASSERT_EQ(top.type, VAL_SHORT_STRING, "%d");
+    ASSERT_EQ(holds(top, "abcd"), true, "%d");
+    ASSERT_EQ(vm.strings, NULL, "%p");
+    vm_free(&vm);
+    free_program(&program);
+
+    // A long slice views the constant's bytes
+    top = run_on(&vm, &program, "  CONSTANT \"the quick brown fox\"\n  CONSTANT 4\n  CONSTANT 15\n  SLICE\n  HALT\n");
+    ASSERT_EQ(top.type, VAL_SLICE, "%d");
+    ASSERT_EQ(top.as.string, program.main_chunk.constants.values[0].as.string + 4, "%p");
+    ASSERT_EQ(holds(top, "quick brown"), true, "%d");
+    ASSERT_EQ(vm.heap_bytes, (size_t)0, "%zu");
+    vm_free(&vm);
+    free_program(&program);
+
+    // Appends the numbers 0 to 9 and a double, then a slice of the result
+    top = run_on(&vm, &program,
+                 "FUNCTION digits 2\n"
+                 "  NEW_BUILDER\n"
+                 "  SET_LOCAL 1\n"             // the builder
+                 "  CONSTANT 0\n"
+                 "  SET_LOCAL 2\n"             // the counter
+                 "loop:\n"
+                 "  GET_LOCAL 1\n"
+                 "  GET_LOCAL 2\n"
+                 "  APPEND\n"
+                 "  POP\n"
+                 "  GET_LOCAL 2\n"
+                 "  CONSTANT 1\n"
+                 "  ADD\n"
+                 "  DUP\n"
+                 "  SET_LOCAL 2\n"
+                 "  CONSTANT 10\n"
+                 "  JMP_IF_LESS loop\n"
+                 "  GET_LOCAL 1\n"
+                 "  CONSTANT 0.5\n"
+                 "  APPEND\n"
+                 "  BUILD\n"
+                 "  RETURN\n"
+                 "ENDFUNCTION\n"
+                 "  CONSTANT digits\n"
+                 "  CALL 0\n"
+                 "  HALT\n");
+    ASSERT_EQ(holds(top, "01234567890.5"), true, "%d");
+    vm_free(&vm);
+    free_program(&program);
+
+    int64_t number = 0;
+    // Strings of different kinds compare by contents
+    ASSERT_EQ(run_source("  CONSTANT \"abcdefghijk\"\n  CONSTANT 1\n  CONSTANT 11\n  SLICE\n"
+                         "  CONSTANT \"bcd\"\n  CONSTANT \"efghijk\"\n  CONCAT\n  EQUAL\n  HALT\n", &number),
+              VM_OK, "%d");
+    ASSERT_EQ(number, (int64_t)1, "%lld");
+    ASSERT_EQ(run_source("  CONSTANT \"apple\"\n  CONSTANT \"banana\"\n  COMPARE\n  HALT\n", &number), VM_OK, "%d");
+    ASSERT_EQ(number, (int64_t)-1, "%lld");
+    ASSERT_EQ(run_source("  CONSTANT \"ab\"\n  CONSTANT \"a\"\n  COMPARE\n  HALT\n", &number), VM_OK, "%d");
+    ASSERT_EQ(number, (int64_t)1, "%lld");
+    ASSERT_EQ(run_source("  CONSTANT \"kappa\"\n  LENGTH\n  HALT\n", &number), VM_OK, "%d");
+    ASSERT_EQ(number, (int64_t)5, "%lld");
+    // A key made at run time finds the property a constant key set
+    ASSERT_EQ(run_source("  NEW_OBJECT\n  CONSTANT \"key\"\n  CONSTANT 7\n  SET_PROPERTY\n"
+                         "  CONSTANT \"k\"\n  CONSTANT \"ey\"\n  CONCAT\n  GET_PROPERTY\n  HALT\n", &number),
+              VM_OK, "%d");
+    ASSERT_EQ(number, (int64_t)7, "%lld");
+
+    const char *errors[] = {
+        "  CONSTANT \"abc\"\n  CONSTANT 1\n  CONCAT\n  HALT\n",
+        "  CONSTANT \"abc\"\n  CONSTANT 2\n  CONSTANT 4\n  SLICE\n  HALT\n",
+        "  CONSTANT \"abc\"\n  CONSTANT 2\n  CONSTANT 1\n  SLICE\n  HALT\n",
+        "  CONSTANT \"abc\"\n  CONSTANT -1\n  CONSTANT 1\n  SLICE\n  HALT\n",
+        "  CONSTANT 1\n  LENGTH\n  HALT\n",
+        "  CONSTANT \"abc\"\n  CONSTANT \"d\"\n  APPEND\n  HALT\n",
+        "  NEW_BUILDER\n  NEW_OBJECT\n  APPEND\n  HALT\n",
+        "  CONSTANT \"abc\"\n  BUILD\n  HALT\n",
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        ASSERT_EQ(run_source(errors[i], &number), VM_RUNTIME_ERROR, "%d");
+    }
+
+    // Builders count against the heap limit as they grow
+    Program endless = assemble_program_from_string(
+        "  NEW_BUILDER\nloop:\n  CONSTANT \"more text\"\n  APPEND\n  JMP loop\n");
+    ASSERT_EQ(endless.had_error, false, "%d");
+    start_program(&vm, &endless);
+    vm_set_limits(&vm, &(VMLimits){.max_heap_bytes = 1 << 20});
+    ASSERT_EQ(vm_run(&vm), VM_LIMIT_EXCEEDED, "%d");
+    ASSERT_EQ(vm.exceeded, LIMIT_HEAP, "%d");
+    vm_free(&vm);
+    ASSERT_EQ(vm.heap_bytes, (size_t)0, "%zu");
+    ASSERT_EQ(vm.builders, NULL, "%p");
+    free_program(&endless);
+}
+
+TEST(test_lists) {
+    // Fills a list with the squares of 0 to 99 and sums it back
+    const char *squares =
+        "FUNCTION squares 3\n"
+        "  NEW_LIST\n"
+        "  SET_LOCAL 1\n"             // the list
+        "  CONSTANT 0\n"
+        "  SET_LOCAL 2\n"             // the index
+        "fill:\n"
+        "  GET_LOCAL 1\n"
+        "  GET_LOCAL 2\n"
+        "  DUP\n"
+        "  MUL\n"
+        "  LIST_PUSH\n"
+        "  POP\n"
+        "  GET_LOCAL 2\n"
+        "  CONSTANT 1\n"
+        "  ADD\n"
+        "  DUP\n"
+        "  SET_LOCAL 2\n"
+        "  CONSTANT 100\n"
+        "  JMP_IF_LESS fill\n"
+        "  CONSTANT 0\n"
+        "  SET_LOCAL 3\n"             // the sum
+        "sum:\n"
+        "  GET_LOCAL 2\n"
+        "  CONSTANT 1\n"
+        "  SUB\n"
+        "  DUP\n"
+        "  SET_LOCAL 2\n"
+        "  GET_LOCAL 1\n"
+        "  SWAP\n"
+        "  LIST_GET\n"
+        "  GET_LOCAL 3\n"
+        "  ADD\n"
+        "  SET_LOCAL 3\n"
+        "  GET_LOCAL 2\n"
+        "  CONSTANT 0\n"
+        "  JMP_IF_GREATER sum\n"
+        "  GET_LOCAL 3\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT squares\n"
+        "  CALL 0\n"
+        "  HALT\n";
+    VM vm;
+    Program program;
+    Value top = run_on(&vm, &program, squares);
+    ASSERT_EQ(top.as.number, (int64_t)328350, "%lld");
+    // The only list there is
+    const List *list = vm.lists;
+    ASSERT_EQ(list->length, (size_t)100, "%zu");
+    ASSERT_EQ(list->kind, ELEMENTS_INTEGER, "%d");
+    vm_free(&vm);
+    free_program(&program);
+
+    // Storing a string moves the list to generic storage, and the integers
+    // stay where they were
+    top = run_on(&vm, &program,
+                 "  NEW_LIST\n  CONSTANT 7\n  LIST_PUSH\n  CONSTANT 8\n  LIST_PUSH\n"
+                 "  CONSTANT 0\n  CONSTANT \"seven\"\n  LIST_SET\n  HALT\n");
+    ASSERT_EQ(top.as.list->kind, ELEMENTS_GENERIC, "%d");
+    ASSERT_EQ(top.as.list->as.items[1].as.number, (int64_t)8, "%lld");
+    vm_free(&vm);
+    free_program(&program);
+
+    int64_t number = 0;
+    ASSERT_EQ(run_source("  NEW_LIST\n  CONSTANT 2.5\n  LIST_PUSH\n  CONSTANT 1\n  LIST_PUSH\n"
+                         "  CONSTANT 1\n  LIST_GET\n  HALT\n", &number), VM_OK, "%d");
+    ASSERT_EQ(number, (int64_t)1, "%lld");
+    ASSERT_EQ(run_source("  NEW_LIST\n  CONSTANT 1\n  LIST_PUSH\n  CONSTANT 2\n  LIST_PUSH\n  LENGTH\n  HALT\n",
+                         &number), VM_OK, "%d");
+    ASSERT_EQ(number, (int64_t)2, "%lld");
+
+    const char *errors[] = {
+        "  NEW_LIST\n  CONSTANT 0\n  LIST_GET\n  HALT\n",
+        "  NEW_LIST\n  CONSTANT 1\n  LIST_PUSH\n  CONSTANT -1\n  LIST_GET\n  HALT\n",
+        "  NEW_LIST\n  CONSTANT 1\n  LIST_PUSH\n  CONSTANT 0.0\n  LIST_GET\n  HALT\n",
+        "  NEW_LIST\n  CONSTANT 1\n  CONSTANT 2\n  LIST_SET\n  HALT\n",
+        "  NEW_OBJECT\n  CONSTANT 1\n  LIST_PUSH\n  HALT\n",
+        "  CONSTANT 1\n  CONSTANT 0\n  LIST_GET\n  HALT\n",
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        ASSERT_EQ(run_source(errors[i], &number), VM_RUNTIME_ERROR, "%d");
+    }
+
+    // Lists count against the heap limit as they grow
+    Program endless = assemble_program_from_string("  NEW_LIST\nloop:\n  CONSTANT 1\n  LIST_PUSH\n  JMP loop\n");
+    ASSERT_EQ(endless.had_error, false, "%d");
+    start_program(&vm, &endless);
+    vm_set_limits(&vm, &(VMLimits){.max_heap_bytes = 1 << 20});
+    ASSERT_EQ(vm_run(&vm), VM_LIMIT_EXCEEDED, "%d");
+    ASSERT_EQ(vm.exceeded, LIMIT_HEAP, "%d");
+    vm_free(&vm);
+    ASSERT_EQ(vm.heap_bytes, (size_t)0, "%zu");
+    ASSERT_EQ(vm.lists, NULL, "%p");
+    free_program(&endless);
+}
+
 int main(void) {
     RUN_TEST(test_simple_addition);
     RUN_TEST(test_jmp_if_false);
     RUN_TEST(test_unconditional_jump);
     RUN_TEST(test_function_call);
     RUN_TEST(test_op_call);
+    RUN_TEST(test_arithmetic_and_stack_ops);
+    RUN_TEST(test_numeric_tower);
+    RUN_TEST(test_fused_jumps);
+    RUN_TEST(test_switch);
+    RUN_TEST(test_locals);
+    RUN_TEST(test_exceptions);
+    RUN_TEST(test_limits);
+    RUN_TEST(test_objects);
+    RUN_TEST(test_strings);
+    RUN_TEST(test_lists);
     printf("✔︎ All execution tests passed.\n");
     return 0;
 } 
\ No newline at end of file
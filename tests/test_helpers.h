@@ -0,0 +1,62 @@
+#ifndef VM_TEST_HELPERS_H
+#define VM_TEST_HELPERS_H
+
+#include "../assembler.h"
+#include "../vm.h"
+#include "test_macros.h"
+
+// Fixtures shared by the tests of the passes over bytecode
+
+// Runs chunk as the main chunk and returns the single integer it leaves
+static inline int64_t run_result(Chunk *chunk) {
+    VM vm;
+    vm_init(&vm);
+    CallFrame *frame = &vm.frames[vm.frame_count++];
+    frame->chunk = chunk;
+    frame->ip = chunk->code.code;
+    frame->slots = vm.stack;
+    ASSERT_EQ(vm_run(&vm), VM_OK, "%d");
+    ASSERT_EQ(vm.stack_top - vm.stack, (long)1, "%ld");
+    const int64_t result = vm.stack[0].as.number;
+    vm_free(&vm);
+    return result;
+}
+
+static inline size_t count_opcode(const Chunk *chunk, uint8_t opcode) {
+    size_t count = 0;
+    for (size_t i = 0; i < chunk->code.count; i++) {
+        if (get_opcode(chunk->code.code[i]) == opcode) count++;
+    }
+    return count;
+}
+
+// The chunk of the first function among chunk's constants, or NULL
+static inline Chunk *function_chunk(const Chunk *chunk) {
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        if (chunk->constants.values[i].type == VAL_FUNCTION) return chunk->constants.values[i].as.function->chunk;
+    }
+    return NULL;
+}
+
+// A pass such as optimize_chunk, with stats pointing at its own statistics
+typedef int (*ChunkPass)(Chunk *chunk, void *stats);
+
+// Runs src as assembled and after pass, checks both agree and returns the
+// main chunk's code size after the pass
+static inline size_t check_pass_result(const char *src, int64_t expected, ChunkPass pass, void *stats) {
+    Program plain = assemble_program_from_string(src);
+    ASSERT_EQ(plain.had_error, false, "%d");
+    ASSERT_EQ(run_result(&plain.main_chunk), expected, "%lld");
+
+    Program transformed = assemble_program_from_string(src);
+    ASSERT_EQ(pass(&transformed.main_chunk, stats), 0, "%d");
+    ASSERT_EQ(transformed.main_chunk.verified, true, "%d");
+    ASSERT_EQ(run_result(&transformed.main_chunk), expected, "%lld");
+
+    const size_t count = transformed.main_chunk.code.count;
+    free_program(&plain);
+    free_program(&transformed);
+    return count;
+}
+
+#endif //VM_TEST_HELPERS_H
@@ -0,0 +1,200 @@
+#include "../host.h"
+#include "../chunk.h"
+#include "test_macros.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *SRC =
+    "FUNCTION add\n"
+    "  GET_LOCAL 1\n"
+    "  GET_LOCAL 2\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION fact\n"
+    "  GET_LOCAL 1\n"
+    "  CONSTANT 1\n"
+    "  JMP_IF_GREATER recurse\n"
+    "  CONSTANT 1\n"
+    "  RETURN\n"
+    "recurse:\n"
+    "  GET_LOCAL 0\n"
+    "  GET_LOCAL 1\n"
+    "  CONSTANT 1\n"
+    "  SUB\n"
+    "  CALL 1\n"
+    "  GET_LOCAL 1\n"
+    "  MUL\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION fail\n"
+    "  GET_LOCAL 1\n"
+    "  THROW\n"
+    "ENDFUNCTION\n"
+    "FUNCTION half\n"
+    "  GET_LOCAL 1\n"
+    "  CONSTANT 2.0\n"
+    "  DIV\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION stop 1\n"
+    "  CONSTANT 7\n"
+    "  HALT\n"
+    "ENDFUNCTION\n"
+    "  HALT\n";
+
+static Value number(int64_t n) {
+    return (Value){.type = VAL_NUMBER, .as.number = n};
+}
+
+TEST(test_host_calls_by_name_and_function) {
+    HostProgram host;
+    ASSERT_EQ(host_load_source(&host, SRC), 0, "%d");
+    VM vm;
+    vm_init(&vm);
+
+    // The same VM serves call after call
+    Value result;
+    for (int64_t i = 0; i < 100; i++) {
+        const Value args[] = {number(i), number(1000)};
+        ASSERT_EQ(host_call(&vm, &host, "add", args, 2, &result), VM_OK, "%d");
+        ASSERT_EQ(result.as.number, i + 1000, "%lld");
+        ASSERT_EQ(vm.frame_count, 0, "%d");
+        ASSERT_EQ(vm.stack_top, vm.stack, "%p");
+    }
+    Function *fact = host_find(&host, "fact");
+    ASSERT_NE(fact, NULL, "%p");
+    const Value ten = number(10);
+    ASSERT_EQ(vm_call(&vm, fact, &ten, 1, &result), VM_OK, "%d");
+    ASSERT_EQ(result.as.number, (int64_t)3628800, "%lld");
+    // A HALT inside the function ends the call with the top of the stack
+    ASSERT_EQ(host_call(&vm, &host, "stop", NULL, 0, &result), VM_OK, "%d");
+    ASSERT_EQ(result.as.number, (int64_t)7, "%lld");
+    ASSERT_EQ(vm.frame_count, 0, "%d");
+
+    vm_free(&vm);
+    host_free(&host);
+}
+
+TEST(test_host_errors_leave_vm_reusable) {
+    HostProgram host;
+    ASSERT_EQ(host_load_source(&host, SRC), 0, "%d");
+    VM vm;
+    vm_init(&vm);
+    Value result = number(-1);
+    const Value args[] = {number(1), number(2)};
+
+    ASSERT_EQ(host_call(&vm, &host, "fail", args, 1, &result), VM_RUNTIME_ERROR, "%d");
+    ASSERT_EQ(result.as.number, (int64_t)-1, "%lld");
+    ASSERT_EQ(host_call(&vm, &host, "add", args, 0, &result), VM_RUNTIME_ERROR, "%d");
+    ASSERT_EQ(host_call(&vm, &host, "missing", args, 2, &result), VM_RUNTIME_ERROR, "%d");
+    ASSERT_EQ(host_find(&host, "missing"), NULL, "%p");
+    ASSERT_EQ(vm_call(&vm, NULL, args, 0, &result), VM_RUNTIME_ERROR, "%d");
+
+    ASSERT_EQ(host_call(&vm, &host, "add", args, 2, &result), VM_OK, "%d");
+    ASSERT_EQ(result.as.number, (int64_t)3, "%lld");
+    vm_free(&vm);
+    host_free(&host);
+
+    ASSERT_NE(host_load_source(&host, "  CONSTANT nowhere\n  HALT\n"), 0, "%d");
+    ASSERT_NE(host_load_file(&host, "no_such_file.kbc"), 0, "%d");
+}
+
+TEST(test_host_loads_bytecode) {
+    Program program = assemble_program_from_string(SRC);
+    ASSERT_EQ(program.had_error, false, "%d");
+    // Main must refer to the functions for them to be saved with it
+    Chunk *main = &program.main_chunk;
+    for (size_t i = 0; i < program.function_count; i++) {
+        add_constant(main, (Value){.type = VAL_FUNCTION, .as.function = program.functions[i].function});
+    }
+    const char *filename = "test_host.kbc";
+    ASSERT_EQ(save_chunk(main, filename), 0, "%d");
+    free_program(&program);
+
+    HostProgram host;
+    ASSERT_EQ(host_load_file(&host, filename), 0, "%d");
+    VM vm;
+    vm_init(&vm);
+    const Value five = number(5);
+    Value result;
+    ASSERT_EQ(host_call(&vm, &host, "fact", &five, 1, &result), VM_OK, "%d");
+    ASSERT_EQ(result.as.number, (int64_t)120, "%lld");
+    vm_free(&vm);
+    host_free(&host);
+    remove(filename);
+}
+
+typedef struct {
+    const HostProgram *host;
+    int64_t sum;
+} Worker;
+
+static void *call_repeatedly(void *arg) {
+    Worker *worker = arg;
+    VM vm;
+    vm_init(&vm);
+    for (int64_t i = 0; i < 10000; i++) {
+        const Value args[] = {number(i), number(1)};
+        Value result;
+        if (host_call(&vm, worker->host, "add", args, 2, &result) != VM_OK) return NULL;
+        worker->sum += result.as.number;
+    }
+    vm_free(&vm);
+    return NULL;
+}
+
+// Threads share the program and bring their own VMs
+TEST(test_host_shared_between_threads) {
+    HostProgram host;
+    ASSERT_EQ(host_load_source(&host, SRC), 0, "%d");
+    Worker workers[4];
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        workers[i] = (Worker){&host, 0};
+        pthread_create(&threads[i], NULL, call_repeatedly, &workers[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        // 1 + 2 + ... + 10000
+        ASSERT_EQ(workers[i].sum, (int64_t)50005000, "%lld");
+    }
+    host_free(&host);
+}
+
+TEST(test_host_handle_request) {
+    HostProgram host;
+    ASSERT_EQ(host_load_source(&host, SRC), 0, "%d");
+    VM vm;
+    vm_init(&vm);
+    char response[256];
+    const char *cases[][2] = {
+        {"add 2 3", "OK 5\n"},
+        {"  add\t-2 3\r", "OK 1\n"},
+        {"half 3", "OK 1.5\n"},
+        {"fail 1", "ERR Runtime error\n"},
+        {"add", "ERR Runtime error\n"},
+        {"add 1 x", "ERR Invalid argument 'x'\n"},
+        {"add 99999999999999999999 1", "ERR Invalid argument '99999999999999999999'\n"},
+        {"sub 1 2", "ERR Undefined function 'sub'\n"},
+        {"", "ERR Empty request\n"},
+        {"add 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17", "ERR Too many arguments\n"},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        host_handle_request(&host, 1, &vm, cases[i][0], response, sizeof(response));
+        ASSERT_EQ(strcmp(response, cases[i][1]), 0, "%d");
+    }
+    vm_free(&vm);
+    host_free(&host);
+}
+
+int main(void) {
+    RUN_TEST(test_host_calls_by_name_and_function);
+    RUN_TEST(test_host_errors_leave_vm_reusable);
+    RUN_TEST(test_host_loads_bytecode);
+    RUN_TEST(test_host_shared_between_threads);
+    RUN_TEST(test_host_handle_request);
+    printf("✔︎ All host tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "../inliner.h"
+#include "../optimizer.h"
+#include "test_helpers.h"
+#include <string.h>
+
+static int inline_pass(Chunk *chunk, void *stats) {
+    return inline_chunk(chunk, stats, NULL);
+}
+
+// Inlines src and checks the result matches the plain program
+static InlineStats check_inlined(const char *src, int64_t expected) {
+    InlineStats stats;
+    check_pass_result(src, expected, inline_pass, &stats);
+    return stats;
+}
+
+TEST(test_inline_simple_call) {
+    const char *src =
+        "FUNCTION add_numbers\n"
+        "  ADD\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT add_numbers\n"
+        "  CONSTANT 5\n"
+        "  CONSTANT 10\n"
+        "  CALL 2\n"
+        "  HALT\n";
+    Program program = assemble_program_from_string(src);
+    InlineStats stats;
+    ASSERT_EQ(inline_chunk(&program.main_chunk, &stats, NULL), 0, "%d");
+    ASSERT_EQ(stats.inlined_calls, (size_t)1, "%zu");
+    ASSERT_EQ(count_opcode(&program.main_chunk, OP_CALL), (size_t)0, "%zu");
+    ASSERT_EQ(run_result(&program.main_chunk), (int64_t)15, "%lld");
+
+    // With the call gone the optimizer can fold the whole program
+    ASSERT_EQ(optimize_chunk(&program.main_chunk, NULL), 0, "%d");
+    ASSERT_EQ(program.main_chunk.code.count, (size_t)2, "%zu");
+    ASSERT_EQ(run_result(&program.main_chunk), (int64_t)15, "%lld");
+    free_program(&program);
+}
+
+TEST(test_inline_nested_and_branching_calls) {
+    const char *src =
+        "FUNCTION add\n"
+        "  ADD\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "FUNCTION pick\n"
+        "  JMP_IF_FALSE zero\n"
+        "  CONSTANT 100\n"
+        "  RETURN\n"
+        "zero:\n"
+        "  CONSTANT 200\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT add\n"
+        "  CONSTANT pick\n"
+        "  CONSTANT 0\n"
+        "  CALL 1\n"
+        "  CONSTANT add\n"
+        "  CONSTANT 1\n"
+        "  CONSTANT 2\n"
+        "  CALL 2\n"
+        "  CALL 2\n"
+        "  HALT\n";
+    const InlineStats stats = check_inlined(src, 203);
+    ASSERT_EQ(stats.inlined_calls, (size_t)3, "%zu");
+    ASSERT_EQ(stats.skipped_calls, (size_t)0, "%zu");
+}
+
+TEST(test_inline_skips_unsuitable_callees) {
+    // Ignores its argument, so a RETURN would leave it behind
+    const char *src =
+        "FUNCTION seven\n"
+        "  CONSTANT 7\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "FUNCTION long\n"
+        "  CONSTANT 1\n  ADD\n  CONSTANT 1\n  ADD\n  CONSTANT 1\n  ADD\n  CONSTANT 1\n  ADD\n"
+        "  CONSTANT 1\n  ADD\n  CONSTANT 1\n  ADD\n  CONSTANT 1\n  ADD\n  CONSTANT 1\n  ADD\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT long\n"
+        "  CONSTANT seven\n"
+        "  CONSTANT 3\n"
+        "  CALL 1\n"
+        "  CALL 1\n"
+        "  HALT\n";
+    const InlineStats stats = check_inlined(src, 15);
+    ASSERT_EQ(stats.inlined_calls, (size_t)0, "%zu");
+    ASSERT_EQ(stats.skipped_calls, (size_t)2, "%zu");
+}
+
+TEST(test_inline_skips_recursion) {
+    const char *src =
+        "FUNCTION forever\n"
+        "  CONSTANT forever\n"
+        "  CALL 0\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT forever\n"
+        "  CALL 0\n"
+        "  HALT\n";
+    Program program = assemble_program_from_string(src);
+    InlineStats stats;
+    ASSERT_EQ(inline_chunk(&program.main_chunk, &stats, NULL), 0, "%d");
+    ASSERT_EQ(stats.inlined_calls, (size_t)0, "%zu");
+    ASSERT_EQ(stats.skipped_calls, (size_t)2, "%zu");
+    free_program(&program);
+}
+
+TEST(test_inline_report_names_functions) {
+    const char *src =
+        "FUNCTION add_numbers\n"
+        "  ADD\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "FUNCTION forever\n"
+        "  CONSTANT forever\n"
+        "  CALL 0\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT add_numbers\n"
+        "  CONSTANT 5\n"
+        "  CONSTANT 10\n"
+        "  CALL 2\n"
+        "  CONSTANT forever\n"
+        "  CALL 0\n"
+        "  HALT\n";
+    Program program = assemble_program_from_string(src);
+    InlineStats stats;
+    FILE *out = tmpfile();
+    ASSERT_EQ(inline_chunk(&program.main_chunk, &stats, out), 0, "%d");
+    rewind(out);
+    char report[4096];
+    const size_t length = fread(report, 1, sizeof(report) - 1, out);
+    report[length] = '\0';
+    fclose(out);
+    ASSERT_NE(strstr(report, "inlined function add_numbers (2 instructions)"), NULL, "%p");
+    ASSERT_NE(strstr(report, "to function forever: "), NULL, "%p");
+    ASSERT_EQ(strstr(report, "<#"), NULL, "%p");
+    free_program(&program);
+}
+
+int main(void) {
+    RUN_TEST(test_inline_simple_call);
+    RUN_TEST(test_inline_nested_and_branching_calls);
+    RUN_TEST(test_inline_skips_unsuitable_callees);
+    RUN_TEST(test_inline_skips_recursion);
+    RUN_TEST(test_inline_report_names_functions);
+    printf("✔︎ All inliner tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,248 @@
+#include "../ir.h"
+#include "../verifier.h"
+#include "test_helpers.h"
+
+static int ir_pass(Chunk *chunk, void *stats) {
+    return ir_optimize_chunk(chunk, stats);
+}
+
+TEST(test_ir_folds_through_diamond) {
+    // The branch depends on a call, but both arms push the same value
+    const char *src =
+        "FUNCTION one\n"
+        "  CONSTANT 1\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT one\n"
+        "  CALL 0\n"
+        "  JMP_IF_FALSE other\n"
+        "  CONSTANT 2\n"
+        "  JMP join\n"
+        "other:\n"
+        "  CONSTANT 2\n"
+        "join:\n"
+        "  CONSTANT 3\n"
+        "  ADD\n"
+        "  HALT\n";
+    IrStats stats;
+    ASSERT_EQ(check_pass_result(src, 5, ir_pass, &stats), (size_t)6, "%zu");
+    ASSERT_EQ(stats.folded_values, (size_t)1, "%zu");
+    ASSERT_EQ(stats.folded_branches, (size_t)0, "%zu");
+    ASSERT_GT(stats.congruent_values, (size_t)0, "%zu");
+    ASSERT_EQ(stats.skipped_chunks, (size_t)0, "%zu");
+}
+
+TEST(test_ir_folds_branch_on_phi) {
+    const char *src =
+        "FUNCTION one\n"
+        "  CONSTANT 1\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT one\n"
+        "  CALL 0\n"
+        "  JMP_IF_FALSE a\n"
+        "  CONSTANT 0\n"
+        "  JMP join\n"
+        "a:\n"
+        "  CONSTANT 0\n"
+        "join:\n"
+        "  JMP_IF_FALSE zero\n"
+        "  CONSTANT 10\n"
+        "  HALT\n"
+        "zero:\n"
+        "  CONSTANT 20\n"
+        "  HALT\n";
+    IrStats stats;
+    check_pass_result(src, 20, ir_pass, &stats);
+    ASSERT_EQ(stats.folded_branches, (size_t)1, "%zu");
+    ASSERT_GT(stats.removed_instructions, (size_t)0, "%zu");
+}
+
+TEST(test_ir_removes_dead_stores) {
+    // RETURN discards everything below its result
+    const char *src =
+        "FUNCTION nine\n"
+        "  CONSTANT 7\n"
+        "  CONSTANT 8\n"
+        "  ADD\n"
+        "  CONSTANT 9\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT nine\n"
+        "  CONSTANT 4\n"
+        "  CALL 1\n"
+        "  HALT\n";
+    IrStats stats;
+    ASSERT_EQ(check_pass_result(src, 9, ir_pass, &stats), (size_t)4, "%zu");
+    ASSERT_EQ(stats.removed_instructions, (size_t)3, "%zu");
+
+    Program program = assemble_program_from_string(src);
+    ASSERT_EQ(ir_optimize_chunk(&program.main_chunk, NULL), 0, "%d");
+    const Chunk *body = function_chunk(&program.main_chunk);
+    ASSERT_EQ(body->code.count, (size_t)2, "%zu");
+    ASSERT_EQ(count_opcode(body, OP_ADD), (size_t)0, "%zu");
+    free_program(&program);
+}
+
+TEST(test_ir_finds_loop_invariants) {
+    // The 5 goes round the loop unchanged until the call returns 0
+    const char *src =
+        "FUNCTION zero\n"
+        "  CONSTANT 0\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT 5\n"
+        "loop:\n"
+        "  CONSTANT zero\n"
+        "  CALL 0\n"
+        "  JMP_IF_FALSE done\n"
+        "  JMP loop\n"
+        "done:\n"
+        "  HALT\n";
+    Program program = assemble_program_from_string(src);
+    ASSERT_EQ(verify_chunk(&program.main_chunk), 0, "%d");
+    IrFunction ir;
+    IrStats stats = {0};
+    ASSERT_EQ(ir_build(&ir, &program.main_chunk), 0, "%d");
+    ASSERT_EQ(ir.block_count, (size_t)4, "%zu");
+    ir_number_values(&ir, &stats);
+    ir_mark_invariants(&ir, &stats);
+    ASSERT_EQ(ir.blocks[1].loop_header, (size_t)1, "%zu");
+    ASSERT_EQ(ir.blocks[2].loop_header, (size_t)1, "%zu");
+    ASSERT_EQ(ir.blocks[3].loop_header, IR_NONE, "%zu");
+    const IrValue *carried = &ir.values[ir.blocks[1].phis[0]];
+    ASSERT_EQ(carried->invariant, true, "%d");
+    ASSERT_EQ(carried->lattice, IR_KNOWN, "%d");
+    // The header's phi and the latch's copy of it
+    ASSERT_EQ(stats.invariant_values, (size_t)2, "%zu");
+    ir_free(&ir);
+    free_program(&program);
+
+    check_pass_result(src, 5, ir_pass, NULL);
+}
+
+TEST(test_ir_folds_arithmetic_and_stack_shuffles) {
+    // 4 - 6 * 6, with a dead push in between
+    const char *src =
+        "  CONSTANT 6\n"
+        "  DUP\n"
+        "  MUL\n"
+        "  CONSTANT 4\n"
+        "  SWAP\n"
+        "  CONSTANT 99\n"
+        "  POP\n"
+        "  SUB\n"
+        "  HALT\n";
+    IrStats stats;
+    ASSERT_EQ(check_pass_result(src, -32, ir_pass, &stats), (size_t)2, "%zu");
+    ASSERT_EQ(stats.folded_values, (size_t)1, "%zu");
+    ASSERT_EQ(stats.skipped_chunks, (size_t)0, "%zu");
+}
+
+TEST(test_ir_folds_compare_and_branch_on_nan) {
+    // inf - inf is NaN, and NaN < 1 is false
+    const char *src =
+        "  CONSTANT 1e308\n"
+        "  CONSTANT 1e308\n"
+        "  MUL\n"
+        "  DUP\n"
+        "  SUB\n"
+        "  CONSTANT 1\n"
+        "  JMP_IF_LESS less\n"
+        "  CONSTANT 222\n"
+        "  HALT\n"
+        "less:\n"
+        "  CONSTANT 111\n"
+        "  HALT\n";
+    IrStats stats;
+    ASSERT_EQ(check_pass_result(src, 222, ir_pass, &stats), (size_t)2, "%zu");
+    ASSERT_EQ(stats.folded_branches, (size_t)1, "%zu");
+}
+
+TEST(test_ir_keeps_locals_in_place) {
+    // Slot 0 of the main chunk is the first value pushed, so SET_LOCAL 0
+    // overwrites the 1 that ADD later reads
+    IrStats stats;
+    check_pass_result("  CONSTANT 1\n  CONSTANT 2\n  SET_LOCAL 0\n  CONSTANT 3\n  ADD\n  HALT\n", 5, ir_pass, &stats);
+    ASSERT_EQ(stats.folded_values, (size_t)0, "%zu");
+
+    // Sums 5 + 4 + ... + 1 in slot 0, counting down in slot 1
+    const char *loop =
+        "  CONSTANT 0\n"
+        "  CONSTANT 5\n"
+        "loop:\n"
+        "  GET_LOCAL 0\n"
+        "  GET_LOCAL 1\n"
+        "  ADD\n"
+        "  SET_LOCAL 0\n"
+        "  GET_LOCAL 1\n"
+        "  CONSTANT 1\n"
+        "  SUB\n"
+        "  SET_LOCAL 1\n"
+        "  GET_LOCAL 1\n"
+        "  CONSTANT 0\n"
+        "  JMP_IF_GREATER loop\n"
+        "  POP\n"
+        "  HALT\n";
+    check_pass_result(loop, 15, ir_pass, &stats);
+    ASSERT_EQ(stats.skipped_chunks, (size_t)0, "%zu");
+}
+
+TEST(test_ir_keeps_operations_that_may_fail) {
+    // The quotient is never used, but dividing by zero still has to fail
+    Program program = assemble_program_from_string(
+        "  CONSTANT 8\n  CONSTANT 2\n  DIV\n  POP\n"
+        "  CONSTANT 1\n  CONSTANT 0\n  DIV\n  POP\n"
+        "  CONSTANT 5\n  HALT\n");
+    IrStats stats;
+    ASSERT_EQ(ir_optimize_chunk(&program.main_chunk, &stats), 0, "%d");
+    ASSERT_EQ(program.main_chunk.code.count, (size_t)6, "%zu");
+    ASSERT_EQ(count_opcode(&program.main_chunk, OP_DIV), (size_t)1, "%zu");
+    VM vm;
+    vm_init(&vm);
+    CallFrame *frame = &vm.frames[vm.frame_count++];
+    frame->chunk = &program.main_chunk;
+    frame->ip = program.main_chunk.code.code;
+    frame->slots = vm.stack;
+    ASSERT_EQ(vm_run(&vm), VM_RUNTIME_ERROR, "%d");
+    vm_free(&vm);
+    free_program(&program);
+}
+
+TEST(test_ir_replaces_string_constants) {
+    // The optimized chunk holds its own copies of the strings it keeps
+    Program program = assemble_program_from_string(
+        "  CONSTANT \"abc\"\n  POP\n  CONSTANT \"de\"\n  POP\n  CONSTANT 1\n  HALT\n");
+    IrStats stats;
+    ASSERT_EQ(ir_optimize_chunk(&program.main_chunk, &stats), 0, "%d");
+    ASSERT_EQ(stats.skipped_chunks, (size_t)0, "%zu");
+    ASSERT_EQ(run_result(&program.main_chunk), (int64_t)1, "%lld");
+    free_program(&program);
+}
+
+TEST(test_ir_rejects_unverifiable_chunk) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_JMP, 7));
+    IrFunction ir;
+    ASSERT_EQ(ir_build(&ir, &chunk), -1, "%d");
+    ir_free(&ir);
+    ASSERT_NE(ir_optimize_chunk(&chunk, NULL), 0, "%d");
+    ASSERT_EQ(chunk.code.count, (size_t)1, "%zu");
+    free_chunk(&chunk);
+}
+
+int main(void) {
+    RUN_TEST(test_ir_folds_through_diamond);
+    RUN_TEST(test_ir_folds_branch_on_phi);
+    RUN_TEST(test_ir_removes_dead_stores);
+    RUN_TEST(test_ir_finds_loop_invariants);
+    RUN_TEST(test_ir_folds_arithmetic_and_stack_shuffles);
+    RUN_TEST(test_ir_folds_compare_and_branch_on_nan);
+    RUN_TEST(test_ir_keeps_locals_in_place);
+    RUN_TEST(test_ir_keeps_operations_that_may_fail);
+    RUN_TEST(test_ir_replaces_string_constants);
+    RUN_TEST(test_ir_rejects_unverifiable_chunk);
+    printf("✔︎ All IR tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "../list.h"
+#include "test_macros.h"
+
+static Value number(int64_t n) {
+    return (Value){.type = VAL_NUMBER, .as.number = n};
+}
+
+TEST(test_integer_list) {
+    List list;
+    init_list(&list);
+    ASSERT_EQ(list.kind, ELEMENTS_INTEGER, "%d");
+    for (int64_t i = 0; i < 1000; i++) list_push(&list, number(i * 3));
+    ASSERT_EQ(list.length, (size_t)1000, "%zu");
+    ASSERT_EQ(list.kind, ELEMENTS_INTEGER, "%d");
+    list_set(&list, 10, number(-5));
+    ASSERT_EQ(list_get(&list, 10).as.number, (int64_t)-5, "%lld");
+    ASSERT_EQ(list_get(&list, 999).type, VAL_NUMBER, "%d");
+    ASSERT_EQ(list_get(&list, 999).as.number, (int64_t)2997, "%lld");
+    free_list(&list);
+    ASSERT_EQ(list.length, (size_t)0, "%zu");
+}
+
+TEST(test_list_transitions) {
+    List list;
+    init_list(&list);
+    for (int64_t i = 0; i < 100; i++) list_push(&list, number(i));
+
+    // Storing a double converts the list, keeping what it held
+    list_set(&list, 50, (Value){.type = VAL_DOUBLE, .as.fp_number = 0.5});
+    ASSERT_EQ(list.kind, ELEMENTS_GENERIC, "%d");
+    ASSERT_EQ(list.length, (size_t)100, "%zu");
+    ASSERT_EQ(list_get(&list, 50).type, VAL_DOUBLE, "%d");
+    for (size_t i = 0; i < 100; i++) {
+        if (i != 50) ASSERT_EQ(list_get(&list, i).as.number, (int64_t)i, "%lld");
+    }
+    // and it stays generic once integers are back
+    list_set(&list, 50, number(50));
+    ASSERT_EQ(list.kind, ELEMENTS_GENERIC, "%d");
+    free_list(&list);
+
+    // Pushing a non-integer converts too, even onto an empty list
+    init_list(&list);
+    list_push(&list, (Value){.type = VAL_NULL});
+    ASSERT_EQ(list.kind, ELEMENTS_GENERIC, "%d");
+    ASSERT_EQ(list_get(&list, 0).type, VAL_NULL, "%d");
+    for (int64_t i = 0; i < 20; i++) list_push(&list, number(i));
+    ASSERT_EQ(list_get(&list, 20).as.number, (int64_t)19, "%lld");
+    free_list(&list);
+}
+
+TEST(test_list_bytes) {
+    List packed, generic;
+    init_list(&packed);
+    init_list(&generic);
+    list_push(&generic, (Value){.type = VAL_NULL});
+    list_set(&generic, 0, number(0));
+    for (int64_t i = 1; i < 100000; i++) {
+        list_push(&packed, number(i));
+        list_push(&generic, number(i));
+    }
+    ASSERT_EQ(packed.capacity, generic.capacity, "%zu");
+    // Integers take half the room of Values
+    ASSERT_EQ((list_bytes(&generic) - sizeof(List)) / (list_bytes(&packed) - sizeof(List)), (size_t)2, "%zu");
+    free_list(&packed);
+    free_list(&generic);
+}
+
+int main(void) {
+    RUN_TEST(test_integer_list);
+    RUN_TEST(test_list_transitions);
+    RUN_TEST(test_list_bytes);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "../numeric.h"
+#include "../opcode.h"
+#include "test_macros.h"
+#include <string.h>
+
+static Value integer(int64_t number) {
+    return (Value){.type = VAL_NUMBER, .as.number = number};
+}
+
+static Value floating(double number) {
+    return (Value){.type = VAL_DOUBLE, .as.fp_number = number};
+}
+
+TEST(test_numeric_binary) {
+    Value result;
+    ASSERT_EQ(numeric_binary(OP_MUL, integer(6), integer(7), &result), NUMERIC_OK, "%d");
+    ASSERT_EQ(result.type, VAL_NUMBER, "%d");
+    ASSERT_EQ(result.as.number, (int64_t)42, "%lld");
+
+    ASSERT_EQ(numeric_binary(OP_SUB, integer(INT64_MIN), integer(1), &result), NUMERIC_OK, "%d");
+    ASSERT_EQ(result.type, VAL_DOUBLE, "%d");
+    ASSERT_EQ(result.as.fp_number, -9223372036854775809.0, "%f");
+
+    ASSERT_EQ(numeric_binary(OP_ADD, integer(1), floating(0.5), &result), NUMERIC_OK, "%d");
+    ASSERT_EQ(result.type, VAL_DOUBLE, "%d");
+    ASSERT_EQ(result.as.fp_number, 1.5, "%f");
+    ASSERT_EQ(numeric_binary(OP_GREATER_EQUAL, floating(1.5), integer(2), &result), NUMERIC_OK, "%d");
+    ASSERT_EQ(result.type, VAL_NUMBER, "%d");
+    ASSERT_EQ(result.as.number, (int64_t)0, "%lld");
+
+    ASSERT_EQ(numeric_binary(OP_MOD, integer(1), integer(0), &result), NUMERIC_DIVISION_BY_ZERO, "%d");
+    ASSERT_EQ(numeric_binary(OP_DIV, floating(1), floating(0), &result), NUMERIC_DIVISION_BY_ZERO, "%d");
+    ASSERT_EQ(numeric_binary(OP_ADD, (Value){.type = VAL_NULL}, integer(1), &result), NUMERIC_NOT_A_NUMBER, "%d");
+}
+
+TEST(test_format_double) {
+    char text[32];
+    format_double(0.1, text, sizeof(text));
+    ASSERT_EQ(strcmp(text, "0.1"), 0, "%d");
+    format_double(3, text, sizeof(text));
+    ASSERT_EQ(strcmp(text, "3.0"), 0, "%d");
+    format_double(-2e30, text, sizeof(text));
+    ASSERT_EQ(strcmp(text, "-2e+30"), 0, "%d");
+    // Needs all 17 digits to read back
+    format_double(0.1 + 0.2, text, sizeof(text));
+    ASSERT_EQ(strcmp(text, "0.30000000000000004"), 0, "%d");
+}
+
+TEST(test_sum_int64) {
+    int64_t values[1003];
+    int64_t expected = 0;
+    for (size_t i = 0; i < 1003; i++) {
+        values[i] = (int64_t)(i * 7919) - 3000000;
+        expected += values[i];
+    }
+    int64_t sum = 0;
+    ASSERT_EQ(numeric_sum_int64(values, 1003, &sum), true, "%d");
+    ASSERT_EQ(sum, expected, "%lld");
+    ASSERT_EQ(numeric_sum_int64(values, 0, &sum), true, "%d");
+    ASSERT_EQ(sum, (int64_t)0, "%lld");
+
+    // Partial sums overflow but the total fits
+    const int64_t swings[] = {INT64_MAX, INT64_MAX, -INT64_MAX, -INT64_MAX, INT64_MIN, 5};
+    ASSERT_EQ(numeric_sum_int64(swings, 6, &sum), true, "%d");
+    ASSERT_EQ(sum, INT64_MIN + 5, "%lld");
+    sum = 17;
+    ASSERT_EQ(numeric_sum_int64(swings, 2, &sum), false, "%d");
+    ASSERT_EQ(sum, (int64_t)17, "%lld");
+    ASSERT_EQ(numeric_sum_int64(swings + 4, 1, &sum), true, "%d");
+    ASSERT_EQ(sum, INT64_MIN, "%lld");
+    const int64_t below[] = {INT64_MIN, -1};
+    ASSERT_EQ(numeric_sum_int64(below, 2, &sum), false, "%d");
+}
+
+TEST(test_bulk_add) {
+    int64_t a[37], b[37], out[37];
+    double x[37], y[37], z[37];
+    for (size_t i = 0; i < 37; i++) {
+        a[i] = (int64_t)i;
+        b[i] = (int64_t)(i * i);
+    }
+    ASSERT_EQ(numeric_add_int64(out, a, b, 37), true, "%d");
+    ASSERT_EQ(out[36], (int64_t)(36 + 36 * 36), "%lld");
+    // In place, with one element overflowing
+    b[20] = INT64_MAX;
+    ASSERT_EQ(numeric_add_int64(a, a, b, 37), false, "%d");
+    ASSERT_EQ(a[20], INT64_MIN + 19, "%lld");
+    ASSERT_EQ(a[21], (int64_t)(21 + 21 * 21), "%lld");
+
+    numeric_int64_to_double(x, out, 37);
+    numeric_int64_to_double(y, out, 37);
+    numeric_add_double(z, x, y, 37);
+    ASSERT_EQ(z[36], 2.0 * (36 + 36 * 36), "%f");
+    double expected = 0;
+    for (size_t i = 0; i < 37; i++) expected += z[i];
+    ASSERT_EQ(numeric_sum_double(z, 37), expected, "%f");
+    ASSERT_EQ(numeric_sum_double(z, 0), 0.0, "%f");
+}
+
+int main(void) {
+    RUN_TEST(test_numeric_binary);
+    RUN_TEST(test_format_double);
+    RUN_TEST(test_sum_int64);
+    RUN_TEST(test_bulk_add);
+    printf("✔︎ All numeric tests passed.\n");
+    return 0;
+}
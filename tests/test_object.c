@@ -0,0 +1,214 @@
+#include "../object.h"
+#include "test_macros.h"
+#include <stdio.h>
+#include <string.h>
+
+static bool set_key(Object *object, const char *key, int64_t number) {
+    return object_set(object, key, strlen(key), (Value){.type = VAL_NUMBER, .as.number = number});
+}
+
+// The number stored under key, or -1 if there is none
+static int64_t get_key(const Object *object, const char *key) {
+    Value value;
+    return object_get(object, key, strlen(key), &value) ? value.as.number : -1;
+}
+
+TEST(test_small_object) {
+    Object object;
+    init_object(&object);
+    ASSERT_EQ(get_key(&object, "x"), (int64_t)-1, "%lld");
+    ASSERT_EQ(set_key(&object, "x", 1), true, "%d");
+    ASSERT_EQ(set_key(&object, "y", 2), true, "%d");
+    ASSERT_EQ(set_key(&object, "x", 3), false, "%d");
+    ASSERT_EQ(object.count, (size_t)2, "%zu");
+    ASSERT_EQ(get_key(&object, "x"), (int64_t)3, "%lld");
+    ASSERT_EQ(get_key(&object, "y"), (int64_t)2, "%lld");
+    ASSERT_EQ(object.control, NULL, "%p");
+
+    // Keys are compared by their bytes, not by where they are stored
+    char key[] = "yx";
+    ASSERT_EQ(object_get(&object, key + 1, 1, &(Value){0}), true, "%d");
+
+    ASSERT_EQ(object_delete(&object, "x", 1), true, "%d");
+    ASSERT_EQ(object_delete(&object, "x", 1), false, "%d");
+    ASSERT_EQ(get_key(&object, "x"), (int64_t)-1, "%lld");
+    ASSERT_EQ(object.count, (size_t)1, "%zu");
+
+    // The hole the deletion left is reused once the array fills up
+    char name[16];
+    for (int i = 0; i < OBJECT_SMALL_MAX - 1; i++) {
+        snprintf(name, sizeof(name), "k%d", i);
+        set_key(&object, name, i);
+    }
+    ASSERT_EQ(object.count, (size_t)OBJECT_SMALL_MAX, "%zu");
+    ASSERT_EQ(object.control, NULL, "%p");
+    ASSERT_EQ(get_key(&object, "y"), (int64_t)2, "%lld");
+    free_object(&object);
+}
+
+TEST(test_object_grows_into_table) {
+    Object object;
+    init_object(&object);
+    char name[32];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(name, sizeof(name), "key%d", i);
+        ASSERT_EQ(set_key(&object, name, i), true, "%d");
+        if (i == OBJECT_SMALL_MAX - 1) ASSERT_EQ(object.control, NULL, "%p");
+        if (i == OBJECT_SMALL_MAX) ASSERT_NE(object.control, NULL, "%p");
+    }
+    ASSERT_EQ(object.count, (size_t)5000, "%zu");
+    for (int i = 0; i < 5000; i++) {
+        snprintf(name, sizeof(name), "key%d", i);
+        ASSERT_EQ(get_key(&object, name), (int64_t)i, "%lld");
+    }
+    ASSERT_EQ(get_key(&object, "key5000"), (int64_t)-1, "%lld");
+    // Never more than seven eighths full
+    ASSERT_GT(object.capacity - object.capacity / 8, object.count - 1, "%zu");
+    free_object(&object);
+}
+
+TEST(test_object_delete_and_reinsert) {
+    Object object;
+    init_object(&object);
+    char name[32];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "key%d", i);
+        set_key(&object, name, i);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        snprintf(name, sizeof(name), "key%d", i);
+        ASSERT_EQ(object_delete(&object, name, strlen(name)), true, "%d");
+    }
+    ASSERT_EQ(object.count, (size_t)500, "%zu");
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "key%d", i);
+        ASSERT_EQ(get_key(&object, name), i % 2 ? (int64_t)i : (int64_t)-1, "%lld");
+    }
+
+    // Churning through many more keys than fit reuses deleted slots
+    // instead of growing without bound
+    const size_t capacity = object.capacity;
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 500; i++) {
+            snprintf(name, sizeof(name), "churn%d", i);
+            set_key(&object, name, round);
+        }
+        for (int i = 0; i < 500; i++) {
+            snprintf(name, sizeof(name), "churn%d", i);
+            ASSERT_EQ(object_delete(&object, name, strlen(name)), true, "%d");
+        }
+    }
+    ASSERT_EQ(object.capacity, capacity, "%zu");
+    ASSERT_EQ(object.count, (size_t)500, "%zu");
+    ASSERT_EQ(get_key(&object, "key999"), (int64_t)999, "%lld");
+    free_object(&object);
+}
+
+// Counts the properties object_next visits, checking each key is one of
+// the count keys "key<n>" and is visited once
+static size_t visit_all(const Object *object, size_t count) {
+    bool seen[256] = {false};
+    size_t visited = 0, cursor = 0;
+    const Property *property;
+    while (object_next(object, &cursor, &property)) {
+        int n;
+        ASSERT_EQ(sscanf(property->key, "key%d", &n), 1, "%d");
+        ASSERT_EQ(n >= 0 && (size_t)n < count && !seen[n], true, "%d");
+        ASSERT_EQ(property->value.as.number, (int64_t)n, "%lld");
+        seen[n] = true;
+        visited++;
+    }
+    return visited;
+}
+
+TEST(test_object_iteration) {
+    char name[32];
+    for (size_t count = 0; count <= 200; count += count < 10 ? 1 : 50) {
+        Object object;
+        init_object(&object);
+        for (size_t i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "key%zu", i);
+            set_key(&object, name, (int64_t)i);
+        }
+        ASSERT_EQ(visit_all(&object, count), count, "%zu");
+
+        // Deleting each property as it is reached still visits the rest
+        size_t cursor = 0, visited = 0;
+        const Property *property;
+        while (object_next(&object, &cursor, &property)) {
+            visited++;
+            ASSERT_EQ(object_delete(&object, property->key, property->length), true, "%d");
+        }
+        ASSERT_EQ(visited, count, "%zu");
+        ASSERT_EQ(object.count, (size_t)0, "%zu");
+        free_object(&object);
+    }
+}
+
+TEST(test_object_prototype) {
+    Object base, derived;
+    init_object(&base);
+    init_object(&derived);
+    derived.prototype = &base;
+    set_key(&base, "shared", 1);
+    set_key(&derived, "own", 2);
+    ASSERT_EQ(get_key(&derived, "shared"), (int64_t)1, "%lld");
+    ASSERT_EQ(get_key(&derived, "own"), (int64_t)2, "%lld");
+    ASSERT_EQ(get_key(&base, "own"), (int64_t)-1, "%lld");
+    // Setting through the derived object shadows rather than overwrites
+    set_key(&derived, "shared", 3);
+    ASSERT_EQ(get_key(&derived, "shared"), (int64_t)3, "%lld");
+    ASSERT_EQ(get_key(&base, "shared"), (int64_t)1, "%lld");
+    free_object(&derived);
+    free_object(&base);
+}
+
+TEST(test_object_bytes) {
+    Object object;
+    init_object(&object);
+    const size_t empty = object_bytes(&object);
+    set_key(&object, "abc", 1);
+    ASSERT_GT(object_bytes(&object), empty + 3, "%zu");
+    char name[32];
+    for (int i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "key%d", i);
+        set_key(&object, name, i);
+    }
+    ASSERT_GT(object_bytes(&object), object.capacity * sizeof(Property), "%zu");
+    free_object(&object);
+    ASSERT_EQ(object_bytes(&object), empty, "%zu");
+}
+
+TEST(test_object_delete_releases_keys) {
+    // Keys set and deleted one after another, small and hashed
+    char name[64];
+    for (size_t live = 0; live <= 40; live += 40) {
+        Object object;
+        init_object(&object);
+        for (size_t i = 0; i < live; i++) {
+            snprintf(name, sizeof(name), "live%zu", i);
+            set_key(&object, name, (int64_t)i);
+        }
+        size_t settled = 0;
+        for (int i = 0; i < 100000; i++) {
+            snprintf(name, sizeof(name), "a-rather-long-property-name-%d", i);
+            set_key(&object, name, i);
+            ASSERT_EQ(object_delete(&object, name, strlen(name)), true, "%d");
+            if (i == 1000) settled = object_bytes(&object);
+        }
+        ASSERT_EQ(object.count, live, "%zu");
+        ASSERT_EQ(object_bytes(&object), settled, "%zu");
+        free_object(&object);
+    }
+}
+
+int main(void) {
+    RUN_TEST(test_small_object);
+    RUN_TEST(test_object_grows_into_table);
+    RUN_TEST(test_object_delete_and_reinsert);
+    RUN_TEST(test_object_iteration);
+    RUN_TEST(test_object_prototype);
+    RUN_TEST(test_object_bytes);
+    RUN_TEST(test_object_delete_releases_keys);
+    return 0;
+}
@@ -0,0 +1,269 @@
+#include "../optimizer.h"
+#include "test_helpers.h"
+
+static int optimize_pass(Chunk *chunk, void *stats) {
+    return optimize_chunk(chunk, stats);
+}
+
+TEST(test_optimize_basic_arithmetic) {
+    const char *src =
+        "  CONSTANT 1\n"
+        "  CONSTANT 1\n"
+        "  JMP_IF_FALSE end\n"
+        "  CONSTANT 10\n"
+        "  JMP finish\n"
+        "end:\n"
+        "  CONSTANT 20\n"
+        "finish:\n"
+        "  ADD\n"
+        "  HALT\n";
+    OptimizeStats stats;
+    // Everything folds down to CONSTANT 11; HALT
+    ASSERT_EQ(check_pass_result(src, 11, optimize_pass, &stats), (size_t)2, "%zu");
+    ASSERT_EQ(stats.folded_branches, (size_t)1, "%zu");
+    ASSERT_EQ(stats.folded_operations, (size_t)1, "%zu");
+    ASSERT_EQ(stats.removed_instructions, (size_t)6, "%zu");
+}
+
+TEST(test_optimize_false_branch_and_constants) {
+    const char *src =
+        "  CONSTANT 0\n"
+        "  JMP_IF_FALSE other\n"
+        "  CONSTANT 1\n"
+        "  HALT\n"
+        "other:\n"
+        "  CONSTANT 2\n"
+        "  CONSTANT 3\n"
+        "  ADD\n"
+        "  CONSTANT 4\n"
+        "  ADD\n"
+        "  HALT\n";
+    Program program = assemble_program_from_string(src);
+    OptimizeStats stats;
+    ASSERT_EQ(optimize_chunk(&program.main_chunk, &stats), 0, "%d");
+    ASSERT_EQ(program.main_chunk.code.count, (size_t)2, "%zu");
+    // Only the folded sum is left in the constant pool
+    ASSERT_EQ(program.main_chunk.constants.count, (size_t)1, "%zu");
+    ASSERT_EQ(program.main_chunk.constants.values[0].as.number, (int64_t)9, "%lld");
+    ASSERT_EQ(run_result(&program.main_chunk), (int64_t)9, "%lld");
+    free_program(&program);
+}
+
+TEST(test_optimize_threads_jump_chains) {
+    // The first value is not a constant, so the branch stays and its jump
+    // chain is threaded instead
+    const char *src =
+        "FUNCTION one\n"
+        "  CONSTANT 1\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT one\n"
+        "  CALL 0\n"
+        "  JMP_IF_FALSE a\n"
+        "  JMP b\n"
+        "a:\n"
+        "  JMP c\n"
+        "b:\n"
+        "  JMP c\n"
+        "c:\n"
+        "  CONSTANT 5\n"
+        "  CONSTANT 6\n"
+        "  ADD\n"
+        "  JMP done\n"
+        "done:\n"
+        "  HALT\n";
+    OptimizeStats stats;
+    ASSERT_EQ(check_pass_result(src, 11, optimize_pass, &stats), (size_t)5, "%zu");
+    ASSERT_GT(stats.threaded_jumps, (size_t)0, "%zu");
+}
+
+TEST(test_optimize_function_bodies) {
+    const char *src =
+        "FUNCTION add_ten\n"
+        "  CONSTANT 4\n"
+        "  CONSTANT 6\n"
+        "  ADD\n"
+        "  ADD\n"
+        "  JMP out\n"
+        "out:\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT add_ten\n"
+        "  CONSTANT 32\n"
+        "  CALL 1\n"
+        "  HALT\n";
+    OptimizeStats stats;
+    ASSERT_EQ(check_pass_result(src, 42, optimize_pass, &stats), (size_t)4, "%zu");
+    ASSERT_EQ(stats.folded_operations, (size_t)1, "%zu");
+}
+
+TEST(test_optimize_rejects_unverifiable_chunk) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_JMP, 7));
+    ASSERT_NE(optimize_chunk(&chunk, NULL), 0, "%d");
+    ASSERT_EQ(chunk.code.count, (size_t)1, "%zu");
+    free_chunk(&chunk);
+}
+
+TEST(test_optimize_fuses_compare_and_branch) {
+    // Counts down from 9 in steps of 3; the comparison and its
+    // JMP_IF_FALSE become one JMP_IF_EQUAL
+    const char *src =
+        "  CONSTANT 9\n"
+        "loop:\n"
+        "  CONSTANT 3\n"
+        "  SUB\n"
+        "  DUP\n"
+        "  CONSTANT 0\n"
+        "  NOT_EQUAL\n"
+        "  JMP_IF_FALSE done\n"
+        "  JMP loop\n"
+        "done:\n"
+        "  HALT\n";
+    OptimizeStats stats;
+    ASSERT_EQ(check_pass_result(src, 0, optimize_pass, &stats), (size_t)8, "%zu");
+    ASSERT_EQ(stats.fused_branches, (size_t)1, "%zu");
+}
+
+TEST(test_optimize_keeps_ordered_compare_and_branch) {
+    // NaN compares false every way round, so 1 < NaN being false does not
+    // make 1 >= NaN true and the pair must stay apart
+    const char *src =
+        "  CONSTANT 1e308\n"
+        "  CONSTANT 1e308\n"
+        "  MUL\n"
+        "  DUP\n"
+        "  SUB\n"
+        "  CONSTANT 1\n"
+        "  LESS\n"
+        "  JMP_IF_FALSE notless\n"
+        "  CONSTANT 111\n"
+        "  HALT\n"
+        "notless:\n"
+        "  CONSTANT 222\n"
+        "  HALT\n";
+    OptimizeStats stats;
+    check_pass_result(src, 222, optimize_pass, &stats);
+    ASSERT_EQ(stats.fused_branches, (size_t)0, "%zu");
+}
+
+TEST(test_optimize_folds_operations_and_compare_jumps) {
+    const char *src =
+        "  CONSTANT 6\n"
+        "  CONSTANT 7\n"
+        "  MUL\n"
+        "  CONSTANT 99\n"
+        "  POP\n"
+        "  CONSTANT 1\n"
+        "  CONSTANT 2\n"
+        "  JMP_IF_LESS keep\n"
+        "  CONSTANT 1000\n"
+        "  ADD\n"
+        "keep:\n"
+        "  HALT\n";
+    OptimizeStats stats;
+    ASSERT_EQ(check_pass_result(src, 42, optimize_pass, &stats), (size_t)2, "%zu");
+    ASSERT_EQ(stats.folded_operations, (size_t)1, "%zu");
+    ASSERT_EQ(stats.folded_branches, (size_t)1, "%zu");
+
+    // Division by zero stays in the code to fail at run time
+    Program program = assemble_program_from_string("  CONSTANT 1\n  CONSTANT 0\n  DIV\n  HALT\n");
+    ASSERT_EQ(optimize_chunk(&program.main_chunk, &stats), 0, "%d");
+    ASSERT_EQ(program.main_chunk.code.count, (size_t)4, "%zu");
+    free_program(&program);
+}
+
+TEST(test_optimize_switch) {
+    // The selector is a constant, so only the second case survives
+    const char *src =
+        "  CONSTANT 1\n"
+        "  SWITCH a b\n"
+        "  CONSTANT 0\n"
+        "  HALT\n"
+        "a:\n"
+        "  CONSTANT 1\n"
+        "  HALT\n"
+        "b:\n"
+        "  CONSTANT 2\n"
+        "  HALT\n";
+    OptimizeStats stats;
+    ASSERT_EQ(check_pass_result(src, 2, optimize_pass, &stats), (size_t)2, "%zu");
+    ASSERT_EQ(stats.folded_branches, (size_t)1, "%zu");
+
+    // Otherwise the table is kept and its targets follow the code as it shrinks
+    const char *dynamic =
+        "FUNCTION two\n"
+        "  CONSTANT 2\n"
+        "  RETURN\n"
+        "ENDFUNCTION\n"
+        "  CONSTANT two\n"
+        "  CALL 0\n"
+        "  SWITCH a b c\n"
+        "  CONSTANT 0\n"
+        "  HALT\n"
+        "a:\n"
+        "  JMP end\n"
+        "b:\n"
+        "  CONSTANT 3\n"
+        "  CONSTANT 4\n"
+        "  ADD\n"
+        "  HALT\n"
+        "c:\n"
+        "  CONSTANT 5\n"
+        "  CONSTANT 6\n"
+        "  ADD\n"
+        "  HALT\n"
+        "end:\n"
+        "  CONSTANT 1\n"
+        "  HALT\n";
+    Program program = assemble_program_from_string(dynamic);
+    ASSERT_EQ(optimize_chunk(&program.main_chunk, &stats), 0, "%d");
+    ASSERT_EQ(stats.threaded_jumps, (size_t)1, "%zu");
+    ASSERT_EQ(run_result(&program.main_chunk), (int64_t)11, "%lld");
+    free_program(&program);
+}
+
+TEST(test_optimize_keeps_handlers) {
+    // Only a throw reaches the handler, and the dead code before it goes
+    const char *src =
+        "  CONSTANT 1\n"
+        "  TRY caught\n"
+        "  CONSTANT 2\n"
+        "  CONSTANT 3\n"
+        "  ADD\n"
+        "  THROW\n"
+        "  ENDTRY\n"
+        "  CONSTANT 0\n"
+        "  HALT\n"
+        "caught:\n"
+        "  ADD\n"
+        "  HALT\n";
+    OptimizeStats stats;
+    ASSERT_EQ(check_pass_result(src, 6, optimize_pass, &stats), (size_t)5, "%zu");
+
+    Program program = assemble_program_from_string(src);
+    ASSERT_EQ(optimize_chunk(&program.main_chunk, &stats), 0, "%d");
+    const Handler *handler = &program.main_chunk.handlers.handlers[0];
+    ASSERT_EQ(program.main_chunk.handlers.count, (size_t)1, "%zu");
+    ASSERT_EQ(handler->start, (size_t)1, "%zu");
+    ASSERT_EQ(handler->end, (size_t)3, "%zu");
+    ASSERT_EQ(handler->target, (size_t)3, "%zu");
+    ASSERT_EQ(handler->depth, (int64_t)1, "%lld");
+    free_program(&program);
+}
+
+int main(void) {
+    RUN_TEST(test_optimize_basic_arithmetic);
+    RUN_TEST(test_optimize_false_branch_and_constants);
+    RUN_TEST(test_optimize_threads_jump_chains);
+    RUN_TEST(test_optimize_function_bodies);
+    RUN_TEST(test_optimize_rejects_unverifiable_chunk);
+    RUN_TEST(test_optimize_fuses_compare_and_branch);
+    RUN_TEST(test_optimize_keeps_ordered_compare_and_branch);
+    RUN_TEST(test_optimize_folds_operations_and_compare_jumps);
+    RUN_TEST(test_optimize_switch);
+    RUN_TEST(test_optimize_keeps_handlers);
+    printf("✔︎ All optimizer tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "../perf_stats.h"
+#include "../assembler.h"
+#include "../vm.h"
+#include "test_macros.h"
+#include <string.h>
+
+static const char *CALLS_SRC =
+    "FUNCTION add\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  CONSTANT add\n"
+    "  CONSTANT 1\n"
+    "  CONSTANT 2\n"
+    "  CALL 2\n"
+    "  CHECKPOINT\n"
+    "  CONSTANT add\n"
+    "  CONSTANT 3\n"
+    "  CONSTANT 4\n"
+    "  CALL 2\n"
+    "  ADD\n"
+    "  HALT\n";
+
+static VMResult run_with_perf(Chunk *chunk, PerfStats *stats) {
+    VM vm;
+    vm_init(&vm);
+    vm.perf = stats;
+    vm.frames[vm.frame_count++] = (CallFrame){chunk, chunk->code.code, vm.stack, vm.stack};
+    VMResult result;
+    perf_stats_begin(stats);
+    while ((result = vm_run(&vm)) == VM_CHECKPOINT) {}
+    perf_stats_end(stats, stats->run_counts);
+    vm_free(&vm);
+    return result;
+}
+
+// Holds whether or not this machine lets us read hardware counters
+TEST(test_perf_stats_counts_instructions_per_function) {
+    Program program = assemble_program_from_string(CALLS_SRC);
+    PerfStats stats;
+    perf_stats_init(&stats);
+    ASSERT_EQ(run_with_perf(&program.main_chunk, &stats), VM_OK, "%d");
+
+    ASSERT_EQ(stats.function_count, (size_t)2, "%zu");
+    ASSERT_EQ(stats.functions[0].chunk, &program.main_chunk, "%p");
+    ASSERT_EQ(stats.functions[0].instructions, (uint64_t)11, "%llu");
+    ASSERT_EQ(stats.functions[1].instructions, (uint64_t)4, "%llu");
+    ASSERT_EQ(stats.charging, false, "%d");
+    if (perf_stats_available(&stats)) {
+        ASSERT_EQ(stats.error[0], '\0', "%c");
+        if (stats.slots[PERF_INSTRUCTIONS] >= 0) ASSERT_GT(stats.run_counts[PERF_INSTRUCTIONS], (uint64_t)0, "%llu");
+    } else {
+        ASSERT_NE(stats.error[0], '\0', "%c");
+        ASSERT_EQ(stats.run_counts[PERF_CYCLES], (uint64_t)0, "%llu");
+        ASSERT_EQ(stats.functions[0].counts[PERF_CYCLES], (uint64_t)0, "%llu");
+    }
+    perf_stats_free(&stats);
+    free_program(&program);
+}
+
+TEST(test_perf_stats_report) {
+    Program program = assemble_program_from_string(CALLS_SRC);
+    PerfStats stats;
+    perf_stats_init(&stats);
+    ASSERT_EQ(run_with_perf(&program.main_chunk, &stats), VM_OK, "%d");
+
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    perf_stats_report(&stats, &program.main_chunk, out);
+    fclose(out);
+    ASSERT_NE(strstr(buf, "== functions =="), NULL, "%p");
+    ASSERT_NE(strstr(buf, "  main "), NULL, "%p");
+    ASSERT_NE(strstr(buf, "  add "), NULL, "%p");
+    if (perf_stats_available(&stats)) {
+        ASSERT_NE(strstr(buf, "per VM instr"), NULL, "%p");
+    } else {
+        ASSERT_NE(strstr(buf, "hardware counters unavailable"), NULL, "%p");
+        ASSERT_NE(strstr(buf, "15 VM instructions"), NULL, "%p");
+    }
+    free(buf);
+    perf_stats_free(&stats);
+    free_program(&program);
+}
+
+int main(void) {
+    RUN_TEST(test_perf_stats_counts_instructions_per_function);
+    RUN_TEST(test_perf_stats_report);
+    printf("✔︎ All perf stats tests passed.\n");
+    return 0;
+}
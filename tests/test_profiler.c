@@ -0,0 +1,134 @@
+#include "../profiler.h"
+#include "../assembler.h"
+#include "../verifier.h"
+#include "../vm.h"
+#include "test_macros.h"
+#include <string.h>
+
+static VMResult run_profiled(Chunk *chunk, Profile *profile) {
+    VM vm;
+    vm_init(&vm);
+    vm.profile = profile;
+    CallFrame *frame = &vm.frames[vm.frame_count++];
+    frame->chunk = chunk;
+    frame->ip = chunk->code.code;
+    frame->slots = vm.stack;
+    VMResult result;
+    while ((result = vm_run(&vm)) == VM_CHECKPOINT) {}
+    vm_free(&vm);
+    return result;
+}
+
+static const char *CALLS_SRC =
+    "FUNCTION add\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  CONSTANT add\n"
+    "  CONSTANT 1\n"
+    "  CONSTANT 2\n"
+    "  CALL 2\n"
+    "  CHECKPOINT\n"
+    "  CONSTANT add\n"
+    "  CONSTANT 3\n"
+    "  CONSTANT 4\n"
+    "  CALL 2\n"
+    "  ADD\n"
+    "  HALT\n";
+
+TEST(test_profile_counts_opcodes) {
+    Program program = assemble_program_from_string(CALLS_SRC);
+    ASSERT_EQ(verify_chunk(&program.main_chunk), 0, "%d");
+    Profile profile;
+    profile_init(&profile);
+    ASSERT_EQ(run_profiled(&program.main_chunk, &profile), VM_OK, "%d");
+
+    ASSERT_EQ(profile.opcode_counts[OP_CONSTANT], (uint64_t)6, "%llu");
+    ASSERT_EQ(profile.opcode_counts[OP_CALL], (uint64_t)2, "%llu");
+    ASSERT_EQ(profile.opcode_counts[OP_ADD], (uint64_t)3, "%llu");
+    ASSERT_EQ(profile.opcode_counts[OP_RETURN], (uint64_t)2, "%llu");
+    ASSERT_EQ(profile.opcode_counts[OP_CHECKPOINT], (uint64_t)1, "%llu");
+    ASSERT_EQ(profile.opcode_counts[OP_HALT], (uint64_t)1, "%llu");
+    ASSERT_EQ(profile.opcode_counts[OP_JMP], (uint64_t)0, "%llu");
+
+    // Pairs follow execution order, across calls and the resumed checkpoint
+    ASSERT_EQ(profile.pair_counts[OP_CALL][OP_ADD], (uint64_t)2, "%llu");
+    ASSERT_EQ(profile.pair_counts[OP_ADD][OP_RETURN], (uint64_t)2, "%llu");
+    ASSERT_EQ(profile.pair_counts[OP_RETURN][OP_CHECKPOINT], (uint64_t)1, "%llu");
+    ASSERT_EQ(profile.pair_counts[OP_CHECKPOINT][OP_CONSTANT], (uint64_t)1, "%llu");
+    ASSERT_EQ(profile.pair_counts[OP_CONSTANT][OP_CONSTANT], (uint64_t)4, "%llu");
+    ASSERT_GT(profile.opcode_ticks[OP_CONSTANT], (uint64_t)0, "%llu");
+    ASSERT_EQ(profile.timing, false, "%d");
+    profile_free(&profile);
+    free_program(&program);
+}
+
+TEST(test_profile_counts_functions) {
+    Program program = assemble_program_from_string(CALLS_SRC);
+    ASSERT_EQ(verify_chunk(&program.main_chunk), 0, "%d");
+    Profile profile;
+    profile_init(&profile);
+    ASSERT_EQ(run_profiled(&program.main_chunk, &profile), VM_OK, "%d");
+
+    ASSERT_EQ(profile.function_count, (size_t)2, "%zu");
+    const FunctionProfile *main_profile = &profile.functions[0];
+    const FunctionProfile *add_profile = &profile.functions[1];
+    ASSERT_EQ(main_profile->chunk, &program.main_chunk, "%p");
+    ASSERT_EQ(main_profile->instructions, (uint64_t)11, "%llu");
+    ASSERT_EQ(main_profile->calls, (uint64_t)0, "%llu");
+    ASSERT_EQ(add_profile->instructions, (uint64_t)4, "%llu");
+    ASSERT_EQ(add_profile->calls, (uint64_t)2, "%llu");
+    ASSERT_GT(add_profile->ticks, (uint64_t)0, "%llu");
+    profile_free(&profile);
+    free_program(&program);
+}
+
+TEST(test_profile_report) {
+    Program program = assemble_program_from_string(CALLS_SRC);
+    Profile profile;
+    profile_init(&profile);
+    ASSERT_EQ(run_profiled(&program.main_chunk, &profile), VM_OK, "%d");
+
+    FILE *out = tmpfile();
+    profile_report(&profile, &program.main_chunk, out);
+    rewind(out);
+    char report[4096];
+    const size_t length = fread(report, 1, sizeof(report) - 1, out);
+    report[length] = '\0';
+    fclose(out);
+    ASSERT_NE(strstr(report, "15 instructions"), NULL, "%p");
+    ASSERT_NE(strstr(report, "OP_CONSTANT"), NULL, "%p");
+    ASSERT_NE(strstr(report, "== functions =="), NULL, "%p");
+    // Called functions go by name, and the root chunk is main
+    ASSERT_NE(strstr(report, "\n  add "), NULL, "%p");
+    ASSERT_NE(strstr(report, "\n  main "), NULL, "%p");
+    ASSERT_EQ(strstr(report, "<#"), NULL, "%p");
+    ASSERT_NE(strstr(report, "OP_CALL          -> OP_ADD"), NULL, "%p");
+    profile_free(&profile);
+    free_program(&program);
+}
+
+TEST(test_profile_runtime_error) {
+    // Instructions up to the failing one are still counted
+    Chunk chunk;
+    init_chunk(&chunk);
+    add_constant(&chunk, (Value){.type = VAL_NUMBER, .as.number = 1});
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_CALL, 0));
+    Profile profile;
+    profile_init(&profile);
+    ASSERT_EQ(run_profiled(&chunk, &profile), VM_RUNTIME_ERROR, "%d");
+    ASSERT_EQ(profile.opcode_counts[OP_CALL], (uint64_t)1, "%llu");
+    ASSERT_EQ(profile.functions[0].instructions, (uint64_t)2, "%llu");
+    profile_free(&profile);
+    free_chunk(&chunk);
+}
+
+int main(void) {
+    RUN_TEST(test_profile_counts_opcodes);
+    RUN_TEST(test_profile_counts_functions);
+    RUN_TEST(test_profile_report);
+    RUN_TEST(test_profile_runtime_error);
+    printf("✔︎ All profiler tests passed.\n");
+    return 0;
+}
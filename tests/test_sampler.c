@@ -0,0 +1,114 @@
+#include "../sampler.h"
+#include "test_helpers.h"
+#include <string.h>
+#include <time.h>
+
+static const char *SRC =
+    "FUNCTION work\n"
+    "  CONSTANT 1\n  CONSTANT 2\n  ADD\n  CONSTANT 3\n  ADD\n  CONSTANT 4\n  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "loop:\n"
+    "  CONSTANT work\n"
+    "  CALL 0\n"
+    "  JMP_IF_FALSE next\n"
+    "next:\n"
+    "  CHECKPOINT\n"
+    "  JMP loop\n";
+
+// Writes the folded output to a buffer the caller frees
+static char *folded(const Sampler *sampler, const Chunk *root, bool with_offsets) {
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    sampler_write_folded(sampler, root, out, with_offsets);
+    fclose(out);
+    return buf;
+}
+
+TEST(test_sampler_folds_stacks) {
+    Program program = assemble_program_from_string(SRC);
+    Chunk *work = function_chunk(&program.main_chunk);
+    VM vm;
+    vm_init(&vm);
+    vm.frames[0] = (CallFrame){&program.main_chunk, program.main_chunk.code.code + 2, vm.stack, vm.stack};
+    vm.frames[1] = (CallFrame){work, work->code.code + 3, vm.stack + 1, vm.stack + 1};
+
+    Sampler sampler;
+    sampler_init(&sampler, 16);
+    vm.frame_count = 2;
+    sampler_record(&sampler, &vm);
+    sampler_record(&sampler, &vm);
+    vm.frame_count = 1;
+    sampler_record(&sampler, &vm);
+    ASSERT_EQ(sampler.sample_count, (size_t)3, "%zu");
+
+    char *plain = folded(&sampler, &program.main_chunk, false);
+    ASSERT_EQ(strcmp(plain, "main 1\nmain;work 2\n"), 0, "%d");
+    char *offsets = folded(&sampler, &program.main_chunk, true);
+    ASSERT_EQ(strcmp(offsets, "main+2 1\nmain+2;work+3 2\n"), 0, "%d");
+    free(plain);
+    free(offsets);
+    sampler_free(&sampler);
+    free_program(&program);
+}
+
+TEST(test_sampler_unnamed_and_dropped) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    VM vm;
+    vm_init(&vm);
+    vm.frames[vm.frame_count++] = (CallFrame){&chunk, chunk.code.code, vm.stack, vm.stack};
+
+    Sampler sampler;
+    sampler_init(&sampler, 1);
+    sampler_record(&sampler, &vm);
+    sampler_record(&sampler, &vm);
+    ASSERT_EQ(sampler.sample_count, (size_t)1, "%zu");
+    ASSERT_EQ(sampler.dropped, (size_t)1, "%zu");
+
+    // Without a root every chunk is named by its address
+    char *plain = folded(&sampler, NULL, false);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "<#%p> 1\n", (void *)&chunk);
+    ASSERT_EQ(strcmp(plain, expected), 0, "%d");
+    free(plain);
+    sampler_free(&sampler);
+    free_chunk(&chunk);
+}
+
+TEST(test_sampler_timer) {
+    Program program = assemble_program_from_string(SRC);
+    VM vm;
+    vm_init(&vm);
+    vm.frames[vm.frame_count++] = (CallFrame){&program.main_chunk, program.main_chunk.code.code, vm.stack, vm.stack};
+
+    Sampler sampler;
+    sampler_init(&sampler, 1024);
+    ASSERT_EQ(sampler_start(&sampler, &vm, 200), 0, "%d");
+    // Only one timer at a time
+    ASSERT_EQ(sampler_start(&sampler, &vm, 200), -1, "%d");
+    const time_t deadline = time(NULL) + 10;
+    while (sampler.sample_count < 5 && time(NULL) < deadline) {
+        ASSERT_EQ(vm_run(&vm), VM_CHECKPOINT, "%d");
+    }
+    sampler_stop();
+    ASSERT_GT(sampler.sample_count, (size_t)4, "%zu");
+
+    char *plain = folded(&sampler, &program.main_chunk, false);
+    for (char *line = plain; *line; line = strchr(line, '\n') + 1) {
+        ASSERT_EQ(strncmp(line, "main", 4), 0, "%d");
+    }
+    free(plain);
+    sampler_free(&sampler);
+    free_program(&program);
+}
+
+int main(void) {
+    RUN_TEST(test_sampler_folds_stacks);
+    RUN_TEST(test_sampler_unnamed_and_dropped);
+    RUN_TEST(test_sampler_timer);
+    printf("✔︎ All sampler tests passed.\n");
+    return 0;
+}
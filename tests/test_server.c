@@ -0,0 +1,89 @@
+#include "../server.h"
+#include "test_macros.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char *SRC =
+    "FUNCTION add\n"
+    "  GET_LOCAL 1\n"
+    "  GET_LOCAL 2\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION half\n"
+    "  GET_LOCAL 1\n"
+    "  CONSTANT 2.0\n"
+    "  DIV\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  HALT\n";
+
+static int connect_to(const char *path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    strcpy(address.sun_path, path);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, (struct sockaddr *)&address, sizeof(address)), 0, "%d");
+    return fd;
+}
+
+// Reads until count response lines have arrived
+static void read_lines(int fd, char *buffer, size_t size, int count) {
+    size_t length = 0;
+    int lines = 0;
+    while (lines < count && length < size - 1) {
+        const ssize_t n = read(fd, buffer + length, size - 1 - length);
+        ASSERT_GT(n, (ssize_t)0, "%zd");
+        for (ssize_t i = 0; i < n; i++) lines += buffer[length + (size_t)i] == '\n';
+        length += (size_t)n;
+    }
+    buffer[length] = '\0';
+}
+
+TEST(test_server_over_socket) {
+    HostProgram program;
+    ASSERT_EQ(host_load_source(&program, SRC), 0, "%d");
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/kappavm_test_%d.sock", (int)getpid());
+    Server server;
+    // A single worker still takes turns between connections
+    ASSERT_EQ(server_start(&server, path, &program, 1, 1), 0, "%d");
+    const int a = connect_to(path);
+    const int b = connect_to(path);
+
+    // Several requests in one write, the last split across two
+    const char *pipelined = "add 1 2\nnope\nadd 40 ";
+    ASSERT_EQ(write(a, pipelined, strlen(pipelined)), (ssize_t)strlen(pipelined), "%zd");
+    char buffer[512];
+    read_lines(a, buffer, sizeof(buffer), 2);
+    ASSERT_EQ(strcmp(buffer, "OK 3\nERR Undefined function 'nope'\n"), 0, "%d");
+    ASSERT_EQ(write(b, "half 5\n", 7), (ssize_t)7, "%zd");
+    read_lines(b, buffer, sizeof(buffer), 1);
+    ASSERT_EQ(strcmp(buffer, "OK 2.5\n"), 0, "%d");
+    ASSERT_EQ(write(a, "2\n", 2), (ssize_t)2, "%zd");
+    read_lines(a, buffer, sizeof(buffer), 1);
+    ASSERT_EQ(strcmp(buffer, "OK 42\n"), 0, "%d");
+
+    // An overlong line ends the connection
+    char long_line[HOST_MAX_LINE + 8];
+    memset(long_line, 'x', sizeof(long_line));
+    ASSERT_EQ(write(b, long_line, sizeof(long_line)), (ssize_t)sizeof(long_line), "%zd");
+    read_lines(b, buffer, sizeof(buffer), 1);
+    ASSERT_EQ(strcmp(buffer, "ERR Request too long\n"), 0, "%d");
+    // The rest of the line was never read, so the close may come as a reset
+    ASSERT_GT((ssize_t)1, read(b, buffer, sizeof(buffer)), "%zd");
+
+    close(a);
+    close(b);
+    server_stop(&server);
+    unlink(path);
+    host_free(&program);
+}
+
+int main(void) {
+    RUN_TEST(test_server_over_socket);
+    printf("✔︎ All server tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "../snapshot.h"
+#include "../vm.h"
+#include "../chunk.h"
+#include "../assembler.h"
+#include "../list.h"
+#include "../object.h"
+#include "../string_value.h"
+#include "test_macros.h"
+#include <stdlib.h>
+#include <string.h>
+
+TEST(test_snapshot_roundtrip) {
+    // Function: add its two arguments
+    Chunk func_chunk;
+    init_chunk(&func_chunk);
+    write_instruction(&func_chunk, make_instruction(OP_ADD, 0));
+    write_instruction(&func_chunk, make_instruction(OP_RETURN, 0));
+    Function func = { .chunk = &func_chunk, .name = "add" };
+
+    // Main: push 7, checkpoint, then call func(7 + 5, 30) ... halt
+    Chunk main_chunk;
+    init_chunk(&main_chunk);
+    add_constant(&main_chunk, (Value){ .type = VAL_FUNCTION, .as.function = &func });
+    add_constant(&main_chunk, (Value){ .type = VAL_NUMBER, .as.number = 7 });
+    add_constant(&main_chunk, (Value){ .type = VAL_NUMBER, .as.number = 5 });
+    add_constant(&main_chunk, (Value){ .type = VAL_NUMBER, .as.number = 30 });
+    write_instruction(&main_chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&main_chunk, make_instruction(OP_CONSTANT, 1));
+    write_instruction(&main_chunk, make_instruction(OP_CHECKPOINT, 0));
+    write_instruction(&main_chunk, make_instruction(OP_CONSTANT, 2));
+    write_instruction(&main_chunk, make_instruction(OP_ADD, 0));
+    write_instruction(&main_chunk, make_instruction(OP_CONSTANT, 3));
+    write_instruction(&main_chunk, make_instruction(OP_CALL, 2));
+    write_instruction(&main_chunk, make_instruction(OP_HALT, 0));
+
+    VM vm;
+    vm_init(&vm);
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = &main_chunk;
+    frame->ip = main_chunk.code.code;
+    frame->slots = vm.stack;
+    ASSERT_EQ(vm_run(&vm), VM_CHECKPOINT, "%d");
+    ASSERT_EQ(vm.stack_top - vm.stack, (long)2, "%ld");
+
+    const char *filename = "test_snapshot.ksnap";
+    ASSERT_EQ(save_snapshot(&vm, filename), 0, "%d");
+    vm_free(&vm);
+    free_chunk(&func_chunk);
+    free_chunk(&main_chunk);
+
+    VM restored;
+    Snapshot snapshot;
+    ASSERT_EQ(load_snapshot(&restored, &snapshot, filename), 0, "%d");
+    ASSERT_EQ(snapshot.chunk_count, (size_t)2, "%zu");
+    ASSERT_EQ(snapshot.function_count, (size_t)1, "%zu");
+    ASSERT_EQ(restored.frame_count, 1, "%d");
+    ASSERT_EQ(restored.stack_top - restored.stack, (long)2, "%ld");
+    ASSERT_EQ(restored.stack[0].type, VAL_FUNCTION, "%d");
+    ASSERT_EQ(strcmp(restored.stack[0].as.function->name, "add"), 0, "%d");
+
+    ASSERT_EQ(vm_run(&restored), VM_OK, "%d");
+    ASSERT_EQ(restored.stack_top - restored.stack, (long)1, "%ld");
+    ASSERT_EQ(restored.stack[0].as.number, (int64_t)42, "%lld");
+
+    vm_free(&restored);
+    free_snapshot(&snapshot);
+    remove(filename);
+}
+
+TEST(test_snapshot_rejects_bad_file) {
+    const char *filename = "test_snapshot_bad.ksnap";
+    FILE *f = fopen(filename, "wb");
+    fprintf(f, "KBC0 this is not a snapshot at all");
+    fclose(f);
+
+    VM vm;
+    Snapshot snapshot;
+    ASSERT_EQ(load_snapshot(&vm, &snapshot, filename), -2, "%d");
+    ASSERT_EQ(snapshot.mapping, NULL, "%p");
+    ASSERT_EQ(load_snapshot(&vm, &snapshot, "does_not_exist.ksnap"), -1, "%d");
+    remove(filename);
+}
+
+TEST(test_snapshot_jump_tables) {
+    Chunk chunk = assemble_chunk_from_string(
+        "  CONSTANT 1\n  CHECKPOINT\n  SWITCH a b\n  HALT\na:\n  CONSTANT 10\n  HALT\nb:\n  CONSTANT 20\n  HALT\n");
+    VM vm;
+    vm_init(&vm);
+    vm.frames[vm.frame_count++] = (CallFrame){&chunk, chunk.code.code, vm.stack, vm.stack};
+    ASSERT_EQ(vm_run(&vm), VM_CHECKPOINT, "%d");
+    const char *filename = "test_snapshot_tables.ksnap";
+    ASSERT_EQ(save_snapshot(&vm, filename), 0, "%d");
+    vm_free(&vm);
+    free_chunk(&chunk);
+
+    VM restored;
+    Snapshot snapshot;
+    ASSERT_EQ(load_snapshot(&restored, &snapshot, filename), 0, "%d");
+    ASSERT_EQ(snapshot.chunks[0].jump_tables.count, (size_t)1, "%zu");
+    ASSERT_EQ(snapshot.chunks[0].jump_tables.tables[0].targets[1], (size_t)6, "%zu");
+    ASSERT_EQ(vm_run(&restored), VM_OK, "%d");
+    ASSERT_EQ(restored.stack_top[-1].as.number, (int64_t)20, "%lld");
+    vm_free(&restored);
+    free_snapshot(&snapshot);
+    remove(filename);
+}
+
+static bool string_is(Value value, const char *expected) {
+    size_t length;
+    const char *chars = string_chars(&value, &length);
+    return length == strlen(expected) && memcmp(chars, expected, length) == 0;
+}
+
+TEST(test_snapshot_heap_values) {
+    // An object holding itself and a list that holds the object, an integer
+    // list, a builder and one string of each kind, then a checkpoint
+    Chunk chunk = assemble_chunk_from_string(
+        "  NEW_OBJECT\n  DUP\n  CONSTANT \"self\"\n  SWAP\n  SET_PROPERTY\n"
+        "  CONSTANT \"list\"\n  NEW_LIST\n  CONSTANT 1.5\n  LIST_PUSH\n  CONSTANT \"item\"\n  LIST_PUSH\n"
+        "  GET_LOCAL 0\n  LIST_PUSH\n  SET_PROPERTY\n"
+        "  NEW_LIST\n  CONSTANT 10\n  LIST_PUSH\n  CONSTANT 20\n  LIST_PUSH\n"
+        "  NEW_BUILDER\n  CONSTANT \"abc\"\n  APPEND\n"
+        "  CONSTANT \"made at run time, \"\n  CONSTANT \"on the heap\"\n  CONCAT\n"
+        "  CONSTANT \"a constant to slice\"\n  CONSTANT 2\n  CONSTANT 19\n  SLICE\n"
+        "  CONSTANT \"ab\"\n  CONSTANT \"cd\"\n  CONCAT\n"
+        "  CONSTANT \"constant\"\n"
+        "  CHECKPOINT\n"
+        "  GET_LOCAL 2\n  CONSTANT \"def\"\n  APPEND\n  BUILD\n  HALT\n");
+    VM vm;
+    vm_init(&vm);
+    vm.frames[vm.frame_count++] = (CallFrame){&chunk, chunk.code.code, vm.stack, vm.stack};
+    ASSERT_EQ(vm_run(&vm), VM_CHECKPOINT, "%d");
+    const char *filename = "test_snapshot_heap.ksnap";
+    ASSERT_EQ(save_snapshot(&vm, filename), 0, "%d");
+    vm_free(&vm);
+    free_chunk(&chunk);
+
+    VM restored;
+    Snapshot snapshot;
+    ASSERT_EQ(load_snapshot(&restored, &snapshot, filename), 0, "%d");
+    ASSERT_EQ(restored.stack_top - restored.stack, (long)7, "%ld");
+    ASSERT_GT(restored.heap_bytes, (size_t)0, "%zu");
+
+    ASSERT_EQ(restored.stack[0].type, VAL_OBJECT, "%d");
+    Object *object = restored.stack[0].as.object;
+    Value self, list;
+    ASSERT_EQ(object_get(object, "self", 4, &self), true, "%d");
+    ASSERT_EQ(self.as.object, object, "%p");
+    ASSERT_EQ(object_get(object, "list", 4, &list), true, "%d");
+    ASSERT_EQ(list.type, VAL_LIST, "%d");
+    ASSERT_EQ(list.as.list->kind, ELEMENTS_GENERIC, "%d");
+    ASSERT_EQ(list.as.list->length, (size_t)3, "%zu");
+    ASSERT_EQ(list_get(list.as.list, 0).as.fp_number, 1.5, "%f");
+    ASSERT_EQ(string_is(list_get(list.as.list, 1), "item"), true, "%d");
+    ASSERT_EQ(list_get(list.as.list, 2).as.object, object, "%p");
+
+    ASSERT_EQ(restored.stack[1].type, VAL_LIST, "%d");
+    ASSERT_EQ(restored.stack[1].as.list->kind, ELEMENTS_INTEGER, "%d");
+    ASSERT_EQ(restored.stack[1].as.list->length, (size_t)2, "%zu");
+    ASSERT_EQ(list_get(restored.stack[1].as.list, 1).as.number, (int64_t)20, "%lld");
+
+    ASSERT_EQ(restored.stack[2].type, VAL_BUILDER, "%d");
+    ASSERT_EQ(restored.stack[3].type, VAL_HEAP_STRING, "%d");
+    ASSERT_EQ(string_is(restored.stack[3], "made at run time, on the heap"), true, "%d");
+    ASSERT_EQ(restored.stack[4].type, VAL_SLICE, "%d");
+    ASSERT_EQ(string_is(restored.stack[4], "constant to slice"), true, "%d");
+    ASSERT_EQ(restored.stack[5].type, VAL_SHORT_STRING, "%d");
+    ASSERT_EQ(string_is(restored.stack[5], "abcd"), true, "%d");
+    ASSERT_EQ(restored.stack[6].type, VAL_STRING, "%d");
+    ASSERT_EQ(string_is(restored.stack[6], "constant"), true, "%d");
+
+    // The builder picks up where it left off
+    ASSERT_EQ(vm_run(&restored), VM_OK, "%d");
+    ASSERT_EQ(string_is(restored.stack_top[-1], "abcdef"), true, "%d");
+    vm_free(&restored);
+    free_snapshot(&snapshot);
+    remove(filename);
+}
+
+int main(void) {
+    RUN_TEST(test_snapshot_roundtrip);
+    RUN_TEST(test_snapshot_rejects_bad_file);
+    RUN_TEST(test_snapshot_jump_tables);
+    RUN_TEST(test_snapshot_heap_values);
+    printf("✔︎ All snapshot tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "../string_value.h"
+#include "test_macros.h"
+#include <stdlib.h>
+#include <string.h>
+
+static Value constant(const char *string) {
+    return (Value){.type = VAL_STRING, .as.string = (char *)string};
+}
+
+// Whether value holds exactly the bytes of expected
+static bool holds(const Value *value, const char *expected) {
+    size_t length;
+    const char *chars = string_chars(value, &length);
+    return length == strlen(expected) && memcmp(chars, expected, length) == 0;
+}
+
+TEST(test_short_string) {
+    ASSERT_EQ(sizeof(Value), (size_t)16, "%zu");
+    const Value value = make_short_string("kappavm!", 8);
+    ASSERT_EQ(value.type, VAL_SHORT_STRING, "%d");
+    ASSERT_EQ(is_string(value), true, "%d");
+    ASSERT_EQ(holds(&value, "kappavm!"), true, "%d");
+    const Value empty = make_short_string("", 0);
+    ASSERT_EQ(holds(&empty, ""), true, "%d");
+}
+
+TEST(test_string_slice) {
+    const char *text = "the quick brown fox";
+    const Value string = constant(text);
+
+    // Long enough that it views the original bytes rather than copying
+    const Value long_slice = string_slice(&string, 4, 15);
+    ASSERT_EQ(long_slice.type, VAL_SLICE, "%d");
+    ASSERT_EQ(long_slice.as.string, text + 4, "%p");
+    ASSERT_EQ(holds(&long_slice, "quick brown"), true, "%d");
+
+    // Slices of slices still point into the original
+    const Value nested = string_slice(&long_slice, 6, 11);
+    ASSERT_EQ(nested.type, VAL_SHORT_STRING, "%d");
+    ASSERT_EQ(holds(&nested, "brown"), true, "%d");
+    const Value whole = string_slice(&string, 0, 19);
+    const Value inner = string_slice(&whole, 1, 19);
+    ASSERT_EQ(inner.as.string, text + 1, "%p");
+
+    const Value empty = string_slice(&string, 3, 3);
+    ASSERT_EQ(holds(&empty, ""), true, "%d");
+}
+
+TEST(test_string_compare) {
+    ASSERT_EQ(string_compare("abc", 3, "abc", 3), 0, "%d");
+    ASSERT_GT(0, string_compare("abc", 3, "abd", 3), "%d");
+    ASSERT_GT(string_compare("abd", 3, "abc", 3), 0, "%d");
+    // A prefix sorts first
+    ASSERT_GT(0, string_compare("ab", 2, "abc", 3), "%d");
+    ASSERT_GT(string_compare("abc", 3, "ab", 2), 0, "%d");
+    ASSERT_EQ(string_compare("", 0, "", 0), 0, "%d");
+    // Bytes compare unsigned, and a NUL is an ordinary byte
+    ASSERT_GT(string_compare("\xff", 1, "a", 1), 0, "%d");
+    ASSERT_GT(string_compare("a\0b", 3, "a", 1), 0, "%d");
+}
+
+TEST(test_builder) {
+    StringBuilder builder;
+    init_builder(&builder);
+    size_t reallocations = 0, capacity = 0;
+    for (int i = 0; i < 10000; i++) {
+        builder_append(&builder, "xy", 2);
+        if (builder.capacity != capacity) {
+            reallocations++;
+            capacity = builder.capacity;
+        }
+    }
+    ASSERT_EQ(builder.length, (size_t)20000, "%zu");
+    // Doubling needs a logarithmic number of reallocations
+    ASSERT_GT((size_t)20, reallocations, "%zu");
+    ASSERT_EQ(memcmp(builder.chars + 19998, "xy", 2), 0, "%d");
+
+    // A single append larger than doubling provides
+    char *big = malloc(100000);
+    memset(big, 'z', 100000);
+    builder_append(&builder, big, 100000);
+    ASSERT_EQ(builder.length, (size_t)120000, "%zu");
+    ASSERT_GT(builder.capacity, builder.length - 1, "%zu");
+    ASSERT_EQ(builder.chars[119999], 'z', "%c");
+    free(big);
+
+    free_builder(&builder);
+    ASSERT_EQ(builder.chars, NULL, "%p");
+    ASSERT_EQ(builder.length, (size_t)0, "%zu");
+}
+
+int main(void) {
+    RUN_TEST(test_short_string);
+    RUN_TEST(test_string_slice);
+    RUN_TEST(test_string_compare);
+    RUN_TEST(test_builder);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "../trace.h"
+#include "../assembler.h"
+#include "../vm.h"
+#include "test_macros.h"
+#include <string.h>
+#include <unistd.h>
+
+static VMResult run_traced(Chunk *chunk, Tracer *tracer) {
+    VM vm;
+    vm_init(&vm);
+    vm.tracer = tracer;
+    CallFrame *frame = &vm.frames[vm.frame_count++];
+    frame->chunk = chunk;
+    frame->ip = chunk->code.code;
+    frame->slots = vm.stack;
+    VMResult result;
+    while ((result = vm_run(&vm)) == VM_CHECKPOINT) {}
+    vm_free(&vm);
+    return result;
+}
+
+static const char *CALLS_SRC =
+    "FUNCTION add\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  CONSTANT add\n"
+    "  CONSTANT 1\n"
+    "  CONSTANT 2\n"
+    "  CALL 2\n"
+    "  HALT\n";
+
+TEST(test_trace_records) {
+    Program program = assemble_program_from_string(CALLS_SRC);
+    Tracer tracer;
+    tracer_init(&tracer, &program.main_chunk, 16);
+    ASSERT_EQ(tracer.table.count, (size_t)2, "%zu");
+    ASSERT_EQ(run_traced(&program.main_chunk, &tracer), VM_OK, "%d");
+
+    // CONSTANT x3, CALL, ADD, RETURN, HALT
+    ASSERT_EQ(tracer.head, (uint64_t)7, "%llu");
+    const uint8_t opcodes[] = {OP_CONSTANT, OP_CONSTANT, OP_CONSTANT, OP_CALL, OP_ADD, OP_RETURN, OP_HALT};
+    const uint32_t chunks[] = {0, 0, 0, 0, 1, 1, 0};
+    const uint32_t ips[] = {0, 1, 2, 3, 0, 1, 4};
+    const uint16_t depths[] = {0, 1, 2, 3, 3, 2, 1};
+    for (size_t i = 0; i < 7; i++) {
+        ASSERT_EQ(tracer.records[i].opcode, opcodes[i], "%u");
+        ASSERT_EQ(tracer.records[i].chunk, chunks[i], "%u");
+        ASSERT_EQ(tracer.records[i].ip, ips[i], "%u");
+        ASSERT_EQ(tracer.records[i].depth, depths[i], "%u");
+    }
+    tracer_free(&tracer);
+    free_program(&program);
+}
+
+TEST(test_trace_wraps) {
+    Program program = assemble_program_from_string(
+        "  CONSTANT 1\n  CONSTANT 2\n  ADD\n  CONSTANT 3\n  ADD\n  CONSTANT 4\n  ADD\n  HALT\n");
+    Tracer tracer;
+    tracer_init(&tracer, &program.main_chunk, 4);
+    ASSERT_EQ(tracer.capacity, (size_t)4, "%zu");
+    ASSERT_EQ(run_traced(&program.main_chunk, &tracer), VM_OK, "%d");
+    ASSERT_EQ(tracer.head, (uint64_t)8, "%llu");
+
+    // The slot about to be overwritten is left out
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    tracer_dump(&tracer, 100, out);
+    fclose(out);
+    ASSERT_EQ(strcmp(buf,
+                     "#5 main depth 1  5: OP_CONSTANT 3\n"
+                     "#6 main depth 2  6: OP_ADD 0\n"
+                     "#7 main depth 1  7: OP_HALT 0\n"), 0, "%d");
+    free(buf);
+    tracer_free(&tracer);
+    free_program(&program);
+}
+
+TEST(test_trace_save_and_decode) {
+    Program program = assemble_program_from_string(CALLS_SRC);
+    Tracer tracer;
+    tracer_init(&tracer, &program.main_chunk, 16);
+    ASSERT_EQ(run_traced(&program.main_chunk, &tracer), VM_OK, "%d");
+
+    char filename[] = "/tmp/kappa_trace_XXXXXX";
+    const int fd = mkstemp(filename);
+    ASSERT_NE(fd, -1, "%d");
+    close(fd);
+    ASSERT_EQ(trace_save(&tracer, filename), 0, "%d");
+
+    TraceLog log;
+    ASSERT_EQ(trace_load(&log, filename), 0, "%d");
+    ASSERT_EQ(log.count, (size_t)7, "%zu");
+    ASSERT_EQ(log.first_sequence, (uint64_t)0, "%llu");
+    ASSERT_EQ(memcmp(log.records, tracer.records, sizeof(TraceRecord) * 7), 0, "%d");
+
+    // A table built from the bytecode alone numbers the chunks the same way
+    TraceChunkTable table;
+    trace_chunk_table(&table, &program.main_chunk);
+    char *buf = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buf, &length);
+    trace_print(log.records + 4, 2, 4, &table, out);
+    fclose(out);
+    ASSERT_EQ(strcmp(buf, "#4 add depth 3  0: OP_ADD 0\n#5 add depth 2  1: OP_RETURN 0\n"), 0, "%d");
+    free(buf);
+
+    free_trace_chunk_table(&table);
+    free_trace_log(&log);
+    unlink(filename);
+    ASSERT_EQ(trace_load(&log, filename), -1, "%d");
+    tracer_free(&tracer);
+    free_program(&program);
+}
+
+TEST(test_trace_runtime_error) {
+    // Calling a number fails at the CALL
+    Program program = assemble_program_from_string("  CONSTANT 1\n  CALL 0\n  HALT\n");
+    Tracer tracer;
+    tracer_init(&tracer, &program.main_chunk, 16);
+    ASSERT_EQ(run_traced(&program.main_chunk, &tracer), VM_RUNTIME_ERROR, "%d");
+    ASSERT_EQ(tracer.head, (uint64_t)2, "%llu");
+    ASSERT_EQ(tracer.records[1].opcode, OP_CALL, "%u");
+    ASSERT_EQ(tracer.records[1].depth, 1, "%u");
+    tracer_free(&tracer);
+    free_program(&program);
+}
+
+int main(void) {
+    RUN_TEST(test_trace_records);
+    RUN_TEST(test_trace_wraps);
+    RUN_TEST(test_trace_save_and_decode);
+    RUN_TEST(test_trace_runtime_error);
+    printf("✔︎ All trace tests passed.\n");
+    return 0;
+}
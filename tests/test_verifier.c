@@ -0,0 +1,260 @@
+#include "../verifier.h"
+#include "../vm.h"
+#include "../chunk.h"
+#include "test_macros.h"
+
+static VMResult run_chunk(VM *vm, Chunk *chunk) {
+    vm_init(vm);
+    CallFrame *frame = &vm->frames[vm->frame_count++];
+    frame->chunk = chunk;
+    frame->ip = chunk->code.code;
+    frame->slots = vm->stack;
+    return vm_run(vm);
+}
+
+TEST(test_verify_accepts_function_call) {
+    // Function: add its two arguments
+    Chunk func_chunk;
+    init_chunk(&func_chunk);
+    write_instruction(&func_chunk, make_instruction(OP_ADD, 0));
+    write_instruction(&func_chunk, make_instruction(OP_RETURN, 0));
+    Function func = { .chunk = &func_chunk };
+
+    Chunk chunk;
+    init_chunk(&chunk);
+    add_constant(&chunk, (Value){ .type = VAL_FUNCTION, .as.function = &func });
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 40 });
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 2 });
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 1));
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 2));
+    write_instruction(&chunk, make_instruction(OP_CALL, 2));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+
+    ASSERT_EQ(verify_chunk(&chunk), 0, "%d");
+    ASSERT_EQ(chunk.verified, true, "%d");
+    ASSERT_EQ(func_chunk.verified, true, "%d");
+    ASSERT_EQ(chunk.max_stack, (size_t)3, "%zu");
+    ASSERT_EQ(chunk.stack_needed, (size_t)0, "%zu");
+    // The callee consumes both arguments it was passed
+    ASSERT_EQ(func_chunk.stack_needed, (size_t)2, "%zu");
+
+    VM vm;
+    ASSERT_EQ(run_chunk(&vm, &chunk), VM_OK, "%d");
+    ASSERT_EQ(vm.stack_top - vm.stack, (long)1, "%ld");
+    ASSERT_EQ(vm.stack[0].as.number, (int64_t)42, "%lld");
+    vm_free(&vm);
+    free_chunk(&chunk);
+    free_chunk(&func_chunk);
+}
+
+TEST(test_verify_accepts_loop) {
+    // 3 + 4 through a conditional jump that is always taken
+    Chunk chunk;
+    init_chunk(&chunk);
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 0 });
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 3 });
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 4 });
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 1));
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_JMP_IF_FALSE, 1));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 2));
+    write_instruction(&chunk, make_instruction(OP_ADD, 0));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+
+    ASSERT_EQ(verify_chunk(&chunk), 0, "%d");
+    ASSERT_EQ(chunk.max_stack, (size_t)2, "%zu");
+
+    VM vm;
+    ASSERT_EQ(run_chunk(&vm, &chunk), VM_OK, "%d");
+    ASSERT_EQ(vm.stack[0].as.number, (int64_t)7, "%lld");
+    vm_free(&vm);
+    free_chunk(&chunk);
+}
+
+TEST(test_verify_rejects_bad_jump) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_JMP, 10));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    ASSERT_NE(verify_chunk(&chunk), 0, "%d");
+    ASSERT_EQ(chunk.verified, false, "%d");
+    free_chunk(&chunk);
+}
+
+TEST(test_verify_rejects_bad_constant) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 3));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    ASSERT_NE(verify_chunk(&chunk), 0, "%d");
+    free_chunk(&chunk);
+}
+
+TEST(test_verify_underflow_and_fall_through) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_ADD, 0));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    // Values consumed from below the frame are recorded rather than rejected;
+    // vm_run only runs the chunk unchecked when they are actually there
+    ASSERT_EQ(verify_chunk(&chunk), 0, "%d");
+    ASSERT_EQ(chunk.stack_needed, (size_t)2, "%zu");
+    VM vm;
+    ASSERT_EQ(run_chunk(&vm, &chunk), VM_RUNTIME_ERROR, "%d");
+    vm_free(&vm);
+    free_chunk(&chunk);
+
+    init_chunk(&chunk);
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 1 });
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    ASSERT_NE(verify_chunk(&chunk), 0, "%d");
+    free_chunk(&chunk);
+}
+
+TEST(test_verify_rejects_inconsistent_stack) {
+    // One path reaches the HALT with an extra value on the stack
+    Chunk chunk;
+    init_chunk(&chunk);
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 0 });
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_JMP_IF_FALSE, 1));
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    ASSERT_NE(verify_chunk(&chunk), 0, "%d");
+    free_chunk(&chunk);
+}
+
+TEST(test_checked_run_catches_bad_code) {
+    // Never verified, so vm_run falls back to the checked interpreter
+    Chunk chunk;
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 5));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    VM vm;
+    ASSERT_EQ(run_chunk(&vm, &chunk), VM_RUNTIME_ERROR, "%d");
+    vm_free(&vm);
+    free_chunk(&chunk);
+
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_ADD, 0));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    ASSERT_EQ(run_chunk(&vm, &chunk), VM_RUNTIME_ERROR, "%d");
+    vm_free(&vm);
+    free_chunk(&chunk);
+
+    init_chunk(&chunk);
+    write_instruction(&chunk, make_instruction(OP_JMP, 4));
+    ASSERT_EQ(run_chunk(&vm, &chunk), VM_RUNTIME_ERROR, "%d");
+    vm_free(&vm);
+    free_chunk(&chunk);
+}
+
+TEST(test_verify_stack_effects) {
+    // DUP grows the stack, a fused jump pops both operands and both of its
+    // successors must agree on the height
+    Chunk chunk;
+    init_chunk(&chunk);
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 1 });
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_DUP, 0));
+    write_instruction(&chunk, make_instruction(OP_DUP, 0));
+    write_instruction(&chunk, make_instruction(OP_JMP_IF_EQUAL, 1));
+    write_instruction(&chunk, make_instruction(OP_DUP, 0));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    ASSERT_NE(verify_chunk(&chunk), 0, "%d");
+
+    chunk.code.code[3] = make_instruction(OP_JMP_IF_LESS, 0);
+    chunk.code.code[4] = make_instruction(OP_POP, 0);
+    ASSERT_EQ(verify_chunk(&chunk), 0, "%d");
+    ASSERT_EQ(chunk.max_stack, (size_t)3, "%zu");
+    ASSERT_EQ(chunk.stack_needed, (size_t)0, "%zu");
+    free_chunk(&chunk);
+}
+
+TEST(test_verify_local_slots) {
+    // Reading slot 2 needs three values in the frame: the callee and two
+    // arguments, or one argument and one local
+    Chunk func_chunk;
+    init_chunk(&func_chunk);
+    write_instruction(&func_chunk, make_instruction(OP_GET_LOCAL, 2));
+    write_instruction(&func_chunk, make_instruction(OP_RETURN, 0));
+    Function func = { .chunk = &func_chunk };
+    ASSERT_EQ(verify_chunk(&func_chunk), 0, "%d");
+    ASSERT_EQ(func_chunk.stack_needed, (size_t)3, "%zu");
+
+    Chunk chunk;
+    init_chunk(&chunk);
+    add_constant(&chunk, (Value){ .type = VAL_FUNCTION, .as.function = &func });
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 7 });
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 1));
+    write_instruction(&chunk, make_instruction(OP_CALL, 1));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    ASSERT_EQ(verify_chunk(&chunk), 0, "%d");
+    VM vm;
+    ASSERT_EQ(run_chunk(&vm, &chunk), VM_RUNTIME_ERROR, "%d");
+    vm_free(&vm);
+
+    // The local makes up the difference; it starts out null
+    func.local_count = 1;
+    ASSERT_EQ(run_chunk(&vm, &chunk), VM_OK, "%d");
+    ASSERT_EQ(vm.stack[0].type, VAL_NULL, "%d");
+    vm_free(&vm);
+
+    // Main has no slots beyond what it pushes
+    free_chunk(&func_chunk);
+    write_instruction(&func_chunk, make_instruction(OP_SET_LOCAL, 0));
+    write_instruction(&func_chunk, make_instruction(OP_HALT, 0));
+    ASSERT_EQ(verify_chunk(&func_chunk), 0, "%d");
+    ASSERT_EQ(func_chunk.stack_needed, (size_t)2, "%zu");
+    free_chunk(&func_chunk);
+    free_chunk(&chunk);
+}
+
+TEST(test_verify_handlers) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    add_constant(&chunk, (Value){ .type = VAL_NUMBER, .as.number = 0 });
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_CONSTANT, 0));
+    write_instruction(&chunk, make_instruction(OP_POP, 0));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    write_instruction(&chunk, make_instruction(OP_POP, 0));
+    write_instruction(&chunk, make_instruction(OP_HALT, 0));
+    // Only the handler reaches 4, with the thrown value on top of the one
+    // value the range starts with
+    add_handler(&chunk, (Handler){ .start = 1, .end = 3, .target = 4 });
+    ASSERT_EQ(verify_chunk(&chunk), 0, "%d");
+    ASSERT_EQ(chunk.handlers.handlers[0].depth, (int64_t)1, "%lld");
+    ASSERT_EQ(chunk.max_stack, (size_t)2, "%zu");
+
+    // From 2 the POP would eat into the stack the handler restores
+    chunk.handlers.handlers[0].start = 2;
+    chunk.verified = false;
+    ASSERT_NE(verify_chunk(&chunk), 0, "%d");
+
+    chunk.handlers.handlers[0] = (Handler){ .start = 1, .end = 1, .target = 4 };
+    chunk.verified = false;
+    ASSERT_NE(verify_chunk(&chunk), 0, "%d");
+    chunk.handlers.handlers[0] = (Handler){ .start = 1, .end = 3, .target = 6 };
+    chunk.verified = false;
+    ASSERT_NE(verify_chunk(&chunk), 0, "%d");
+    free_chunk(&chunk);
+}
+
+int main(void) {
+    RUN_TEST(test_verify_accepts_function_call);
+    RUN_TEST(test_verify_accepts_loop);
+    RUN_TEST(test_verify_rejects_bad_jump);
+    RUN_TEST(test_verify_rejects_bad_constant);
+    RUN_TEST(test_verify_underflow_and_fall_through);
+    RUN_TEST(test_verify_rejects_inconsistent_stack);
+    RUN_TEST(test_checked_run_catches_bad_code);
+    RUN_TEST(test_verify_stack_effects);
+    RUN_TEST(test_verify_local_slots);
+    RUN_TEST(test_verify_handlers);
+    printf("✔︎ All verifier tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "../zygote.h"
+#include "test_macros.h"
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *SRC =
+    "FUNCTION add\n"
+    "  GET_LOCAL 1\n"
+    "  GET_LOCAL 2\n"
+    "  ADD\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "FUNCTION half\n"
+    "  GET_LOCAL 1\n"
+    "  CONSTANT 2.0\n"
+    "  DIV\n"
+    "  RETURN\n"
+    "ENDFUNCTION\n"
+    "  HALT\n";
+
+static void expect(Zygote *zygote, int worker, const char *request, const char *expected) {
+    char response[256];
+    ASSERT_EQ(zygote_submit(zygote, worker, request), 0, "%d");
+    zygote_collect(zygote, worker, response, sizeof(response));
+    ASSERT_EQ(strcmp(response, expected), 0, "%d");
+}
+
+TEST(test_zygote_answers_requests) {
+    HostProgram program;
+    ASSERT_EQ(host_load_source(&program, SRC), 0, "%d");
+    Zygote zygote;
+    ASSERT_EQ(zygote_start(&zygote, &program, 1, 2), 0, "%d");
+    ASSERT_EQ(zygote.worker_count, 2, "%d");
+    ASSERT_NE(zygote.workers[0].pid, zygote.workers[1].pid, "%d");
+    ASSERT_NE(zygote.workers[0].pid, getpid(), "%d");
+
+    expect(&zygote, 0, "add 2 3", "OK 5\n");
+    expect(&zygote, 1, "half 5", "OK 2.5\n");
+    expect(&zygote, 1, "nope", "ERR Undefined function 'nope'\n");
+
+    // Both workers busy at once, and several requests queued on one
+    char response[256];
+    ASSERT_EQ(zygote_submit(&zygote, 0, "add 1 1"), 0, "%d");
+    ASSERT_EQ(zygote_submit(&zygote, 1, "add 2 2"), 0, "%d");
+    ASSERT_EQ(zygote_submit(&zygote, 0, "add 3 3"), 0, "%d");
+    zygote_collect(&zygote, 1, response, sizeof(response));
+    ASSERT_EQ(strcmp(response, "OK 4\n"), 0, "%d");
+    zygote_collect(&zygote, 0, response, sizeof(response));
+    ASSERT_EQ(strcmp(response, "OK 2\n"), 0, "%d");
+    zygote_collect(&zygote, 0, response, sizeof(response));
+    ASSERT_EQ(strcmp(response, "OK 6\n"), 0, "%d");
+    ASSERT_EQ(zygote.workers[0].pending, (size_t)0, "%zu");
+
+    char long_line[HOST_MAX_LINE + 8];
+    memset(long_line, 'x', sizeof(long_line) - 1);
+    long_line[sizeof(long_line) - 1] = '\0';
+    ASSERT_EQ(zygote_submit(&zygote, 0, long_line), -1, "%d");
+    ASSERT_EQ(zygote.workers[0].pending, (size_t)0, "%zu");
+
+    zygote_stop(&zygote);
+    host_free(&program);
+}
+
+TEST(test_zygote_replaces_dead_worker) {
+    HostProgram program;
+    ASSERT_EQ(host_load_source(&program, SRC), 0, "%d");
+    Zygote zygote;
+    ASSERT_EQ(zygote_start(&zygote, &program, 1, 1), 0, "%d");
+    expect(&zygote, 0, "add 1 2", "OK 3\n");
+
+    const pid_t first = zygote.workers[0].pid;
+    kill(first, SIGKILL);
+    expect(&zygote, 0, "add 1 2", "ERR Worker died\n");
+    ASSERT_EQ(zygote.respawns, (size_t)1, "%zu");
+    ASSERT_NE(zygote.workers[0].pid, first, "%d");
+    // The replacement starts from the parent's loaded program
+    expect(&zygote, 0, "add 20 22", "OK 42\n");
+
+    zygote_stop(&zygote);
+    host_free(&program);
+}
+
+int main(void) {
+    RUN_TEST(test_zygote_answers_requests);
+    RUN_TEST(test_zygote_replaces_dead_worker);
+    printf("✔︎ All zygote tests passed.\n");
+    return 0;
+}
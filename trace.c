@@ -0,0 +1,274 @@
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_MAGIC "KTR0"
+#define TRACE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t first_sequence;   // sequence number of the first record
+    uint64_t count;
+} TraceHeader;
+
+static bool table_contains(const TraceChunkTable* table, const Chunk* chunk) {
+    for (size_t i = 0; i < table->count; i++) {
+        if (table->chunks[i].chunk == chunk) return true;
+    }
+    return false;
+}
+
+static void collect_chunks(TraceChunkTable* table, size_t* capacity, const Chunk* chunk, const char* name) {
+    if (table_contains(table, chunk)) return;
+    if (table->count == *capacity) {
+        *capacity = *capacity < 8 ? 8 : *capacity * 2;
+        table->chunks = realloc(table->chunks, sizeof(TraceChunk) * *capacity);
+    }
+    table->chunks[table->count++] = (TraceChunk){chunk, name};
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        const Value value = chunk->constants.values[i];
+        if (value.type == VAL_FUNCTION && value.as.function && value.as.function->chunk) {
+            collect_chunks(table, capacity, value.as.function->chunk, value.as.function->name);
+        }
+    }
+}
+
+void trace_chunk_table(TraceChunkTable* table, const Chunk* root) {
+    table->chunks = NULL;
+    table->count = 0;
+    size_t capacity = 0;
+    if (root) collect_chunks(table, &capacity, root, "main");
+}
+
+void free_trace_chunk_table(TraceChunkTable* table) {
+    free(table->chunks);
+    table->chunks = NULL;
+    table->count = 0;
+}
+
+static int compare_ids(const void* a, const void* b) {
+    const uintptr_t x = (uintptr_t)((const TraceChunkId*)a)->chunk;
+    const uintptr_t y = (uintptr_t)((const TraceChunkId*)b)->chunk;
+    return x < y ? -1 : x > y;
+}
+
+void tracer_init(Tracer* tracer, const Chunk* root, size_t capacity) {
+    memset(tracer, 0, sizeof(Tracer));
+    size_t rounded = 2;
+    while (rounded < capacity) rounded *= 2;
+    tracer->capacity = rounded;
+    tracer->records = calloc(rounded, sizeof(TraceRecord));
+    trace_chunk_table(&tracer->table, root);
+    tracer->ids = malloc(sizeof(TraceChunkId) * (tracer->table.count ? tracer->table.count : 1));
+    for (size_t i = 0; i < tracer->table.count; i++) {
+        tracer->ids[i] = (TraceChunkId){tracer->table.chunks[i].chunk, (uint32_t)i};
+    }
+    qsort(tracer->ids, tracer->table.count, sizeof(TraceChunkId), compare_ids);
+    tracer->current_id = TRACE_UNKNOWN_CHUNK;
+}
+
+void tracer_free(Tracer* tracer) {
+    free(tracer->records);
+    free(tracer->ids);
+    free_trace_chunk_table(&tracer->table);
+    memset(tracer, 0, sizeof(Tracer));
+}
+
+uint32_t tracer_chunk_id(const Tracer* tracer, const Chunk* chunk) {
+    size_t low = 0, high = tracer->table.count;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const Chunk* candidate = tracer->ids[mid].chunk;
+        if (candidate == chunk) return tracer->ids[mid].id;
+        if ((uintptr_t)candidate < (uintptr_t)chunk) low = mid + 1;
+        else high = mid;
+    }
+    return TRACE_UNKNOWN_CHUNK;
+}
+
+// The range of records that is safe to read. Once the ring has wrapped, the
+// oldest slot is the one the VM overwrites next, so it is left out.
+static void readable_range(const Tracer* tracer, uint64_t* first, uint64_t* count) {
+    const uint64_t head = __atomic_load_n(&tracer->head, __ATOMIC_ACQUIRE);
+    *count = head < tracer->capacity ? head : tracer->capacity - 1;
+    *first = head - *count;
+}
+
+static int write_all(int fd, const void* data, size_t length) {
+    const char* bytes = data;
+    while (length > 0) {
+        const ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+int trace_write(const Tracer* tracer, int fd) {
+    uint64_t first, count;
+    readable_range(tracer, &first, &count);
+    TraceHeader header = {.version = TRACE_VERSION, .first_sequence = first, .count = count};
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    if (write_all(fd, &header, sizeof(header)) != 0) return -1;
+
+    // At most two runs: up to the end of the ring, then from its start
+    const size_t start = (size_t)(first & (tracer->capacity - 1));
+    const size_t tail = tracer->capacity - start < count ? tracer->capacity - start : (size_t)count;
+    if (write_all(fd, tracer->records + start, sizeof(TraceRecord) * tail) != 0) return -1;
+    if (write_all(fd, tracer->records, sizeof(TraceRecord) * ((size_t)count - tail)) != 0) return -1;
+    return 0;
+}
+
+int trace_save(const Tracer* tracer, const char* filename) {
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    const int res = trace_write(tracer, fd);
+    if (close(fd) != 0) return -1;
+    return res;
+}
+
+static const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+#define FATAL_SIGNAL_COUNT (sizeof(fatal_signals) / sizeof(fatal_signals[0]))
+
+static Tracer* volatile signal_tracer = NULL;
+static volatile int signal_fd = -1;
+static struct sigaction previous_fatal[FATAL_SIGNAL_COUNT];
+static struct sigaction previous_usr1;
+
+static void dump_to_signal_fd(void) {
+    const Tracer* tracer = signal_tracer;
+    const int fd = signal_fd;
+    if (!tracer || fd < 0) return;
+    if (lseek(fd, 0, SEEK_SET) != 0) return;
+    if (trace_write(tracer, fd) != 0) return;
+    const off_t end = lseek(fd, 0, SEEK_CUR);
+    if (end >= 0) (void)ftruncate(fd, end);
+}
+
+static void handle_fatal(int signal) {
+    dump_to_signal_fd();
+    // SA_RESETHAND restored the default action; the signal stays blocked
+    // until the handler returns and then terminates the process
+    raise(signal);
+}
+
+static void handle_usr1(int signal) {
+    (void)signal;
+    const int saved_errno = errno;
+    dump_to_signal_fd();
+    errno = saved_errno;
+}
+
+int trace_install_signal_dump(Tracer* tracer, const char* filename) {
+    if (signal_tracer) return -1;
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    signal_fd = fd;
+    signal_tracer = tracer;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = handle_fatal;
+    action.sa_flags = SA_RESETHAND;
+    for (size_t i = 0; i < FATAL_SIGNAL_COUNT; i++) {
+        sigaction(fatal_signals[i], &action, &previous_fatal[i]);
+    }
+    action.sa_handler = handle_usr1;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, &previous_usr1);
+    return 0;
+}
+
+void trace_remove_signal_dump(void) {
+    if (!signal_tracer) return;
+    for (size_t i = 0; i < FATAL_SIGNAL_COUNT; i++) {
+        sigaction(fatal_signals[i], &previous_fatal[i], NULL);
+    }
+    sigaction(SIGUSR1, &previous_usr1, NULL);
+    signal_tracer = NULL;
+    close(signal_fd);
+    signal_fd = -1;
+}
+
+void trace_print(const TraceRecord* records, size_t count, uint64_t first_sequence,
+                 const TraceChunkTable* program, FILE* out) {
+    for (size_t i = 0; i < count; i++) {
+        const TraceRecord* record = &records[i];
+        const TraceChunk* entry = program && record->chunk < program->count ? &program->chunks[record->chunk] : NULL;
+        fprintf(out, "#%llu ", (unsigned long long)(first_sequence + i));
+        if (entry && entry->name) {
+            fprintf(out, "%s", entry->name);
+        } else if (record->chunk == TRACE_UNKNOWN_CHUNK) {
+            fprintf(out, "<unknown>");
+        } else {
+            fprintf(out, "<chunk %u>", record->chunk);
+        }
+        fprintf(out, " depth %u  ", record->depth);
+        if (entry && record->ip < entry->chunk->code.count) {
+            disassemble_instruction(entry->chunk, record->ip, out);
+        } else if (record->opcode < OPCODE_COUNT) {
+            // Without the bytecode only the opcode is known
+            fprintf(out, "%u: %s\n", record->ip, opcode_name(record->opcode));
+        } else {
+            fprintf(out, "%u: [unknown opcode %u]\n", record->ip, record->opcode);
+        }
+    }
+}
+
+void tracer_dump(const Tracer* tracer, size_t count, FILE* out) {
+    uint64_t first, available;
+    readable_range(tracer, &first, &available);
+    if (count > available) count = (size_t)available;
+    first += available - count;
+    TraceRecord* records = malloc(sizeof(TraceRecord) * (count ? count : 1));
+    for (size_t i = 0; i < count; i++) {
+        records[i] = tracer->records[(first + i) & (tracer->capacity - 1)];
+    }
+    trace_print(records, count, first, &tracer->table, out);
+    free(records);
+}
+
+int trace_load(TraceLog* log, const char* filename) {
+    log->records = NULL;
+    log->count = 0;
+    log->first_sequence = 0;
+    FILE* f = fopen(filename, "rb");
+    if (!f) return -1;
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TRACE_MAGIC, 4) != 0) {
+        fclose(f);
+        return -2;
+    }
+    if (header.version != TRACE_VERSION) {
+        fclose(f);
+        return -3;
+    }
+    log->records = header.count <= SIZE_MAX / sizeof(TraceRecord)
+        ? malloc(sizeof(TraceRecord) * (header.count ? header.count : 1)) : NULL;
+    if (!log->records || fread(log->records, sizeof(TraceRecord), header.count, f) != header.count) {
+        free_trace_log(log);
+        fclose(f);
+        return -4;
+    }
+    log->count = (size_t)header.count;
+    log->first_sequence = header.first_sequence;
+    fclose(f);
+    return 0;
+}
+
+void free_trace_log(TraceLog* log) {
+    free(log->records);
+    log->records = NULL;
+    log->count = 0;
+    log->first_sequence = 0;
+}
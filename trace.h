@@ -0,0 +1,101 @@
+#ifndef KAPPAVM_TRACE_H
+#define KAPPAVM_TRACE_H
+
+#include <stdio.h>
+#include "chunk.h"
+
+// Records kept per VM; must be a power of two
+#define TRACE_DEFAULT_CAPACITY 4096
+// Records printed to stderr when vm_run fails
+#define TRACE_ERROR_DUMP 32
+#define TRACE_UNKNOWN_CHUNK UINT32_MAX
+
+typedef struct {
+    uint32_t chunk;        // id in the program's TraceChunkTable
+    uint32_t ip;           // offset of the instruction in its chunk
+    uint16_t depth;        // values on the VM stack before it ran
+    uint8_t opcode;
+    uint8_t reserved;
+} TraceRecord;
+
+typedef struct {
+    const Chunk* chunk;
+    const char* name;      // NULL for unnamed functions
+} TraceChunk;
+
+// Numbers the chunks of a program: the root chunk is 0, then function
+// chunks in depth-first order of their constants. The numbering depends only
+// on the bytecode, so a trace can be decoded against the same .kbc file later.
+typedef struct {
+    TraceChunk* chunks;
+    size_t count;
+} TraceChunkTable;
+
+void trace_chunk_table(TraceChunkTable* table, const Chunk* root);
+void free_trace_chunk_table(TraceChunkTable* table);
+
+typedef struct {
+    const Chunk* chunk;
+    uint32_t id;
+} TraceChunkId;
+
+// Ring buffer of the most recent instructions a VM executed. Only the VM's
+// thread writes; each record is published by a release store of head, so a
+// signal handler or another thread can copy out the last records without a lock.
+typedef struct Tracer {
+    TraceRecord* records;
+    size_t capacity;
+    uint64_t head;         // records written so far
+    TraceChunkTable table;
+    TraceChunkId* ids;     // table sorted by chunk address
+    const Chunk* current_chunk;
+    uint32_t current_id;
+} Tracer;
+
+void tracer_init(Tracer* tracer, const Chunk* root, size_t capacity);
+void tracer_free(Tracer* tracer);
+uint32_t tracer_chunk_id(const Tracer* tracer, const Chunk* chunk);
+
+static inline void trace_step(Tracer* tracer, const Chunk* chunk, size_t ip, uint8_t opcode, size_t depth) {
+    if (chunk != tracer->current_chunk) {
+        tracer->current_id = tracer_chunk_id(tracer, chunk);
+        tracer->current_chunk = chunk;
+    }
+    const uint64_t head = tracer->head;
+    tracer->records[head & (tracer->capacity - 1)] = (TraceRecord){
+        .chunk = tracer->current_id,
+        .ip = (uint32_t)ip,
+        .depth = (uint16_t)depth,
+        .opcode = opcode,
+    };
+    __atomic_store_n(&tracer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Writes the buffered records, oldest first, in the .ktrace format.
+// Async-signal-safe. Returns 0 on success.
+int trace_write(const Tracer* tracer, int fd);
+int trace_save(const Tracer* tracer, const char* filename);
+// Writes the trace to filename when the process gets SIGUSR1, or a fatal
+// signal (SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT) before dying of it.
+// Only one tracer can be installed at a time. Returns 0 on success.
+int trace_install_signal_dump(Tracer* tracer, const char* filename);
+void trace_remove_signal_dump(void);
+
+// One line per record: sequence number, function, stack depth, then the
+// instruction as disassemble_chunk prints it. program may be NULL.
+void trace_print(const TraceRecord* records, size_t count, uint64_t first_sequence,
+                 const TraceChunkTable* program, FILE* out);
+// Prints the last count records of a live tracer
+void tracer_dump(const Tracer* tracer, size_t count, FILE* out);
+
+// A .ktrace file read back for offline decoding
+typedef struct {
+    TraceRecord* records;
+    size_t count;
+    uint64_t first_sequence;
+} TraceLog;
+
+int trace_load(TraceLog* log, const char* filename);
+void free_trace_log(TraceLog* log);
+
+#endif //KAPPAVM_TRACE_H
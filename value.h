@@ -5,29 +5,60 @@
 struct Chunk; // Forward-declare
 
 typedef enum {
-    VAL_NULL, VAL_NUMBER, VAL_STRING, VAL_LIST, VAL_OBJECT, VAL_FUNCTION
+    VAL_NULL, VAL_NUMBER,
+    VAL_STRING, // as.string, NUL-terminated and owned elsewhere, e.g. by a chunk
+    VAL_LIST, VAL_OBJECT, VAL_FUNCTION,
+    VAL_DOUBLE, // as.fp_number; integers that overflow are promoted to it
+    // Strings made at run time; see string_value.h
+    VAL_SHORT_STRING,   // length bytes in as.chars
+    VAL_SLICE,          // length bytes at as.string, part of another string
+    VAL_HEAP_STRING,    // as.heap_string
+    VAL_BUILDER,        // as.builder
 } ValueType;
 
 typedef struct Value Value;
 typedef struct Object Object;
 typedef struct Function Function;
+typedef struct String String;
+typedef struct StringBuilder StringBuilder;
 
-typedef struct {
+typedef struct List List;
+
+// How a list stores its elements; see list.h
+typedef enum {
+    ELEMENTS_INTEGER,           // as.numbers, every element a VAL_NUMBER
+    ELEMENTS_GENERIC,           // as.items
+} ElementsKind;
+
+struct List {
+    ElementsKind kind;
     size_t length;
-    Value *items;
     size_t capacity;
-} List;
+    union {
+        int64_t *numbers;
+        Value *items;
+    } as;
+    List *next;                 // the owning VM's list of lists
+};
 
-struct Object{
-    size_t count;
-    char **keys;
-    Value *values;
-    size_t capacity;
-    Object *prototype;
+struct Property;
+
+// A map from string keys to values; see object.h
+struct Object {
+    size_t count;               // live properties
+    size_t capacity;            // slots in properties
+    size_t used;                // while small: slots handed out, holes included
+    size_t growth_left;         // once hashed: empty slots that may fill before it grows
+    struct Property *properties;
+    uint8_t *control;           // one byte per slot once hashed, NULL while small
+    size_t key_bytes;           // held by the keys
+    Object *prototype;          // searched when a lookup misses, or NULL
+    Object *next;               // the owning VM's list of objects
 };
 
 struct Value {
     ValueType type;
+    uint32_t length;    // VAL_SHORT_STRING and VAL_SLICE: the byte count
     union {
         double fp_number;
         char *string;
@@ -35,12 +66,34 @@ struct Value {
         List *list;
         Object *object;
         Function *function;
+        char chars[8];
+        String *heap_string;
+        StringBuilder *builder;
     } as;
 };
 
+// A string on the VM heap, allocated together with its bytes
+struct String {
+    size_t length;
+    String *next;               // the owning VM's list of strings
+    char chars[];               // length bytes and a NUL
+};
+
+struct StringBuilder {
+    char *chars;                // not NUL-terminated
+    size_t length;
+    size_t capacity;
+    StringBuilder *next;        // the owning VM's list of builders
+};
+
 struct Function {
     struct Chunk* chunk;
-    // We can add more here later, like arity, name for debugging, etc.
+    // Name from the FUNCTION definition, or NULL. Owned by whoever created
+    // the function: the assembler's Program, or the caller of load_chunk.
+    char* name;
+    // Slots reserved above the arguments on each call, from the FUNCTION
+    // header. They start out null.
+    size_t local_count;
 };
 
 #endif //KAPPAVM_VALUE_H 
\ No newline at end of file
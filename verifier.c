@@ -0,0 +1,275 @@
+#include "verifier.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static int verify_error(size_t offset, const char* message) {
+    fprintf(stderr, "VerifyError: instruction %zu: %s\n", offset, message);
+    return -1;
+}
+
+// Sign-extends a 56-bit operand
+static int64_t signed_operand(Instruction inst) {
+    return (int64_t)(get_operand(inst) << 8) >> 8;
+}
+
+// Records the stack height on entry to target, checking it against any
+// height already seen there. Newly reached instructions go on the worklist.
+static int flow_to(int64_t* depth, size_t* worklist, size_t* worklist_count,
+                   size_t from, size_t target, size_t count, int64_t height) {
+    if (target >= count) return verify_error(from, "control flow leaves the chunk");
+    if (depth[target] == UNVISITED) {
+        depth[target] = height;
+        worklist[(*worklist_count)++] = target;
+    } else if (depth[target] != height) {
+        return verify_error(target, "inconsistent stack height");
+    }
+    return 0;
+}
+
+void stack_effect(Instruction inst, int64_t* pops, int64_t* pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch (get_opcode(inst)) {
+        case OP_CONSTANT: *pushes = 1; break;
+        case OP_JMP_IF_FALSE: *pops = 1; break;
+        case OP_CALL: *pops = (int64_t)get_operand(inst) + 1; *pushes = 1; break;
+        case OP_RETURN: *pops = 1; break;
+        case OP_DUP: *pops = 1; *pushes = 2; break;
+        case OP_SWAP: *pops = 2; *pushes = 2; break;
+        case OP_POP: *pops = 1; break;
+        case OP_SWITCH: *pops = 1; break;
+        case OP_GET_LOCAL: *pushes = 1; break;
+        case OP_SET_LOCAL: *pops = 1; break;
+        case OP_THROW: *pops = 1; break;
+        case OP_NEW_OBJECT: *pushes = 1; break;
+        case OP_GET_PROPERTY: *pops = 2; *pushes = 1; break;
+        case OP_SET_PROPERTY: *pops = 3; *pushes = 1; break;
+        case OP_DELETE_PROPERTY: *pops = 2; *pushes = 1; break;
+        case OP_NEXT_PROPERTY: *pops = 2; *pushes = 3; break;
+        case OP_CONCAT: *pops = 2; *pushes = 1; break;
+        case OP_SLICE: *pops = 3; *pushes = 1; break;
+        case OP_LENGTH: *pops = 1; *pushes = 1; break;
+        case OP_COMPARE: *pops = 2; *pushes = 1; break;
+        case OP_NEW_BUILDER: *pushes = 1; break;
+        case OP_APPEND: *pops = 2; *pushes = 1; break;
+        case OP_BUILD: *pops = 1; *pushes = 1; break;
+        case OP_NEW_LIST: *pushes = 1; break;
+        case OP_LIST_PUSH: *pops = 2; *pushes = 1; break;
+        case OP_LIST_GET: *pops = 2; *pushes = 1; break;
+        case OP_LIST_SET: *pops = 3; *pushes = 1; break;
+        default:
+            if (is_binary_opcode(get_opcode(inst))) {
+                *pops = 2;
+                *pushes = 1;
+            } else if (is_fused_jump_opcode(get_opcode(inst))) {
+                *pops = 2;
+            }
+            break;
+    }
+}
+
+// Abstract interpretation over stack heights. Heights are relative to the
+// height on entry; negative heights consume values the caller placed above
+// the frame's slots.
+static int analyze_code(const Chunk* chunk, int64_t* depth, int64_t* min_out, int64_t* max_out) {
+    const size_t count = chunk->code.count;
+    if (count == 0) return verify_error(0, "empty chunk");
+
+    for (size_t h = 0; h < chunk->handlers.count; h++) {
+        const Handler* handler = &chunk->handlers.handlers[h];
+        if (handler->start >= handler->end || handler->end > count) {
+            return verify_error(handler->start, "exception handler range out of bounds");
+        }
+        if (handler->target >= count) return verify_error(handler->start, "exception handler target out of range");
+    }
+
+    size_t* worklist = malloc(sizeof(size_t) * count);
+    for (size_t i = 0; i < count; i++) depth[i] = UNVISITED;
+    size_t worklist_count = 0;
+    depth[0] = 0;
+    worklist[worklist_count++] = 0;
+
+    int64_t min_depth = 0, max_depth = 0;
+    int res = 0;
+    while (worklist_count > 0 && res == 0) {
+        const size_t i = worklist[--worklist_count];
+        const Instruction inst = chunk->code.code[i];
+        const uint64_t operand = get_operand(inst);
+        bool falls_through = true;
+        bool jumps = false;
+
+        switch (get_opcode(inst)) {
+            case OP_CONSTANT:
+                if (operand >= chunk->constants.count) res = verify_error(i, "constant index out of range");
+                break;
+            case OP_JMP:
+                jumps = true;
+                falls_through = false;
+                break;
+            case OP_JMP_IF_FALSE:
+                jumps = true;
+                break;
+            case OP_CALL:
+                if (operand > UINT8_MAX) res = verify_error(i, "too many call arguments");
+                break;
+            case OP_RETURN:
+            case OP_HALT:
+            case OP_THROW:
+                falls_through = false;
+                break;
+            case OP_SWITCH:
+                if (operand >= chunk->jump_tables.count) res = verify_error(i, "jump table index out of range");
+                break;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                if (operand > UINT8_MAX) res = verify_error(i, "local slot out of range");
+                break;
+            case OP_CHECKPOINT:
+            case OP_DUP:
+            case OP_SWAP:
+            case OP_POP:
+            case OP_NEW_OBJECT:
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            case OP_DELETE_PROPERTY:
+            case OP_NEXT_PROPERTY:
+            case OP_CONCAT:
+            case OP_SLICE:
+            case OP_LENGTH:
+            case OP_COMPARE:
+            case OP_NEW_BUILDER:
+            case OP_APPEND:
+            case OP_BUILD:
+            case OP_NEW_LIST:
+            case OP_LIST_PUSH:
+            case OP_LIST_GET:
+            case OP_LIST_SET:
+                break;
+            default:
+                if (is_fused_jump_opcode(get_opcode(inst))) {
+                    jumps = true;
+                } else if (!is_binary_opcode(get_opcode(inst))) {
+                    res = verify_error(i, "unknown opcode");
+                }
+                break;
+        }
+        if (res != 0) break;
+
+        int64_t pops, pushes;
+        stack_effect(inst, &pops, &pushes);
+        int64_t height = depth[i] - pops;
+        if (height < min_depth) min_depth = height;
+        if (get_opcode(inst) == OP_GET_LOCAL || get_opcode(inst) == OP_SET_LOCAL) {
+            // Slot n must lie below the values on the stack, which holds
+            // when at least n + 1 - height of them were there on entry
+            const int64_t slot_depth = height - (int64_t)operand - 1;
+            if (slot_depth < min_depth) min_depth = slot_depth;
+        }
+        height += pushes;
+        if (height > max_depth) max_depth = height;
+
+        if (jumps) {
+            // vm_run reads jump offsets as int16_t
+            const int64_t offset = signed_operand(inst);
+            if (offset != (int16_t)offset) {
+                res = verify_error(i, "jump offset out of range");
+                break;
+            }
+            const int64_t target = (int64_t)i + 1 + offset;
+            if (target < 0) {
+                res = verify_error(i, "control flow leaves the chunk");
+                break;
+            }
+            res = flow_to(depth, worklist, &worklist_count, i, (size_t)target, count, height);
+        }
+        if (get_opcode(inst) == OP_SWITCH) {
+            const JumpTable* table = &chunk->jump_tables.tables[operand];
+            for (size_t e = 0; e < table->count && res == 0; e++) {
+                res = flow_to(depth, worklist, &worklist_count, i, table->targets[e], count, height);
+            }
+        }
+        if (res == 0 && falls_through) {
+            res = flow_to(depth, worklist, &worklist_count, i, i + 1, count, height);
+        }
+        // A handler starts with the stack as it was at the start of its
+        // range, plus the thrown value
+        for (size_t h = 0; h < chunk->handlers.count && res == 0; h++) {
+            const Handler* handler = &chunk->handlers.handlers[h];
+            if (handler->start != i) continue;
+            if (depth[i] + 1 > max_depth) max_depth = depth[i] + 1;
+            res = flow_to(depth, worklist, &worklist_count, i, handler->target, count, depth[i] + 1);
+        }
+    }
+    free(worklist);
+    *min_out = min_depth;
+    *max_out = max_depth;
+    return res;
+}
+
+int stack_heights(const Chunk* chunk, int64_t* heights) {
+    int64_t min_depth, max_depth;
+    return analyze_code(chunk, heights, &min_depth, &max_depth);
+}
+
+// Records the height at the start of each handler's range as its depth.
+// Unwinding cuts the stack back to that depth, so no instruction in the
+// range may pop below it.
+static int check_handlers(Chunk* chunk, const int64_t* depth) {
+    for (size_t h = 0; h < chunk->handlers.count; h++) {
+        Handler* handler = &chunk->handlers.handlers[h];
+        if (depth[handler->start] == UNVISITED) continue;
+        handler->depth = depth[handler->start];
+        for (size_t i = handler->start; i < handler->end; i++) {
+            if (depth[i] == UNVISITED) continue;
+            int64_t pops, pushes;
+            stack_effect(chunk->code.code[i], &pops, &pushes);
+            if (depth[i] - pops < handler->depth) {
+                return verify_error(i, "pops below the start of its exception handler range");
+            }
+        }
+    }
+    return 0;
+}
+
+int compute_handler_depths(Chunk* chunk) {
+    int64_t* depth = malloc(sizeof(int64_t) * (chunk->code.count ? chunk->code.count : 1));
+    int res = stack_heights(chunk, depth);
+    if (res == 0) res = check_handlers(chunk, depth);
+    free(depth);
+    return res;
+}
+
+static int verify_code(Chunk* chunk) {
+    int64_t* depth = malloc(sizeof(int64_t) * (chunk->code.count ? chunk->code.count : 1));
+    int64_t min_depth, max_depth;
+    int res = analyze_code(chunk, depth, &min_depth, &max_depth);
+    if (res == 0) res = check_handlers(chunk, depth);
+    free(depth);
+    if (res != 0) return res;
+    if (max_depth > VM_INIT_STACK_SIZE) return verify_error(0, "stack use exceeds the VM stack");
+
+    chunk->stack_needed = (size_t)-min_depth;
+    chunk->max_stack = (size_t)max_depth;
+    return 0;
+}
+
+int verify_chunk(Chunk* chunk) {
+    if (chunk->verified) return 0;
+    // Marked up front so that recursive functions terminate; cleared again on failure
+    chunk->verified = true;
+    int res = verify_code(chunk);
+    for (size_t i = 0; i < chunk->constants.count && res == 0; i++) {
+        const Value value = chunk->constants.values[i];
+        if (value.type != VAL_FUNCTION) continue;
+        if (!value.as.function || !value.as.function->chunk) {
+            fprintf(stderr, "VerifyError: constant %zu: function without a chunk\n", i);
+            res = -1;
+        } else {
+            res = verify_chunk(value.as.function->chunk);
+        }
+    }
+    if (res != 0) chunk->verified = false;
+    return res;
+}
@@ -0,0 +1,30 @@
+#ifndef KAPPAVM_VERIFIER_H
+#define KAPPAVM_VERIFIER_H
+
+#include "chunk.h"
+
+// Checks that a chunk and every function chunk reachable from its constant
+// pool are well formed: known opcodes, in-range constant indices and jump
+// targets, no falling off the end of the code, and a consistent stack height
+// at every instruction. On success the chunks are marked verified and their
+// stack requirements recorded, which lets vm_run skip per-instruction checks.
+// Returns 0 on success; problems are reported on stderr.
+int verify_chunk(Chunk* chunk);
+
+// Marks instructions that no path from the start of the chunk reaches
+#define UNVISITED INT64_MIN
+
+// Values an instruction pops and then pushes
+void stack_effect(Instruction inst, int64_t* pops, int64_t* pushes);
+
+// Fills heights[i] with the stack height on entry to instruction i, relative
+// to the height on entry to the chunk, or UNVISITED. heights must hold
+// chunk->code.count entries. Returns 0 if the chunk's heights are consistent.
+int stack_heights(const Chunk* chunk, int64_t* heights);
+
+// Sets each exception handler's depth to the stack height at the start of
+// its range, as verify_chunk does. Returns 0 if the chunk's heights and
+// handlers are consistent.
+int compute_handler_depths(Chunk* chunk);
+
+#endif //KAPPAVM_VERIFIER_H
@@ -1,7 +1,18 @@
 #include "vm.h"
 #include "chunk.h"
+#include "list.h"
+#include "numeric.h"
+#include "object.h"
 #include "opcode.h"
+#include "perf_stats.h"
+#include "profiler.h"
+#include "string_value.h"
+#include "trace.h"
+#include "verifier.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 void push(VM *vm, Value value) {
     *vm->stack_top = value;
@@ -18,92 +29,807 @@ static Value peek(VM *vm, int distance) {
 }
 
 static int is_falsey(Value value) {
-    return value.type == VAL_NULL || (value.type == VAL_NUMBER && value.as.number == 0);
+    return value.type == VAL_NULL || (value.type == VAL_NUMBER && value.as.number == 0) ||
+           (value.type == VAL_DOUBLE && value.as.fp_number == 0);
+}
+
+static bool strings_equal(const Value *a, const Value *b) {
+    size_t a_length, b_length;
+    const char *a_chars = string_chars(a, &a_length);
+    const char *b_chars = string_chars(b, &b_length);
+    return a_length == b_length && memcmp(a_chars, b_chars, a_length) == 0;
+}
+
+// Numbers compare by value, whether integers or doubles; strings by
+// contents, whatever their kind; lists, objects, functions and builders by
+// identity
+static bool values_equal(Value a, Value b) {
+    if (a.type != b.type) {
+        if (is_string(a) && is_string(b)) return strings_equal(&a, &b);
+        return is_numeric(a) && is_numeric(b) && numeric_as_double(a) == numeric_as_double(b);
+    }
+    switch (a.type) {
+        case VAL_NULL: return true;
+        case VAL_NUMBER: return a.as.number == b.as.number;
+        case VAL_DOUBLE: return a.as.fp_number == b.as.fp_number;
+        case VAL_STRING:
+        case VAL_SHORT_STRING:
+        case VAL_SLICE:
+        case VAL_HEAP_STRING: return strings_equal(&a, &b);
+        case VAL_LIST: return a.as.list == b.as.list;
+        case VAL_OBJECT: return a.as.object == b.as.object;
+        case VAL_FUNCTION: return a.as.function == b.as.function;
+        case VAL_BUILDER: return a.as.builder == b.as.builder;
+    }
+    return false;
+}
+
+// Everything binary_op does not handle inline
+static __attribute__((noinline)) NumericResult binary_op_slow(uint8_t opcode, Value a, Value b, Value *result) {
+    if (opcode == OP_EQUAL || opcode == OP_NOT_EQUAL) {
+        *result = (Value){.type = VAL_NUMBER, .as.number = values_equal(a, b) == (opcode == OP_EQUAL)};
+        return NUMERIC_OK;
+    }
+    return numeric_binary(opcode, a, b, result);
+}
+
+// Applies a binary opcode. Equality is defined for every value; the other
+// operators need numbers. Two integers whose result fits in int64_t take the
+// inline path; overflow, doubles and errors go through binary_op_slow.
+static inline NumericResult binary_op(uint8_t opcode, Value a, Value b, Value *result) {
+    int64_t number;
+    if (a.type == VAL_NUMBER && b.type == VAL_NUMBER && evaluate_binary(opcode, a.as.number, b.as.number, &number)) {
+        *result = (Value){.type = VAL_NUMBER, .as.number = number};
+        return NUMERIC_OK;
+    }
+    return binary_op_slow(opcode, a, b, result);
 }
 
 void vm_init(VM *vm) {
     vm->frame_count = 0;
     vm->stack_top = vm->stack;
+    vm->profile = NULL;
+    vm->tracer = NULL;
+    vm->perf = NULL;
+    vm->heap_bytes = 0;
+    vm->objects = NULL;
+    vm->strings = NULL;
+    vm->builders = NULL;
+    vm->lists = NULL;
+    vm_set_limits(vm, &(VMLimits){0});
+}
+
+static void free_heap(VM *vm) {
+    for (Object *object = vm->objects; object;) {
+        Object *next = object->next;
+        free_object(object);
+        free(object);
+        object = next;
+    }
+    vm->objects = NULL;
+    for (String *string = vm->strings; string;) {
+        String *next = string->next;
+        free(string);
+        string = next;
+    }
+    vm->strings = NULL;
+    for (StringBuilder *builder = vm->builders; builder;) {
+        StringBuilder *next = builder->next;
+        free_builder(builder);
+        free(builder);
+        builder = next;
+    }
+    vm->builders = NULL;
+    for (List *list = vm->lists; list;) {
+        List *next = list->next;
+        free_list(list);
+        free(list);
+        list = next;
+    }
+    vm->lists = NULL;
+    vm->heap_bytes = 0;
 }
 
 void vm_free(VM *vm) {
+    free_heap(vm);
+}
+
+static Object *new_object(VM *vm) {
+    Object *object = malloc(sizeof(Object));
+    init_object(object);
+    object->next = vm->objects;
+    vm->objects = object;
+    vm->heap_bytes += object_bytes(object);
+    return object;
+}
+
+// A string of the given bytes, kept in the value if it is short enough and
+// on the heap otherwise. The parts are concatenated, so a string can be
+// made from two others without building it up elsewhere first.
+static Value new_string(VM *vm, const char *first, size_t first_length, const char *second, size_t second_length) {
+    const size_t length = first_length + second_length;
+    if (length <= STRING_SHORT_MAX) {
+        Value value = make_short_string(first, first_length);
+        memcpy(value.as.chars + first_length, second, second_length);
+        value.length = (uint32_t)length;
+        return value;
+    }
+    String *string = malloc(sizeof(String) + length + 1);
+    string->length = length;
+    memcpy(string->chars, first, first_length);
+    memcpy(string->chars + first_length, second, second_length);
+    string->chars[length] = '\0';
+    string->next = vm->strings;
+    vm->strings = string;
+    vm->heap_bytes += sizeof(String) + length + 1;
+    return (Value){.type = VAL_HEAP_STRING, .as.heap_string = string};
+}
+
+static List *new_list(VM *vm) {
+    List *list = malloc(sizeof(List));
+    init_list(list);
+    list->next = vm->lists;
+    vm->lists = list;
+    vm->heap_bytes += list_bytes(list);
+    return list;
+}
+
+static StringBuilder *new_builder(VM *vm) {
+    StringBuilder *builder = malloc(sizeof(StringBuilder));
+    init_builder(builder);
+    builder->next = vm->builders;
+    vm->builders = builder;
+    vm->heap_bytes += sizeof(StringBuilder);
+    return builder;
+}
+
+// With a deadline the clock is read at least once per this many charged
+// instructions, which takes well under a millisecond
+#define LIMIT_CLOCK_INTERVAL 16384
+
+uint64_t vm_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Fuel to go until the next check: up to the instruction limit, and no
+// further than the clock interval when the clock or the heap has to be
+// looked at too
+static void grant_fuel(VM *vm) {
+    const VMLimits *limits = &vm->limits;
+    uint64_t grant = limits->max_instructions ? limits->max_instructions - vm->instructions : INT64_MAX;
+    if ((limits->deadline_ns || limits->max_heap_bytes) && grant > LIMIT_CLOCK_INTERVAL) {
+        grant = LIMIT_CLOCK_INTERVAL;
+    }
+    if (grant > INT64_MAX) grant = INT64_MAX;
+    vm->fuel_granted = vm->fuel = (int64_t)grant;
+}
+
+// Runs when the fuel is spent: settles the instruction count, checks every
+// limit and, if none is reached, grants more fuel
+static __attribute__((noinline)) bool limit_exceeded(VM *vm) {
+    const VMLimits *limits = &vm->limits;
+    vm->instructions += (uint64_t)(vm->fuel_granted - vm->fuel);
+    vm->fuel_granted = vm->fuel = 0;
+    if (limits->max_instructions && vm->instructions > limits->max_instructions) {
+        vm->exceeded = LIMIT_INSTRUCTIONS;
+    } else if (limits->max_heap_bytes && vm->heap_bytes > limits->max_heap_bytes) {
+        vm->exceeded = LIMIT_HEAP;
+    } else if (limits->deadline_ns && vm_clock_ns() >= limits->deadline_ns) {
+        vm->exceeded = LIMIT_DEADLINE;
+    } else {
+        grant_fuel(vm);
+        return false;
+    }
+    return true;
+}
+
+void vm_set_limits(VM *vm, const VMLimits *limits) {
+    vm->limits = *limits;
+    vm->instructions = 0;
+    vm->exceeded = LIMIT_NONE;
+    grant_fuel(vm);
+}
+
+// Whether a frame starting at the beginning of chunk, with its slots at
+// slots, stays within the stack limits the verifier computed
+static bool fits_verified(VM *vm, const struct Chunk *chunk, const Value *slots) {
+    return (size_t)(vm->stack_top - slots) >= chunk->stack_needed &&
+           (size_t)(vm->stack + VM_INIT_STACK_SIZE - vm->stack_top) >= chunk->max_stack;
+}
+
+// Prints an uncaught error and leaves the VM empty, ready for the next run
+static VMResult uncaught(VM *vm, const char *message, Value thrown) {
+    if (message) {
+        fprintf(stderr, "RuntimeError: %s\n", message);
+    } else if (thrown.type == VAL_NUMBER) {
+        fprintf(stderr, "RuntimeError: Uncaught exception %lld.\n", (long long)thrown.as.number);
+    } else if (thrown.type == VAL_DOUBLE) {
+        char text[32];
+        format_double(thrown.as.fp_number, text, sizeof(text));
+        fprintf(stderr, "RuntimeError: Uncaught exception %s.\n", text);
+    } else if (is_string(thrown)) {
+        size_t length;
+        const char *chars = string_chars(&thrown, &length);
+        fprintf(stderr, "RuntimeError: Uncaught exception \"%.*s\".\n", (int)length, chars);
+    } else {
+        fprintf(stderr, "RuntimeError: Uncaught exception.\n");
+    }
+    vm->frame_count = 0;
+    vm->stack_top = vm->stack;
+    return VM_RUNTIME_ERROR;
 }
 
-void vm_run(VM *vm) {
+// Looks for a handler covering the current instruction of each frame, from
+// the innermost outwards; a calling frame's current instruction is its
+// OP_CALL. On success the frames above the handler's are dropped, the stack
+// is cut back to the handler's depth with thrown on top, and *frame resumes
+// at the handler. Runs only when something is thrown, so code inside a
+// handler's range executes exactly as it would outside one.
+static __attribute__((noinline)) bool unwind(VM *vm, CallFrame **frame, Value thrown) {
+    for (int index = vm->frame_count - 1; index >= 0; index--) {
+        CallFrame *candidate = &vm->frames[index];
+        const Handler *handler = find_handler(candidate->chunk, (size_t)(candidate->ip - candidate->chunk->code.code) - 1);
+        if (!handler) continue;
+        Value *top = candidate->base + handler->depth;
+        // Only an unverified handler table can point outside the live stack
+        if (top < candidate->slots || top >= vm->stack_top + 1 || top >= vm->stack + VM_INIT_STACK_SIZE) return false;
+        vm->frame_count = index + 1;
+        vm->stack_top = top;
+        push(vm, thrown);
+        candidate->ip = candidate->chunk->code.code + handler->target;
+        *frame = candidate;
+        return true;
+    }
+    return false;
+}
+
+// The interpreter keeps vm->fuel in a local while it runs and writes it
+// back on the way out
+#define EXIT(result) \
+    do { vm->fuel = fuel; return (result); } while (0)
+// Errors in the program's behaviour, such as dividing by zero, are thrown
+// as a string and can be caught
+#define RUNTIME_ERROR(message) \
+    do { error = message; goto throw_error; } while (0)
+// Malformed bytecode found by the checked interpreter is not catchable
+#define FATAL_ERROR(message) \
+    do { EXIT(uncaught(vm, message, (Value){.type = VAL_NULL})); } while (0)
+// Stack checks that only the checked interpreter performs
+#define NEED(n) \
+    do { if (checked && vm->stack_top - frame->slots < (n)) FATAL_ERROR("Stack underflow."); } while (0)
+#define ROOM(n) \
+    do { if (checked && vm->stack + VM_INIT_STACK_SIZE - vm->stack_top < (n)) FATAL_ERROR("Stack overflow."); } while (0)
+// Charges instructions against the limits; only backward jumps and calls do
+#define CHARGE(n) \
+    do { \
+        fuel -= (n); \
+        if (fuel < 0) { \
+            vm->fuel = fuel; \
+            if (limit_exceeded(vm)) return VM_LIMIT_EXCEEDED; \
+            fuel = vm->fuel; \
+        } \
+    } while (0)
+// Jumps by offset, charging the instructions a backward jump goes back over
+#define JUMP(offset) \
+    do { \
+        const int16_t jump_offset = (offset); \
+        frame->ip += jump_offset; \
+        if (jump_offset < 0) CHARGE(-jump_offset); \
+    } while (0)
+#define BINARY_OP(opcode, a, b, result) \
+    do { \
+        const NumericResult status = binary_op(opcode, a, b, result); \
+        if (status == NUMERIC_DIVISION_BY_ZERO) RUNTIME_ERROR("Division by zero."); \
+        if (status == NUMERIC_NOT_A_NUMBER) RUNTIME_ERROR("Operands must be numbers."); \
+    } while (0)
+
+// The interpreter loop is written once and instantiated for each
+// combination of its flags. The checked variant validates the instruction
+// pointer, constant indices and every stack access; the unchecked variant
+// relies on verify_chunk and only checks the callee at each OP_CALL. The
+// instrumented variants record every instruction in vm->profile,
+// vm->tracer and vm->perf, so runs with none of them pay nothing for them.
+static inline __attribute__((always_inline)) VMResult run(VM *vm, const bool checked, const bool instrumented) {
     CallFrame *frame = &vm->frames[vm->frame_count - 1];
+    const char *error = NULL;
+    Value thrown;
+    int64_t fuel = vm->fuel;
 
     while (1) {
-        if (DEBUG_INFO) {
-            int line_number = frame->ip - frame->chunk->code.code;
-            fprintf(stderr, "[%d] ", line_number);
-            // print stack
-            for (int i = 0; i < vm->stack_top - vm->stack; i++) {
-                fprintf(stderr, "%lld ", vm->stack[i].as.number);
-            }
-            fprintf(stderr, "\n");
+        if (checked) {
+            const ptrdiff_t offset = frame->ip - frame->chunk->code.code;
+            if (offset < 0 || (size_t)offset >= frame->chunk->code.count) {
+                FATAL_ERROR("Instruction pointer out of range.");
+            }
+        }
+        if (instrumented) {
+            if (vm->profile) profile_step(vm->profile, frame->chunk, get_opcode(*frame->ip));
+            if (vm->tracer) {
+                trace_step(vm->tracer, frame->chunk, (size_t)(frame->ip - frame->chunk->code.code),
+                           get_opcode(*frame->ip), (size_t)(vm->stack_top - vm->stack));
+            }
+            if (vm->perf) perf_step(vm->perf, frame->chunk);
         }
-
         Instruction instruction = *frame->ip++;
         switch (get_opcode(instruction)) {
             case OP_CONSTANT: {
-                push(vm, frame->chunk->constants.values[get_operand(instruction)]);
+                const uint64_t index = get_operand(instruction);
+                if (checked && index >= frame->chunk->constants.count) {
+                    FATAL_ERROR("Constant index out of range.");
+                }
+                ROOM(1);
+                push(vm, frame->chunk->constants.values[index]);
                 break;
             }
-            case OP_ADD: {
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_MOD:
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_LESS:
+            case OP_LESS_EQUAL:
+            case OP_GREATER:
+            case OP_GREATER_EQUAL: {
+                NEED(2);
                 Value b = pop(vm);
                 Value a = pop(vm);
-                push(vm, (Value){.type = VAL_NUMBER, .as.number = a.as.number + b.as.number});
+                Value result;
+                BINARY_OP(get_opcode(instruction), a, b, &result);
+                push(vm, result);
+                break;
+            }
+            case OP_DUP: {
+                NEED(1);
+                ROOM(1);
+                push(vm, peek(vm, 0));
+                break;
+            }
+            case OP_SWAP: {
+                NEED(2);
+                Value top = vm->stack_top[-1];
+                vm->stack_top[-1] = vm->stack_top[-2];
+                vm->stack_top[-2] = top;
+                break;
+            }
+            case OP_POP: {
+                NEED(1);
+                pop(vm);
                 break;
             }
             case OP_JMP: {
-                frame->ip += (int16_t) get_operand(instruction);
+                JUMP((int16_t) get_operand(instruction));
                 break;
             }
             case OP_JMP_IF_FALSE: {
+                NEED(1);
                 if (is_falsey(pop(vm))) {
-                    frame->ip += (int16_t) get_operand(instruction);
+                    JUMP((int16_t) get_operand(instruction));
+                }
+                break;
+            }
+            case OP_JMP_IF_EQUAL:
+            case OP_JMP_IF_NOT_EQUAL:
+            case OP_JMP_IF_LESS:
+            case OP_JMP_IF_LESS_EQUAL:
+            case OP_JMP_IF_GREATER:
+            case OP_JMP_IF_GREATER_EQUAL: {
+                NEED(2);
+                Value b = pop(vm);
+                Value a = pop(vm);
+                Value taken;
+                BINARY_OP(jump_comparison(get_opcode(instruction)), a, b, &taken);
+                if (taken.as.number) {
+                    JUMP((int16_t) get_operand(instruction));
+                }
+                break;
+            }
+            case OP_GET_LOCAL: {
+                const uint64_t slot = get_operand(instruction);
+                if (checked && slot >= (uint64_t)(vm->stack_top - frame->slots)) FATAL_ERROR("Local slot out of range.");
+                ROOM(1);
+                push(vm, frame->slots[slot]);
+                break;
+            }
+            case OP_SET_LOCAL: {
+                const uint64_t slot = get_operand(instruction);
+                NEED(1);
+                if (checked && slot >= (uint64_t)(vm->stack_top - frame->slots - 1)) FATAL_ERROR("Local slot out of range.");
+                frame->slots[slot] = pop(vm);
+                break;
+            }
+            case OP_SWITCH: {
+                const uint64_t index = get_operand(instruction);
+                if (checked && index >= frame->chunk->jump_tables.count) {
+                    FATAL_ERROR("Jump table index out of range.");
+                }
+                NEED(1);
+                const Value selector = pop(vm);
+                const JumpTable *table = &frame->chunk->jump_tables.tables[index];
+                if (selector.type == VAL_NUMBER && selector.as.number >= 0 &&
+                    (uint64_t)selector.as.number < table->count) {
+                    Instruction *target = frame->chunk->code.code + table->targets[selector.as.number];
+                    const ptrdiff_t distance = frame->ip - target;
+                    frame->ip = target;
+                    if (distance > 0) CHARGE(distance);
                 }
                 break;
             }
             case OP_CALL: {
                 uint8_t arg_count = get_operand(instruction);
+                NEED(arg_count + 1);
                 Value callee = peek(vm, arg_count);
 
                 if (callee.type != VAL_FUNCTION) {
-                    fprintf(stderr, "RuntimeError: Can only call functions.\n");
-                    return;
+                    RUNTIME_ERROR("Can only call functions.");
                 }
 
                 Function *function = callee.as.function;
 
                 if (vm->frame_count == MAX_FRAMES) {
-                    fprintf(stderr, "RuntimeError: Stack overflow.\n");
-                    return;
+                    RUNTIME_ERROR("Stack overflow.");
+                }
+
+                Value *slots = vm->stack_top - arg_count - 1;
+                // Reserve the callee's locals in one bump
+                const size_t local_count = function->local_count;
+                if ((size_t)(vm->stack + VM_INIT_STACK_SIZE - vm->stack_top) < local_count) {
+                    RUNTIME_ERROR("Stack overflow.");
+                }
+                for (size_t i = 0; i < local_count; i++) vm->stack_top[i] = (Value){.type = VAL_NULL};
+                vm->stack_top += local_count;
+                if (!checked) {
+                    // Function values can come from the host, so the callee
+                    // may not have been verified along with its caller
+                    if (!function->chunk->verified && verify_chunk(function->chunk) != 0) {
+                        FATAL_ERROR("Called function failed verification.");
+                    }
+                    if (arg_count + 1 + local_count < function->chunk->stack_needed) {
+                        RUNTIME_ERROR("Not enough arguments.");
+                    }
+                    if (!fits_verified(vm, function->chunk, slots)) {
+                        RUNTIME_ERROR("Stack overflow.");
+                    }
                 }
 
-                CallFrame *new_frame = &vm->frames[vm->frame_count++];
+                if (instrumented && vm->profile) {
+                    FunctionProfile *callee = &vm->profile->functions[profile_function(vm->profile, function->chunk)];
+                    callee->name = function->name;
+                    callee->calls++;
+                }
+
+                CallFrame *new_frame = &vm->frames[vm->frame_count];
                 new_frame->chunk = function->chunk;
                 new_frame->ip = function->chunk->code.code;
-                new_frame->slots = vm->stack_top - arg_count - 1;
+                new_frame->slots = slots;
+                new_frame->base = vm->stack_top;
+                // The sampling profiler reads frames from a signal handler, so
+                // a frame is counted only once it is complete
+                __atomic_signal_fence(__ATOMIC_SEQ_CST);
+                vm->frame_count++;
 
                 frame = new_frame;
+                CHARGE(1);
                 break;
             }
             case OP_RETURN: {
+                NEED(1);
                 Value return_value = pop(vm);
                 vm->frame_count--;
+                vm->stack_top = frame->slots;
+                push(vm, return_value);
                 if (vm->frame_count == 0) {
-                    pop(vm);
-                    return;
+                    EXIT(VM_OK);
                 }
                 frame = &vm->frames[vm->frame_count - 1];
-                vm->stack_top = frame->slots;
-                push(vm, return_value);
                 break;
             }
             case OP_HALT: {
-                return;
+                EXIT(VM_OK);
+            }
+            case OP_CHECKPOINT: {
+                EXIT(VM_CHECKPOINT);
+            }
+            case OP_THROW: {
+                NEED(1);
+                thrown = pop(vm);
+                error = NULL;
+                goto throw_value;
+            }
+            case OP_NEW_OBJECT: {
+                ROOM(1);
+                push(vm, (Value){.type = VAL_OBJECT, .as.object = new_object(vm)});
+                break;
+            }
+            case OP_GET_PROPERTY: {
+                NEED(2);
+                const Value key = pop(vm);
+                const Value target = pop(vm);
+                if (target.type != VAL_OBJECT) RUNTIME_ERROR("Only objects have properties.");
+                if (!is_string(key)) RUNTIME_ERROR("Property keys must be strings.");
+                size_t length;
+                const char *chars = string_chars(&key, &length);
+                Value value;
+                if (!object_get(target.as.object, chars, length, &value)) {
+                    value = (Value){.type = VAL_NULL};
+                }
+                push(vm, value);
+                break;
+            }
+            case OP_SET_PROPERTY:
+            case OP_DELETE_PROPERTY: {
+                const bool set = get_opcode(instruction) == OP_SET_PROPERTY;
+                NEED(set ? 3 : 2);
+                const Value value = set ? pop(vm) : (Value){.type = VAL_NULL};
+                const Value key = pop(vm);
+                const Value target = peek(vm, 0);
+                if (target.type != VAL_OBJECT) RUNTIME_ERROR("Only objects have properties.");
+                if (!is_string(key)) RUNTIME_ERROR("Property keys must be strings.");
+                size_t length;
+                const char *chars = string_chars(&key, &length);
+                // Unsigned arithmetic carries a shrinking object through too
+                const size_t before = object_bytes(target.as.object);
+                if (set) {
+                    object_set(target.as.object, chars, length, value);
+                } else {
+                    object_delete(target.as.object, chars, length);
+                }
+                vm->heap_bytes += object_bytes(target.as.object) - before;
+                break;
+            }
+            case OP_NEXT_PROPERTY: {
+                NEED(2);
+                ROOM(1);
+                const Value cursor = pop(vm);
+                const Value target = peek(vm, 0);
+                if (target.type != VAL_OBJECT) RUNTIME_ERROR("Only objects have properties.");
+                if (cursor.type != VAL_NUMBER || cursor.as.number < 0) {
+                    RUNTIME_ERROR("Property cursor must be a non-negative integer.");
+                }
+                size_t position = (size_t)cursor.as.number;
+                const Property *property;
+                const bool found = object_next(target.as.object, &position, &property);
+                push(vm, (Value){.type = VAL_NUMBER, .as.number = (int64_t)position});
+                // A copy, since deleting the property frees the object's key
+                push(vm, found ? new_string(vm, property->key, property->length, "", 0) : (Value){.type = VAL_NULL});
+                break;
+            }
+            case OP_CONCAT: {
+                NEED(2);
+                const Value b = pop(vm);
+                const Value a = pop(vm);
+                if (!is_string(a) || !is_string(b)) RUNTIME_ERROR("Operands must be strings.");
+                size_t a_length, b_length;
+                const char *a_chars = string_chars(&a, &a_length);
+                const char *b_chars = string_chars(&b, &b_length);
+                push(vm, new_string(vm, a_chars, a_length, b_chars, b_length));
+                break;
+            }
+            case OP_SLICE: {
+                NEED(3);
+                const Value end = pop(vm);
+                const Value start = pop(vm);
+                const Value string = pop(vm);
+                if (!is_string(string)) RUNTIME_ERROR("Only strings can be sliced.");
+                size_t length;
+                const char *chars = string_chars(&string, &length);
+                if (start.type != VAL_NUMBER || end.type != VAL_NUMBER || start.as.number < 0 ||
+                    end.as.number < start.as.number || (uint64_t)end.as.number > length) {
+                    RUNTIME_ERROR("Slice bounds out of range.");
+                }
+                const size_t from = (size_t)start.as.number, to = (size_t)end.as.number;
+                // A view's length has to fit in the value, so a longer one
+                // is a copy
+                push(vm, to - from <= UINT32_MAX ? string_slice(&string, from, to)
+                                                 : new_string(vm, chars + from, to - from, "", 0));
+                break;
+            }
+            case OP_LENGTH: {
+                NEED(1);
+                const Value target = pop(vm);
+                size_t length;
+                if (target.type == VAL_LIST) {
+                    length = target.as.list->length;
+                } else if (is_string(target)) {
+                    string_chars(&target, &length);
+                } else {
+                    RUNTIME_ERROR("Only strings and lists have a length.");
+                }
+                push(vm, (Value){.type = VAL_NUMBER, .as.number = (int64_t)length});
+                break;
+            }
+            case OP_COMPARE: {
+                NEED(2);
+                const Value b = pop(vm);
+                const Value a = pop(vm);
+                if (!is_string(a) || !is_string(b)) RUNTIME_ERROR("Operands must be strings.");
+                size_t a_length, b_length;
+                const char *a_chars = string_chars(&a, &a_length);
+                const char *b_chars = string_chars(&b, &b_length);
+                const int order = string_compare(a_chars, a_length, b_chars, b_length);
+                push(vm, (Value){.type = VAL_NUMBER, .as.number = (order > 0) - (order < 0)});
+                break;
+            }
+            case OP_NEW_BUILDER: {
+                ROOM(1);
+                push(vm, (Value){.type = VAL_BUILDER, .as.builder = new_builder(vm)});
+                break;
+            }
+            case OP_APPEND: {
+                NEED(2);
+                const Value value = pop(vm);
+                const Value target = peek(vm, 0);
+                if (target.type != VAL_BUILDER) RUNTIME_ERROR("Can only append to a string builder.");
+                StringBuilder *builder = target.as.builder;
+                const size_t before = builder->capacity;
+                char text[32];
+                size_t length;
+                const char *chars;
+                if (is_string(value)) {
+                    chars = string_chars(&value, &length);
+                } else if (value.type == VAL_NUMBER) {
+                    length = (size_t)snprintf(text, sizeof(text), "%lld", (long long)value.as.number);
+                    chars = text;
+                } else if (value.type == VAL_DOUBLE) {
+                    format_double(value.as.fp_number, text, sizeof(text));
+                    length = strlen(text);
+                    chars = text;
+                } else {
+                    RUNTIME_ERROR("Can only append strings and numbers.");
+                }
+                builder_append(builder, chars, length);
+                vm->heap_bytes += builder->capacity - before;
+                break;
+            }
+            case OP_BUILD: {
+                NEED(1);
+                const Value target = pop(vm);
+                if (target.type != VAL_BUILDER) RUNTIME_ERROR("Can only build from a string builder.");
+                const StringBuilder *builder = target.as.builder;
+                push(vm, new_string(vm, builder->length ? builder->chars : "", builder->length, "", 0));
+                break;
+            }
+            case OP_NEW_LIST: {
+                ROOM(1);
+                push(vm, (Value){.type = VAL_LIST, .as.list = new_list(vm)});
+                break;
+            }
+            case OP_LIST_PUSH: {
+                NEED(2);
+                const Value value = pop(vm);
+                const Value target = peek(vm, 0);
+                if (target.type != VAL_LIST) RUNTIME_ERROR("Can only push onto a list.");
+                // Growing or leaving integer storage changes the size
+                const size_t before = list_bytes(target.as.list);
+                list_push(target.as.list, value);
+                vm->heap_bytes += list_bytes(target.as.list) - before;
+                break;
+            }
+            case OP_LIST_GET: {
+                NEED(2);
+                const Value index = pop(vm);
+                const Value target = pop(vm);
+                if (target.type != VAL_LIST) RUNTIME_ERROR("Only lists can be indexed.");
+                if (index.type != VAL_NUMBER) RUNTIME_ERROR("List index must be an integer.");
+                if ((uint64_t)index.as.number >= target.as.list->length) RUNTIME_ERROR("List index out of range.");
+                push(vm, list_get(target.as.list, (size_t)index.as.number));
+                break;
+            }
+            case OP_LIST_SET: {
+                NEED(3);
+                const Value value = pop(vm);
+                const Value index = pop(vm);
+                const Value target = peek(vm, 0);
+                if (target.type != VAL_LIST) RUNTIME_ERROR("Only lists can be indexed.");
+                if (index.type != VAL_NUMBER) RUNTIME_ERROR("List index must be an integer.");
+                if ((uint64_t)index.as.number >= target.as.list->length) RUNTIME_ERROR("List index out of range.");
+                const size_t before = list_bytes(target.as.list);
+                list_set(target.as.list, (size_t)index.as.number, value);
+                vm->heap_bytes += list_bytes(target.as.list) - before;
+                break;
+            }
+            default: {
+                if (checked) FATAL_ERROR("Unknown opcode.");
+                __builtin_unreachable();
             }
         }
+        continue;
+
+    throw_error:
+        thrown = (Value){.type = VAL_STRING, .as.string = (char *)error};
+    throw_value:
+        if (!unwind(vm, &frame, thrown)) EXIT(uncaught(vm, error, thrown));
+    }
+}
+
+#undef RUNTIME_ERROR
+#undef FATAL_ERROR
+#undef NEED
+#undef ROOM
+#undef EXIT
+#undef CHARGE
+#undef JUMP
+#undef BINARY_OP
+
+static VMResult run_checked(VM *vm) {
+    return run(vm, true, false);
+}
+
+static VMResult run_unchecked(VM *vm) {
+    return run(vm, false, false);
+}
+
+static VMResult run_checked_instrumented(VM *vm) {
+    return run(vm, true, true);
+}
+
+static VMResult run_unchecked_instrumented(VM *vm) {
+    return run(vm, false, true);
+}
+
+VMResult vm_call(VM *vm, Function *function, const Value *args, const size_t arg_count, Value *result) {
+    if (vm->frame_count != 0) {
+        fprintf(stderr, "RuntimeError: VM is already running.\n");
+        return VM_RUNTIME_ERROR;
+    }
+    free_heap(vm);
+    if (!function || !function->chunk) {
+        fprintf(stderr, "RuntimeError: Can only call functions.\n");
+        return VM_RUNTIME_ERROR;
+    }
+    if (!function->chunk->verified && verify_chunk(function->chunk) != 0) {
+        fprintf(stderr, "RuntimeError: Called function failed verification.\n");
+        return VM_RUNTIME_ERROR;
+    }
+    const size_t slot_count = 1 + arg_count + function->local_count;
+    if (slot_count < function->chunk->stack_needed) {
+        fprintf(stderr, "RuntimeError: Not enough arguments.\n");
+        return VM_RUNTIME_ERROR;
+    }
+    if (slot_count > VM_INIT_STACK_SIZE) {
+        fprintf(stderr, "RuntimeError: Stack overflow.\n");
+        return VM_RUNTIME_ERROR;
+    }
+
+    // Lay the frame out as OP_CALL would; vm_run takes it from there
+    vm->stack_top = vm->stack;
+    vm->stack[0] = (Value){.type = VAL_FUNCTION, .as.function = function};
+    if (arg_count > 0) memcpy(vm->stack + 1, args, sizeof(Value) * arg_count);
+    for (size_t i = 1 + arg_count; i < slot_count; i++) vm->stack[i] = (Value){.type = VAL_NULL};
+    vm->stack_top += slot_count;
+    vm->frames[0] = (CallFrame){function->chunk, function->chunk->code.code, vm->stack, vm->stack_top};
+    vm->frame_count = 1;
+
+    VMResult status;
+    while ((status = vm_run(vm)) == VM_CHECKPOINT) {}
+    // RETURN from the function leaves just its result; a HALT inside it
+    // leaves the frame in place with the result on top
+    if (status == VM_OK) *result = vm->stack_top > vm->stack ? vm->stack_top[-1] : (Value){.type = VAL_NULL};
+    vm->frame_count = 0;
+    vm->stack_top = vm->stack;
+    return status;
+}
+
+VMResult vm_run(VM *vm) {
+    CallFrame *frame = &vm->frames[vm->frame_count - 1];
+    // The verifier's guarantees describe a chunk entered at its first
+    // instruction. Anything else, such as a resumed checkpoint or hand-built
+    // frames, runs in the checked interpreter.
+    const bool entering = vm->frame_count == 1 && frame->ip == frame->chunk->code.code;
+    if (entering) frame->base = vm->stack_top;
+    const bool unchecked = entering && frame->chunk->verified && fits_verified(vm, frame->chunk, frame->slots);
+    if (vm->profile || vm->tracer || vm->perf) {
+        const VMResult result = unchecked ? run_unchecked_instrumented(vm) : run_checked_instrumented(vm);
+        if (vm->profile) profile_stop(vm->profile);
+        if (vm->perf) perf_stop(vm->perf);
+        if (vm->tracer && result == VM_RUNTIME_ERROR) {
+            fprintf(stderr, "Last instructions before the error:\n");
+            tracer_dump(vm->tracer, TRACE_ERROR_DUMP, stderr);
+        }
+        return result;
     }
+    return unchecked ? run_unchecked(vm) : run_checked(vm);
 }
@@ -14,22 +14,88 @@ typedef struct {
     struct Chunk *chunk;
     Instruction* ip;
     Value* slots;
+    // Stack top on entry to the chunk, after any locals were reserved;
+    // exception handler depths count from here. Set by OP_CALL, and by
+    // vm_run for a chunk it enters at its first instruction.
+    Value* base;
 } CallFrame;
 
+struct Profile;
+struct Tracer;
+struct PerfStats;
+
+// Limits on one VM's runs, for programs that cannot be trusted to finish.
+// They are only looked at on backward jumps and calls, so straight-line
+// code pays nothing for them. Every run that goes on forever passes one of
+// those over and over. A backward jump charges the instructions it jumps
+// back over, and a call charges one. The instruction count is therefore
+// exact for loops without forward jumps and an upper bound otherwise.
+typedef struct {
+    uint64_t max_instructions;  // 0 for no limit
+    uint64_t deadline_ns;       // on the vm_clock_ns clock, 0 for none
+    size_t max_heap_bytes;      // 0 for no limit
+} VMLimits;
+
+typedef enum {
+    LIMIT_NONE,
+    LIMIT_INSTRUCTIONS,
+    LIMIT_DEADLINE,
+    LIMIT_HEAP,
+} LimitKind;
+
 typedef struct {
     CallFrame frames[MAX_FRAMES];
     int frame_count;
 
     Value stack[VM_INIT_STACK_SIZE];
     Value *stack_top;
+    struct Profile *profile; // collects execution statistics when set; see profiler.h
+    struct Tracer *tracer;   // records recent instructions when set; see trace.h
+    struct PerfStats *perf;  // hardware counters per function when set; see perf_stats.h
+
+    VMLimits limits;         // set through vm_set_limits
+    uint64_t instructions;   // charged against limits.max_instructions so far
+    size_t heap_bytes;       // heap held by the running program, counted where it allocates
+    // Instructions left to charge before the limits are looked at again,
+    // and how many there were when they last were
+    int64_t fuel;
+    int64_t fuel_granted;
+    LimitKind exceeded;      // the limit behind the last VM_LIMIT_EXCEEDED
+    // Every object, string, string builder and list the program created.
+    // There is no collector: they are freed together by vm_free and at the
+    // start of each vm_call.
+    Object *objects;
+    String *strings;
+    StringBuilder *builders;
+    List *lists;
 } VM;
 
+typedef enum {
+    VM_OK,
+    VM_CHECKPOINT,     // Stopped at OP_CHECKPOINT; calling vm_run again resumes after it
+    VM_RUNTIME_ERROR,  // Nothing caught the error; the stack and frames are left empty
+    // A limit in vm->limits was reached, see vm->exceeded. The program cannot
+    // catch it. The frames are left as they were at a backward jump or call,
+    // so calling vm_run again resumes once the limits allow it.
+    VM_LIMIT_EXCEEDED,
+} VMResult;
+
 void vm_init(VM *vm);
 void vm_free(VM *vm);
-void vm_run(VM *vm);
+// Replaces the VM's limits and starts counting instructions from zero
+void vm_set_limits(VM *vm, const VMLimits *limits);
+// Monotonic time in nanoseconds, the clock VMLimits.deadline_ns is read on
+uint64_t vm_clock_ns(void);
+VMResult vm_run(VM *vm);
+// Calls function with arg_count arguments on an idle VM, running past any
+// checkpoints, and stores its return value in *result on success. The VM is
+// idle again afterwards either way, so a host can keep one VM and call into
+// it repeatedly; see host.h. Instructions count against the limits across
+// calls until vm_set_limits starts the count over. Objects, strings and
+// lists the previous call created, including any in its result, are freed
+// first.
+VMResult vm_call(VM *vm, Function *function, const Value *args, size_t arg_count, Value *result);
 void push(VM *vm, Value value);
 Value pop(VM *vm);
 
-static const int DEBUG_INFO = 0;
-
 #endif
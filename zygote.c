@@ -0,0 +1,192 @@
+#include "zygote.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        const ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+// The worker side: answers request lines from job_fd on result_fd until the
+// parent closes the pipe. Responses to everything one read brought in go
+// back in one write.
+static void run_worker(const Zygote* zygote, int job_fd, int result_fd) {
+    VM vm;
+    vm_init(&vm);
+    char buffer[HOST_MAX_LINE];
+    size_t length = 0;
+    char output[4 * (HOST_MAX_LINE + 16)];
+    for (;;) {
+        const ssize_t n = read(job_fd, buffer + length, sizeof(buffer) - length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        length += (size_t)n;
+        size_t start = 0, out = 0;
+        for (char* newline; (newline = memchr(buffer + start, '\n', length - start)) != NULL;) {
+            *newline = '\0';
+            if (sizeof(output) - out < HOST_MAX_LINE + 16) {
+                if (!write_all(result_fd, output, out)) goto done;
+                out = 0;
+            }
+            host_handle_request(zygote->programs, zygote->program_count, &vm, buffer + start, output + out,
+                                sizeof(output) - out);
+            out += strlen(output + out);
+            start = (size_t)(newline - buffer) + 1;
+        }
+        if (out > 0 && !write_all(result_fd, output, out)) break;
+        length -= start;
+        memmove(buffer, buffer + start, length);
+        // zygote_submit never sends a line this long
+        if (length == sizeof(buffer)) break;
+    }
+done:
+    vm_free(&vm);
+}
+
+static int spawn_worker(Zygote* zygote, int index) {
+    ZygoteWorker* worker = &zygote->workers[index];
+    int jobs[2], results[2];
+    if (pipe(jobs) != 0) return -1;
+    if (pipe(results) != 0) {
+        close(jobs[0]);
+        close(jobs[1]);
+        return -1;
+    }
+    // Buffered output would otherwise be written once by each process
+    fflush(NULL);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(jobs[0]);
+        close(jobs[1]);
+        close(results[0]);
+        close(results[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // The other workers' pipes must close when the parent closes them,
+        // or those workers would never see the end of their input
+        for (int i = 0; i < zygote->worker_count; i++) {
+            if (i == index || zygote->workers[i].pid <= 0) continue;
+            close(zygote->workers[i].job_fd);
+            close(zygote->workers[i].result_fd);
+        }
+        close(jobs[1]);
+        close(results[0]);
+        signal(SIGPIPE, SIG_DFL);
+        run_worker(zygote, jobs[0], results[1]);
+        _exit(0);
+    }
+    close(jobs[0]);
+    close(results[1]);
+    worker->pid = pid;
+    worker->job_fd = jobs[1];
+    worker->result_fd = results[0];
+    worker->length = 0;
+    return 0;
+}
+
+// Closes the worker's pipes and waits for it to exit, which it does at the
+// end of its input
+static void reap_worker(ZygoteWorker* worker) {
+    close(worker->job_fd);
+    close(worker->result_fd);
+    while (waitpid(worker->pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+    worker->pid = 0;
+}
+
+int zygote_start(Zygote* zygote, const HostProgram* programs, const size_t program_count, int worker_count) {
+    if (worker_count <= 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cpus > 0 ? (int)cpus : 1;
+    }
+    zygote->programs = programs;
+    zygote->program_count = program_count;
+    zygote->workers = calloc((size_t)worker_count, sizeof(ZygoteWorker));
+    zygote->worker_count = worker_count;
+    zygote->respawns = 0;
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < worker_count; i++) {
+        if (spawn_worker(zygote, i) != 0) {
+            fprintf(stderr, "Failed to start worker: %s\n", strerror(errno));
+            zygote->worker_count = i;
+            zygote_stop(zygote);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int zygote_submit(Zygote* zygote, int worker, const char* line) {
+    char request[HOST_MAX_LINE];
+    const int length = snprintf(request, sizeof(request), "%s\n", line);
+    if (length < 0 || (size_t)length >= sizeof(request)) return -1;
+    ZygoteWorker* w = &zygote->workers[worker];
+    w->pending++;
+    // A worker that could not be restarted gets another chance here
+    if (w->pid == 0 && spawn_worker(zygote, worker) != 0) {
+        w->lost++;
+        return 0;
+    }
+    // A failed write means the worker is gone, which zygote_collect finds
+    // out when it reads the end of its output
+    write_all(w->job_fd, request, (size_t)length);
+    return 0;
+}
+
+void zygote_collect(Zygote* zygote, int worker, char* response, const size_t size) {
+    ZygoteWorker* w = &zygote->workers[worker];
+    for (;;) {
+        if (w->lost > 0) {
+            w->lost--;
+            w->pending--;
+            snprintf(response, size, "ERR Worker died\n");
+            return;
+        }
+        const char* newline = memchr(w->buffer, '\n', w->length);
+        if (newline) {
+            const size_t line = (size_t)(newline - w->buffer) + 1;
+            snprintf(response, size, "%.*s", (int)line, w->buffer);
+            w->length -= line;
+            memmove(w->buffer, w->buffer + line, w->length);
+            w->pending--;
+            return;
+        }
+        const ssize_t n = read(w->result_fd, w->buffer + w->length, sizeof(w->buffer) - w->length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0 && w->length + (size_t)n < sizeof(w->buffer)) {
+            w->length += (size_t)n;
+            continue;
+        }
+        // The worker died, or sent a line longer than any response: either
+        // way its remaining requests are lost and it is replaced
+        if (n > 0) kill(w->pid, SIGKILL);
+        reap_worker(w);
+        w->lost = w->pending;
+        if (spawn_worker(zygote, worker) == 0) {
+            zygote->respawns++;
+        } else {
+            fprintf(stderr, "Failed to restart worker: %s\n", strerror(errno));
+        }
+    }
+}
+
+void zygote_stop(Zygote* zygote) {
+    for (int i = 0; i < zygote->worker_count; i++) {
+        if (zygote->workers[i].pid > 0) reap_worker(&zygote->workers[i]);
+    }
+    free(zygote->workers);
+    zygote->workers = NULL;
+    zygote->worker_count = 0;
+}
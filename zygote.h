@@ -0,0 +1,54 @@
+#ifndef KAPPAVM_ZYGOTE_H
+#define KAPPAVM_ZYGOTE_H
+
+#include <sys/types.h>
+#include "host.h"
+
+// A prefork pool of worker processes. The parent loads and verifies the
+// programs once and then forks the workers, which inherit every chunk
+// copy-on-write. Nothing writes to a verified chunk, so those pages stay
+// shared for the life of the pool. A worker's own memory is little more
+// than its VM, and starting one is a single fork with nothing to load or
+// verify.
+//
+// Each worker reads request lines from a pipe and writes back one response
+// line per request, as host_handle_request formats them. Workers are
+// separate processes, so one that dies takes only its pending requests
+// with it. It is replaced by a fresh fork of the parent.
+typedef struct {
+    pid_t pid;
+    int job_fd;                         // requests to the worker
+    int result_fd;                      // responses from it
+    size_t pending;                     // requests sent and not yet collected
+    size_t lost;                        // of those, ones a dead worker took with it
+    size_t length;                      // bytes of unread responses in buffer
+    char buffer[HOST_MAX_LINE + 16];
+} ZygoteWorker;
+
+typedef struct {
+    const HostProgram* programs;        // searched in order for a function name
+    size_t program_count;
+    ZygoteWorker* workers;
+    int worker_count;
+    size_t respawns;                    // workers replaced after dying
+} Zygote;
+
+// Forks worker_count workers (0 = one per CPU) from the calling process.
+// The programs must already be loaded and must stay loaded until zygote_stop
+// returns. SIGPIPE is ignored from here on so that writing to a dead worker
+// fails instead of killing the parent. Returns 0 on success.
+int zygote_start(Zygote* zygote, const HostProgram* programs, size_t program_count, int worker_count);
+// Sends worker one request line, without its newline. Returns -1 without
+// sending anything if the line is longer than HOST_MAX_LINE allows. A
+// worker blocks once its unread responses fill the pipe, so only submit a
+// few requests to a worker before collecting them.
+int zygote_submit(Zygote* zygote, int worker, const char* line);
+// Waits for the response to worker's oldest pending request and copies it,
+// newline included, into response. If the worker has died, every request it
+// still had gets "ERR Worker died" and a new worker takes its place.
+void zygote_collect(Zygote* zygote, int worker, char* response, size_t size);
+// Closes the pipes, which the workers take as the signal to exit, and waits
+// for them
+void zygote_stop(Zygote* zygote);
+
+#endif //KAPPAVM_ZYGOTE_H